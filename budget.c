@@ -0,0 +1,268 @@
+/**
+ * @file budget.c
+ * @brief Implementation of the airtime budget
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This file contains the implementation of the budget declared in budget.h. The bucket is
+ * kept in thousandths of a session so a slow refill still adds up between two calls.
+ */
+
+#include "budget.h"
+
+#define BUDGET_MILLI 1000u
+
+/**
+ * @brief Adds the tokens earned since the last refill
+ *
+ * @note The caller holds the mutex
+ */
+static void budget_refill(struct budget_t *budget, uint32_t now_ms)
+{
+  uint32_t elapsed = now_ms - budget->refill_ms;
+  uint32_t cap = budget->config.burst * BUDGET_MILLI;
+  /* one thousandth of a session every 3600000 / (rate * 1000) ms */
+  uint64_t earned = (uint64_t)elapsed * budget->config.sessions_per_hour / 3600;
+  if (earned == 0)
+    return;
+  /* keep the remainder of a partial token for the next refill */
+  budget->refill_ms += (uint32_t)(earned * 3600 / budget->config.sessions_per_hour);
+  uint64_t tokens = budget->counters.tokens + earned;
+  budget->counters.tokens = tokens > cap ? cap : (uint32_t)tokens;
+}
+
+/**
+ * @brief Starts the counts over in a new day or month
+ *
+ * @note The caller holds the mutex
+ */
+static void budget_roll(struct budget_t *budget, uint32_t day, uint32_t month)
+{
+  struct budget_counters *counters = &budget->counters;
+  /* what was spent before the clock was known belongs to the first known period */
+  if (day != BUDGET_PERIOD_UNKNOWN && day != counters->day)
+  {
+    if (counters->day != BUDGET_PERIOD_UNKNOWN)
+    {
+      counters->day_sessions = 0;
+      counters->day_bytes = 0;
+    }
+    counters->day = day;
+  }
+  if (month != BUDGET_PERIOD_UNKNOWN && month != counters->month)
+  {
+    if (counters->month != BUDGET_PERIOD_UNKNOWN)
+    {
+      counters->month_sessions = 0;
+      counters->month_bytes = 0;
+    }
+    counters->month = month;
+  }
+}
+
+static uint32_t budget_left(uint32_t cap, uint32_t used)
+{
+  if (cap == 0)
+    return BUDGET_UNLIMITED;
+  return used < cap ? cap - used : 0;
+}
+
+static void budget_save(struct budget_t *budget)
+{
+  if (budget->store.save != NULL)
+    budget->store.save(budget->store.ctx, &budget->counters);
+}
+
+/**
+ * @brief Creates a new budget with a full bucket and nothing spent
+ *
+ * @param config The limits, copied
+ * @return Pointer to the newly created budget, or NULL if allocation failed
+ */
+struct budget_t *newBudget(const struct budget_config *config)
+{
+  struct budget_t *budget = calloc(1, sizeof *budget);
+  if (budget == NULL)
+    return NULL;
+  budget->config = *config;
+  /* an hour's worth unless told otherwise */
+  if (budget->config.burst == 0)
+    budget->config.burst = config->sessions_per_hour;
+  budget->counters.day = BUDGET_PERIOD_UNKNOWN;
+  budget->counters.month = BUDGET_PERIOD_UNKNOWN;
+  budget->counters.tokens = budget->config.burst * BUDGET_MILLI;
+  pthread_mutex_init(&budget->mutex, NULL);
+  return budget;
+}
+
+/**
+ * @brief Sets the persistence callback
+ *
+ * @param budget Pointer to the budget
+ * @param store The callback, copied
+ */
+void budget_set_store(struct budget_t *budget, const struct budget_store *store)
+{
+  pthread_mutex_lock(&budget->mutex);
+  budget->store = *store;
+  pthread_mutex_unlock(&budget->mutex);
+}
+
+/**
+ * @brief Loads persisted counters, e.g. after a reboot
+ *
+ * @param budget Pointer to the budget
+ * @param counters The counters from the store
+ * @param now_ms The current time, the bucket refills from here
+ */
+void budget_restore(struct budget_t *budget, const struct budget_counters *counters, uint32_t now_ms)
+{
+  pthread_mutex_lock(&budget->mutex);
+  budget->counters = *counters;
+  /* a smaller burst since the save */
+  if (budget->counters.tokens > budget->config.burst * BUDGET_MILLI)
+    budget->counters.tokens = budget->config.burst * BUDGET_MILLI;
+  budget->refill_ms = now_ms;
+  pthread_mutex_unlock(&budget->mutex);
+}
+
+/**
+ * @brief Asks for a session
+ *
+ * @param budget Pointer to the budget
+ * @param priority The enum budget_priority of the session
+ * @param mo_bytes Size of the MO message it would send, checked against the byte caps
+ * @param now_ms The current time
+ * @param day The current day number, BUDGET_PERIOD_UNKNOWN without a clock
+ * @param month The current month number, BUDGET_PERIOD_UNKNOWN without a clock
+ * @return The enum budget_verdict, BUDGET_OK counts the session
+ */
+int budget_acquire(struct budget_t *budget, int priority, uint32_t mo_bytes, uint32_t now_ms, uint32_t day,
+                   uint32_t month)
+{
+  if (priority < 0 || priority >= BUDGET_PRIORITIES)
+    priority = BUDGET_BACKGROUND;
+
+  pthread_mutex_lock(&budget->mutex);
+  const struct budget_config *config = &budget->config;
+  struct budget_counters *counters = &budget->counters;
+  budget_roll(budget, day, month);
+
+  int verdict = BUDGET_OK;
+  if ((config->month_sessions > 0 && counters->month_sessions >= config->month_sessions) ||
+      (config->month_bytes > 0 && counters->month_bytes + mo_bytes > config->month_bytes))
+    verdict = BUDGET_MONTH;
+  else if ((config->day_sessions > 0 && counters->day_sessions >= config->day_sessions) ||
+           (config->day_bytes > 0 && counters->day_bytes + mo_bytes > config->day_bytes))
+    verdict = BUDGET_DAY;
+  else if (config->sessions_per_hour > 0)
+  {
+    budget_refill(budget, now_ms);
+    /* the session itself plus what this priority leaves for the ones above it */
+    if (counters->tokens < (config->reserve[priority] + 1) * BUDGET_MILLI)
+      verdict = BUDGET_RATE;
+    else
+      counters->tokens -= BUDGET_MILLI;
+  }
+
+  if (verdict != BUDGET_OK)
+  {
+    budget->stats.denied[priority]++;
+    budget->stats.denied_rate += verdict == BUDGET_RATE;
+    budget->stats.denied_day += verdict == BUDGET_DAY;
+    budget->stats.denied_month += verdict == BUDGET_MONTH;
+    pthread_mutex_unlock(&budget->mutex);
+    return verdict;
+  }
+  counters->day_sessions++;
+  counters->month_sessions++;
+  budget->stats.sessions++;
+  /* saved before the session, a reset during it must not give the session back */
+  budget_save(budget);
+  pthread_mutex_unlock(&budget->mutex);
+  return BUDGET_OK;
+}
+
+/**
+ * @brief Gives back a session budget_acquire() allowed but that never started
+ *
+ * @param budget Pointer to the budget
+ */
+void budget_refund(struct budget_t *budget)
+{
+  pthread_mutex_lock(&budget->mutex);
+  struct budget_counters *counters = &budget->counters;
+  if (budget->config.sessions_per_hour > 0)
+  {
+    uint32_t cap = budget->config.burst * BUDGET_MILLI;
+    counters->tokens = counters->tokens + BUDGET_MILLI > cap ? cap : counters->tokens + BUDGET_MILLI;
+  }
+  if (counters->day_sessions > 0)
+    counters->day_sessions--;
+  if (counters->month_sessions > 0)
+    counters->month_sessions--;
+  if (budget->stats.sessions > 0)
+    budget->stats.sessions--;
+  budget->stats.refunded++;
+  budget_save(budget);
+  pthread_mutex_unlock(&budget->mutex);
+}
+
+/**
+ * @brief Charges the bytes a session moved
+ *
+ * @param budget Pointer to the budget
+ * @param bytes MO and MT bytes of the session
+ */
+void budget_charge(struct budget_t *budget, uint32_t bytes)
+{
+  if (bytes == 0)
+    return;
+  pthread_mutex_lock(&budget->mutex);
+  budget->counters.day_bytes += bytes;
+  budget->counters.month_bytes += bytes;
+  budget->stats.bytes += bytes;
+  budget_save(budget);
+  pthread_mutex_unlock(&budget->mutex);
+}
+
+/**
+ * @brief Copies the statistics and what is left
+ *
+ * @param budget Pointer to the budget
+ * @param now_ms The current time, for the bucket level
+ * @param stats Pointer to the statistics to fill
+ */
+void budget_get_stats(struct budget_t *budget, uint32_t now_ms, struct budget_stats *stats)
+{
+  pthread_mutex_lock(&budget->mutex);
+  const struct budget_config *config = &budget->config;
+  const struct budget_counters *counters = &budget->counters;
+  *stats = budget->stats;
+  if (config->sessions_per_hour > 0)
+  {
+    budget_refill(budget, now_ms);
+    stats->tokens = counters->tokens / BUDGET_MILLI;
+  }
+  else
+    stats->tokens = BUDGET_UNLIMITED;
+  stats->day_sessions_left = budget_left(config->day_sessions, counters->day_sessions);
+  stats->day_bytes_left = budget_left(config->day_bytes, counters->day_bytes);
+  stats->month_sessions_left = budget_left(config->month_sessions, counters->month_sessions);
+  stats->month_bytes_left = budget_left(config->month_bytes, counters->month_bytes);
+  pthread_mutex_unlock(&budget->mutex);
+}
+
+/**
+ * @brief Destroys a budget
+ *
+ * @param budget Double pointer to the budget to destroy
+ */
+void destroy_budget(struct budget_t **budget)
+{
+  if (*budget == NULL)
+    return;
+  pthread_mutex_destroy(&(*budget)->mutex);
+  free(*budget);
+  *budget = NULL;
+}
@@ -0,0 +1,223 @@
+/**
+ * @file budget.h
+ * @brief An airtime budget that rate limits and caps SBD sessions
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This header file provides the session budget of the driver. Every +SBDIX can be billed,
+ * so a bug or a flapping link retrying around the clock can burn a month's plan in a day.
+ * A session is only started once the budget allows it:
+ *
+ * - a token bucket of burst sessions refilled at sessions_per_hour. A priority has to leave
+ *   its reserve in the bucket, so routine traffic can't spend the last sessions an alarm
+ *   would need.
+ * - hard caps on sessions and bytes per day and per month, for every priority. The counts
+ *   start over when the caller passes a new day or month number. BUDGET_PERIOD_UNKNOWN
+ *   (no clock yet) keeps counting into the current period, erring on the safe side.
+ *
+ * Bytes are what the session moved, the MO message when it went through and the MT message
+ * received. A store callback sees every change of the counters and the bucket so the budget
+ * survives a reboot (the driver puts it in NVS), and a boot loop can't reset it.
+ *
+ * All operations are serialized with an internal mutex.
+ *
+ * Usage example:
+ * @code
+ * struct budget_config config = { .sessions_per_hour = 6, .burst = 6, .reserve = { 0, 1, 2 },
+ *                                 .day_sessions = 48, .month_bytes = 100000 };
+ * struct budget_t *budget = newBudget(&config);
+ * if (budget_acquire(budget, BUDGET_NORMAL, mo_bytes, now_ms, day, month) == BUDGET_OK)
+ * {
+ *   if (start_session() == 0)
+ *     budget_charge(budget, session_bytes());
+ *   else
+ *     budget_refund(budget);
+ * }
+ * destroy_budget(&budget);
+ * @endcode
+ */
+
+#ifndef BUDGET_H_INCLUDED
+#define BUDGET_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define BUDGET_PRIORITIES 3                  /**< Urgent, normal and background, as in dispatch.h */
+#define BUDGET_PERIOD_UNKNOWN UINT32_MAX     /**< Day or month not known, keep the current counts */
+#define BUDGET_UNLIMITED UINT32_MAX          /**< Remaining count without a cap */
+
+/**
+ * @brief Priority of a session, the same order as the dispatch classes
+ */
+enum budget_priority
+{
+  BUDGET_URGENT = 0,
+  BUDGET_NORMAL,
+  BUDGET_BACKGROUND,
+};
+
+/**
+ * @brief Outcome of budget_acquire()
+ */
+enum budget_verdict
+{
+  BUDGET_OK = 0,                 /**< Go ahead, a session was taken */
+  BUDGET_RATE,                   /**< The bucket is down to the reserve of the priority */
+  BUDGET_DAY,                    /**< A daily cap is reached */
+  BUDGET_MONTH,                  /**< A monthly cap is reached */
+};
+
+/**
+ * @brief Limits, 0 turns a limit off
+ */
+struct budget_config
+{
+  uint32_t sessions_per_hour;              /**< Bucket refill */
+  uint32_t burst;                          /**< Bucket size in sessions, 0 for sessions_per_hour */
+  uint32_t reserve[BUDGET_PRIORITIES];     /**< Sessions a priority has to leave in the bucket */
+  uint32_t day_sessions;
+  uint32_t day_bytes;
+  uint32_t month_sessions;
+  uint32_t month_bytes;
+};
+
+/**
+ * @brief What the store persists
+ */
+struct budget_counters
+{
+  uint32_t day;                  /**< Day number the day counts belong to */
+  uint32_t month;                /**< Month number the month counts belong to */
+  uint32_t day_sessions;
+  uint32_t day_bytes;
+  uint32_t month_sessions;
+  uint32_t month_bytes;
+  uint32_t tokens;               /**< Bucket level in thousandths of a session */
+};
+
+/**
+ * @brief Budget statistics and what is left
+ */
+struct budget_stats
+{
+  uint32_t sessions;                       /**< Sessions allowed */
+  uint32_t refunded;                       /**< Sessions given back, allowed but never started */
+  uint32_t bytes;                          /**< Bytes charged */
+  uint32_t denied[BUDGET_PRIORITIES];      /**< Sessions refused per priority */
+  uint32_t denied_rate;                    /**< Refused by the bucket */
+  uint32_t denied_day;                     /**< Refused by a daily cap */
+  uint32_t denied_month;                   /**< Refused by a monthly cap */
+  uint32_t tokens;                         /**< Whole sessions in the bucket, filled by the snapshot */
+  uint32_t day_sessions_left;              /**< BUDGET_UNLIMITED without a cap, filled by the snapshot */
+  uint32_t day_bytes_left;
+  uint32_t month_sessions_left;
+  uint32_t month_bytes_left;
+};
+
+/**
+ * @brief Persistence of the counters
+ */
+struct budget_store
+{
+  void *ctx;
+  void (*save)(void *ctx, const struct budget_counters *counters);
+};
+
+/**
+ * @brief Main budget structure
+ */
+struct budget_t
+{
+  struct budget_config config;
+  struct budget_counters counters;
+  uint32_t refill_ms;            /**< Time the bucket was last refilled */
+  struct budget_store store;     /**< Persistence, save NULL when off */
+  struct budget_stats stats;     /**< Statistics */
+  pthread_mutex_t mutex;         /**< Serializes every operation */
+};
+
+/**
+ * @brief Creates a new budget with a full bucket and nothing spent
+ *
+ * @param config The limits, copied
+ * @return Pointer to the newly created budget, or NULL if allocation failed
+ *
+ * @note The caller is responsible for destroying the budget
+ */
+struct budget_t *newBudget(const struct budget_config *config);
+
+/**
+ * @brief Sets the persistence callback
+ *
+ * @param budget Pointer to the budget
+ * @param store The callback, copied
+ */
+void budget_set_store(struct budget_t *budget, const struct budget_store *store);
+
+/**
+ * @brief Loads persisted counters, e.g. after a reboot
+ *
+ * @param budget Pointer to the budget
+ * @param counters The counters from the store
+ * @param now_ms The current time, the bucket refills from here
+ */
+void budget_restore(struct budget_t *budget, const struct budget_counters *counters, uint32_t now_ms);
+
+/**
+ * @brief Asks for a session
+ *
+ * @param budget Pointer to the budget
+ * @param priority The enum budget_priority of the session
+ * @param mo_bytes Size of the MO message it would send, checked against the byte caps
+ * @param now_ms The current time
+ * @param day The current day number, BUDGET_PERIOD_UNKNOWN without a clock
+ * @param month The current month number, BUDGET_PERIOD_UNKNOWN without a clock
+ * @return The enum budget_verdict, BUDGET_OK counts the session
+ */
+int budget_acquire(struct budget_t *budget, int priority, uint32_t mo_bytes, uint32_t now_ms, uint32_t day,
+                   uint32_t month);
+
+/**
+ * @brief Gives back a session budget_acquire() allowed but that never started
+ *
+ * @param budget Pointer to the budget
+ */
+void budget_refund(struct budget_t *budget);
+
+/**
+ * @brief Charges the bytes a session moved
+ *
+ * @param budget Pointer to the budget
+ * @param bytes MO and MT bytes of the session
+ */
+void budget_charge(struct budget_t *budget, uint32_t bytes);
+
+/**
+ * @brief Copies the statistics and what is left
+ *
+ * @param budget Pointer to the budget
+ * @param now_ms The current time, for the bucket level
+ * @param stats Pointer to the statistics to fill
+ */
+void budget_get_stats(struct budget_t *budget, uint32_t now_ms, struct budget_stats *stats);
+
+/**
+ * @brief Destroys a budget
+ *
+ * @param budget Double pointer to the budget to destroy
+ */
+void destroy_budget(struct budget_t **budget);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BUDGET_H_INCLUDED */
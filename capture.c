@@ -0,0 +1,174 @@
+/**
+ * @file capture.c
+ * @brief Implementation of the UART capture format
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This file contains the implementation of the capture writer and reader declared in
+ * capture.h. Every record is encoded into a small header buffer and written with two
+ * sink calls under the writer mutex.
+ */
+
+#include "capture.h"
+
+/**
+ * @brief Encodes an unsigned LEB128 varint
+ *
+ * @return The number of bytes written, at most 5
+ */
+static size_t capture_put_varint(uint8_t *out, uint32_t value)
+{
+  size_t n = 0;
+  do
+  {
+    uint8_t byte = value & 0x7F;
+    value >>= 7;
+    out[n++] = byte | (value ? 0x80 : 0);
+  } while (value);
+  return n;
+}
+
+/**
+ * @brief Decodes an unsigned LEB128 varint
+ *
+ * @return 0 on success, -1 if truncated or longer than 32 bits
+ */
+static int capture_get_varint(const uint8_t *buffer, size_t size, size_t *offset, uint32_t *value)
+{
+  uint32_t result = 0;
+  for (int shift = 0; shift < 35; shift += 7)
+  {
+    if (*offset >= size)
+      return -1;
+    uint8_t byte = buffer[(*offset)++];
+    result |= (uint32_t)(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+    {
+      *value = result;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Initializes a capture writer and writes the header
+ *
+ * @param capture Pointer to the writer
+ * @param sink Output of the encoded bytes
+ * @param ctx Passed to the sink
+ * @param now_us The current time in us, the first record delta is relative to it
+ * @return 0 on success, -1 if the sink refused the header
+ */
+int capture_init(struct capture_t *capture, capture_sink_t sink, void *ctx, uint32_t now_us)
+{
+  memset(capture, 0, sizeof *capture);
+  capture->sink = sink;
+  capture->ctx = ctx;
+  capture->last_us = now_us;
+  pthread_mutex_init(&capture->mutex, NULL);
+
+  uint8_t header[CAPTURE_HEADER_SIZE];
+  memcpy(header, CAPTURE_MAGIC, 4);
+  header[4] = CAPTURE_VERSION;
+  if (sink(ctx, header, sizeof header) != 0)
+    return -1;
+  capture->bytes = sizeof header;
+  return 0;
+}
+
+/**
+ * @brief Appends a record
+ *
+ * @param capture Pointer to the writer
+ * @param now_us The current time in us
+ * @param direction The enum capture_direction
+ * @param data The bytes
+ * @param length The number of bytes
+ * @return 0 on success, -1 if the sink refused the record
+ *
+ * @note Writes longer than CAPTURE_RECORD_MAX are split, the extra records have a zero delta
+ */
+int capture_record(struct capture_t *capture, uint32_t now_us, uint8_t direction, const void *data, size_t length)
+{
+  const uint8_t *bytes = data;
+  int status = 0;
+
+  pthread_mutex_lock(&capture->mutex);
+  do
+  {
+    size_t chunk = length > CAPTURE_RECORD_MAX ? CAPTURE_RECORD_MAX : length;
+    uint8_t header[11];
+    size_t n = 0;
+    header[n++] = direction;
+    n += capture_put_varint(header + n, now_us - capture->last_us);
+    n += capture_put_varint(header + n, (uint32_t)chunk);
+    capture->last_us = now_us;
+
+    if (capture->sink(capture->ctx, header, n) != 0 || 
+        (chunk > 0 && capture->sink(capture->ctx, bytes, chunk) != 0))
+    {
+      capture->failed++;
+      status = -1;
+      break;
+    }
+    capture->records++;
+    capture->bytes += n + chunk;
+    bytes += chunk;
+    length -= chunk;
+  } while (length > 0);
+  pthread_mutex_unlock(&capture->mutex);
+  return status;
+}
+
+/**
+ * @brief Releases the writer, the sink is not closed
+ *
+ * @param capture Pointer to the writer
+ */
+void capture_close(struct capture_t *capture)
+{
+  pthread_mutex_destroy(&capture->mutex);
+}
+
+/**
+ * @brief Checks the header of a capture buffer
+ *
+ * @param buffer The capture bytes
+ * @param size The number of bytes
+ * @return The offset of the first record, or 0 if the header is invalid
+ */
+size_t capture_parse_header(const uint8_t *buffer, size_t size)
+{
+  if (size < CAPTURE_HEADER_SIZE || memcmp(buffer, CAPTURE_MAGIC, 4) != 0 || buffer[4] != CAPTURE_VERSION)
+    return 0;
+  return CAPTURE_HEADER_SIZE;
+}
+
+/**
+ * @brief Decodes the record at an offset
+ *
+ * @param buffer The capture bytes
+ * @param size The number of bytes
+ * @param offset Pointer to the offset, advanced past the record
+ * @param record Pointer to the record to fill
+ * @return 1 when a record was decoded, 0 at the end, -1 if the record is truncated or malformed
+ */
+int capture_next(const uint8_t *buffer, size_t size, size_t *offset, struct capture_record *record)
+{
+  if (*offset >= size)
+    return 0;
+
+  size_t at = *offset;
+  record->direction = buffer[at++];
+  if (record->direction > CAPTURE_TX)
+    return -1;
+  if (capture_get_varint(buffer, size, &at, &record->delta_us) != 0 || 
+      capture_get_varint(buffer, size, &at, &record->length) != 0)
+    return -1;
+  if (record->length > size - at)
+    return -1;
+  record->data = buffer + at;
+  *offset = at + record->length;
+  return 1;
+}
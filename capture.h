@@ -0,0 +1,148 @@
+/**
+ * @file capture.h
+ * @brief A compact timestamped record of UART traffic in both directions
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This header file provides the writer and reader of the capture format used to record
+ * modem sessions in the field and replay them on the host (tools/iridium_replay.c).
+ *
+ * File layout, all integers are unsigned LEB128 varints:
+ * @code
+ * "IRCP" <version:1 byte>                       header
+ * <direction:1 byte> <delta_us> <length> <bytes> record, repeated
+ * @endcode
+ * direction is CAPTURE_RX for modem output and CAPTURE_TX for driver writes, delta_us
+ * is the time since the previous record. A typical record costs 3 to 5 bytes on top
+ * of the data.
+ *
+ * The writer hands encoded bytes to a sink callback (a file, a RAM buffer, a socket).
+ * Records are serialized with an internal mutex, a record is never split between
+ * two sink calls.
+ *
+ * Usage example:
+ * @code
+ * struct capture_t capture;
+ * capture_init(&capture, sink, file, now_us);
+ * capture_record(&capture, now_us, CAPTURE_TX, "AT+CSQ\r", 7);
+ * @endcode
+ */
+
+#ifndef CAPTURE_H_INCLUDED
+#define CAPTURE_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * @brief Header magic and format version
+ */
+#define CAPTURE_MAGIC "IRCP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 5
+
+/**
+ * @brief Largest record payload, longer writes are split into several records
+ */
+#define CAPTURE_RECORD_MAX 1024
+
+/**
+ * @brief Record direction
+ */
+enum capture_direction
+{
+  CAPTURE_RX = 0,                /**< Modem to driver */
+  CAPTURE_TX = 1                 /**< Driver to modem */
+};
+
+/**
+ * @brief Receives encoded capture bytes, returns 0 on success
+ */
+typedef int (*capture_sink_t)(void *ctx, const uint8_t *data, size_t length);
+
+/**
+ * @brief Capture writer structure
+ */
+struct capture_t
+{
+  capture_sink_t sink;           /**< Output of the encoded bytes */
+  void *ctx;                     /**< Passed to the sink */
+  uint32_t last_us;              /**< Timestamp of the previous record */
+  uint32_t records;              /**< Records written */
+  uint32_t bytes;                /**< Encoded bytes written, header included */
+  uint32_t failed;               /**< Records the sink refused */
+  pthread_mutex_t mutex;         /**< Serializes records */
+};
+
+/**
+ * @brief A decoded record, data points into the capture buffer
+ */
+struct capture_record
+{
+  uint8_t direction;             /**< enum capture_direction */
+  uint32_t delta_us;             /**< Time since the previous record */
+  uint32_t length;               /**< Payload length */
+  const uint8_t *data;           /**< Payload */
+};
+
+/**
+ * @brief Initializes a capture writer and writes the header
+ *
+ * @param capture Pointer to the writer
+ * @param sink Output of the encoded bytes
+ * @param ctx Passed to the sink
+ * @param now_us The current time in us, the first record delta is relative to it
+ * @return 0 on success, -1 if the sink refused the header
+ */
+int capture_init(struct capture_t *capture, capture_sink_t sink, void *ctx, uint32_t now_us);
+
+/**
+ * @brief Appends a record
+ *
+ * @param capture Pointer to the writer
+ * @param now_us The current time in us
+ * @param direction The enum capture_direction
+ * @param data The bytes
+ * @param length The number of bytes
+ * @return 0 on success, -1 if the sink refused the record
+ */
+int capture_record(struct capture_t *capture, uint32_t now_us, uint8_t direction, const void *data, size_t length);
+
+/**
+ * @brief Releases the writer, the sink is not closed
+ *
+ * @param capture Pointer to the writer
+ */
+void capture_close(struct capture_t *capture);
+
+/**
+ * @brief Checks the header of a capture buffer
+ *
+ * @param buffer The capture bytes
+ * @param size The number of bytes
+ * @return The offset of the first record, or 0 if the header is invalid
+ */
+size_t capture_parse_header(const uint8_t *buffer, size_t size);
+
+/**
+ * @brief Decodes the record at an offset
+ *
+ * @param buffer The capture bytes
+ * @param size The number of bytes
+ * @param offset Pointer to the offset, advanced past the record
+ * @param record Pointer to the record to fill
+ * @return 1 when a record was decoded, 0 at the end, -1 if the record is truncated or malformed
+ */
+int capture_next(const uint8_t *buffer, size_t size, size_t *offset, struct capture_record *record);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAPTURE_H_INCLUDED */
@@ -0,0 +1,211 @@
+/**
+ * @file dispatch.c
+ * @brief Implementation of the bounded multi-class priority queue
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This file contains the implementation of the dispatch queue declared in dispatch.h.
+ * Every class is a fixed ring allocated up front, so push and pop never allocate.
+ */
+
+#include "dispatch.h"
+
+/**
+ * @brief Creates a new empty dispatch queue
+ *
+ * @param item_size Size of each item in bytes
+ * @param depth Maximum number of items per class
+ * @param promote_after_ms Wait time that lifts an item one class, 0 disables promotion
+ * @return Pointer to the newly created queue, or NULL if allocation failed
+ *
+ * @note All item storage is allocated here, one block per class
+ */
+struct dispatch_t *newDispatch(size_t item_size, const size_t depth[DISPATCH_CLASSES], uint32_t promote_after_ms)
+{
+  struct dispatch_t *queue = calloc(1, sizeof *queue);
+  if (queue == NULL)
+    return NULL;
+
+  queue->item_size = item_size;
+  queue->promote_after_ms = promote_after_ms;
+  pthread_mutex_init(&queue->mutex, NULL);
+
+  for (int i = 0; i < DISPATCH_CLASSES; i++)
+  {
+    struct dispatch_ring *ring = &queue->rings[i];
+    ring->capacity = depth[i];
+    if (ring->capacity == 0)
+      continue;
+    ring->items = malloc(ring->capacity * item_size);
+    ring->enqueued_ms = malloc(ring->capacity * sizeof(uint32_t));
+    if (ring->items == NULL || ring->enqueued_ms == NULL)
+    {
+      destroy_dispatch(&queue);
+      return NULL;
+    }
+  }
+  return queue;
+}
+
+/**
+ * @brief Copies an item into the queue of its class
+ *
+ * @param queue Pointer to the queue
+ * @param cls The dispatch class of the item
+ * @param item Pointer to the item to copy
+ * @param now_ms The current time in ms
+ * @return 0 on success, -1 if the class is full (the item was not queued)
+ *
+ * @note A full class is counted in the rejected statistic, the caller decides
+ *       whether to retry, wait or report the failure
+ */
+int dispatch_push(struct dispatch_t *queue, int cls, const void *item, uint32_t now_ms)
+{
+  if (cls < 0 || cls >= DISPATCH_CLASSES)
+    return -1;
+
+  pthread_mutex_lock(&queue->mutex);
+  struct dispatch_ring *ring = &queue->rings[cls];
+  struct dispatch_stats *stats = &queue->stats[cls];
+  if (ring->count >= ring->capacity)
+  {
+    stats->rejected++;
+    pthread_mutex_unlock(&queue->mutex);
+    return -1;
+  }
+
+  size_t slot = (ring->head + ring->count) % ring->capacity;
+  memcpy(ring->items + slot * queue->item_size, item, queue->item_size);
+  ring->enqueued_ms[slot] = now_ms;
+  ring->count++;
+
+  stats->enqueued++;
+  stats->depth = ring->count;
+  if (ring->count > stats->high_water)
+    stats->high_water = ring->count;
+  pthread_mutex_unlock(&queue->mutex);
+  return 0;
+}
+
+/**
+ * @brief Removes the item with the highest effective priority
+ *
+ * Only the head of each class ring is considered, so items stay FIFO within
+ * their class. The effective priority of a head is its class minus one for
+ * every promote_after_ms it has waited, ties go to the higher class.
+ *
+ * @param queue Pointer to the queue
+ * @param item Pointer to the storage the item is copied to
+ * @param now_ms The current time in ms
+ * @param cls Pointer to store the class of the item, can be NULL
+ * @return 0 on success, -1 if the queue is empty
+ */
+int dispatch_pop(struct dispatch_t *queue, void *item, uint32_t now_ms, int *cls)
+{
+  pthread_mutex_lock(&queue->mutex);
+
+  int best = -1;
+  long best_priority = 0;
+  for (int i = 0; i < DISPATCH_CLASSES; i++)
+  {
+    struct dispatch_ring *ring = &queue->rings[i];
+    if (ring->count == 0)
+      continue;
+    long priority = i;
+    if (queue->promote_after_ms > 0)
+      priority -= (long)((now_ms - ring->enqueued_ms[ring->head]) / queue->promote_after_ms);
+    if (best < 0 || priority < best_priority)
+    {
+      best = i;
+      best_priority = priority;
+    }
+  }
+
+  if (best < 0)
+  {
+    pthread_mutex_unlock(&queue->mutex);
+    return -1;
+  }
+
+  struct dispatch_ring *ring = &queue->rings[best];
+  struct dispatch_stats *stats = &queue->stats[best];
+  uint32_t wait_ms = now_ms - ring->enqueued_ms[ring->head];
+  memcpy(item, ring->items + ring->head * queue->item_size, queue->item_size);
+  ring->head = (ring->head + 1) % ring->capacity;
+  ring->count--;
+
+  stats->dequeued++;
+  stats->depth = ring->count;
+  stats->wait_ms_total += wait_ms;
+  if (wait_ms > stats->wait_ms_max)
+    stats->wait_ms_max = wait_ms;
+  for (int i = 0; i < best; i++)
+  {
+    /* served while a higher class had work, only age can do that */
+    if (queue->rings[i].count > 0)
+    {
+      stats->promoted++;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&queue->mutex);
+
+  if (cls)
+    *cls = best;
+  return 0;
+}
+
+/**
+ * @brief Number of items queued across all classes
+ *
+ * @param queue Pointer to the queue
+ * @return The number of queued items
+ */
+size_t dispatch_size(struct dispatch_t *queue)
+{
+  size_t size = 0;
+  pthread_mutex_lock(&queue->mutex);
+  for (int i = 0; i < DISPATCH_CLASSES; i++)
+    size += queue->rings[i].count;
+  pthread_mutex_unlock(&queue->mutex);
+  return size;
+}
+
+/**
+ * @brief Copies the statistics of a class
+ *
+ * @param queue Pointer to the queue
+ * @param cls The dispatch class
+ * @param stats Pointer to the statistics to fill
+ * @return 0 on success, -1 if the class is invalid
+ */
+int dispatch_get_stats(struct dispatch_t *queue, int cls, struct dispatch_stats *stats)
+{
+  if (cls < 0 || cls >= DISPATCH_CLASSES)
+    return -1;
+  pthread_mutex_lock(&queue->mutex);
+  *stats = queue->stats[cls];
+  pthread_mutex_unlock(&queue->mutex);
+  return 0;
+}
+
+/**
+ * @brief Completely destroys the queue and frees all associated memory
+ *
+ * @param queue Pointer to a pointer to the queue to destroy
+ *
+ * @note If *queue is NULL, this function has no effect
+ */
+void destroy_dispatch(struct dispatch_t **queue)
+{
+  if (*queue == NULL)
+    return;
+  for (int i = 0; i < DISPATCH_CLASSES; i++)
+  {
+    free((*queue)->rings[i].items);
+    free((*queue)->rings[i].enqueued_ms);
+  }
+  pthread_mutex_destroy(&(*queue)->mutex);
+  free(*queue);
+  *queue = NULL;
+}
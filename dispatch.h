@@ -0,0 +1,155 @@
+/**
+ * @file dispatch.h
+ * @brief A bounded multi-class priority queue with age-based promotion
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This header file provides a priority dispatch queue for fixed-size items. Items are
+ * kept in one FIFO ring per class, each with its own bounded depth. A push into a full
+ * class is rejected so the caller can apply back-pressure instead of losing the item.
+ * A pop serves the class with the highest effective priority, where every
+ * promote_after_ms an item has waited lifts it one class, so background items are
+ * never starved. Wait times are recorded per class.
+ *
+ * All operations are serialized with an internal mutex.
+ *
+ * Usage example:
+ * @code
+ * size_t depth[DISPATCH_CLASSES] = { 2, 4, 4 };
+ * struct dispatch_t *queue = newDispatch(sizeof(int), depth, 30000);
+ * int item = 42;
+ * dispatch_push(queue, DISPATCH_URGENT, &item, now_ms);
+ * dispatch_pop(queue, &item, now_ms, NULL);  // returns 0, item = 42
+ * destroy_dispatch(&queue);
+ * @endcode
+ */
+
+#ifndef DISPATCH_H_INCLUDED
+#define DISPATCH_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * @brief Dispatch classes, lower value is served first
+ */
+enum dispatch_class
+{
+  DISPATCH_URGENT = 0,           /**< Alarms and other urgent traffic */
+  DISPATCH_NORMAL = 1,           /**< Regular commands */
+  DISPATCH_BACKGROUND = 2,       /**< Polling and housekeeping */
+  DISPATCH_CLASSES = 3           /**< Number of classes */
+};
+
+/**
+ * @brief Per-class queue statistics
+ */
+struct dispatch_stats
+{
+  uint32_t enqueued;             /**< Items accepted */
+  uint32_t dequeued;             /**< Items served */
+  uint32_t rejected;             /**< Pushes refused because the class was full */
+  uint32_t promoted;             /**< Items served ahead of their class because of age */
+  uint32_t wait_ms_total;        /**< Sum of the wait times of served items */
+  uint32_t wait_ms_max;          /**< Longest wait time of a served item */
+  size_t depth;                  /**< Items currently queued */
+  size_t high_water;             /**< Most items ever queued at once */
+};
+
+/**
+ * @brief A single class ring
+ */
+struct dispatch_ring
+{
+  uint8_t *items;                /**< Item storage, capacity * item_size bytes */
+  uint32_t *enqueued_ms;         /**< Enqueue time of each slot */
+  size_t head;                   /**< Index of the oldest item */
+  size_t count;                  /**< Number of queued items */
+  size_t capacity;               /**< Maximum number of items */
+};
+
+/**
+ * @brief Main dispatch queue structure
+ */
+struct dispatch_t
+{
+  size_t item_size;                                 /**< Size of each item in bytes */
+  uint32_t promote_after_ms;                        /**< Wait time that lifts an item one class, 0 disables */
+  struct dispatch_ring rings[DISPATCH_CLASSES];     /**< One ring per class */
+  struct dispatch_stats stats[DISPATCH_CLASSES];    /**< Statistics per class */
+  pthread_mutex_t mutex;                            /**< Serializes every operation */
+};
+
+/**
+ * @brief Creates a new empty dispatch queue
+ *
+ * @param item_size Size of each item in bytes
+ * @param depth Maximum number of items per class
+ * @param promote_after_ms Wait time that lifts an item one class, 0 disables promotion
+ * @return Pointer to the newly created queue, or NULL if allocation failed
+ *
+ * @note This function allocates memory. Use destroy_dispatch() to free it.
+ */
+struct dispatch_t *newDispatch(size_t item_size, const size_t depth[DISPATCH_CLASSES], uint32_t promote_after_ms);
+
+/**
+ * @brief Copies an item into the queue of its class
+ *
+ * @param queue Pointer to the queue
+ * @param cls The dispatch class of the item
+ * @param item Pointer to the item to copy
+ * @param now_ms The current time in ms, used for wait times and promotion
+ * @return 0 on success, -1 if the class is full (the item was not queued)
+ */
+int dispatch_push(struct dispatch_t *queue, int cls, const void *item, uint32_t now_ms);
+
+/**
+ * @brief Removes the item with the highest effective priority
+ *
+ * @param queue Pointer to the queue
+ * @param item Pointer to the storage the item is copied to
+ * @param now_ms The current time in ms
+ * @param cls Pointer to store the class of the item, can be NULL
+ * @return 0 on success, -1 if the queue is empty
+ */
+int dispatch_pop(struct dispatch_t *queue, void *item, uint32_t now_ms, int *cls);
+
+/**
+ * @brief Number of items queued across all classes
+ *
+ * @param queue Pointer to the queue
+ * @return The number of queued items
+ */
+size_t dispatch_size(struct dispatch_t *queue);
+
+/**
+ * @brief Copies the statistics of a class
+ *
+ * @param queue Pointer to the queue
+ * @param cls The dispatch class
+ * @param stats Pointer to the statistics to fill
+ * @return 0 on success, -1 if the class is invalid
+ */
+int dispatch_get_stats(struct dispatch_t *queue, int cls, struct dispatch_stats *stats);
+
+/**
+ * @brief Completely destroys the queue and frees all associated memory
+ *
+ * @param queue Pointer to a pointer to the queue to destroy
+ *
+ * @note The pointer is set to NULL after destruction.
+ */
+void destroy_dispatch(struct dispatch_t **queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DISPATCH_H_INCLUDED */
@@ -33,7 +33,9 @@
 
 #include "led_strip_encoder.h"
 
+#include "esp_timer.h"
 #include "../../../iridium.h"
+#include "../../../telemetry.h"
 
 static const char *TAG = "iridium_examples";
 
@@ -140,6 +142,52 @@ void cb_message(iridium_t* satcom, char* data) {
     ESP_LOGI(TAG, "CALLBACK[INCOMING] %s", data);
 }
 
+#if CONFIG_IRIDIUM_TELEMETRY_BENCH
+/*
+* Encode a synthetic GPS track into SBD sized frames, log the encode cost and the
+* schema descriptor (hex) that tools/iridium_telemetry decodes the frames with.
+*/
+static void telemetry_bench(void) {
+    static struct telemetry_schema schema;
+    telemetry_schema_init(&schema);
+    telemetry_schema_field(&schema, "time", 0, 2147483647, 0, TELEMETRY_DELTA);
+    telemetry_schema_field(&schema, "lat", -90, 90, 5, TELEMETRY_DELTA);
+    telemetry_schema_field(&schema, "lon", -180, 180, 5, TELEMETRY_DELTA);
+    telemetry_schema_field(&schema, "alt", -500, 9000, 1, TELEMETRY_DELTA);
+    telemetry_schema_field(&schema, "battery", 3, 4.3, 2, 0);
+
+    uint8_t descriptor[TELEMETRY_DESCRIPTOR_MAX];
+    size_t length = telemetry_schema_serialize(&schema, descriptor, sizeof(descriptor));
+    char hex[2 * TELEMETRY_DESCRIPTOR_MAX + 1];
+    for (size_t i = 0; i < length; i++) {
+        sprintf(hex + 2 * i, "%02x", descriptor[i]);
+    }
+    ESP_LOGI(TAG, "Telemetry Schema [%02x] %s", schema.id, hex);
+
+    static uint8_t frame[IRI_SBD_MO_MAX];
+    struct telemetry_encoder encoder;
+    telemetry_encoder_init(&encoder, &schema);
+    telemetry_begin(&encoder, frame, sizeof(frame));
+    double fix[] = { 1714000000, 39.2818624911, -77.1234567, 120.0, 4.1 };
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < 1000; i++) {
+        fix[0] += 1;
+        fix[1] += (i % 7 - 3) * 0.00004;
+        fix[2] += (i % 5 - 2) * 0.00005;
+        fix[3] += (i % 3 - 1) * 0.1;
+        if (telemetry_add(&encoder, fix) != 0) {
+            telemetry_end(&encoder);
+            telemetry_begin(&encoder, frame, sizeof(frame));
+            telemetry_add(&encoder, fix);
+        }
+    }
+    telemetry_end(&encoder);
+    int64_t elapsed = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "Telemetry Encode [%" PRId64 " us / 1000 fixes] %.1f fixes per %d byte message", 
+             elapsed, encoder.stats.frames ? (double)encoder.stats.records / encoder.stats.frames : 0.0, IRI_SBD_MO_MAX);
+}
+#endif
+
 void system_monitoring_task(void *pvParameters) {
     ESP_LOGI(TAG, "System [system_monitoring_task]");
 
@@ -207,6 +255,15 @@ void app_main(void)
     satcom->uart_cts_number = UART_PIN_NO_CHANGE;
     satcom->gpio_sleep_pin_number = UART_SLEEP_GPIO_NUM;
     satcom->gpio_net_pin_number = UART_NET_GPIO_NUM;
+#if CONFIG_IRIDIUM_METRICS_INTERVAL_MS > 0
+    /* Periodic session metrics (latency histograms, sessions, queue depth) */
+    satcom->metrics_callback = &iridium_metrics_report;
+    satcom->metrics_interval_ms = CONFIG_IRIDIUM_METRICS_INTERVAL_MS;
+#endif
+    /* Sleep the modem between sessions, commands wake it on demand */
+    satcom->power_idle_ms = CONFIG_IRIDIUM_POWER_IDLE_MS;
+    /* Batch iridium_schedule() records into transmit windows */
+    satcom->window_interval_ms = CONFIG_IRIDIUM_WINDOW_INTERVAL_MS;
     
     /* Create FreeRTOS Monitoring Task */
     //xTaskCreate(&system_monitoring_task, "system_monitoring_task", 4048, satcom, 12, NULL);
@@ -216,6 +273,16 @@ void app_main(void)
         ESP_LOGI(TAG, "Iridium Modem [Initialized]");
     }
 
+#if CONFIG_IRIDIUM_FOOTPRINT_REPORT
+    /* Static / heap usage of the driver */
+    iridium_footprint_report(satcom);
+#endif
+
+#if CONFIG_IRIDIUM_TELEMETRY_BENCH
+    /* On-device cost of the bit-packed telemetry encoder */
+    telemetry_bench();
+#endif
+
     /* Allow Ring Triggers */
     iridium_result_t ring = iridium_config_ring(satcom, true);
     if (ring.status == SAT_OK) {
@@ -227,7 +294,7 @@ void app_main(void)
 
     /* Loop */          
     for(;;) {
-        iridium_result_t r1 = iridium_send(satcom, AT_CSQ, "", true, 500);
+        iridium_result_t r1 = iridium_query(satcom, AT_CSQ);
         if (r1.status == SAT_OK) {
             ESP_LOGI(TAG, "R[%d] = %s", r1.status, r1.result);
         }
@@ -0,0 +1,371 @@
+/**
+ * @file forecast.c
+ * @brief Implementation of the signal forecast
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This file contains the implementation of the forecast declared in forecast.h. The
+ * predictor rebuilds its grid from the sample ring on every call, a few thousand
+ * multiply-adds for FORECAST_GRID bins, so nothing but the samples is kept between
+ * calls.
+ */
+
+#include "forecast.h"
+
+/* success probability per +CSQ before any session was seen, and its weight in sessions */
+static const float forecast_prior[FORECAST_LEVELS] = { 0.02f, 0.35f, 0.60f, 0.78f, 0.88f, 0.94f };
+#define FORECAST_PRIOR_WEIGHT 4.0f
+
+/* the trend fades by this much per bin, a minute of falling signal says little about the next ten */
+#define FORECAST_TREND_DAMPING 0.9f
+
+static float forecast_clamp(float csq)
+{
+  return csq < 0.0f ? 0.0f : csq > FORECAST_LEVELS - 1 ? (float)(FORECAST_LEVELS - 1) : csq;
+}
+
+static const struct forecast_sample *forecast_at(const struct forecast_t *forecast, size_t index)
+{
+  return &forecast->samples[(forecast->head + index) % forecast->capacity];
+}
+
+static float forecast_value(const struct forecast_sample *sample)
+{
+  return sample->service ? (float)sample->csq : 0.0f;
+}
+
+/**
+ * @brief Resamples the history onto the grid, the last bin ends at now_ms
+ *
+ * @return Number of bins filled, the newest is grid[bins - 1]
+ */
+static size_t forecast_grid(struct forecast_t *forecast, uint32_t now_ms)
+{
+  uint32_t span = now_ms - forecast_at(forecast, 0)->time_ms;
+  size_t bins = span / forecast->bin_ms + 1;
+  if (bins > FORECAST_GRID)
+    bins = FORECAST_GRID;
+
+  float sum[FORECAST_GRID];
+  uint32_t count[FORECAST_GRID];
+  memset(sum, 0, sizeof sum);
+  memset(count, 0, sizeof count);
+  /* the value carried into the window, the newest sample before it */
+  float carry = -1.0f;
+  for (size_t i = 0; i < forecast->count; i++)
+  {
+    const struct forecast_sample *sample = forecast_at(forecast, i);
+    uint32_t age = now_ms - sample->time_ms;
+    /* a sample stamped after now_ms belongs to the newest bin */
+    size_t back = (int32_t)age < 0 ? 0 : age / forecast->bin_ms;
+    if (back >= bins)
+    {
+      carry = forecast_value(sample);
+      continue;
+    }
+    size_t index = bins - 1 - back;
+    sum[index] += forecast_value(sample);
+    count[index]++;
+  }
+
+  /* a value holds until the next report */
+  for (size_t i = 0; i < bins; i++)
+  {
+    if (count[i] > 0)
+      carry = sum[i] / count[i];
+    else if (carry < 0.0f)
+    {
+      /* nothing before the window either, take the first bin with data */
+      for (size_t j = i; j < bins && carry < 0.0f; j++)
+        if (count[j] > 0)
+          carry = sum[j] / count[j];
+    }
+    forecast->grid[i] = carry;
+  }
+  return bins;
+}
+
+/**
+ * @brief Least squares slope of the newest bins, csq per bin
+ */
+static float forecast_slope(const float *grid, size_t bins)
+{
+  size_t n = bins < FORECAST_TREND_BINS ? bins : FORECAST_TREND_BINS;
+  if (n < 3)
+    return 0.0f;
+  const float *y = grid + bins - n;
+  float mean_x = (n - 1) / 2.0f, mean_y = 0.0f;
+  for (size_t i = 0; i < n; i++)
+    mean_y += y[i];
+  mean_y /= n;
+  float sxy = 0.0f, sxx = 0.0f;
+  for (size_t i = 0; i < n; i++)
+  {
+    sxy += (i - mean_x) * (y[i] - mean_y);
+    sxx += (i - mean_x) * (i - mean_x);
+  }
+  return sxy / sxx;
+}
+
+/**
+ * @brief The lag of the strongest autocorrelation, 0 when below FORECAST_PERIODIC
+ */
+static size_t forecast_period(const struct forecast_t *forecast, size_t bins, float *score)
+{
+  const float *grid = forecast->grid;
+  size_t lag_min = (FORECAST_LAG_MIN_MS + forecast->bin_ms - 1) / forecast->bin_ms;
+  size_t lag_max = FORECAST_LAG_MAX_MS / forecast->bin_ms;
+  /* at least one full period overlapping itself */
+  if (lag_max > bins / 2)
+    lag_max = bins / 2;
+  *score = 0.0f;
+  if (lag_min < 2 || lag_min > lag_max)
+    return 0;
+
+  float mean = 0.0f;
+  for (size_t i = 0; i < bins; i++)
+    mean += grid[i];
+  mean /= bins;
+  float variance = 0.0f;
+  for (size_t i = 0; i < bins; i++)
+    variance += (grid[i] - mean) * (grid[i] - mean);
+  if (variance < 1e-3f)
+    return 0;
+
+  size_t best = 0;
+  for (size_t lag = lag_min; lag <= lag_max; lag++)
+  {
+    float sum = 0.0f;
+    for (size_t i = lag; i < bins; i++)
+      sum += (grid[i] - mean) * (grid[i - lag] - mean);
+    /* normalized by the overlap so long lags are not penalized */
+    float r = sum / variance * bins / (bins - lag);
+    if (r > *score)
+    {
+      *score = r;
+      best = lag;
+    }
+  }
+  if (*score > 1.0f)
+    *score = 1.0f;
+  return *score >= FORECAST_PERIODIC ? best : 0;
+}
+
+static float forecast_probability_locked(const struct forecast_t *forecast, float csq)
+{
+  csq = forecast_clamp(csq);
+  int low = (int)csq;
+  int high = low < FORECAST_LEVELS - 1 ? low + 1 : low;
+  float p[2];
+  int level[2] = { low, high };
+  for (int i = 0; i < 2; i++)
+    p[i] = (forecast->successes[level[i]] + forecast_prior[level[i]] * FORECAST_PRIOR_WEIGHT) /
+           (forecast->attempts[level[i]] + FORECAST_PRIOR_WEIGHT);
+  float fraction = csq - low;
+  return p[0] + (p[1] - p[0]) * fraction;
+}
+
+/**
+ * @brief Creates a new empty forecast
+ *
+ * @param capacity Number of samples kept, the oldest is overwritten
+ * @param bin_ms Grid resolution, FORECAST_GRID bins of it are looked at
+ * @return Pointer to the newly created forecast, or NULL if allocation failed
+ *
+ * @note The caller is responsible for destroying the forecast
+ */
+struct forecast_t *newForecast(size_t capacity, uint32_t bin_ms)
+{
+  if (capacity == 0 || bin_ms == 0)
+    return NULL;
+  struct forecast_t *forecast = calloc(1, sizeof *forecast);
+  if (forecast == NULL)
+    return NULL;
+  forecast->samples = calloc(capacity, sizeof *forecast->samples);
+  if (forecast->samples == NULL)
+  {
+    free(forecast);
+    return NULL;
+  }
+  forecast->capacity = capacity;
+  forecast->bin_ms = bin_ms;
+  pthread_mutex_init(&forecast->mutex, NULL);
+  return forecast;
+}
+
+/**
+ * @brief Records a signal sample
+ *
+ * @param forecast Pointer to the forecast
+ * @param now_ms The time of the sample
+ * @param csq The +CSQ value, clamped to 0-5
+ * @param service Network service available, no service counts as no signal
+ */
+void forecast_sample(struct forecast_t *forecast, uint32_t now_ms, int csq, int service)
+{
+  pthread_mutex_lock(&forecast->mutex);
+  struct forecast_sample *sample;
+  if (forecast->count == forecast->capacity)
+  {
+    sample = &forecast->samples[forecast->head];
+    forecast->head = (forecast->head + 1) % forecast->capacity;
+  }
+  else
+  {
+    sample = &forecast->samples[(forecast->head + forecast->count) % forecast->capacity];
+    forecast->count++;
+  }
+  sample->time_ms = now_ms;
+  sample->csq = (uint8_t)(csq < 0 ? 0 : csq > FORECAST_LEVELS - 1 ? FORECAST_LEVELS - 1 : csq);
+  sample->service = service != 0;
+  forecast->stats.samples++;
+  pthread_mutex_unlock(&forecast->mutex);
+}
+
+/**
+ * @brief Records the outcome of a session
+ *
+ * @param forecast Pointer to the forecast
+ * @param csq The signal when the session started
+ * @param success Non-zero if the MO message went through
+ */
+void forecast_session(struct forecast_t *forecast, int csq, int success)
+{
+  int level = csq < 0 ? 0 : csq > FORECAST_LEVELS - 1 ? FORECAST_LEVELS - 1 : csq;
+  pthread_mutex_lock(&forecast->mutex);
+  forecast->attempts[level]++;
+  forecast->stats.sessions++;
+  if (success)
+  {
+    forecast->successes[level]++;
+    forecast->stats.successes++;
+  }
+  pthread_mutex_unlock(&forecast->mutex);
+}
+
+/**
+ * @brief The success probability of a session at a signal level
+ *
+ * @param forecast Pointer to the forecast
+ * @param csq The signal, fractions interpolate
+ * @return The probability, the prior blended with the recorded outcomes
+ */
+float forecast_probability(struct forecast_t *forecast, float csq)
+{
+  pthread_mutex_lock(&forecast->mutex);
+  float p = forecast_probability_locked(forecast, csq);
+  pthread_mutex_unlock(&forecast->mutex);
+  return p;
+}
+
+/**
+ * @brief Predicts the best time to start a session within a horizon
+ *
+ * @param forecast Pointer to the forecast
+ * @param now_ms The current time
+ * @param horizon_ms The longest acceptable wait
+ * @param estimate Pointer to the estimate to fill
+ * @return 0 on success, -1 if there are no samples
+ */
+int forecast_predict(struct forecast_t *forecast, uint32_t now_ms, uint32_t horizon_ms, struct forecast_estimate *estimate)
+{
+  memset(estimate, 0, sizeof *estimate);
+  pthread_mutex_lock(&forecast->mutex);
+  if (forecast->count == 0)
+  {
+    pthread_mutex_unlock(&forecast->mutex);
+    return -1;
+  }
+
+  size_t bins = forecast_grid(forecast, now_ms);
+  const float *grid = forecast->grid;
+  float level = grid[bins - 1];
+  float slope = forecast_slope(grid, bins);
+  float periodicity;
+  size_t period = forecast_period(forecast, bins, &periodicity);
+
+  /* how long the signal has been gone, a brief dropout and an outage look the same right now */
+  for (size_t i = forecast->count; i-- > 0;)
+  {
+    const struct forecast_sample *sample = forecast_at(forecast, i);
+    if (forecast_value(sample) > 0.0f)
+    {
+      if (i != forecast->count - 1)
+        estimate->outage_ms = now_ms - forecast_at(forecast, i + 1)->time_ms;
+      break;
+    }
+    if (i == 0)
+      estimate->outage_ms = now_ms - sample->time_ms;
+  }
+
+  size_t horizon = horizon_ms / forecast->bin_ms;
+  float damped = 0.0f, damping = 1.0f;
+  float best = -1.0f;
+  float probability[FORECAST_GRID + 1];
+  if (horizon > FORECAST_GRID)
+    horizon = FORECAST_GRID;
+  for (size_t k = 0; k <= horizon; k++)
+  {
+    float csq = level;
+    if (k > 0)
+    {
+      damping *= FORECAST_TREND_DAMPING;
+      damped += damping;
+      csq = level + slope * damped;
+      if (period > 0)
+      {
+        /* the same point of the pass one or more periods back */
+        size_t back = (k + period - 1) / period * period;
+        csq = periodicity * grid[bins - 1 + k - back] + (1.0f - periodicity) * csq;
+      }
+    }
+    probability[k] = forecast_probability_locked(forecast, csq);
+    if (probability[k] > best)
+      best = probability[k];
+  }
+  size_t start = 0;
+  while (probability[start] < best - FORECAST_SLACK)
+    start++;
+
+  estimate->delay_ms = start * forecast->bin_ms;
+  estimate->probability = probability[start];
+  estimate->probability_now = probability[0];
+  estimate->csq_now = level;
+  estimate->trend = slope * 60000.0f / forecast->bin_ms;
+  estimate->period_ms = period * forecast->bin_ms;
+  estimate->periodicity = periodicity;
+  estimate->samples = forecast->count;
+  forecast->stats.predictions++;
+  if (start > 0)
+    forecast->stats.deferred++;
+  pthread_mutex_unlock(&forecast->mutex);
+  return 0;
+}
+
+/**
+ * @brief Copies the forecast statistics
+ *
+ * @param forecast Pointer to the forecast
+ * @param stats Pointer to the statistics to fill
+ */
+void forecast_get_stats(struct forecast_t *forecast, struct forecast_stats *stats)
+{
+  pthread_mutex_lock(&forecast->mutex);
+  *stats = forecast->stats;
+  pthread_mutex_unlock(&forecast->mutex);
+}
+
+/**
+ * @brief Destroys a forecast
+ *
+ * @param forecast Double pointer to the forecast to destroy
+ */
+void destroy_forecast(struct forecast_t **forecast)
+{
+  if (*forecast == NULL)
+    return;
+  free((*forecast)->samples);
+  pthread_mutex_destroy(&(*forecast)->mutex);
+  free(*forecast);
+  *forecast = NULL;
+}
@@ -0,0 +1,182 @@
+/**
+ * @file forecast.h
+ * @brief A signal quality history and a predictor of the next good transmit time
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This header file provides a fixed-size time series of +CSQ / service samples and a
+ * lightweight predictor on top of it. The samples are resampled onto a grid of bin_ms
+ * bins (a value holds until the next report, like +CIEV does), then
+ *
+ * - the level and trend come from a least squares fit over the last FORECAST_TREND_BINS,
+ * - the periodicity of the satellite passes comes from the autocorrelation of the grid
+ *   over lags FORECAST_LAG_MIN_MS to FORECAST_LAG_MAX_MS,
+ * - the predicted signal k bins ahead blends the damped trend and the value one period
+ *   back, weighted by the autocorrelation,
+ * - the probability of a successful session at a signal level is learned from the
+ *   session outcomes, starting from a prior.
+ *
+ * forecast_predict() scans the horizon and returns the earliest start whose probability
+ * is within FORECAST_SLACK of the best one, so a brief dropout is waited out while a
+ * flat or falling signal sends right away.
+ *
+ * All operations are serialized with an internal mutex.
+ *
+ * Usage example:
+ * @code
+ * struct forecast_t *forecast = newForecast(256, 30000);
+ * forecast_sample(forecast, now_ms, csq, 1);
+ * struct forecast_estimate estimate;
+ * if (forecast_predict(forecast, now_ms, 600000, &estimate) == 0 && estimate.delay_ms > 0)
+ *   wait(estimate.delay_ms);
+ * forecast_session(forecast, csq, success);
+ * destroy_forecast(&forecast);
+ * @endcode
+ */
+
+#ifndef FORECAST_H_INCLUDED
+#define FORECAST_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define FORECAST_LEVELS 6                /**< +CSQ 0 to 5 */
+#define FORECAST_GRID 96                 /**< Bins of history the predictor looks at */
+#define FORECAST_TREND_BINS 10           /**< Bins of the trend fit */
+#define FORECAST_LAG_MIN_MS 180000       /**< Shortest pass period considered */
+#define FORECAST_LAG_MAX_MS 1200000      /**< Longest pass period considered */
+#define FORECAST_PERIODIC 0.3f           /**< Autocorrelation that counts as periodic */
+#define FORECAST_SLACK 0.05f             /**< Earlier start accepted this close to the best */
+
+/**
+ * @brief A signal sample
+ */
+struct forecast_sample
+{
+  uint32_t time_ms;              /**< Driver clock */
+  uint8_t csq;                   /**< +CSQ 0-5 */
+  uint8_t service;               /**< Network service available */
+};
+
+/**
+ * @brief Forecast statistics
+ */
+struct forecast_stats
+{
+  uint32_t samples;              /**< Samples recorded */
+  uint32_t sessions;             /**< Session outcomes recorded */
+  uint32_t successes;
+  uint32_t predictions;          /**< forecast_predict() calls with data */
+  uint32_t deferred;             /**< Predictions that advised to wait */
+};
+
+/**
+ * @brief A prediction
+ */
+struct forecast_estimate
+{
+  uint32_t delay_ms;             /**< Best time to start a session, from now */
+  float probability;             /**< Session success probability at delay_ms */
+  float probability_now;         /**< Session success probability right now */
+  float csq_now;                 /**< Current signal level */
+  float trend;                   /**< Signal change per minute */
+  uint32_t period_ms;            /**< Pass period, 0 when none was found */
+  float periodicity;             /**< Autocorrelation at period_ms */
+  uint32_t outage_ms;            /**< Time without signal, 0 with signal */
+  size_t samples;                /**< Samples in the history */
+};
+
+/**
+ * @brief Main forecast structure
+ */
+struct forecast_t
+{
+  struct forecast_sample *samples;         /**< Sample ring, capacity entries */
+  size_t capacity;
+  size_t head;                             /**< Index of the oldest sample */
+  size_t count;
+  uint32_t bin_ms;                         /**< Grid resolution */
+  uint32_t attempts[FORECAST_LEVELS];      /**< Sessions per signal level */
+  uint32_t successes[FORECAST_LEVELS];
+  float grid[FORECAST_GRID];               /**< Resampled history, scratch of forecast_predict() */
+  struct forecast_stats stats;             /**< Statistics */
+  pthread_mutex_t mutex;                   /**< Serializes every operation */
+};
+
+/**
+ * @brief Creates a new empty forecast
+ *
+ * @param capacity Number of samples kept, the oldest is overwritten
+ * @param bin_ms Grid resolution, FORECAST_GRID bins of it are looked at
+ * @return Pointer to the newly created forecast, or NULL if allocation failed
+ *
+ * @note The caller is responsible for destroying the forecast
+ */
+struct forecast_t *newForecast(size_t capacity, uint32_t bin_ms);
+
+/**
+ * @brief Records a signal sample
+ *
+ * @param forecast Pointer to the forecast
+ * @param now_ms The time of the sample
+ * @param csq The +CSQ value, clamped to 0-5
+ * @param service Network service available, no service counts as no signal
+ */
+void forecast_sample(struct forecast_t *forecast, uint32_t now_ms, int csq, int service);
+
+/**
+ * @brief Records the outcome of a session
+ *
+ * @param forecast Pointer to the forecast
+ * @param csq The signal when the session started
+ * @param success Non-zero if the MO message went through
+ */
+void forecast_session(struct forecast_t *forecast, int csq, int success);
+
+/**
+ * @brief The success probability of a session at a signal level
+ *
+ * @param forecast Pointer to the forecast
+ * @param csq The signal, fractions interpolate
+ * @return The probability, the prior blended with the recorded outcomes
+ */
+float forecast_probability(struct forecast_t *forecast, float csq);
+
+/**
+ * @brief Predicts the best time to start a session within a horizon
+ *
+ * @param forecast Pointer to the forecast
+ * @param now_ms The current time
+ * @param horizon_ms The longest acceptable wait
+ * @param estimate Pointer to the estimate to fill
+ * @return 0 on success, -1 if there are no samples
+ */
+int forecast_predict(struct forecast_t *forecast, uint32_t now_ms, uint32_t horizon_ms, struct forecast_estimate *estimate);
+
+/**
+ * @brief Copies the forecast statistics
+ *
+ * @param forecast Pointer to the forecast
+ * @param stats Pointer to the statistics to fill
+ */
+void forecast_get_stats(struct forecast_t *forecast, struct forecast_stats *stats);
+
+/**
+ * @brief Destroys a forecast
+ *
+ * @param forecast Double pointer to the forecast to destroy
+ */
+void destroy_forecast(struct forecast_t **forecast);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FORECAST_H_INCLUDED */
@@ -0,0 +1,82 @@
+/**
+ * @file histogram.c
+ * @brief Implementation of the fixed-bucket histogram
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This file contains the implementation of the histogram declared in histogram.h.
+ * The bounds cover a short AT command (tens of ms) up to a full +SBDIX session.
+ */
+
+#include "histogram.h"
+
+const uint32_t histogram_bounds[HISTOGRAM_BUCKETS - 1] = {
+  50, 100, 250, 500, 1000, 2500, 5000, 10000, 20000, 30000, 60000
+};
+
+/**
+ * @brief Clears all counters of a histogram
+ *
+ * @param histogram Pointer to the histogram
+ */
+void histogram_reset(struct histogram_t *histogram)
+{
+  memset(histogram, 0, sizeof *histogram);
+}
+
+/**
+ * @brief Records a value in its bucket
+ *
+ * @param histogram Pointer to the histogram
+ * @param value The value to record
+ *
+ * @note The sum saturates instead of wrapping
+ */
+void histogram_record(struct histogram_t *histogram, uint32_t value)
+{
+  int bucket = 0;
+  while (bucket < HISTOGRAM_BUCKETS - 1 && value > histogram_bounds[bucket])
+    bucket++;
+  histogram->buckets[bucket]++;
+
+  if (histogram->count == 0 || value < histogram->min)
+    histogram->min = value;
+  if (value > histogram->max)
+    histogram->max = value;
+  histogram->count++;
+  histogram->sum = (histogram->sum > UINT32_MAX - value) ? UINT32_MAX : histogram->sum + value;
+}
+
+/**
+ * @brief Approximates a percentile of the recorded values
+ *
+ * @param histogram Pointer to the histogram
+ * @param percentile The percentile, 0 to 100
+ * @return The upper bound of the bucket holding the percentile, the maximum for the
+ *         last bucket, or 0 if nothing was recorded
+ *
+ * @note The bound is clamped to the recorded maximum
+ */
+uint32_t histogram_percentile(const struct histogram_t *histogram, int percentile)
+{
+  if (histogram->count == 0)
+    return 0;
+  if (percentile < 0)
+    percentile = 0;
+  if (percentile > 100)
+    percentile = 100;
+
+  /* rank of the value, rounded up so p100 is the last value */
+  uint32_t rank = (uint32_t)(((uint64_t)histogram->count * percentile + 99) / 100);
+  if (rank == 0)
+    rank = 1;
+
+  uint32_t seen = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS - 1; i++)
+  {
+    seen += histogram->buckets[i];
+    if (seen >= rank)
+      return histogram_bounds[i] < histogram->max ? histogram_bounds[i] : histogram->max;
+  }
+  return histogram->max;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file histogram.h
+ * @brief A fixed-bucket histogram for latency measurements
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This header file provides a histogram with a fixed set of bucket bounds shared by
+ * every instance. Recording a value is a short linear scan over the bounds and a few
+ * counter updates, with no allocation and no floating point, so it is cheap enough to
+ * leave enabled in production builds. Percentiles are approximated by the upper bound
+ * of the bucket they fall in.
+ *
+ * The histogram is not synchronized, the owner serializes access.
+ *
+ * Usage example:
+ * @code
+ * struct histogram_t h;
+ * histogram_reset(&h);
+ * histogram_record(&h, 420);
+ * histogram_percentile(&h, 50);  // returns 500
+ * @endcode
+ */
+
+#ifndef HISTOGRAM_H_INCLUDED
+#define HISTOGRAM_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+#include <stdint.h>
+
+/**
+ * @brief Number of buckets, the last one has no upper bound
+ */
+#define HISTOGRAM_BUCKETS 12
+
+/**
+ * @brief Upper bounds (inclusive) of every bucket but the last, in ms
+ */
+extern const uint32_t histogram_bounds[HISTOGRAM_BUCKETS - 1];
+
+/**
+ * @brief Histogram structure
+ */
+struct histogram_t
+{
+  uint32_t buckets[HISTOGRAM_BUCKETS];  /**< Count per bucket */
+  uint32_t count;                       /**< Number of recorded values */
+  uint32_t sum;                         /**< Sum of the recorded values */
+  uint32_t min;                         /**< Smallest recorded value */
+  uint32_t max;                         /**< Largest recorded value */
+};
+
+/**
+ * @brief Clears all counters of a histogram
+ *
+ * @param histogram Pointer to the histogram
+ */
+void histogram_reset(struct histogram_t *histogram);
+
+/**
+ * @brief Records a value in its bucket
+ *
+ * @param histogram Pointer to the histogram
+ * @param value The value to record
+ */
+void histogram_record(struct histogram_t *histogram, uint32_t value);
+
+/**
+ * @brief Approximates a percentile of the recorded values
+ *
+ * @param histogram Pointer to the histogram
+ * @param percentile The percentile, 0 to 100
+ * @return The upper bound of the bucket holding the percentile, the maximum for the
+ *         last bucket, or 0 if nothing was recorded
+ */
+uint32_t histogram_percentile(const struct histogram_t *histogram, int percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HISTOGRAM_H_INCLUDED */
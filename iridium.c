@@ -2,162 +2,453 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <limits.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "iridium.h"
 
 static const char *TAG_IRIDIUM = "esp32_iridium";
 
+_Static_assert(IRI_UART_RX_BUF_SIZE > 128, "uart RX buffer must exceed the hardware FIFO");
+_Static_assert((IRI_TRACE_DEPTH & (IRI_TRACE_DEPTH - 1)) == 0, "trace depth must be a power of two");
+
+/*
+    Driver clock, every timestamp, sleep and timeout goes through satcom->clock
+*/
+static uint64_t iridium_system_now_us(const struct vclock_t *clock) {
+    (void)clock;
+    return (uint64_t)esp_timer_get_time();
+}
+
+static void iridium_system_sleep_us(const struct vclock_t *clock, uint64_t us) {
+    (void)clock;
+    vTaskDelay(pdMS_TO_TICKS(us / 1000));
+}
+
+static void iridium_system_wait_us(const struct vclock_t *clock, pthread_cond_t *cond, pthread_mutex_t *mutex, uint64_t us) {
+    (void)clock;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += us / 1000000;
+    ts.tv_nsec += (long)(us % 1000000) * 1000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(cond, mutex, &ts);
+}
+
+static const struct vclock_t iridium_system_clock = {
+    .now_us = iridium_system_now_us,
+    .sleep_us = iridium_system_sleep_us,
+    .wait_us = iridium_system_wait_us,
+};
+
+static const struct vclock_t *iridium_clock(iridium_t *satcom) {
+    return satcom->clock != NULL ? satcom->clock : &iridium_system_clock;
+}
+
+/**
+ * @brief The driver time base in ms, for timeouts and queue wait times.
+ * @param satcom the iridium_t struct pointer.
+ * @return the time in ms, wraps after ~49 days.
+ */
+static uint32_t iridium_now_ms(iridium_t *satcom) {
+    const struct vclock_t *clock = iridium_clock(satcom);
+    return (uint32_t)(clock->now_us(clock) / 1000);
+}
+
+/**
+ * @brief Block the calling task on the driver clock.
+ * @param satcom the iridium_t struct pointer.
+ * @param ms the time to sleep.
+ */
+static void iridium_sleep_ms(iridium_t *satcom, uint32_t ms) {
+    const struct vclock_t *clock = iridium_clock(satcom);
+    clock->sleep_us(clock, (uint64_t)ms * 1000);
+}
+
+/* compiled out above IRI_TRACE_LEVEL, never formats or blocks */
+#define IRI_TRACE(level, satcom, event, nonce, arg, data, length) \
+    do { \
+        if ((level) <= IRI_TRACE_LEVEL) { \
+            trace_record(&(satcom)->trace, (uint32_t)iridium_clock(satcom)->now_us(iridium_clock(satcom)), (event), (nonce), (arg), (data), (length)); \
+        } \
+    } while (0)
+
+/**
+ * @brief Record UART bytes into the capture, if one is still set once p_capture_mutex is held.
+ * @param satcom the iridium_t struct pointer.
+ * @param direction CAPTURE_TX or CAPTURE_RX.
+ * @param data the bytes.
+ * @param length the number of bytes.
+ */
+static void iridium_capture_record(iridium_t *satcom, uint8_t direction, const void *data, size_t length) {
+    pthread_mutex_lock(&satcom->p_capture_mutex);
+    struct capture_t *capture = satcom->capture;
+    if (capture != NULL) {
+        capture_record(capture, (uint32_t)iridium_clock(satcom)->now_us(iridium_clock(satcom)), direction, data, length);
+    }
+    pthread_mutex_unlock(&satcom->p_capture_mutex);
+}
+
+/* capture of the raw UART traffic, one atomic load when off */
+#define IRI_CAPTURE(satcom, direction, data, length) \
+    do { \
+        if (__atomic_load_n(&(satcom)->capture, __ATOMIC_RELAXED) != NULL) { \
+            iridium_capture_record((satcom), (direction), (data), (length)); \
+        } \
+    } while (0)
+
 /*
     Helper Iridium Functions 
 */
 bool startsWith(const char *pre, const char *str)
 {
-    size_t lenpre = strlen(pre),
-           lenstr = strlen(str);
-    return lenstr < lenpre ? false : memcmp(pre, str, lenpre) == 0;
+    return strncmp(pre, str, strlen(pre)) == 0;
 }
 
-char** str_split(char* a_str, char a_delim)
-{
-    char** result    = 0;
-    size_t count     = 0;
-    char* tmp        = a_str;
-    char* last_comma = 0;
-    char delim[2];
-    delim[0] = a_delim;
-    delim[1] = 0;
+/* prefix test against a string literal, the length is a compile-time constant */
+#define IRI_HAS_PREFIX(line, literal) (strncmp((line), (literal), sizeof(literal) - 1) == 0)
 
-    /* Count how many elements will be extracted. */
-    while (*tmp)
-    {
-        if (a_delim == *tmp)
-        {
-            count++;
-            last_comma = tmp;
+/**
+ * @brief the wire format of a command, resolved at compile time.
+ */
+typedef struct iridium_command_def {
+    const char *wire;               // "AT+CSQ\r", or the part before the argument ("AT+SBDWT=")
+    uint16_t wire_length;
+    uint16_t argument_max;          // longest argument, 0 = the command takes none
+    const char *prefix;             // expected response prefix ("+CSQ"), NULL for any data line
+    uint16_t prefix_length;
+} iridium_command_def_t;
+
+#define IRI_WIRE(text)              (text), (uint16_t)(sizeof(text) - 1)
+#define IRI_WIRE_ARG(text)          IRI_WIRE(text), (uint16_t)(IRI_CMD_MAX - (sizeof(text) - 1) - 2)
+#define IRI_PREFIX(text)            (text), (uint16_t)(sizeof(text) - 1)
+#define IRI_ANY_DATA                NULL, 0
+
+static const iridium_command_def_t iridium_commands[IRI_COMMAND_COUNT] = {
+    [AT]            = { IRI_WIRE("AT\r"), 0, IRI_ANY_DATA },
+    [AT_CSQ]        = { IRI_WIRE("AT+CSQ\r"), 0, IRI_PREFIX("+CSQ") },
+    [AT_SBDSX]      = { IRI_WIRE("AT+SBDSX\r"), 0, IRI_PREFIX("+SBDSX") },
+    [AT_CGMI]       = { IRI_WIRE("AT+CGMI\r"), 0, IRI_ANY_DATA },
+    [AT_CGMM]       = { IRI_WIRE("AT+CGMM\r"), 0, IRI_ANY_DATA },
+    [AT_SBDRT]      = { IRI_WIRE("AT+SBDRT\r"), 0, IRI_PREFIX("+SBDRT") },
+    [AT_SBDWT]      = { IRI_WIRE("AT+SBDWT="), IRI_SBD_TEXT_MAX, IRI_ANY_DATA },
+    [AT_SBDIX]      = { IRI_WIRE("AT+SBDIX\r"), 0, IRI_PREFIX("+SBDIX") },
+    [AT_MSSTM]      = { IRI_WIRE("AT-MSSTM\r"), 0, IRI_PREFIX("-MSSTM") },
+    [AT_SBDMTA]     = { IRI_WIRE_ARG("AT+SBDMTA="), IRI_ANY_DATA },
+    [AT_W0]         = { IRI_WIRE("AT&w0\r"), 0, IRI_ANY_DATA },
+    [AT_CRIS]       = { IRI_WIRE("AT+CRIS\r"), 0, IRI_PREFIX("+CRIS") },
+    [AT_SBDIXA]     = { IRI_WIRE("AT+SBDIXA\r"), 0, IRI_PREFIX("+SBDIX") },
+    [AT_K0]         = { IRI_WIRE("AT&K0\r"), 0, IRI_ANY_DATA },
+    [AT_SBDMTAQ]    = { IRI_WIRE("AT+SBDMTA?\r"), 0, IRI_PREFIX("+SBDMTA") },
+    [AT_CIER]       = { IRI_WIRE_ARG("AT+CIER="), IRI_ANY_DATA },
+    [AT_SBDWB]      = { IRI_WIRE_ARG("AT+SBDWB="), IRI_ANY_DATA },
+    [AT_E]          = { IRI_WIRE_ARG("ATE"), IRI_ANY_DATA },
+    [AT_SBDD]       = { IRI_WIRE_ARG("AT+SBDD"), IRI_ANY_DATA },
+};
+
+/* the longest command, its "\r" and terminator fit the echo and the queued message */
+_Static_assert(sizeof("AT+SBDWT=") - 1 + IRI_SBD_TEXT_MAX + 2 <= IRI_CMD_MAX, "IRI_CMD_MAX too small for +SBDWT");
+
+/**
+ * @brief Find the command of an echo line ("AT+SBDWT=hello" is AT_SBDWT).
+ * @param echo the command as echoed by the modem, without "\r".
+ * @return the iridium_command_t or -2 when it is none of them.
+ */
+static int iridium_command_match(const char *echo) {
+    for (int command = 0; command < IRI_COMMAND_COUNT; command++) {
+        const iridium_command_def_t *def = &iridium_commands[command];
+        if (def->argument_max > 0) {
+            if (strncmp(echo, def->wire, def->wire_length) == 0) {
+                return command;
+            }
+        } else if (strncmp(echo, def->wire, def->wire_length - 1) == 0 && echo[def->wire_length - 1] == '\0') {
+            /* the whole command, "AT+SBDIX" is not "AT+SBDIXA" */
+            return command;
         }
-        tmp++;
     }
+    return -2;
+}
 
-    /* Add space for trailing token. */
-    count += last_comma < (a_str + strlen(a_str) - 1);
-
-    /* Add space for terminating null string so caller
-       knows where the list of returned strings ends. */
-    count++;
-
-    result = malloc(sizeof(char*) * count);
+/**
+ * @brief Read the comma separated numbers after the ':' of a response ("+SBDIX: 0, 12, 1, 3, 22, 0").
+ * @param data the response line.
+ * @param values the numbers read.
+ * @param count the numbers expected.
+ * @return the numbers read, less than count when the line is short.
+ */
+static int iridium_parse_values(const char *data, int *values, int count) {
+    const char *cursor = strchr(data, ':');
+    if (cursor == NULL) {
+        return 0;
+    }
+    cursor++;
+    for (int i = 0; i < count; i++) {
+        char *end;
+        long value = strtol(cursor, &end, 10);
+        if (end == cursor) {
+            return i;
+        }
+        values[i] = (int)value;
+        cursor = end;
+        while (*cursor == ' ') {
+            cursor++;
+        }
+        if (*cursor == ',') {
+            cursor++;
+        }
+    }
+    return count;
+}
 
-    if (result)
-    {
-        size_t idx  = 0;
-        char* token = strtok(a_str, delim);
+/**
+ * @brief Reset a result to an empty, not yet completed state.
+ * @param result the iridium_result_t to reset.
+ */
+static void iridium_result_reset(iridium_result_t *result) {
+    memset(result, 0, sizeof(iridium_result_t));
+    result->status = SAT_ERROR;
+    result->error = IRI_ERR_NONE;
+    result->mo_status = -1;
+    result->mt_status = -1;
+}
 
-        while (token)
-        {
-            assert(idx < count);
-            *(result + idx++) = strdup(token);
-            token = strtok(0, delim);
-        }
-        assert(idx == count - 1);
-        *(result + idx) = 0;
+/**
+ * @brief Copy response text into a caller buffer, what fits of it.
+ * @param buffer the buffer, always terminated unless size is 0.
+ * @param size the buffer size.
+ * @param text the response text.
+ * @param length the response text length.
+ */
+static void iridium_copy_text(char *buffer, size_t size, const char *text, size_t length) {
+    if (size == 0) {
+        return;
     }
+    size_t copied = length < size ? length : size - 1;
+    memcpy(buffer, text, copied);
+    buffer[copied] = '\0';
+}
 
-    return result;
+/**
+ * @brief Convert a -MSSTM tick count to UTC.
+ * @param ticks the 90 ms tick count.
+ * @return the UTC time in ms since the Unix epoch.
+ * @note the 32 bit count wraps after ~12 years, Iridium moves the epoch (IRI_MSSTM_EPOCH_MS) before that.
+ */
+uint64_t iridium_msstm_to_utc_ms(uint32_t ticks) {
+    return IRI_MSSTM_EPOCH_MS + (uint64_t)ticks * IRI_MSSTM_TICK_MS;
 }
 
 /**
- * @brief Process data returned to device from UART bus. 
+ * @brief Sync the clock offset to a -MSSTM answer of the outstanding command.
  * @param satcom the iridium_t struct pointer.
- * @param command the AT command being processed.
- * @param data the data returned to be parsed into iridium_t struct.
- * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ * @param ticks the 90 ms tick count.
  */
-iridium_status_t iridium_satcom_process_result(iridium_t *satcom, char *command, char *data) {
-    if (strcmp ("AT", command) == 0) { return SAT_OK; }
-    if (strcmp ("AT&K0", command) == 0) { return SAT_OK; }
-    if (strcmp ("AT&w0", command) == 0) { return SAT_OK; }
-    if (strcmp ("AT&K0", command) == 0) { return SAT_OK; }
-    if (startsWith("AT+SBDMTA", command)) { return SAT_OK; }
-
-    if (strcmp ("AT+CGMI", command) == 0) {
-        strcpy(satcom->manufacturer_identification, data);
-        satcom->callback(satcom, AT_CGMI, SAT_OK);
-        return SAT_OK;
-    } 
-
-    if (strcmp ("AT+CGMM", command) == 0) {
-        strcpy(satcom->model_identification, data);
-        satcom->callback(satcom, AT_CGMM, SAT_OK);
-        return SAT_OK;
-    } 
+static void iridium_time_update(iridium_t *satcom, uint32_t ticks) {
+    const struct vclock_t *clock = iridium_clock(satcom);
+    uint64_t now_us = clock->now_us(clock);
+
+    /* the modem read its clock somewhere between the write and the answer, take the middle */
+    uint32_t latency_ms = iridium_now_ms(satcom) - satcom->pending.sent_ms;
+    uint64_t local_us = now_us - (uint64_t)latency_ms * 1000 / 2;
+    uint64_t utc_ms = iridium_msstm_to_utc_ms(ticks);
+
+    /* time shares the metrics lock, both are cheap snapshots */
+    pthread_mutex_lock(&satcom->p_metrics_mutex);
+    iridium_time_t *time = &satcom->time;
+    if (time->valid && local_us - time->local_us >= 600ULL * 1000000) {
+        /* a 90 ms tick over at least 10 minutes keeps the estimate within 150 ppm */
+        int64_t local_elapsed_us = (int64_t)(local_us - time->local_us);
+        int64_t utc_elapsed_us = (int64_t)(utc_ms - time->utc_ms) * 1000;
+        time->drift_ppm = (int32_t)((utc_elapsed_us - local_elapsed_us) * 1000000 / local_elapsed_us);
+    }
+    time->valid = 1;
+    time->ticks = ticks;
+    time->utc_ms = utc_ms;
+    time->local_us = local_us;
+    time->syncs++;
+    pthread_mutex_unlock(&satcom->p_metrics_mutex);
+}
 
-    if (strcmp ("AT+CSQ", command) == 0) {
-        char** tokens = str_split(data, ':');
-     
-        satcom->signal_strength = atoi(*(tokens + 1));
-        satcom->callback(satcom, AT_CSQ, SAT_OK);
+/**
+ * @brief Record the current signal in the forecast history.
+ * @param satcom the iridium_t struct pointer.
+ */
+static void iridium_forecast_sample(iridium_t *satcom) {
+    if (satcom->forecast == NULL) {
+        return;
+    }
+    /* +CIEV service 0 means no signal whatever +CSQ said, never set without indicators */
+    int service = satcom->indicators_enabled == 1 ? satcom->service_available : 1;
+    forecast_sample(satcom->forecast, iridium_now_ms(satcom), satcom->signal_strength, service);
+}
 
-        free(tokens);
-        return SAT_OK;
+/**
+ * @brief Hand an MT message to the application through the message queue.
+ * @param ctx the iridium_t struct pointer.
+ * @param item the iridium_message_t.
+ */
+static void iridium_mt_deliver(void *ctx, const void *item) {
+    iridium_t *satcom = (iridium_t *)ctx;
+    const iridium_message_t *msg = (const iridium_message_t *)item;
+
+    /* end-to-end acknowledgements are consumed here, never queued as messages */
+    if (satcom->reliable != NULL && IRI_HAS_PREFIX(msg->data, RELIABLE_ACK_PREFIX) && 
+        reliable_ack(satcom->reliable, msg->data, iridium_now_ms(satcom)) >= 0) {
+        return;
     }
+    xQueueSend(satcom->message_queue, (void *)msg, 10);
+}
 
-    if (strcmp ("AT+SBDSX", command) == 0) {
-        char** tokens = str_split(data, ':');
-        char** results = str_split(*(tokens + 1), ',');
-     
-        satcom->status_outbound = atoi(*(results));
-        satcom->sequence_outbound = atoi(*(results + 1));
-        satcom->status_inbound = atoi(*(results + 2));
-        satcom->sequence_inbound = atoi(*(results + 3));
-        satcom->bytes_received = atoi(*(results + 4));
-        satcom->messages_waiting = atoi(*(results + 5));
-        satcom->callback(satcom, AT_SBDSX, SAT_OK);
-
-        free(tokens);
-        free(results);
-        return SAT_OK;
+/**
+ * @brief Pass a read MT message through the MTMSN window, duplicates stop here.
+ * @param satcom the iridium_t struct pointer.
+ * @param msg the iridium_message_t with its mtmsn.
+ */
+static void iridium_mt_receive(iridium_t *satcom, const iridium_message_t *msg) {
+    if (satcom->mt_sequence == NULL || msg->mtmsn < 0) {
+        iridium_mt_deliver(satcom, msg);
+        return;
     }
+    if (sequence_push(satcom->mt_sequence, (uint16_t)msg->mtmsn, msg, iridium_now_ms(satcom), 
+                      &iridium_mt_deliver, satcom) == SEQUENCE_DUPLICATE) {
+        ESP_LOGI(TAG_IRIDIUM, "MT_DUPLICATE[%d]", msg->mtmsn);
+    }
+}
 
-    if (strcmp ("AT+SBDIX", command) == 0 || strcmp ("AT+SBDIXA", command) == 0) {
-        char** tokens = str_split(data, ':');
-        char** results = str_split(*(tokens + 1), ',');
-     
-        satcom->status_outbound = atoi(*(results));
-        satcom->sequence_outbound = atoi(*(results + 1));
-        satcom->status_inbound = atoi(*(results + 2));
-        satcom->sequence_inbound = atoi(*(results + 3));
-        satcom->bytes_received = atoi(*(results + 4));
-        satcom->messages_waiting = atoi(*(results + 5));
-        satcom->callback(satcom, AT_SBDSX, SAT_OK);
-
-        free(tokens);
-        free(results);
-        return SAT_OK;
+/**
+ * @brief Set the +CGMI or +CGMM identification string.
+ * @param satcom the iridium_t struct pointer.
+ * @param command AT_CGMI or AT_CGMM.
+ * @param text the identification.
+ * @return SAT_OK, SAT_ERROR when it is longer than IRI_ID_MAX - 1 and was cut.
+ */
+static iridium_status_t iridium_identity_set(iridium_t *satcom, iridium_command_t command, const char *text) {
+    char *field = command == AT_CGMI ? satcom->manufacturer_identification : satcom->model_identification;
+    size_t length = strnlen(text, IRI_ID_MAX);
+    if (length >= IRI_ID_MAX) {
+        ESP_LOGW(TAG_IRIDIUM, "IDENTITY_CUT[%d] longer than %d bytes", (int)command, IRI_ID_MAX - 1);
+        length = IRI_ID_MAX - 1;
     }
+    memcpy(field, text, length);
+    field[length] = '\0';
+    return length == strlen(text) ? SAT_OK : SAT_ERROR;
+}
+
+/**
+ * @brief Process the response data of a completed command.
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium_command_t the data belongs to.
+ * @param data the response data collected for the command.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+static iridium_status_t iridium_process_response(iridium_t *satcom, iridium_command_t command, const char *data) {
+    int values[6];
+
+    switch (command) {
+        case AT:
+        case AT_K0:
+        case AT_W0:
+        case AT_SBDMTA:
+        case AT_CIER:
+        case AT_E:
+        case AT_SBDWT:
+        case AT_SBDMTAQ:
+            return SAT_OK;
 
-    if (strcmp ("AT+SBDRT", command) == 0) {
-        char** tokens = str_split(data, '+');
+        case AT_SBDD:
+            return atoi(data) == 0 ? SAT_OK : SAT_ERROR;
 
-        iridium_message_t msg;
-        strcpy(msg.data, *(tokens));
-        msg.size = strlen(*(tokens));
-        xQueueSend(satcom->message_queue, (void *)&msg, 10);
+        case AT_CGMI:
+        case AT_CGMM:
+            /* the answer is complete either way, the whole text is in the result */
+            iridium_identity_set(satcom, command, data);
+            satcom->callback(satcom, command, SAT_OK);
+            return SAT_OK;
 
-        free(tokens);
-        return SAT_OK;
-    }
+        case AT_CSQ:
+            if (iridium_parse_values(data, values, 1) != 1) {
+                return SAT_ERROR;
+            }
+            satcom->signal_strength = values[0];
+            iridium_forecast_sample(satcom);
+            satcom->callback(satcom, AT_CSQ, SAT_OK);
+            return SAT_OK;
 
-    if (strcmp ("AT+CRIS", command) == 0) {
-        char** tokens = str_split(data, ':');
-        char** results = str_split(*(tokens + 1), ',');
+        case AT_SBDSX:
+        case AT_SBDIX:
+        case AT_SBDIXA:
+            /* +SBDIX: <MO status>, <MOMSN>, <MT status>, <MTMSN>, <MT length>, <MT queued>, +SBDSX alike */
+            if (iridium_parse_values(data, values, 6) != 6) {
+                return SAT_ERROR;
+            }
+            satcom->status_outbound = values[0];
+            satcom->sequence_outbound = values[1];
+            satcom->status_inbound = values[2];
+            satcom->sequence_inbound = values[3];
+            satcom->bytes_received = values[4];
+            satcom->messages_waiting = values[5];
+            /* the MT buffer now holds this MTMSN until the next message replaces it */
+            if (command != AT_SBDSX && satcom->status_inbound == MT_SBD_MESSAGE_SUCCESSFULLY_RECEIVED) {
+                satcom->mt_msn = satcom->sequence_inbound;
+            }
+            satcom->callback(satcom, AT_SBDSX, SAT_OK);
+            return SAT_OK;
+
+        case AT_SBDRT: {
+            /* +SBDRT:<message>, lines are collected in order */
+            const char *payload = IRI_HAS_PREFIX(data, "+SBDRT:") ? data + 7 : data;
+
+            iridium_message_t msg;
+            memset(&msg, 0, sizeof(msg));
+            snprintf(msg.data, sizeof(msg.data), "%s", payload);
+            msg.size = strlen(msg.data);
+            msg.mtmsn = satcom->mt_msn;
+            iridium_mt_receive(satcom, &msg);
+            return SAT_OK;
+        }
 
-        free(tokens);
-        free(results);
-        return SAT_OK;
+        case AT_SBDWB:
+            /* 0 = written, 1 = timeout, 2 = bad checksum, 3 = bad size */
+            satcom->sbdwb_status = atoi(data);
+            return satcom->sbdwb_status == 0 ? SAT_OK : SAT_ERROR;
+
+        case AT_MSSTM: {
+            /* -MSSTM:<hex tick count>, or "no network service" before the modem has seen a satellite */
+            const char *value = IRI_HAS_PREFIX(data, "-MSSTM:") ? data + 7 : data;
+            unsigned int ticks;
+            if (sscanf(value, " %x", &ticks) != 1) {
+                return SAT_ERROR;
+            }
+            iridium_time_update(satcom, (uint32_t)ticks);
+            return SAT_OK;
+        }
+
+        case AT_CRIS:
+            /* +CRIS: <tri>, <sri>, the ring indication is handled as the SBDRING URC */
+            return SAT_OK;
+
+        default:
+            return SAT_ERROR;
     }
+}
 
-    return SAT_ERROR;
+/**
+ * @brief Process data returned to device from UART bus. 
+ * @param satcom the iridium_t struct pointer.
+ * @param command the AT command being processed.
+ * @param data the data returned to be parsed into iridium_t struct.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_satcom_process_result(iridium_t *satcom, char *command, char *data) {
+    int match = iridium_command_match(command);
+    if (match < 0) {
+        return SAT_ERROR;
+    }
+    return iridium_process_response(satcom, (iridium_command_t)match, data);
 }
 
 /**
@@ -200,474 +491,2737 @@ iridium_queue_status_t iridium_get_iqs(iridium_t* satcom) {
 }
 
 /**
- * @brief Send data payload across the UART bus.
- * @param satcom the iridium_t struct pointer.
- * @param data the data to be sent. 
- * @param nonce the nonce used to track responses. 
- * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ * @brief The driver-side timeout of a command, the longest the modem may take.
+ * @param command the iridium modem AT command.
+ * @return the timeout in ms.
  */
-iridium_status_t iridium_send_raw(iridium_t* satcom, char *data, int nonce) {
-    if (satcom->status == IQS_WAITING) {
-        // send iridium_message_t to buffer queue
-        ESP_LOGI(TAG_IRIDIUM, "IN_BUFFER_QUEUE[%d] = %s", nonce, data);
-        iridium_message_t msg;
-        strcpy(msg.data, data);
-        msg.size = strlen(data);
-        msg.nonce = nonce;
-        xQueueSend(satcom->buffer_queue, (void *)&msg, 10);
-        return SAT_OK;  
-    }
-    ESP_LOGI(TAG_IRIDIUM, "SENT_TO_UART_1[%d] = %s", nonce, data);
-    /* transmit data via UART */
-    uart_write_bytes(satcom->uart_number, data, strlen(data));
-    /* update IQS */
-    iridium_update_iqs(satcom, IQS_WAITING);
-    iridium_update_p_nonce(satcom, nonce);
-    return SAT_OK;
+static int iridium_command_timeout_ms(iridium_command_t command) {
+    switch (command) {
+        case AT_SBDIX:
+        case AT_SBDIXA:
+        case AT_SBDWB:
+            return 60000;
+        case AT_CSQ:
+            return 10000;
+        default:
+            return 5000;
+    }
 }
 
+static void iridium_dispatch_next(iridium_t *satcom);
+static iridium_status_t iridium_power_wake(iridium_t *satcom);
+static iridium_status_t iridium_power_sleep(iridium_t *satcom, uint32_t idle_ms);
+static void iridium_time_piggyback(iridium_t *satcom);
+
 /**
- * @brief Enabled or disable the ring notification on the modem.  
+ * @brief Count UART traffic in the session metrics.
  * @param satcom the iridium_t struct pointer.
- * @param enabled the ring notification.
- * @return a iridium_result_t with metadata.
+ * @param tx bytes written.
+ * @param rx bytes read.
  */
-iridium_result_t iridium_config_ring(iridium_t *satcom, bool enabled) {
-    iridium_result_t result;
+static void iridium_metrics_bytes(iridium_t *satcom, size_t tx, size_t rx) {
+    pthread_mutex_lock(&satcom->p_metrics_mutex);
+    satcom->metrics.bytes_tx += tx;
+    satcom->metrics.bytes_rx += rx;
+    pthread_mutex_unlock(&satcom->p_metrics_mutex);
+}
 
-    /* enable/disable satcom ring */
-    if (enabled) {
-        result = iridium_send(satcom, AT_SBDMTA, "1", true, 500);
-        if (result.status != SAT_OK) {
-            return result;
-        }
-    } else {
-        result = iridium_send(satcom, AT_SBDMTA, "0", true, 500);
-        if (result.status != SAT_OK) {
-            return result;
+/**
+ * @brief Record a completed command in the session metrics.
+ * @param satcom the iridium_t struct pointer.
+ * @param command the completed iridium_command_t.
+ * @param error the completion iridium_error_t.
+ * @param mo_status the +SBDIX <MO status> or -1.
+ * @param latency_ms UART write to final result code.
+ */
+static void iridium_metrics_complete(iridium_t *satcom, iridium_command_t command, iridium_error_t error, 
+                                     int mo_status, uint32_t latency_ms) {
+    iridium_metrics_t *metrics = &satcom->metrics;
+    pthread_mutex_lock(&satcom->p_metrics_mutex);
+    if (command >= 0 && command < IRI_COMMAND_COUNT) {
+        if (error == IRI_ERR_NONE) {
+            histogram_record(&metrics->latency[command], latency_ms);
+        } else {
+            metrics->errors[command]++;
         }
     }
-    vTaskDelay(pdMS_TO_TICKS(IRI_BUFF_DELAY));
-
-    /* save config */
-    result = iridium_send(satcom, AT_W0, "", true, 500);
-    if (result.status != SAT_OK) {
-        return result;
+    if (mo_status >= 0 && mo_status < IRI_MO_STATUS_COUNT) {
+        metrics->sessions++;
+        metrics->session_mo[mo_status]++;
     }
-    vTaskDelay(pdMS_TO_TICKS(IRI_BUFF_DELAY));
-
-    /* turn off flow control */
-    result = iridium_send(satcom, AT_K0, "", true, 500);
-    if (result.status != SAT_OK) {
-        return result;
+    if (error == IRI_ERR_UART_OVERFLOW) {
+        metrics->uart_overflows++;
     }
-    vTaskDelay(pdMS_TO_TICKS(IRI_BUFF_DELAY));
+    pthread_mutex_unlock(&satcom->p_metrics_mutex);
+}
 
-    /* check ring status */
-    result = iridium_send(satcom, AT_SBDMTAQ, "", true, 500);
-    return result;
+/**
+ * @brief The commands whose cached answer goes stale when a command completes.
+ * @param command the completed iridium_command_t.
+ * @return a bit mask of iridium_command_t.
+ */
+static uint32_t iridium_cache_affected(iridium_command_t command) {
+    switch (command) {
+        case AT_SBDIX:
+        case AT_SBDIXA:
+        case AT_SBDWT:
+        case AT_SBDWB:
+        case AT_SBDD:       return 1u << AT_SBDSX;      // MO flag, MOMSN/MTMSN, MT waiting
+        case AT_SBDMTA:     return 1u << AT_SBDMTAQ;
+        default:            return 0;
+    }
 }
 
 /**
- * @brief Transmit a message to the iridium network.
+ * @brief Drop the cached answers of a set of commands.
  * @param satcom the iridium_t struct pointer.
- * @param message to be sent.
- * @return a iridium_result_t with metadata.
+ * @param mask a bit mask of iridium_command_t.
  */
-iridium_result_t iridium_tx_message(iridium_t *satcom, char *message) {
-    iridium_result_t result;
-    iridium_result_t r1 = iridium_send(satcom, AT_SBDWT, message, true, 500);
-
-    /* failed to set outbound message buffer */
-    if (r1.status != SAT_OK) {
-        result.status = SAT_ERROR;
-        return result;
+static void iridium_cache_drop(iridium_t *satcom, uint32_t mask) {
+    if (mask == 0) {
+        return;
     }
-
-    int delays[6] = {2000,4000,20000,30000,300000,300000};
-
-    /* short burst - send message - with adaptive retry */
-    for (int i = 0; i < 5; i++){
-        iridium_result_t r2 = iridium_send(satcom, AT_SBDIX, NULL, true, 500);
-        if (r2.status != SAT_OK) {
-            result.status = SAT_ERROR;
-            break;
+    pthread_mutex_lock(&satcom->p_cache_mutex);
+    for (int command = 0; command < IRI_COMMAND_COUNT; command++) {
+        if (mask & (1u << command)) {
+            /* a query in flight must not store an answer from before the event */
+            satcom->cache_epoch[command]++;
+        }
+    }
+    for (int i = 0; i < IRI_CACHE_SLOTS; i++) {
+        iridium_cache_entry_t *entry = &satcom->cache[i];
+        if (entry->valid && (mask & (1u << entry->command))) {
+            entry->valid = 0;
+            satcom->cache_stats.invalidated++;
         }
+    }
+    pthread_mutex_unlock(&satcom->p_cache_mutex);
+}
 
-        /* check short burst message returns */
-        if (satcom->status_outbound == MO_TRANSFERRED_SUCCESSFULLY ||
-            satcom->status_outbound == MO_TRANSFERRED_SUCCESSFULLY_TOO_BIG ||
-            satcom->status_outbound == MO_TRANSFERRED_SUCCESSFULLY_LOC_NOT_ACCEPTED) {
-            break;
-        } else {
-            result.status = SAT_ERROR;
+/**
+ * @brief Find the cached answer of a command, or a slot for it, caller holds p_cache_mutex.
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command.
+ * @param create evict the oldest expiring entry when no slot is free.
+ * @return the entry, NULL when not cached (or no slot).
+ */
+static iridium_cache_entry_t *iridium_cache_slot(iridium_t *satcom, iridium_command_t command, int create) {
+    iridium_cache_entry_t *free_entry = NULL;
+    iridium_cache_entry_t *oldest = NULL;
+    for (int i = 0; i < IRI_CACHE_SLOTS; i++) {
+        iridium_cache_entry_t *entry = &satcom->cache[i];
+        if (entry->valid && entry->command == command) {
+            return entry;
+        }
+        if (!entry->valid) {
+            if (free_entry == NULL) {
+                free_entry = entry;
+            }
+        } else if (satcom->cache_ttl_ms[entry->command] != IRI_CACHE_FOREVER && 
+                   (oldest == NULL || (int32_t)(entry->stored_ms - oldest->stored_ms) < 0)) {
+            oldest = entry;
         }
+    }
+    if (!create) {
+        return NULL;
+    }
+    if (free_entry != NULL) {
+        return free_entry;
+    }
+    if (oldest != NULL) {
+        oldest->valid = 0;
+        satcom->cache_stats.evicted++;
+    }
+    return oldest;
+}
 
-        vTaskDelay(pdMS_TO_TICKS(delays[i]));
-    } 
+/**
+ * @brief Store a successful answer, caller holds p_cache_mutex.
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command.
+ * @param result the response text.
+ * @param length the response text length.
+ * @return 1 when stored, 0 when the answer is longer than an entry holds.
+ */
+static int iridium_cache_store(iridium_t *satcom, iridium_command_t command, const char *result, size_t length) {
+    /* a cut answer would be served as the whole one */
+    if (length >= sizeof(((iridium_cache_entry_t *)0)->result)) {
+        return 0;
+    }
+    iridium_cache_entry_t *entry = iridium_cache_slot(satcom, command, 1);
+    if (entry == NULL) {
+        return 0;
+    }
+    entry->valid = 1;
+    entry->command = command;
+    entry->stored_ms = iridium_now_ms(satcom);
+    entry->length = length;
+    memcpy(entry->result, result, length + 1);
+    return 1;
+}
 
-    return result;
+static void iridium_cache_nvs_key(iridium_command_t command, char *key, size_t size) {
+    snprintf(key, size, "iri_q%02d", (int)command);
 }
 
-/*
-AT+SBDIX = +SBDIX:<MO status>,<MOMSN>,<MT status>,<MTMSN>,<MT length>,<MT queued>
-*/
-/** 
- * @brief Send AT command with data.  
+/**
+ * @brief Write or erase the NVS copy of a IRI_CACHE_FOREVER answer.
  * @param satcom the iridium_t struct pointer.
  * @param command the iridium modem AT command.
- * @param rdata the raw data. 
- * @param wait_response wait for a responce from the modem.
- * @param wait_interval the amount of time in ms for wait interval check.
- * @return a iridium_result_t with metadata.
+ * @param result the response text, NULL to erase.
  */
-iridium_result_t iridium_send(iridium_t* satcom, iridium_command_t command, char *rdata, bool wait_response, int wait_interval) {
-    iridium_result_t result;
+static void iridium_cache_persist(iridium_t *satcom, iridium_command_t command, const char *result) {
+    nvs_handle_t handle;
+    if (!satcom->cache_persist || nvs_open(IRI_CACHE_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    char key[16];
+    iridium_cache_nvs_key(command, key, sizeof(key));
+    esp_err_t err = result != NULL ? nvs_set_str(handle, key, result) : nvs_erase_key(handle, key);
+    if (err == ESP_OK && nvs_commit(handle) == ESP_OK && result != NULL) {
+        pthread_mutex_lock(&satcom->p_cache_mutex);
+        satcom->cache_stats.nvs_stored++;
+        pthread_mutex_unlock(&satcom->p_cache_mutex);
+    }
+    nvs_close(handle);
+}
 
-    /* increment c_nonce */
-    satcom->c_nonce++;
-    int t_nonce = satcom->c_nonce;
+/**
+ * @brief Restore the IRI_CACHE_FOREVER answers of the last boot, NVS must be initialized.
+ * @param satcom the iridium_t struct pointer.
+ */
+static void iridium_cache_load(iridium_t *satcom) {
+    nvs_handle_t handle;
+    if (!satcom->cache_persist || nvs_open(IRI_CACHE_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    for (int command = 0; command < IRI_COMMAND_COUNT; command++) {
+        char key[16];
+        char result[IRI_RESULT_MAX];
+        size_t length = sizeof(result);
+        iridium_cache_nvs_key(command, key, sizeof(key));
+        if (satcom->cache_ttl_ms[command] != IRI_CACHE_FOREVER || 
+            nvs_get_str(handle, key, result, &length) != ESP_OK) {
+            continue;
+        }
+        /* a hit must leave the fields the modem answer would have set, a cut identity is asked again */
+        if ((command == AT_CGMI || command == AT_CGMM) && 
+            iridium_identity_set(satcom, (iridium_command_t)command, result) != SAT_OK) {
+            continue;
+        }
+        pthread_mutex_lock(&satcom->p_cache_mutex);
+        iridium_cache_store(satcom, (iridium_command_t)command, result, strlen(result));
+        satcom->cache_stats.nvs_loaded++;
+        pthread_mutex_unlock(&satcom->p_cache_mutex);
+    }
+    nvs_close(handle);
+}
 
-    switch (command) {
-        case AT:
-            if (iridium_send_raw(satcom, "AT\r", t_nonce) != SAT_OK) {
-                result.status = SAT_ERROR;
-                return result;
-            }
-            break;
-        case AT_CSQ:
-            if (iridium_send_raw(satcom, "AT+CSQ\r", t_nonce) != SAT_OK) {
-                result.status = SAT_ERROR;
-                return result;
-            }
-            break;
-        case AT_CGMI:
-            if (iridium_send_raw(satcom, "AT+CGMI\r", t_nonce) != SAT_OK) {
-                result.status = SAT_ERROR;
-                return result;
-            }
-            break;
-        case AT_CGMM:
-            if (iridium_send_raw(satcom, "AT+CGMM\r", t_nonce) != SAT_OK) {
-                result.status = SAT_ERROR;
-                return result;
-            }
-            break;
-        case AT_SBDIX:
-            if (iridium_send_raw(satcom, "AT+SBDIX\r", t_nonce) != SAT_OK) {
-                result.status = SAT_ERROR;
-                return result;
-            }
-            break;
-        case AT_SBDSX:
-            if (iridium_send_raw(satcom, "AT+SBDSX\r", t_nonce) != SAT_OK) {
-                result.status = SAT_ERROR;
-                return result;
-            }
-            break;
-        case AT_MSSTM:
-            if (iridium_send_raw(satcom, "AT-MSSTM\r", t_nonce) != SAT_OK) {
-                result.status = SAT_ERROR;
-                return result;
-            }
-            break;
-        case AT_SBDRT:
-            if (iridium_send_raw(satcom, "AT+SBDRT\r", t_nonce) != SAT_OK) {
-                result.status = SAT_ERROR;
-                return result;
-            }
-            break;
-        case AT_CRIS:
-            if (iridium_send_raw(satcom, "AT+CRIS\r", t_nonce) != SAT_OK) {
-                result.status = SAT_ERROR;
-                return result;
-            }
-            break;
-         case AT_SBDIXA:
-            if (iridium_send_raw(satcom, "AT+SBDIXA\r", t_nonce) != SAT_OK) {
-                result.status = SAT_ERROR;
-                return result;
-            }
-            break;
-        case AT_SBDMTAQ:
-            if (iridium_send_raw(satcom, "AT+SBDMTA?\r", t_nonce) != SAT_OK) {
-                result.status = SAT_ERROR;
-                return result;
+static void iridium_reliable_nvs_key(size_t slot, char *key, size_t size) {
+    snprintf(key, size, "iri_rel%02u", (unsigned)slot);
+}
+
+/**
+ * @brief Write or erase the NVS copy of a reliable delivery slot.
+ * @param ctx the iridium_t struct pointer.
+ * @param slot the slot.
+ * @param seq the sequence number of the message.
+ * @param data the message bytes.
+ * @param length the message size, 0 to erase.
+ */
+static void iridium_reliable_save(void *ctx, size_t slot, uint16_t seq, const uint8_t *data, size_t length) {
+    (void)ctx;
+    nvs_handle_t handle;
+    if (nvs_open(IRI_CACHE_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    char key[16];
+    iridium_reliable_nvs_key(slot, key, sizeof(key));
+    esp_err_t err;
+    if (length > 0) {
+        uint8_t blob[2 + IRI_SBD_MO_MAX];
+        blob[0] = (uint8_t)seq;
+        blob[1] = (uint8_t)(seq >> 8);
+        memcpy(blob + 2, data, length);
+        err = nvs_set_blob(handle, key, blob, length + 2);
+    } else {
+        err = nvs_erase_key(handle, key);
+    }
+    if (err == ESP_OK) {
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
+
+/**
+ * @brief Write the next reliable delivery sequence number to NVS.
+ * @param ctx the iridium_t struct pointer.
+ * @param next the sequence number of the next message.
+ */
+static void iridium_reliable_save_sequence(void *ctx, uint16_t next) {
+    (void)ctx;
+    nvs_handle_t handle;
+    if (nvs_open(IRI_CACHE_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    uint8_t blob[2] = { (uint8_t)next, (uint8_t)(next >> 8) };
+    if (nvs_set_blob(handle, "iri_relseq", blob, sizeof(blob)) == ESP_OK) {
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
+
+/**
+ * @brief Restore the unacknowledged messages of the last boot, NVS must be initialized.
+ * @param satcom the iridium_t struct pointer.
+ */
+static void iridium_reliable_load(iridium_t *satcom) {
+    nvs_handle_t handle;
+    if (nvs_open(IRI_CACHE_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    uint8_t blob[2 + IRI_SBD_MO_MAX];
+    size_t length = 2;
+    if (nvs_get_blob(handle, "iri_relseq", blob, &length) == ESP_OK && length == 2) {
+        reliable_set_sequence(satcom->reliable, (uint16_t)(blob[0] | blob[1] << 8));
+    }
+    for (size_t slot = 0; slot < satcom->reliable->slots; slot++) {
+        char key[16];
+        iridium_reliable_nvs_key(slot, key, sizeof(key));
+        length = sizeof(blob);
+        if (nvs_get_blob(handle, key, blob, &length) == ESP_OK && length > 2) {
+            reliable_restore(satcom->reliable, slot, (uint16_t)(blob[0] | blob[1] << 8), blob + 2, length - 2);
+        }
+    }
+    nvs_close(handle);
+}
+
+/**
+ * @brief Write the airtime budget counters to NVS.
+ * @param ctx the iridium_t struct pointer.
+ * @param counters the counters.
+ */
+static void iridium_budget_save(void *ctx, const struct budget_counters *counters) {
+    (void)ctx;
+    nvs_handle_t handle;
+    if (nvs_open(IRI_CACHE_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_blob(handle, "iri_budget", counters, sizeof(*counters)) == ESP_OK) {
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
+
+/**
+ * @brief Restore the airtime budget counters of the last boot, NVS must be initialized.
+ * @param satcom the iridium_t struct pointer.
+ */
+static void iridium_budget_load(iridium_t *satcom) {
+    nvs_handle_t handle;
+    if (nvs_open(IRI_CACHE_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    struct budget_counters counters;
+    size_t length = sizeof(counters);
+    if (nvs_get_blob(handle, "iri_budget", &counters, &length) == ESP_OK && length == sizeof(counters)) {
+        budget_restore(satcom->budget, &counters, iridium_now_ms(satcom));
+    }
+    nvs_close(handle);
+}
+
+/**
+ * @brief The UTC day and month numbers of the budget periods.
+ * @param satcom the iridium_t struct pointer.
+ * @param day set to the days since 1970, BUDGET_PERIOD_UNKNOWN before the first time sync.
+ * @param month set to year * 12 + month - 1, BUDGET_PERIOD_UNKNOWN before the first time sync.
+ */
+static void iridium_budget_period(iridium_t *satcom, uint32_t *day, uint32_t *month) {
+    uint64_t utc_ms;
+    *day = BUDGET_PERIOD_UNKNOWN;
+    *month = BUDGET_PERIOD_UNKNOWN;
+    if (iridium_time_utc_ms(satcom, &utc_ms, NULL) != SAT_OK) {
+        return;
+    }
+    *day = (uint32_t)(utc_ms / 86400000ULL);
+    /* civil date from the day count, valid from 1970 on */
+    uint32_t z = *day + 719468;
+    uint32_t era = z / 146097;
+    uint32_t doe = z - era * 146097;
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    uint32_t m = mp < 10 ? mp + 3 : mp - 9;
+    uint32_t y = yoe + era * 400 + (m <= 2 ? 1 : 0);
+    *month = y * 12 + m - 1;
+}
+
+/**
+ * @brief Move the power state machine and account the time of the state left.
+ * @param satcom the iridium_t struct pointer.
+ * @param state the iridium_power_state_t entered.
+ * @note the caller holds p_status_mutex.
+ */
+static void iridium_power_enter(iridium_t *satcom, iridium_power_state_t state) {
+    uint32_t now = iridium_now_ms(satcom);
+    satcom->power.time_ms[satcom->power_state] += now - satcom->power_since_ms;
+    satcom->power_since_ms = now;
+    if (satcom->power_state != state) {
+        IRI_TRACE(1, satcom, TRACE_EV_POWER, 0, state, NULL, 0);
+        satcom->power_state = state;
+    }
+}
+
+/**
+ * @brief Record the completion of the outstanding command and wake its waiter.
+ * @param satcom the iridium_t struct pointer.
+ * @param nonce the nonce of the command being completed.
+ * @param error the iridium_error_t of the command.
+ * @param mo_status the +SBDIX MO status or -1.
+ * @param mt_status the +SBDIX MT status or -1.
+ */
+static void iridium_complete(iridium_t *satcom, int nonce, iridium_error_t error, int mo_status, int mt_status) {
+    iridium_pending_t *pending = &satcom->pending;
+
+    pthread_mutex_lock(&satcom->p_nonce_mutex);
+    /* RX and the timeout check can race, only the first completes */
+    if (pending->nonce == 0 || pending->nonce != nonce) {
+        pthread_mutex_unlock(&satcom->p_nonce_mutex);
+        return;
+    }
+    iridium_completion_t *done = &satcom->completions[satcom->completion_index];
+    char *done_data = satcom->completion_data[satcom->completion_index];
+    satcom->completion_index = (satcom->completion_index + 1) % IRI_COMPLETION_SLOTS;
+    done->nonce = pending->nonce;
+    done->error = error;
+    done->mo_status = mo_status;
+    done->mt_status = mt_status;
+    done->latency_ms = iridium_now_ms(satcom) - pending->sent_ms;
+    /* response_length < IRI_RESPONSE_MAX, lines that did not fit were never added */
+    memcpy(done_data, pending->response, pending->response_length + 1);
+    done->length = pending->response_length;
+    iridium_command_t command = pending->command;
+    uint32_t latency_ms = done->latency_ms;
+    pending->nonce = 0;
+    pending->deadline_ms = 0;
+    pending->binary_data = NULL;
+    /* before the waiter runs, failed writes and sessions may have changed the modem state too */
+    iridium_cache_drop(satcom, iridium_cache_affected(command));
+    pthread_cond_broadcast(&satcom->p_done_cond);
+    pthread_mutex_unlock(&satcom->p_nonce_mutex);
+
+    iridium_metrics_complete(satcom, command, error, mo_status, latency_ms);
+    if (command == AT_MSSTM) {
+        satcom->time_refresh_pending = 0;
+    }
+    IRI_TRACE(1, satcom, TRACE_EV_COMPLETE, nonce, error, NULL, 0);
+
+    /* the transmitter is off again and the idle timeout starts over */
+    pthread_mutex_lock(&satcom->p_status_mutex);
+    if (satcom->power_state == IRI_POWER_SESSION) {
+        iridium_power_enter(satcom, IRI_POWER_IDLE);
+    }
+    satcom->power_active_ms = iridium_now_ms(satcom);
+    pthread_mutex_unlock(&satcom->p_status_mutex);
+
+    iridium_update_iqs(satcom, IQS_OPEN);
+    /* the next command goes out right away, not on the buffer task tick */
+    iridium_dispatch_next(satcom);
+}
+
+/**
+ * @brief Wait for the completion record of a nonce.
+ * @param satcom the iridium_t struct pointer.
+ * @param nonce the nonce of the command.
+ * @param timeout_ms the maximum time to wait.
+ * @param wait_interval the amount of time in ms for wait interval check.
+ * @param done the iridium_completion_t to fill.
+ * @param buffer the response text, always terminated, NULL when not wanted.
+ * @param size the buffer size.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+static iridium_status_t iridium_wait_completion(iridium_t *satcom, int nonce, int timeout_ms, int wait_interval, 
+                                                iridium_completion_t *done, char *buffer, size_t size) {
+    uint32_t start = iridium_now_ms(satcom);
+    iridium_status_t status = SAT_ERROR;
+
+    if (wait_interval <= 0) {
+        wait_interval = 100;
+    }
+
+    pthread_mutex_lock(&satcom->p_nonce_mutex);
+    for (;;) {
+        for (int i = 0; i < IRI_COMPLETION_SLOTS; i++) {
+            if (satcom->completions[i].nonce == nonce) {
+                *done = satcom->completions[i];
+                satcom->completions[i].nonce = 0;
+                if (buffer != NULL) {
+                    iridium_copy_text(buffer, size, satcom->completion_data[i], done->length);
+                }
+                status = SAT_OK;
+                break;
             }
+        }
+        if (status == SAT_OK || (int32_t)(iridium_now_ms(satcom) - start) >= timeout_ms) {
             break;
-        case AT_SBDWT: {
-            char *message = (char*)malloc(50 * sizeof(char));
-            sprintf(message, "AT+SBDWT=%s\r", rdata);
-            result.status = iridium_send_raw(satcom, message, t_nonce);
-            free(message);
+        }
+
+        const struct vclock_t *clock = iridium_clock(satcom);
+        clock->wait_us(clock, &satcom->p_done_cond, &satcom->p_nonce_mutex, (uint64_t)wait_interval * 1000);
+    }
+    pthread_mutex_unlock(&satcom->p_nonce_mutex);
+    return status;
+}
+
+/**
+ * @brief Make a command the outstanding command and write it to the UART bus.
+ * @param satcom the iridium_t struct pointer.
+ * @param msg the command, its wire data and optional +SBDWB payload.
+ */
+static void iridium_write_message(iridium_t* satcom, iridium_command_item_t *msg) {
+    IRI_TRACE(1, satcom, TRACE_EV_TX, msg->nonce, msg->command, msg->data, (size_t)msg->size);
+
+    /* responses are matched against the echo and prefix of this command */
+    iridium_pending_t *pending = &satcom->pending;
+    pthread_mutex_lock(&satcom->p_nonce_mutex);
+    pending->command = (iridium_command_t)msg->command;
+    size_t echo_length = msg->size > 0 && msg->data[msg->size - 1] == '\r' ? (size_t)msg->size - 1 : (size_t)msg->size;
+    if (echo_length >= sizeof(pending->echo)) {
+        echo_length = sizeof(pending->echo) - 1;
+    }
+    memcpy(pending->echo, msg->data, echo_length);
+    pending->echo[echo_length] = '\0';
+    pending->prefix = iridium_commands[pending->command].prefix;
+    pending->prefix_length = iridium_commands[pending->command].prefix_length;
+    pending->echo_seen = 0;
+    pending->prefix_seen = 0;
+    pending->response[0] = '\0';
+    pending->response_length = 0;
+    pending->response_overflow = 0;
+    pending->binary_data = msg->binary;
+    pending->binary_size = msg->binary_size;
+    pending->sent_ms = iridium_now_ms(satcom);
+    pending->deadline_ms = pending->sent_ms + iridium_command_timeout_ms(pending->command);
+    pending->nonce = msg->nonce;
+    satcom->p_nonce = msg->nonce;
+    pthread_mutex_unlock(&satcom->p_nonce_mutex);
+
+    /* transmit data via UART */
+    uart_write_bytes(satcom->uart_number, msg->data, strlen(msg->data));
+    IRI_CAPTURE(satcom, CAPTURE_TX, msg->data, strlen(msg->data));
+    iridium_metrics_bytes(satcom, strlen(msg->data), 0);
+}
+
+/**
+ * @brief Write the highest priority queued command if the modem is idle.
+ * @param satcom the iridium_t struct pointer.
+ */
+static void iridium_dispatch_next(iridium_t *satcom) {
+    iridium_command_item_t msg;
+    int cls = DISPATCH_NORMAL;
+
+    /* check, pop and claim the modem in one step so two callers can't both write */
+    pthread_mutex_lock(&satcom->p_status_mutex);
+    if (satcom->status != IQS_OPEN || satcom->power_state < IRI_POWER_IDLE || 
+        dispatch_pop(satcom->buffer_queue, &msg, iridium_now_ms(satcom), &cls) != 0) {
+        pthread_mutex_unlock(&satcom->p_status_mutex);
+        return;
+    }
+    satcom->status = IQS_WAITING;
+    if (msg.command == AT_SBDIX || msg.command == AT_SBDIXA) {
+        iridium_power_enter(satcom, IRI_POWER_SESSION);
+    }
+    pthread_mutex_unlock(&satcom->p_status_mutex);
+
+    IRI_TRACE(2, satcom, TRACE_EV_DISPATCH, msg.nonce, cls, NULL, 0);
+    iridium_write_message(satcom, &msg);
+}
+
+/**
+ * @brief Queue a command at its priority and write it as soon as the modem is idle.
+ * @param satcom the iridium_t struct pointer.
+ * @param msg the command, its wire data and optional +SBDWB payload.
+ * @param priority the iridium_priority_t of the command.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when the priority class is full.
+ * @note a command queued while the modem sleeps wakes it, the caller blocks until the modem answers.
+ */
+static iridium_status_t iridium_send_message(iridium_t* satcom, iridium_command_item_t *msg, iridium_priority_t priority) {
+    if (dispatch_push(satcom->buffer_queue, priority, msg, iridium_now_ms(satcom)) != 0) {
+        /* back-pressure, the caller gets IRI_ERR_QUEUE_FULL instead of a silent drop */
+        IRI_TRACE(1, satcom, TRACE_EV_QUEUE_FULL, msg->nonce, priority, msg->data, strlen(msg->data));
+        return SAT_ERROR;
+    }
+    IRI_TRACE(2, satcom, TRACE_EV_QUEUE, msg->nonce, priority, NULL, 0);
+
+    /* the command stays queued until the modem is awake */
+    pthread_mutex_lock(&satcom->p_status_mutex);
+    iridium_power_state_t power_state = satcom->power_state;
+    if (power_state < IRI_POWER_IDLE) {
+        satcom->power.deferred++;
+    }
+    pthread_mutex_unlock(&satcom->p_status_mutex);
+    if (power_state == IRI_POWER_SLEEP) {
+        iridium_power_wake(satcom);
+    }
+    iridium_dispatch_next(satcom);
+    return SAT_OK;
+}
+
+/**
+ * @brief Send data payload across the UART bus.
+ * @param satcom the iridium_t struct pointer.
+ * @param data the data to be sent, shorter than IRI_CMD_MAX. 
+ * @param nonce the nonce used to track responses. 
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_send_raw(iridium_t* satcom, char *data, int nonce) {
+    iridium_command_item_t msg;
+    size_t length = strnlen(data, sizeof(msg.data));
+    if (length >= sizeof(msg.data)) {
+        return SAT_ERROR;
+    }
+    memset(&msg, 0, sizeof(msg));
+    memcpy(msg.data, data, length + 1);
+    msg.size = (int)length;
+    msg.nonce = nonce;
+    msg.command = AT;
+    return iridium_send_message(satcom, &msg, IRI_PRIORITY_NORMAL);
+}
+
+/**
+ * @brief Command queue statistics of a priority class (depth, wait times, rejects).
+ * @param satcom the iridium_t struct pointer.
+ * @param priority the iridium_priority_t class.
+ * @param stats the dispatch_stats to fill.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_queue_stats(iridium_t* satcom, iridium_priority_t priority, struct dispatch_stats *stats) {
+    if (satcom->buffer_queue == NULL || dispatch_get_stats(satcom->buffer_queue, priority, stats) != 0) {
+        return SAT_ERROR;
+    }
+    return SAT_OK;
+}
+
+/**
+ * @brief Enabled or disable the ring notification on the modem.  
+ * @param satcom the iridium_t struct pointer.
+ * @param enabled the ring notification.
+ * @return a iridium_result_t with metadata.
+ */
+iridium_result_t iridium_config_ring(iridium_t *satcom, bool enabled) {
+    iridium_result_t result;
+
+    /* enable/disable satcom ring */
+    if (enabled) {
+        result = iridium_send(satcom, AT_SBDMTA, "1", true, 500);
+        if (result.status != SAT_OK) {
             return result;
         }
-        case AT_SBDMTA: {
-            char *message = (char*)malloc(20 * sizeof(char));
-            sprintf(message, "AT+SBDMTA=%s\r", rdata);
-            result.status = iridium_send_raw(satcom, message, t_nonce);
-            free(message);
+    } else {
+        result = iridium_send(satcom, AT_SBDMTA, "0", true, 500);
+        if (result.status != SAT_OK) {
             return result;
         }
-        case AT_W0:
-            if (iridium_send_raw(satcom, "AT&w0\r", t_nonce) != SAT_OK) {
-                result.status = SAT_ERROR;
-                return result;
-            }
+    }
+    /* the mode just written is the answer of +SBDMTA?, no need to ask again */
+    if (satcom->cache_ttl_ms[AT_SBDMTAQ] != IRI_CACHE_OFF) {
+        char mode[16];
+        int length = snprintf(mode, sizeof(mode), "+SBDMTA:%d", enabled ? 1 : 0);
+        pthread_mutex_lock(&satcom->p_cache_mutex);
+        iridium_cache_store(satcom, AT_SBDMTAQ, mode, (size_t)length);
+        pthread_mutex_unlock(&satcom->p_cache_mutex);
+    }
+    iridium_sleep_ms(satcom, IRI_BUFF_DELAY);
+
+    /* save config */
+    result = iridium_send(satcom, AT_W0, "", true, 500);
+    if (result.status != SAT_OK) {
+        return result;
+    }
+    iridium_sleep_ms(satcom, IRI_BUFF_DELAY);
+
+    /* turn off flow control */
+    result = iridium_send(satcom, AT_K0, "", true, 500);
+    if (result.status != SAT_OK) {
+        return result;
+    }
+    iridium_sleep_ms(satcom, IRI_BUFF_DELAY);
+
+    /* check ring status */
+    result = iridium_query(satcom, AT_SBDMTAQ);
+    return result;
+}
+
+/**
+ * @brief Enabled or disable the +CIEV signal/service indicator events.  
+ * @param satcom the iridium_t struct pointer.
+ * @param enabled the indicator events.
+ * @return a iridium_result_t with metadata.
+ */
+iridium_result_t iridium_config_indicators(iridium_t *satcom, bool enabled) {
+    /* mode 1, signal quality and service availability indicators */
+    iridium_result_t result = iridium_send(satcom, AT_CIER, enabled ? "1,1,1" : "0", true, 500);
+    if (result.status == SAT_OK) {
+        /* +CIER is not part of the stored profile, a wake restores it */
+        satcom->indicators_enabled = enabled ? 1 : 0;
+    }
+    return result;
+}
+
+/**
+ * @brief Enabled or disable the command echo (ATE1/ATE0) on the modem.  
+ * @param satcom the iridium_t struct pointer.
+ * @param enabled the command echo, disabled saves UART bandwidth and parse work.
+ * @return a iridium_result_t with metadata.
+ */
+iridium_result_t iridium_config_echo(iridium_t *satcom, bool enabled) {
+    iridium_result_t result = iridium_send(satcom, AT_E, enabled ? "1" : "0", true, 500);
+    if (result.status == SAT_OK) {
+        satcom->echo_enabled = enabled ? 1 : 0;
+    }
+    return result;
+}
+
+/**
+ * @brief Transmit a message to the iridium network.
+ * @param satcom the iridium_t struct pointer.
+ * @param message to be sent.
+ * @return a iridium_result_t with metadata.
+ */
+iridium_result_t iridium_tx_message(iridium_t *satcom, char *message) {
+    return iridium_tx_message_priority(satcom, message, IRI_PRIORITY_NORMAL);
+}
+
+/**
+ * @brief Wait out a retry back-off, giving up early when an urgent message is waiting.
+ * @param satcom the iridium_t struct pointer.
+ * @param delay_ms the back-off in ms.
+ * @return true when the back-off was preempted.
+ */
+static bool iridium_backoff_preempted(iridium_t *satcom, int delay_ms) {
+    for (int waited = 0; waited < delay_ms; waited += IRI_BUFF_DELAY) {
+        pthread_mutex_lock(&satcom->p_status_mutex);
+        int preempt = satcom->mo_preempt;
+        pthread_mutex_unlock(&satcom->p_status_mutex);
+        if (preempt > 0) {
+            return true;
+        }
+        iridium_sleep_ms(satcom, IRI_BUFF_DELAY);
+    }
+    return false;
+}
+
+/**
+ * @brief Stretch a retry back-off to the start the signal forecast expects to succeed.
+ * @param satcom the iridium_t struct pointer.
+ * @param delay_ms the back-off of the retry schedule.
+ * @return the back-off in ms, never shorter than delay_ms.
+ */
+static int iridium_forecast_delay(iridium_t *satcom, int delay_ms) {
+    struct forecast_estimate estimate;
+    if (satcom->forecast == NULL || satcom->forecast_horizon_ms <= 0 || 
+        forecast_predict(satcom->forecast, iridium_now_ms(satcom), satcom->forecast_horizon_ms, &estimate) != 0) {
+        return delay_ms;
+    }
+    if ((int)estimate.delay_ms > delay_ms) {
+        ESP_LOGI(TAG_IRIDIUM, "FORECAST_DEFER[%" PRIu32 " ms] p = %.2f now %.2f", estimate.delay_ms, 
+                 estimate.probability, estimate.probability_now);
+        return (int)estimate.delay_ms;
+    }
+    return delay_ms;
+}
+
+/**
+ * @brief Run +SBDIX with the adaptive retry back-off, the MO buffer is already written.
+ * @param satcom the iridium_t struct pointer.
+ * @param priority the iridium_priority_t, IRI_PRIORITY_URGENT skips the preemption check.
+ * @param sessions incremented per +SBDIX attempt, can be NULL.
+ * @return a iridium_result_t of the last attempt, IRI_ERR_PREEMPTED when an urgent message cut it short,
+ *         IRI_ERR_BUDGET when the airtime budget refused a session.
+ * @note the caller holds p_mo_mutex.
+ */
+static iridium_result_t iridium_session_retry(iridium_t *satcom, iridium_priority_t priority, uint32_t *sessions) {
+    iridium_result_t result;
+    int delays[6] = {2000,4000,20000,30000,300000,300000};
+
+    /* short burst - send message - with adaptive retry */
+    for (int i = 0; i < 5; i++){
+        result = iridium_send_priority(satcom, AT_SBDIX, NULL, priority, true, 500);
+        if (sessions != NULL) {
+            (*sessions)++;
+        }
+
+        /* only a failed session or a timeout is worth retrying */
+        if (result.error != IRI_ERR_SESSION && result.error != IRI_ERR_TIMEOUT) {
             break;
-        case AT_K0:
-            if (iridium_send_raw(satcom, "AT&K0\r", t_nonce) != SAT_OK) {
-                result.status = SAT_ERROR;
-                return result;
-            }
+        }
+        /* nothing follows the last attempt, its back-off would only hold the caller and the MO buffer */
+        if (i == 4) {
             break;
-        default:
+        }
+
+        /* a failed session on a fading signal waits for the next pass instead */
+        int delay_ms = iridium_forecast_delay(satcom, delays[i]);
+
+        /* an urgent message never waits behind the back-off of another one */
+        if (priority != IRI_PRIORITY_URGENT && iridium_backoff_preempted(satcom, delay_ms)) {
+            ESP_LOGI(TAG_IRIDIUM, "SBDIX_PREEMPTED[%d]", i);
+            result.status = SAT_ERROR;
+            result.error = IRI_ERR_PREEMPTED;
             break;
+        }
+        if (priority == IRI_PRIORITY_URGENT) {
+            iridium_sleep_ms(satcom, delay_ms);
+        }
+
+        /* another attempt follows */
+        pthread_mutex_lock(&satcom->p_metrics_mutex);
+        satcom->metrics.retries++;
+        pthread_mutex_unlock(&satcom->p_metrics_mutex);
+    }
+    return result;
+}
+
+/**
+ * @brief Transmit a message to the iridium network at a dispatch priority.
+ * @param satcom the iridium_t struct pointer.
+ * @param message to be sent.
+ * @param priority the iridium_priority_t, IRI_PRIORITY_URGENT preempts the retry back-off of other messages.
+ * @return a iridium_result_t with metadata.
+ */
+iridium_result_t iridium_tx_message_priority(iridium_t *satcom, char *message, iridium_priority_t priority) {
+    /* the MO buffer is shared, it's owned from +SBDWT until the last +SBDIX */
+    if (priority == IRI_PRIORITY_URGENT) {
+        pthread_mutex_lock(&satcom->p_status_mutex);
+        satcom->mo_preempt++;
+        pthread_mutex_unlock(&satcom->p_status_mutex);
+    }
+    pthread_mutex_lock(&satcom->p_mo_mutex);
+    if (priority == IRI_PRIORITY_URGENT) {
+        pthread_mutex_lock(&satcom->p_status_mutex);
+        satcom->mo_preempt--;
+        pthread_mutex_unlock(&satcom->p_status_mutex);
+    }
+
+    /* a sleep clears the MO buffer, stay awake through the back-off */
+    iridium_power_hold(satcom);
+    iridium_result_t result = iridium_send_priority(satcom, AT_SBDWT, message, priority, true, 500);
+
+    /* failed to set outbound message buffer */
+    if (result.status != SAT_OK) {
+        iridium_power_release(satcom);
+        pthread_mutex_unlock(&satcom->p_mo_mutex);
+        return result;
+    }
+
+    result = iridium_session_retry(satcom, priority, NULL);
+
+    iridium_power_release(satcom);
+    pthread_mutex_unlock(&satcom->p_mo_mutex);
+    return result;
+}
+
+/**
+ * @brief Build the wire form of a command and give it the next nonce.
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command.
+ * @param rdata the raw data. 
+ * @param binary the +SBDWB payload or NULL.
+ * @param binary_size the +SBDWB payload size.
+ * @param msg the iridium_command_item_t to fill.
+ * @return IRI_ERR_NONE or IRI_ERR_INVALID_ARG.
+ */
+static iridium_error_t iridium_build_message(iridium_t* satcom, iridium_command_t command, char *rdata, 
+                                             const uint8_t *binary, size_t binary_size, 
+                                             iridium_command_item_t *msg) {
+    if ((int)command < 0 || command >= IRI_COMMAND_COUNT) {
+        return IRI_ERR_INVALID_ARG;
+    }
+    const iridium_command_def_t *def = &iridium_commands[command];
+
+    /* the fixed part and its length come from the table, only the argument is measured */
+    size_t argument_length = 0;
+    if (def->argument_max > 0) {
+        if (rdata == NULL) {
+            return IRI_ERR_INVALID_ARG;
+        }
+        argument_length = strnlen(rdata, (size_t)def->argument_max + 1);
+        if (argument_length > def->argument_max) {
+            return IRI_ERR_INVALID_ARG;
+        }
+    }
+
+    /* callers on every task build commands, each needs its own nonce and 0 marks a free slot */
+    pthread_mutex_lock(&satcom->p_nonce_mutex);
+    satcom->c_nonce = satcom->c_nonce < INT_MAX ? satcom->c_nonce + 1 : 1;
+    int nonce = satcom->c_nonce;
+    pthread_mutex_unlock(&satcom->p_nonce_mutex);
+
+    memset(msg, 0, sizeof(*msg));
+    memcpy(msg->data, def->wire, def->wire_length);
+    msg->size = def->wire_length;
+    if (def->argument_max > 0) {
+        memcpy(msg->data + msg->size, rdata, argument_length);
+        msg->size += (int)argument_length;
+        msg->data[msg->size++] = '\r';
+    }
+    msg->nonce = nonce;
+    msg->command = command;
+    msg->binary = binary;
+    msg->binary_size = binary_size;
+    return IRI_ERR_NONE;
+}
+
+/** 
+ * @brief Send AT command with data and an optional +SBDWB payload.  
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command.
+ * @param rdata the raw data. 
+ * @param binary the +SBDWB payload or NULL, must stay valid until the command completes.
+ * @param binary_size the +SBDWB payload size.
+ * @param priority the iridium_priority_t of the command.
+ * @param wait_response wait for a responce from the modem.
+ * @param wait_interval the amount of time in ms for wait interval check.
+ * @param buffer the response text, NULL for the result field.
+ * @param size the buffer size.
+ * @return a iridium_result_t with metadata.
+ */
+static iridium_result_t iridium_send_command(iridium_t* satcom, iridium_command_t command, char *rdata, 
+                                             const uint8_t *binary, size_t binary_size, 
+                                             iridium_priority_t priority, 
+                                             bool wait_response, int wait_interval, 
+                                             char *buffer, size_t size) {
+    iridium_result_t result;
+    iridium_result_reset(&result);
+    if (buffer == NULL) {
+        buffer = result.result;
+        size = sizeof(result.result);
+    }
+
+    iridium_command_item_t msg;
+    result.error = iridium_build_message(satcom, command, rdata, binary, binary_size, &msg);
+    if (result.error != IRI_ERR_NONE) {
+        return result;
+    }
+    int t_nonce = msg.nonce;
+
+    /* every session can be billed, the budget has the last word before the modem does */
+    bool session = command == AT_SBDIX || command == AT_SBDIXA;
+    if (session && satcom->budget != NULL) {
+        uint32_t day, month;
+        iridium_budget_period(satcom, &day, &month);
+        int verdict = budget_acquire(satcom->budget, priority, satcom->mo_bytes, iridium_now_ms(satcom), day, month);
+        if (verdict != BUDGET_OK) {
+            ESP_LOGW(TAG_IRIDIUM, "BUDGET_DENIED[%d] priority = %d", verdict, (int)priority);
+            result.error = IRI_ERR_BUDGET;
+            return result;
+        }
+    }
+
+    if (iridium_send_message(satcom, &msg, priority) != SAT_OK) {
+        /* back-pressure, the session never started */
+        if (session && satcom->budget != NULL) {
+            budget_refund(satcom->budget);
+        }
+        result.error = IRI_ERR_QUEUE_FULL;
+        return result;
+    }
+
+    if (wait_response) {
+        /* the driver completes every command, the wait limit only guards a stalled driver */
+        int timeout_ms = iridium_command_timeout_ms(command) * 2 + satcom->buffer_delay_ms;
+        iridium_completion_t done;
+        if (iridium_wait_completion(satcom, t_nonce, timeout_ms, wait_interval, &done, buffer, size) != SAT_OK) {
+            result.error = IRI_ERR_TIMEOUT;
+            ESP_LOGI(TAG_IRIDIUM, "WAIT_TIMEOUT_NONCE = [%d]", t_nonce);
+            return result;
+        }
+
+        result.length = done.length;
+        result.error = done.error;
+        result.mo_status = done.mo_status;
+        result.mt_status = done.mt_status;
+        result.latency_ms = done.latency_ms;
+        ESP_LOGI(TAG_IRIDIUM, "WAIT_DONE_NONCE = [%d] error = %d latency = %" PRIu32, t_nonce, done.error, done.latency_ms);
+    }
+
+    result.status = result.error == IRI_ERR_NONE ? SAT_OK : SAT_ERROR;
+    return result;
+}
+
+/*
+AT+SBDIX = +SBDIX:<MO status>,<MOMSN>,<MT status>,<MTMSN>,<MT length>,<MT queued>
+*/
+/** 
+ * @brief Send AT command with data.  
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command.
+ * @param rdata the raw data. 
+ * @param wait_response wait for a responce from the modem.
+ * @param wait_interval the amount of time in ms for wait interval check.
+ * @return a iridium_result_t with metadata.
+ */
+iridium_result_t iridium_send(iridium_t* satcom, iridium_command_t command, char *rdata, bool wait_response, int wait_interval) {
+    return iridium_send_command(satcom, command, rdata, NULL, 0, IRI_PRIORITY_NORMAL, wait_response, wait_interval, NULL, 0);
+}
+
+/** 
+ * @brief Send AT command with data at a dispatch priority.  
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command.
+ * @param rdata the raw data. 
+ * @param priority the iridium_priority_t of the command.
+ * @param wait_response wait for a responce from the modem.
+ * @param wait_interval the amount of time in ms for wait interval check.
+ * @return a iridium_result_t with metadata, IRI_ERR_QUEUE_FULL when the priority class is full.
+ */
+iridium_result_t iridium_send_priority(iridium_t* satcom, iridium_command_t command, char *rdata, iridium_priority_t priority, bool wait_response, int wait_interval) {
+    return iridium_send_command(satcom, command, rdata, NULL, 0, priority, wait_response, wait_interval, NULL, 0);
+}
+
+/** 
+ * @brief Send AT command with data and wait for the response text in a caller buffer.  
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command.
+ * @param rdata the raw data. 
+ * @param priority the iridium_priority_t of the command.
+ * @param buffer the response text, always terminated, may be NULL when size is 0.
+ * @param size the buffer size.
+ * @return a iridium_result_t with metadata, length >= size when the text did not fit the buffer.
+ */
+iridium_result_t iridium_send_into(iridium_t* satcom, iridium_command_t command, char *rdata, iridium_priority_t priority, char *buffer, size_t size) {
+    /* only the length is wanted, like snprintf(NULL, 0, ...), nothing is written with size 0 */
+    char none[1];
+    if (buffer == NULL || size == 0) {
+        buffer = none;
+        size = 0;
+    }
+    return iridium_send_command(satcom, command, rdata, NULL, 0, priority, true, IRI_BUFF_DELAY, buffer, size);
+}
+
+/**
+ * @brief Write a binary message to the MO buffer (+SBDWB).
+ * @param satcom the iridium_t struct pointer.
+ * @param data the message bytes.
+ * @param size the message size, 1 to IRI_SBD_MO_MAX bytes.
+ * @return a iridium_result_t with metadata.
+ */
+iridium_result_t iridium_write_binary(iridium_t *satcom, const uint8_t *data, size_t size) {
+    iridium_result_t result;
+    iridium_result_reset(&result);
+
+    if (data == NULL || size == 0 || size > IRI_SBD_MO_MAX) {
+        result.error = IRI_ERR_INVALID_ARG;
+        return result;
+    }
+
+    /* the payload is written from the RX path once the modem replies READY */
+    char length[8];
+    snprintf(length, sizeof(length), "%u", (unsigned)size);
+    return iridium_send_command(satcom, AT_SBDWB, length, data, size, IRI_PRIORITY_NORMAL, true, 500, NULL, 0);
+}
+
+/**
+ * @brief Transmit a binary message to the iridium network (+SBDWB then +SBDIX).
+ * @param satcom the iridium_t struct pointer.
+ * @param data the message bytes.
+ * @param size the message size, 1 to IRI_SBD_MO_MAX bytes.
+ * @return a iridium_result_t with metadata.
+ */
+iridium_result_t iridium_tx_binary(iridium_t *satcom, const uint8_t *data, size_t size) {
+    pthread_mutex_lock(&satcom->p_mo_mutex);
+
+    /* a sleep clears the MO buffer, stay awake through the back-off */
+    iridium_power_hold(satcom);
+    iridium_result_t result = iridium_write_binary(satcom, data, size);
+
+    /* failed to set outbound message buffer */
+    if (result.status != SAT_OK) {
+        iridium_power_release(satcom);
+        pthread_mutex_unlock(&satcom->p_mo_mutex);
+        return result;
+    }
+
+    result = iridium_session_retry(satcom, IRI_PRIORITY_NORMAL, NULL);
+
+    iridium_power_release(satcom);
+    pthread_mutex_unlock(&satcom->p_mo_mutex);
+    return result;
+}
+
+/**
+ * @brief Drain the MT mailbox after a SBDRING.
+ * @param satcom the iridium_t struct pointer.
+ */
+static void iridium_ring_drain(iridium_t *satcom) {
+    /* every +SBDIXA sends the MO buffer, don't fire between a writer's +SBDWB and its +SBDIX */
+    pthread_mutex_lock(&satcom->p_mo_mutex);
+    /* the MT buffer is lost on sleep, hold the modem until the last +SBDRT */
+    iridium_power_hold(satcom);
+    iridium_result_t rcris = iridium_send(satcom, AT_CRIS, NULL, true, 500);
+    if (rcris.status == SAT_OK) { }
+
+    for(;;) {
+        iridium_result_t r1 = iridium_send(satcom, AT_SBDIXA, "", true, 500);
+        if (r1.status == SAT_OK) {
+            ESP_LOGI(TAG_IRIDIUM, "RST_R1[%d] = %s", r1.status, r1.result);
+        }
+        /* no retry loop against a spent budget, the next ring tries again */
+        if (r1.error == IRI_ERR_BUDGET || satcom->stopping) {
+            break;
+        }
+        if (satcom->status_outbound == MO_TRANSFERRED_SUCCESSFULLY ||
+            satcom->status_outbound == MO_TRANSFERRED_SUCCESSFULLY_TOO_BIG ||
+            satcom->status_outbound == MO_TRANSFERRED_SUCCESSFULLY_LOC_NOT_ACCEPTED) {
+            if (satcom->messages_waiting == 0) {
+                break;
+            }
+            iridium_sleep_ms(satcom, 5000);
+            iridium_result_t r2 = iridium_send(satcom, AT_SBDRT, NULL, true, 500);
+            if (r2.status == SAT_OK) {
+                ESP_LOGI(TAG_IRIDIUM, "RST_R2[%d] = %s", r2.status, r2.result);
+            }
+        }
+        iridium_sleep_ms(satcom, 10000);
+    }
+
+    iridium_result_t r2 = iridium_send(satcom, AT_SBDRT, NULL, true, 500);
+    if (r2.status == SAT_OK) {
+        ESP_LOGI(TAG_IRIDIUM, "RST_R3[%d] = %s", r2.status, r2.result);
+    }
+    iridium_power_release(satcom);
+    pthread_mutex_unlock(&satcom->p_mo_mutex);
+}
+
+/**
+ * @brief Recognise an unsolicited result code (URC) line. 
+ * @param line the response line without line terminators.
+ * @param event the iridium_urc_event_t to fill, can be NULL.
+ * @return the iridium_urc_t of the line or URC_NONE.
+ */
+iridium_urc_t iridium_urc_parse(const char *line, iridium_urc_event_t *event) {
+    iridium_urc_event_t t_event = { URC_NONE, { -1, -1 } };
+
+    /* the first character rules out most lines before any compare */
+    switch (line[0]) {
+        case 'S':
+            if (strcmp("SBDRING", line) == 0) {
+                t_event.type = URC_SBDRING;
+            }
+            break;
+        case '+':
+            if (IRI_HAS_PREFIX(line, "+CIEV:")) {
+                t_event.type = URC_CIEV;
+                sscanf(line + 6, "%d,%d", &t_event.values[0], &t_event.values[1]);
+            } else if (IRI_HAS_PREFIX(line, "+AREG:")) {
+                t_event.type = URC_AREG;
+                sscanf(line + 6, "%d,%d", &t_event.values[0], &t_event.values[1]);
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (event != NULL) {
+        *event = t_event;
+    }
+    return t_event.type;
+}
+
+/**
+ * @brief Route a URC to the long-lived URC task, called from the RX path.
+ * @param satcom the iridium_t struct pointer.
+ * @param event the parsed URC.
+ */
+static void iridium_urc_route(iridium_t *satcom, iridium_urc_event_t *event) {
+    switch (event->type) {
+        case URC_SBDRING:
+            /* coalesce, one drain covers every ring seen before it starts */
+            if (satcom->ring_pending) {
+                satcom->ring_coalesced++;
+                return;
+            }
+            satcom->ring_pending = 1;
+            iridium_cache_drop(satcom, 1u << AT_SBDSX);
+            break;
+        case URC_CIEV:
+            /* state is updated here so readers never see a stale value */
+            if (event->values[0] == 0) {
+                satcom->signal_strength = event->values[1];
+                iridium_cache_drop(satcom, 1u << AT_CSQ);
+            } else if (event->values[0] == 1) {
+                satcom->service_available = event->values[1];
+            }
+            iridium_forecast_sample(satcom);
+            break;
+        default:
+            break;
+    }
+
+    if (xQueueSend(satcom->urc_queue, (void *)event, 0) != pdTRUE) {
+        satcom->urc_dropped++;
+        if (event->type == URC_SBDRING) {
+            satcom->ring_pending = 0;
+        }
+    }
+}
+
+/**
+ * @brief Count a driver task out for iridium_deinit(), the last thing a task does.
+ * @param satcom the iridium_t struct pointer.
+ */
+static void iridium_task_exit(iridium_t *satcom) {
+    pthread_mutex_lock(&satcom->p_status_mutex);
+    satcom->tasks_running--;
+    pthread_mutex_unlock(&satcom->p_status_mutex);
+}
+
+void urc_satcom_task(void *pvParameters) { 
+    iridium_t* satcom = (iridium_t *)pvParameters;
+
+    while (!satcom->stopping) {
+        iridium_urc_event_t event;
+        if (xQueueReceive(satcom->urc_queue, (void *)&event, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        /* woken by iridium_deinit() */
+        if (satcom->stopping) {
+            break;
+        }
+
+        if (event.type == URC_SBDRING) {
+            /* rings during the drain re-arm one more drain */
+            satcom->ring_pending = 0;
+            iridium_ring_drain(satcom);
+        } else if (event.type == URC_CIEV && event.values[0] == 0) {
+            satcom->callback(satcom, AT_CSQ, SAT_OK);
+        }
+
+        if (satcom->urc_callback != NULL) {
+            satcom->urc_callback(satcom, &event);
+        }
+    }
+    iridium_task_exit(satcom);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Mark a -MSSTM read as due when the time sync is older than time_refresh_ms.
+ * @param satcom the iridium_t struct pointer.
+ * @note runs on the RX path, the buffer task queues the command once the modem is idle.
+ */
+static void iridium_time_piggyback(iridium_t *satcom) {
+    if (satcom->time_refresh_ms <= 0 || satcom->time_refresh_pending) {
+        return;
+    }
+    uint64_t utc_ms;
+    uint32_t age_ms;
+    if (iridium_time_utc_ms(satcom, &utc_ms, &age_ms) == SAT_OK && age_ms < (uint32_t)satcom->time_refresh_ms) {
+        return;
+    }
+    satcom->time_refresh_pending = 1;
+}
+
+/**
+ * @brief Queue the background -MSSTM read marked due by iridium_time_piggyback.
+ * @param satcom the iridium_t struct pointer.
+ */
+static void iridium_time_refresh(iridium_t *satcom) {
+    if (satcom->time_refresh_pending != 1) {
+        return;
+    }
+    pthread_mutex_lock(&satcom->p_status_mutex);
+    int idle = satcom->status == IQS_OPEN && satcom->power_state == IRI_POWER_IDLE;
+    pthread_mutex_unlock(&satcom->p_status_mutex);
+    if (!idle) {
+        return;
+    }
+    /* no waiter, the answer is taken by iridium_process_response */
+    satcom->time_refresh_pending = 2;
+    if (iridium_send_priority(satcom, AT_MSSTM, NULL, IRI_PRIORITY_BACKGROUND, false, 0).status != SAT_OK) {
+        satcom->time_refresh_pending = 0;
+    }
+}
+
+/**
+ * @brief Count and drop a line that belongs to no outstanding command.
+ * @param satcom the iridium_t struct pointer.
+ * @param line the response line.
+ */
+static void iridium_rx_orphan(iridium_t *satcom, const char *line) {
+    satcom->orphaned_lines++;
+    IRI_TRACE(1, satcom, TRACE_EV_ORPHAN, 0, satcom->orphaned_lines, line, strlen(line));
+}
+
+/**
+ * @brief Process a single response line from the modem.
+ * @param satcom the iridium_t struct pointer.
+ * @param line the response line without line terminators.
+ */
+static void iridium_rx_line(iridium_t *satcom, char *line) {
+    iridium_pending_t *pending = &satcom->pending;
+    IRI_TRACE(2, satcom, TRACE_EV_RX_LINE, pending->nonce, 0, line, strlen(line));
+
+    /* URCs can arrive anywhere, even in the middle of a command response */
+    iridium_urc_event_t urc;
+    if (iridium_urc_parse(line, &urc) != URC_NONE) {
+        IRI_TRACE(1, satcom, TRACE_EV_URC, 0, urc.type, line, strlen(line));
+        iridium_urc_route(satcom, &urc);
+        return;
+    }
+
+    /* late response of a timed out command, nobody is waiting for it */
+    int nonce = pending->nonce;
+    if (nonce == 0) {
+        iridium_rx_orphan(satcom, line);
+        return;
+    }
+
+    /* with echo on, everything before our echo belongs to an earlier command */
+    if (!pending->echo_seen && strcmp(line, pending->echo) == 0) {
+        pending->echo_seen = 1;
+        return;
+    }
+    if (satcom->echo_enabled > 0 && !pending->echo_seen) {
+        iridium_rx_orphan(satcom, line);
+        return;
+    }
+    if (line[0] == 'A' && line[1] == 'T') {
+        iridium_rx_orphan(satcom, line);
+        return;
+    }
+
+    if (strcmp ("ERROR", line) == 0) {
+        /* fail fast, the command is complete */
+        iridium_complete(satcom, nonce, IRI_ERR_MODEM, -1, -1);
+        return;
+    }
+
+    if (strcmp ("READY", line) == 0 && pending->command == AT_SBDWB && pending->binary_data != NULL) {
+        /* +SBDWB payload followed by the 2-byte big-endian checksum */
+        uint16_t checksum = 0;
+        for (size_t i = 0; i < pending->binary_size; i++) {
+            checksum += pending->binary_data[i];
+        }
+        uint8_t trailer[2] = { (uint8_t)(checksum >> 8), (uint8_t)(checksum & 0xFF) };
+        uart_write_bytes(satcom->uart_number, pending->binary_data, pending->binary_size);
+        uart_write_bytes(satcom->uart_number, trailer, sizeof(trailer));
+        IRI_CAPTURE(satcom, CAPTURE_TX, pending->binary_data, pending->binary_size);
+        IRI_CAPTURE(satcom, CAPTURE_TX, trailer, sizeof(trailer));
+        IRI_TRACE(1, satcom, TRACE_EV_TX_BINARY, nonce, (int32_t)pending->binary_size, NULL, 0);
+        iridium_metrics_bytes(satcom, pending->binary_size + sizeof(trailer), 0);
+        return;
+    }
+
+    if (strcmp ("OK", line) != 0) {
+        /* without echo the expected prefix is the only tie to the request */
+        if (pending->prefix != NULL && !pending->prefix_seen) {
+            if (strncmp(line, pending->prefix, pending->prefix_length) != 0) {
+                iridium_rx_orphan(satcom, line);
+                return;
+            }
+            pending->prefix_seen = 1;
+        }
+        size_t length = strlen(line);
+        /* a line cut in iridium_rx_feed is as incomplete as one that does not fit here */
+        if (!satcom->line_truncated && pending->response_length + length < sizeof(pending->response)) {
+            memcpy(pending->response + pending->response_length, line, length + 1);
+            pending->response_length += length;
+        } else {
+            pending->response_overflow = 1;
+        }
+        return;
+    }
+
+    /* without echo an OK before the expected data is a stale final result code */
+    if (satcom->echo_enabled <= 0 && !pending->echo_seen && pending->prefix != NULL && !pending->prefix_seen) {
+        iridium_rx_orphan(satcom, line);
+        return;
+    }
+
+    /* parsed in place, the text goes on to the waiter unchanged */
+    const char *data = pending->response;
+
+    iridium_error_t error = IRI_ERR_NONE;
+    int mo_status = -1;
+    int mt_status = -1;
+
+    /* half a response would be parsed as a whole one, an MT message cut short */
+    if (pending->response_overflow) {
+        ESP_LOGW(TAG_IRIDIUM, "RESPONSE_TRUNCATED[%d] %u bytes kept", (int)pending->command, (unsigned)pending->response_length);
+        iridium_complete(satcom, nonce, IRI_ERR_TRUNCATED, mo_status, mt_status);
+        return;
+    }
+
+    if (iridium_process_response(satcom, pending->command, data) != SAT_OK) {
+        error = IRI_ERR_PARSE;
+        if (pending->command == AT_SBDWB && satcom->sbdwb_status >= 1 && satcom->sbdwb_status <= 3) {
+            error = (iridium_error_t)(IRI_ERR_SBDWB_TIMEOUT + satcom->sbdwb_status - 1);
+        }
+        if (pending->command == AT_MSSTM && strstr(data, "no network service") != NULL) {
+            error = IRI_ERR_NO_SERVICE;
+            pthread_mutex_lock(&satcom->p_metrics_mutex);
+            satcom->time.no_service++;
+            pthread_mutex_unlock(&satcom->p_metrics_mutex);
+        }
+    }
+
+    /* the MO buffer until the next write or +SBDD0, what the next session sends */
+    if (error == IRI_ERR_NONE && pending->command == AT_SBDWB) {
+        satcom->mo_bytes = (uint32_t)pending->binary_size;
+    } else if (error == IRI_ERR_NONE && pending->command == AT_SBDWT) {
+        satcom->mo_bytes = (uint32_t)(strlen(pending->echo) - iridium_commands[AT_SBDWT].wire_length);
+    } else if (error == IRI_ERR_NONE && pending->command == AT_SBDD) {
+        satcom->mo_bytes = 0;
+    }
+
+    if ((pending->command == AT_SBDIX || pending->command == AT_SBDIXA) && error == IRI_ERR_NONE) {
+        mo_status = satcom->status_outbound;
+        mt_status = satcom->status_inbound;
+        /* 0 - 2 = MO transferred */
+        if (mo_status > MO_TRANSFERRED_SUCCESSFULLY_LOC_NOT_ACCEPTED) {
+            error = IRI_ERR_SESSION;
+        }
+        /* teaches the forecast what a signal level is worth */
+        if (satcom->forecast != NULL) {
+            forecast_session(satcom->forecast, satcom->signal_strength, error == IRI_ERR_NONE);
+        }
+        /* billed bytes, the MO message when it went through and the MT message received, waiter or not */
+        if (satcom->budget != NULL) {
+            uint32_t bytes = mo_status >= MO_TRANSFERRED_SUCCESSFULLY && mo_status <= MO_TRANSFERRED_SUCCESSFULLY_LOC_NOT_ACCEPTED ? 
+                             satcom->mo_bytes : 0;
+            if (mt_status == MT_SBD_MESSAGE_SUCCESSFULLY_RECEIVED) {
+                bytes += (uint32_t)satcom->bytes_received;
+            }
+            budget_charge(satcom->budget, bytes);
+        }
+    }
+
+    iridium_complete(satcom, nonce, error, mo_status, mt_status);
+
+    /* the modem is awake and in service right after a session, the cheapest time to resync */
+    if (mo_status >= 0 && error == IRI_ERR_NONE) {
+        iridium_time_piggyback(satcom);
+    }
+}
+
+/**
+ * @brief Feed raw bytes from the UART bus into the response parser. 
+ * @param satcom the iridium_t struct pointer.
+ * @param data the received bytes.
+ * @param size the number of received bytes.
+ */
+void iridium_rx_feed(iridium_t *satcom, const uint8_t *data, size_t size) {
+    /* lines may be split across UART reads, assemble them first */
+    for (size_t i = 0; i < size; i++) {
+        char c = (char)data[i];
+        if (c == '\r' || c == '\n') {
+            if (satcom->line_length > 0) {
+                satcom->line_buffer[satcom->line_length] = '\0';
+                iridium_rx_line(satcom, satcom->line_buffer);
+                satcom->line_length = 0;
+                satcom->line_truncated = 0;
+            }
+        } else if (c != '\0') {
+            if (satcom->line_length < IRI_LINE_MAX - 1) {
+                satcom->line_buffer[satcom->line_length++] = c;
+            } else {
+                satcom->line_truncated = 1;
+            }
+        }
+    }
+}
+
+void uart_satcom_task(void *pvParameters) { 
+    iridium_t* satcom = (iridium_t *)pvParameters;
+    uint8_t* dtmp = (uint8_t*) malloc(IRI_RD_BUF_SIZE);
+    uart_event_t event;
+    while (satcom->stopping < 2) {
+        if(xQueueReceive(satcom->uart_queue, (void * )&event, (portTickType)portMAX_DELAY)) {
+            bzero(dtmp, IRI_RD_BUF_SIZE);
+            switch(event.type) {
+                case UART_DATA: {
+                    int len = uart_read_bytes(satcom->uart_number, dtmp, 
+                                              event.size < IRI_RD_BUF_SIZE ? event.size : IRI_RD_BUF_SIZE - 1, 
+                                              portMAX_DELAY);
+                    
+                    IRI_TRACE(2, satcom, TRACE_EV_RX_CHUNK, satcom->pending.nonce, len, dtmp, len > 0 ? len : 0);
+
+                    if (len > 0) {
+                        iridium_metrics_bytes(satcom, 0, len);
+                        IRI_CAPTURE(satcom, CAPTURE_RX, dtmp, len);
+                        iridium_rx_feed(satcom, dtmp, len);
+                    }
+                    break;
+                }
+                case UART_FIFO_OVF:
+                case UART_BUFFER_FULL:
+                    uart_flush_input(satcom->uart_number);
+                    xQueueReset(satcom->uart_queue);
+                    satcom->line_length = 0;
+                    satcom->line_truncated = 0;
+                    IRI_TRACE(1, satcom, TRACE_EV_OVERFLOW, satcom->pending.nonce, event.type, NULL, 0);
+                    /* the response is lost, fail the outstanding command now */
+                    iridium_complete(satcom, satcom->pending.nonce, IRI_ERR_UART_OVERFLOW, -1, -1);
+                    break;
+                case UART_BREAK:
+                    break;
+                case UART_PARITY_ERR:
+                    break;
+                case UART_FRAME_ERR:
+                    break;
+                case UART_PATTERN_DET:
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    free(dtmp);
+    dtmp = NULL;
+    iridium_task_exit(satcom);
+    vTaskDelete(NULL);
+}
+
+void buffer_satcom_task(void *pvParameters) { 
+    iridium_t* satcom = (iridium_t *)pvParameters;
+    iridium_queue_status_t t_status = IQS_NONE;
+
+    int delay_ms = satcom->buffer_delay_ms;
+    /* last to stop, the service tasks still need timeouts and dispatch on their way out */
+    while (satcom->stopping < 2) {
+        /* waiting for buffer message event */
+        t_status = iridium_get_iqs(satcom);
+        int p_nonce = satcom->pending.nonce;
+        uint32_t deadline = satcom->pending.deadline_ms;
+        if (t_status == IQS_WAITING && p_nonce != 0 && deadline != 0 && 
+            (int32_t)(iridium_now_ms(satcom) - deadline) >= 0) {
+            /* no final result code, release the modem, a late response is orphaned */
+            IRI_TRACE(1, satcom, TRACE_EV_TIMEOUT, p_nonce, 0, NULL, 0);
+            iridium_complete(satcom, p_nonce, IRI_ERR_TIMEOUT, -1, -1);
+            t_status = iridium_get_iqs(satcom);
+        }
+        if (t_status == IQS_OPEN) {
+            /* commands are dispatched on completion, this only catches stragglers */
+            iridium_dispatch_next(satcom);
+        }
+        /* before the modem may go back to sleep */
+        iridium_time_refresh(satcom);
+        if (satcom->power_idle_ms > 0) {
+            /* duty cycling, refused while anything is outstanding, queued or held */
+            iridium_power_sleep(satcom, (uint32_t)satcom->power_idle_ms);
+        }
+        if (satcom->metrics_callback != NULL && satcom->metrics_interval_ms > 0 && 
+            iridium_now_ms(satcom) - satcom->metrics_dump_ms >= (uint32_t)satcom->metrics_interval_ms) {
+            /* periodic dump, the snapshot is taken on this task so the RX path never waits on it */
+            iridium_metrics_t snapshot;
+            satcom->metrics_dump_ms = iridium_now_ms(satcom);
+            if (iridium_metrics_snapshot(satcom, &snapshot) == SAT_OK) {
+                satcom->metrics_callback(satcom, &snapshot);
+            }
+        }
+        iridium_sleep_ms(satcom, delay_ms);
+    }
+    iridium_task_exit(satcom);
+    vTaskDelete(NULL);
+} 
+
+void message_satcom_task(void *pvParameters) { 
+    iridium_t* satcom = (iridium_t *)pvParameters;
+    int delay_ms = satcom->buffer_delay_ms;
+
+    while (!satcom->stopping) {
+        iridium_message_t rcv_msg;
+        if (xQueueReceive(satcom->message_queue, (void *)&rcv_msg, 0) == pdTRUE) {
+           satcom->message_callback(satcom, rcv_msg.data);
+        } else if (satcom->mt_sequence != NULL) {
+            /* a gap that never fills, what waits behind it goes out after mt_order_hold_ms */
+            sequence_release(satcom->mt_sequence, iridium_now_ms(satcom), &iridium_mt_deliver, satcom);
+        }
+        iridium_sleep_ms(satcom, delay_ms);
+    }
+    iridium_task_exit(satcom);
+    vTaskDelete(NULL);
+}  
+
+/**
+ * @brief Create a default iridium configuration.
+ * @return a valid iridium_t struct configuration.
+ */
+iridium_t* iridium_default_configuration() {
+    iridium_t *satcom = calloc(1, sizeof(iridium_t));
+    satcom->buffer_size = IRI_CMD_QUEUE_DEPTH; // item size
+    satcom->message_size = IRI_MT_QUEUE_DEPTH; // item size
+    satcom->buffer_delay_ms = 1000; // ms
+    satcom->task_message_stack_depth = IRI_TASK_MESSAGE_STACK;
+    satcom->task_buffer_stack_depth = IRI_TASK_BUFFER_STACK;
+    satcom->task_uart_stack_depth = IRI_TASK_UART_STACK;
+    satcom->task_urc_stack_depth = IRI_TASK_URC_STACK;
+    satcom->task_window_stack_depth = IRI_TASK_WINDOW_STACK;
+    satcom->time_refresh_ms = IRI_TIME_REFRESH_MS;
+    /* identity never changes, status answers go stale fast */
+    satcom->cache_ttl_ms[AT_CGMI] = IRI_CACHE_FOREVER;
+    satcom->cache_ttl_ms[AT_CGMM] = IRI_CACHE_FOREVER;
+    satcom->cache_ttl_ms[AT_CSQ] = IRI_CACHE_CSQ_TTL_MS;
+    satcom->cache_ttl_ms[AT_SBDSX] = IRI_CACHE_SBDSX_TTL_MS;
+    satcom->cache_ttl_ms[AT_SBDMTAQ] = IRI_CACHE_CONFIG_TTL_MS;
+    satcom->cache_persist = 1;
+    satcom->forecast_samples = IRI_FORECAST_SAMPLES;
+    satcom->forecast_horizon_ms = IRI_FORECAST_HORIZON_MS;
+    satcom->mt_dedup = 1;
+    satcom->mt_order_hold_ms = IRI_MT_ORDER_HOLD_MS;
+    satcom->reliable_ack_timeout_ms = IRI_RELIABLE_ACK_TIMEOUT_MS;
+    satcom->reliable_persist = 1;
+    satcom->budget_limits.reserve[IRI_PRIORITY_NORMAL] = IRI_BUDGET_RESERVE_NORMAL;
+    satcom->budget_limits.reserve[IRI_PRIORITY_BACKGROUND] = IRI_BUDGET_RESERVE_BACKGROUND;
+    satcom->budget_persist = 1;
+    satcom->command_echo = 1;
+    satcom->gpio_sleep_pin_number = -1;
+    satcom->gpio_net_pin_number = -1;
+    return satcom;
+}
+
+int iridium_is_available(iridium_t *satcom) {
+    if (satcom->gpio_net_pin_number != -1) {
+        return gpio_get_level(satcom->gpio_net_pin_number);
+    }
+    return -1;
+}
+
+/**
+ * @brief Modem specs.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_system_spec(iridium_t *satcom) {
+    /* AT system details */
+    iridium_result_t r;
+
+    r = iridium_query(satcom, AT_CGMI);
+    if (r.status != SAT_OK) {
+        return r.status;
+    }
+
+    r = iridium_query(satcom, AT_CGMM);
+    if (r.status != SAT_OK) {
+        return r.status;
+    }
+
+    return r.status;
+}
+
+/**
+ * @brief Compute the memory budget of the driver instance.
+ * @param satcom the iridium_t struct pointer.
+ * @param footprint the iridium_footprint_t to fill.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_footprint(iridium_t *satcom, iridium_footprint_t *footprint) {
+    if (satcom == NULL || footprint == NULL) {
+        return SAT_ERROR;
+    }
+    memset(footprint, 0, sizeof(iridium_footprint_t));
+
+    footprint->driver_struct = sizeof(iridium_t);
+    footprint->uart_rx_buffer = IRI_UART_RX_BUF_SIZE;
+    footprint->uart_tx_buffer = IRI_UART_TX_BUF_SIZE;
+    footprint->uart_event_queue = IRI_UART_EVENT_DEPTH * sizeof(uart_event_t);
+    footprint->rx_chunk_buffer = IRI_RD_BUF_SIZE;
+    footprint->command_queue = (IRI_QUEUE_URGENT_DEPTH + satcom->buffer_size + IRI_QUEUE_BACKGROUND_DEPTH) * 
+                               (sizeof(iridium_command_item_t) + sizeof(uint32_t)) + sizeof(struct dispatch_t);
+    footprint->message_queue = satcom->message_size * sizeof(iridium_message_t);
+    footprint->urc_queue = IRI_URC_QUEUE_DEPTH * sizeof(iridium_urc_event_t);
+    footprint->mt_window = satcom->mt_sequence != NULL ? 
+                           satcom->mt_sequence->depth * (sizeof(iridium_message_t) + sizeof(struct sequence_slot)) : 0;
+    footprint->outbox = satcom->outbox != NULL ? satcom->outbox->capacity + sizeof(struct outbox_t) +
+                        satcom->outbox->keys * (sizeof(struct outbox_slot) + satcom->outbox->value_max) : 0;
+    footprint->forecast = satcom->forecast != NULL ? 
+                          satcom->forecast->capacity * sizeof(struct forecast_sample) + sizeof(struct forecast_t) : 0;
+    footprint->reliable = satcom->reliable != NULL ? 
+                          satcom->reliable->slots * (satcom->reliable->payload_max + sizeof(struct reliable_entry)) + 
+                          sizeof(struct reliable_t) : 0;
+    footprint->budget = satcom->budget != NULL ? sizeof(struct budget_t) : 0;
+    footprint->task_stacks = satcom->task_message_stack_depth + 
+                             satcom->task_buffer_stack_depth + 
+                             satcom->task_uart_stack_depth + 
+                             satcom->task_urc_stack_depth + 
+                             (satcom->outbox != NULL || satcom->reliable != NULL ? satcom->task_window_stack_depth : 0);
+
+    /* ESP-IDF reports the high-water mark in bytes */
+    TaskHandle_t handles[5] = { satcom->task_message_handle, satcom->task_buffer_handle, 
+                                satcom->task_uart_handle, satcom->task_urc_handle, 
+                                satcom->task_window_handle };
+    for (int i = 0; i < 5; i++) {
+        if (handles[i] != NULL) {
+            footprint->task_stack_unused += uxTaskGetStackHighWaterMark(handles[i]);
+        }
+    }
+
+    footprint->heap_total = footprint->driver_struct + 
+                            footprint->uart_rx_buffer + 
+                            footprint->uart_tx_buffer + 
+                            footprint->uart_event_queue + 
+                            footprint->rx_chunk_buffer + 
+                            footprint->command_queue + 
+                            footprint->message_queue + 
+                            footprint->urc_queue + 
+                            footprint->mt_window + 
+                            footprint->outbox + 
+                            footprint->forecast + 
+                            footprint->reliable + 
+                            footprint->budget + 
+                            footprint->task_stacks;
+    footprint->heap_measured = satcom->heap_footprint;
+    return SAT_OK;
+}
+
+/**
+ * @brief Log the static and heap usage of the driver instance.
+ * @param satcom the iridium_t struct pointer.
+ */
+void iridium_footprint_report(iridium_t *satcom) {
+    iridium_footprint_t fp;
+    if (iridium_footprint(satcom, &fp) != SAT_OK) {
+        return;
+    }
+    ESP_LOGI(TAG_IRIDIUM, "FOOTPRINT[%s] iridium_t = %u", IRI_PROFILE_NAME, (unsigned)fp.driver_struct);
+    ESP_LOGI(TAG_IRIDIUM, "FOOTPRINT[%s] uart rx/tx/events = %u/%u/%u", IRI_PROFILE_NAME, 
+             (unsigned)fp.uart_rx_buffer, (unsigned)fp.uart_tx_buffer, (unsigned)fp.uart_event_queue);
+    ESP_LOGI(TAG_IRIDIUM, "FOOTPRINT[%s] rx chunk = %u", IRI_PROFILE_NAME, (unsigned)fp.rx_chunk_buffer);
+    ESP_LOGI(TAG_IRIDIUM, "FOOTPRINT[%s] queues command/message/urc = %u/%u/%u", IRI_PROFILE_NAME, 
+             (unsigned)fp.command_queue, (unsigned)fp.message_queue, (unsigned)fp.urc_queue);
+    ESP_LOGI(TAG_IRIDIUM, "FOOTPRINT[%s] mt window = %u", IRI_PROFILE_NAME, (unsigned)fp.mt_window);
+    ESP_LOGI(TAG_IRIDIUM, "FOOTPRINT[%s] outbox = %u", IRI_PROFILE_NAME, (unsigned)fp.outbox);
+    ESP_LOGI(TAG_IRIDIUM, "FOOTPRINT[%s] forecast = %u", IRI_PROFILE_NAME, (unsigned)fp.forecast);
+    ESP_LOGI(TAG_IRIDIUM, "FOOTPRINT[%s] reliable = %u", IRI_PROFILE_NAME, (unsigned)fp.reliable);
+    ESP_LOGI(TAG_IRIDIUM, "FOOTPRINT[%s] budget = %u", IRI_PROFILE_NAME, (unsigned)fp.budget);
+    ESP_LOGI(TAG_IRIDIUM, "FOOTPRINT[%s] task stacks = %u (unused %u)", IRI_PROFILE_NAME, 
+             (unsigned)fp.task_stacks, (unsigned)fp.task_stack_unused);
+    ESP_LOGI(TAG_IRIDIUM, "FOOTPRINT[%s] heap budget = %u measured = %u", IRI_PROFILE_NAME, 
+             (unsigned)fp.heap_total, (unsigned)fp.heap_measured);
+}
+
+/**
+ * @brief Copy the session metrics of the driver instance.
+ * @param satcom the iridium_t struct pointer.
+ * @param metrics the iridium_metrics_t to fill.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_metrics_snapshot(iridium_t *satcom, iridium_metrics_t *metrics) {
+    if (satcom == NULL || metrics == NULL) {
+        return SAT_ERROR;
+    }
+    pthread_mutex_lock(&satcom->p_metrics_mutex);
+    *metrics = satcom->metrics;
+    pthread_mutex_unlock(&satcom->p_metrics_mutex);
+
+    for (int i = 0; i < DISPATCH_CLASSES; i++) {
+        if (satcom->buffer_queue == NULL || dispatch_get_stats(satcom->buffer_queue, i, &metrics->queue[i]) != 0) {
+            memset(&metrics->queue[i], 0, sizeof(metrics->queue[i]));
+        }
+    }
+    metrics->uptime_ms = iridium_now_ms(satcom);
+    return SAT_OK;
+}
+
+/**
+ * @brief Clear the session metrics of the driver instance.
+ * @param satcom the iridium_t struct pointer.
+ */
+void iridium_metrics_reset(iridium_t *satcom) {
+    pthread_mutex_lock(&satcom->p_metrics_mutex);
+    memset(&satcom->metrics, 0, sizeof(satcom->metrics));
+    pthread_mutex_unlock(&satcom->p_metrics_mutex);
+}
+
+/**
+ * @brief Log a session metrics snapshot, usable as the metrics_callback.
+ * @param satcom the iridium_t struct pointer.
+ * @param metrics the snapshot to log.
+ */
+void iridium_metrics_report(iridium_t *satcom, const iridium_metrics_t *metrics) {
+    (void)satcom;
+    ESP_LOGI(TAG_IRIDIUM, "METRICS[%" PRIu32 "] bytes tx/rx = %" PRIu32 "/%" PRIu32 " overflows = %" PRIu32, 
+             metrics->uptime_ms, metrics->bytes_tx, metrics->bytes_rx, metrics->uart_overflows);
+    for (int i = 0; i < IRI_COMMAND_COUNT; i++) {
+        const struct histogram_t *h = &metrics->latency[i];
+        if (h->count == 0 && metrics->errors[i] == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG_IRIDIUM, "METRICS cmd[%d] ok = %" PRIu32 " err = %" PRIu32 " ms p50/p90/max = %" PRIu32 "/%" PRIu32 "/%" PRIu32, 
+                 i, h->count, metrics->errors[i], histogram_percentile(h, 50), histogram_percentile(h, 90), h->max);
+    }
+    ESP_LOGI(TAG_IRIDIUM, "METRICS sessions = %" PRIu32 " retries = %" PRIu32, metrics->sessions, metrics->retries);
+    for (int i = 0; i < IRI_MO_STATUS_COUNT; i++) {
+        if (metrics->session_mo[i] > 0) {
+            ESP_LOGI(TAG_IRIDIUM, "METRICS mo[%d] = %" PRIu32, i, metrics->session_mo[i]);
+        }
+    }
+    for (int i = 0; i < DISPATCH_CLASSES; i++) {
+        const struct dispatch_stats *q = &metrics->queue[i];
+        ESP_LOGI(TAG_IRIDIUM, "METRICS queue[%d] depth = %u high = %u rejected = %" PRIu32 " wait max = %" PRIu32, 
+                 i, (unsigned)q->depth, (unsigned)q->high_water, q->rejected, q->wait_ms_max);
+    }
+}
+
+/**
+ * @brief Copy the binary trace of the driver instance, oldest event first.
+ * @param satcom the iridium_t struct pointer.
+ * @param entries the storage for the events.
+ * @param max the number of entries.
+ * @param dropped the number of events lost to overwrites, can be NULL.
+ * @return the number of copied events.
+ */
+size_t iridium_trace_snapshot(iridium_t *satcom, struct trace_entry *entries, size_t max, uint32_t *dropped) {
+    return trace_snapshot(&satcom->trace, entries, max, dropped);
+}
+
+/**
+ * @brief Log the binary trace as IRTRACE hex lines for tools/iridium_trace.
+ * @param satcom the iridium_t struct pointer.
+ */
+void iridium_trace_dump(iridium_t *satcom) {
+    struct trace_entry *entries = malloc(IRI_TRACE_DEPTH * sizeof(struct trace_entry));
+    if (entries == NULL) {
+        return;
+    }
+    struct trace_header header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.entry_size = sizeof(struct trace_entry);
+    header.count = trace_snapshot(&satcom->trace, entries, IRI_TRACE_DEPTH, &header.dropped);
+
+    /* header then entries, 32 bytes per line */
+    char hex[2 * sizeof(struct trace_entry) + 1];
+    const uint8_t *bytes = (const uint8_t *)&header;
+    for (size_t i = 0; i < sizeof(header); i++) {
+        snprintf(hex + 2 * i, 3, "%02x", bytes[i]);
+    }
+    ESP_LOGI(TAG_IRIDIUM, "IRTRACE:%s", hex);
+    for (uint32_t n = 0; n < header.count; n++) {
+        bytes = (const uint8_t *)&entries[n];
+        for (size_t i = 0; i < sizeof(struct trace_entry); i++) {
+            snprintf(hex + 2 * i, 3, "%02x", bytes[i]);
+        }
+        ESP_LOGI(TAG_IRIDIUM, "IRTRACE:%s", hex);
+    }
+    free(entries);
+}
+
+/**
+ * @brief Record all UART bytes in both directions into a capture (tools/iridium_replay).
+ * @param satcom the iridium_t struct pointer.
+ * @param capture an initialized capture writer, must stay valid until iridium_capture_stop().
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ * @note call after iridium_config(), the capture lock is created there.
+ */
+iridium_status_t iridium_capture_start(iridium_t *satcom, struct capture_t *capture) {
+    if (satcom == NULL || capture == NULL) {
+        return SAT_ERROR;
+    }
+    pthread_mutex_lock(&satcom->p_capture_mutex);
+    if (satcom->capture != NULL) {
+        pthread_mutex_unlock(&satcom->p_capture_mutex);
+        return SAT_ERROR;
+    }
+    __atomic_store_n(&satcom->capture, capture, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&satcom->p_capture_mutex);
+    return SAT_OK;
+}
+
+/**
+ * @brief Stop recording, the capture writer can be closed afterwards.
+ * @param satcom the iridium_t struct pointer.
+ */
+void iridium_capture_stop(iridium_t *satcom) {
+    /* TX records come from the caller and buffer tasks, RX records from the UART task, any of
+       them holds the lock for its whole record, so none is left in flight once it is ours */
+    pthread_mutex_lock(&satcom->p_capture_mutex);
+    __atomic_store_n(&satcom->capture, NULL, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&satcom->p_capture_mutex);
+}
+
+/**
+ * @brief Drive the SLP pin low if the modem is idle long enough.
+ * @param satcom the iridium_t struct pointer.
+ * @param idle_ms the time since the last completion required, 0 for any.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+static iridium_status_t iridium_power_sleep(iridium_t *satcom, uint32_t idle_ms) {
+    iridium_status_t status = SAT_ERROR;
+
+    pthread_mutex_lock(&satcom->p_status_mutex);
+    /* a command still queued would have to wake the modem right away */
+    if (satcom->gpio_sleep_pin_number != -1 && 
+        satcom->power_state == IRI_POWER_IDLE && satcom->status == IQS_OPEN && 
+        satcom->power_hold == 0 && dispatch_size(satcom->buffer_queue) == 0 && 
+        iridium_now_ms(satcom) - satcom->power_active_ms >= idle_ms && 
+        gpio_set_level(satcom->gpio_sleep_pin_number, IRI_GPIO_SLP_OFF) == ESP_OK) {
+        iridium_power_enter(satcom, IRI_POWER_SLEEP);
+        satcom->power.sleeps++;
+        status = SAT_OK;
+    }
+    pthread_mutex_unlock(&satcom->p_status_mutex);
+    if (status == SAT_OK) {
+        /* the MO buffer is lost with the power, the signal is unknown after the wake */
+        iridium_cache_drop(satcom, (1u << AT_SBDSX) | (1u << AT_CSQ));
+    }
+    return status;
+}
+
+/**
+ * @brief Write a command straight to the modem while it wakes, bypassing the queue.
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command.
+ * @param rdata the raw data.
+ * @param timeout_ms the maximum time to wait for the final result code.
+ * @return the iridium_error_t of the command, IRI_ERR_TIMEOUT when the modem did not answer,
+ *         IRI_ERR_QUEUE_FULL when the line stayed busy for timeout_ms and nothing was written.
+ */
+static iridium_error_t iridium_power_command(iridium_t *satcom, iridium_command_t command, char *rdata, int timeout_ms) {
+    iridium_command_item_t msg;
+    iridium_error_t error = iridium_build_message(satcom, command, rdata, NULL, 0, &msg);
+    if (error != IRI_ERR_NONE) {
+        return error;
+    }
+
+    /* the queue is held while waking, only a command written before the sleep can still be out */
+    uint32_t start = iridium_now_ms(satcom);
+    pthread_mutex_lock(&satcom->p_status_mutex);
+    while (satcom->status != IQS_OPEN) {
+        pthread_mutex_unlock(&satcom->p_status_mutex);
+        if ((int32_t)(iridium_now_ms(satcom) - start) >= timeout_ms) {
+            return IRI_ERR_QUEUE_FULL;
+        }
+        iridium_sleep_ms(satcom, IRI_BUFF_DELAY);
+        pthread_mutex_lock(&satcom->p_status_mutex);
+    }
+    satcom->status = IQS_WAITING;
+    pthread_mutex_unlock(&satcom->p_status_mutex);
+
+    iridium_write_message(satcom, &msg);
+    iridium_completion_t done;
+    if (iridium_wait_completion(satcom, msg.nonce, timeout_ms, IRI_BUFF_DELAY, &done, NULL, 0) != SAT_OK) {
+        /* still booting, release the modem for the next probe */
+        iridium_complete(satcom, msg.nonce, IRI_ERR_TIMEOUT, -1, -1);
+        iridium_wait_completion(satcom, msg.nonce, 0, IRI_BUFF_DELAY, &done, NULL, 0);
+        return IRI_ERR_TIMEOUT;
+    }
+    return done.error;
+}
+
+/**
+ * @brief Drive the SLP pin high, probe until the modem answers and restore its settings.
+ * @param satcom the iridium_t struct pointer.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when the modem did not answer.
+ * @note only one caller wakes the modem, the others find it waking and queue behind it.
+ */
+static iridium_status_t iridium_power_wake(iridium_t *satcom) {
+    pthread_mutex_lock(&satcom->p_status_mutex);
+    if (satcom->power_state != IRI_POWER_SLEEP) {
+        pthread_mutex_unlock(&satcom->p_status_mutex);
+        return SAT_OK;
+    }
+    iridium_power_enter(satcom, IRI_POWER_WAKING);
+    satcom->power.wakes++;
+    pthread_mutex_unlock(&satcom->p_status_mutex);
+
+    uint32_t start = iridium_now_ms(satcom);
+    gpio_set_level(satcom->gpio_sleep_pin_number, IRI_GPIO_SLP_ON);
+
+    /* the modem boots with its stored profile, probe instead of a fixed delay */
+    satcom->echo_enabled = -1;
+    iridium_status_t status = SAT_ERROR;
+    while ((int32_t)(iridium_now_ms(satcom) - start) < IRI_POWER_WAKE_TIMEOUT_MS) {
+        /* ERROR is an answer too, a probe that was never written is not */
+        iridium_error_t error = iridium_power_command(satcom, AT, NULL, IRI_POWER_PROBE_MS);
+        if (error == IRI_ERR_NONE || error == IRI_ERR_MODEM) {
+            status = SAT_OK;
+            break;
+        }
+    }
+    uint32_t wake_ms = iridium_now_ms(satcom) - start;
+
+    if (status == SAT_OK) {
+        if (iridium_power_command(satcom, AT_E, satcom->command_echo ? "1" : "0", 
+                                  iridium_command_timeout_ms(AT_E)) == IRI_ERR_NONE) {
+            satcom->echo_enabled = satcom->command_echo ? 1 : 0;
+        }
+        if (satcom->indicators_enabled == 1) {
+            iridium_power_command(satcom, AT_CIER, "1,1,1", iridium_command_timeout_ms(AT_CIER));
+        }
+        ESP_LOGI(TAG_IRIDIUM, "POWER_WAKE = %" PRIu32 " ms", wake_ms);
+    } else {
+        /* queued commands run into their own timeouts */
+        ESP_LOGE(TAG_IRIDIUM, "POWER_WAKE_FAILED after %" PRIu32 " ms", wake_ms);
+    }
+
+    pthread_mutex_lock(&satcom->p_status_mutex);
+    if (status == SAT_OK) {
+        histogram_record(&satcom->power.wake_latency, wake_ms);
+    } else {
+        satcom->power.wake_failures++;
+    }
+    satcom->power_active_ms = iridium_now_ms(satcom);
+    iridium_power_enter(satcom, IRI_POWER_IDLE);
+    pthread_mutex_unlock(&satcom->p_status_mutex);
+
+    iridium_dispatch_next(satcom);
+    return status;
+}
+
+/**
+ * @brief Put the modem to sleep through the SLP pin, only when it is idle.
+ * @param satcom the iridium_t struct pointer.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when busy, held or no SLP pin is set.
+ */
+iridium_status_t iridium_modem_sleep(iridium_t *satcom) {
+    return iridium_power_sleep(satcom, 0);
+}
+
+/**
+ * @brief Wake the modem and wait until it answers AT.
+ * @param satcom the iridium_t struct pointer.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_modem_wake(iridium_t *satcom) {
+    if (satcom->gpio_sleep_pin_number == -1) {
+        return SAT_ERROR;
+    }
+    iridium_status_t status = iridium_power_wake(satcom);
+
+    /* another caller may be waking it, wait for the result */
+    while (satcom->power_state == IRI_POWER_WAKING) {
+        iridium_sleep_ms(satcom, IRI_BUFF_DELAY);
+    }
+    return status;
+}
+
+/**
+ * @brief Keep the modem awake across a sequence of commands (e.g. +SBDWB then +SBDIX).
+ * @param satcom the iridium_t struct pointer.
+ */
+void iridium_power_hold(iridium_t *satcom) {
+    pthread_mutex_lock(&satcom->p_status_mutex);
+    satcom->power_hold++;
+    pthread_mutex_unlock(&satcom->p_status_mutex);
+}
+
+/**
+ * @brief Release a iridium_power_hold(), the idle timeout starts again.
+ * @param satcom the iridium_t struct pointer.
+ */
+void iridium_power_release(iridium_t *satcom) {
+    pthread_mutex_lock(&satcom->p_status_mutex);
+    if (satcom->power_hold > 0) {
+        satcom->power_hold--;
+    }
+    satcom->power_active_ms = iridium_now_ms(satcom);
+    pthread_mutex_unlock(&satcom->p_status_mutex);
+}
+
+/**
+ * @brief Copy the power accounting, time and estimated energy per state.
+ * @param satcom the iridium_t struct pointer.
+ * @param stats the iridium_power_stats_t to fill.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_power_stats(iridium_t *satcom, iridium_power_stats_t *stats) {
+    static const uint32_t draw_ua[IRI_POWER_STATES] = {
+        IRI_POWER_SLEEP_UA, IRI_POWER_IDLE_UA, IRI_POWER_IDLE_UA, IRI_POWER_SESSION_UA
+    };
+    if (stats == NULL) {
+        return SAT_ERROR;
+    }
+
+    pthread_mutex_lock(&satcom->p_status_mutex);
+    *stats = satcom->power;
+    stats->state = satcom->power_state;
+    stats->time_ms[stats->state] += iridium_now_ms(satcom) - satcom->power_since_ms;
+    pthread_mutex_unlock(&satcom->p_status_mutex);
+
+    /* uA x mV x ms = pJ */
+    stats->energy_total_uj = 0;
+    for (int i = 0; i < IRI_POWER_STATES; i++) {
+        stats->energy_uj[i] = (uint64_t)stats->time_ms[i] * draw_ua[i] * IRI_POWER_SUPPLY_MV / 1000000;
+        stats->energy_total_uj += stats->energy_uj[i];
+    }
+    return SAT_OK;
+}
+
+/**
+ * @brief Read the Iridium system time (AT-MSSTM) and sync the clock offset.
+ * @param satcom the iridium_t struct pointer.
+ * @return a iridium_result_t with metadata, IRI_ERR_NO_SERVICE without network.
+ */
+iridium_result_t iridium_time_sync(iridium_t *satcom) {
+    return iridium_send(satcom, AT_MSSTM, NULL, true, 500);
+}
+
+/**
+ * @brief The current UTC time from the last sync, no modem traffic.
+ * @param satcom the iridium_t struct pointer.
+ * @param utc_ms the UTC time in ms since the Unix epoch.
+ * @param age_ms the time since the sync, can be NULL.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR before the first sync.
+ */
+iridium_status_t iridium_time_utc_ms(iridium_t *satcom, uint64_t *utc_ms, uint32_t *age_ms) {
+    const struct vclock_t *clock = iridium_clock(satcom);
+    uint64_t now_us = clock->now_us(clock);
+
+    pthread_mutex_lock(&satcom->p_metrics_mutex);
+    iridium_time_t time = satcom->time;
+    pthread_mutex_unlock(&satcom->p_metrics_mutex);
+    if (!time.valid) {
+        return SAT_ERROR;
+    }
+
+    /* extrapolate from the sync, corrected by the measured drift of the local clock */
+    int64_t elapsed_us = (int64_t)(now_us - time.local_us);
+    elapsed_us += elapsed_us / 1000000 * time.drift_ppm;
+    *utc_ms = time.utc_ms + elapsed_us / 1000;
+    if (age_ms != NULL) {
+        *age_ms = (uint32_t)((now_us - time.local_us) / 1000);
+    }
+    return SAT_OK;
+}
+
+/**
+ * @brief Predict the best time to start a session from the signal history.
+ * @param satcom the iridium_t struct pointer.
+ * @param horizon_ms the longest acceptable wait.
+ * @param estimate the forecast_estimate to fill (delay, success probability, trend, pass period).
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when the forecast is off or has no samples.
+ */
+iridium_status_t iridium_forecast(iridium_t *satcom, uint32_t horizon_ms, struct forecast_estimate *estimate) {
+    if (satcom->forecast == NULL || estimate == NULL || 
+        forecast_predict(satcom->forecast, iridium_now_ms(satcom), horizon_ms, estimate) != 0) {
+        return SAT_ERROR;
+    }
+    return SAT_OK;
+}
+
+/**
+ * @brief Run a query command through the cache, the modem is asked on a miss or an expired entry.
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command.
+ * @param buffer the response text, NULL for the result field.
+ * @param size the buffer size.
+ * @return a iridium_result_t with metadata, latency_ms 0 on a hit.
+ */
+static iridium_result_t iridium_query_command(iridium_t *satcom, iridium_command_t command, char *buffer, size_t size) {
+    iridium_result_t result;
+    iridium_result_reset(&result);
+    if (command < 0 || command >= IRI_COMMAND_COUNT) {
+        result.error = IRI_ERR_INVALID_ARG;
+        return result;
+    }
+    int ttl_ms = satcom->cache_ttl_ms[command];
+    if (ttl_ms == IRI_CACHE_OFF) {
+        return iridium_send_command(satcom, command, NULL, NULL, 0, IRI_PRIORITY_NORMAL, true, 500, buffer, size);
+    }
+    char *text = buffer != NULL ? buffer : result.result;
+    size_t text_size = buffer != NULL ? size : sizeof(result.result);
+
+    pthread_mutex_lock(&satcom->p_cache_mutex);
+    iridium_cache_entry_t *entry = iridium_cache_slot(satcom, command, 0);
+    if (entry != NULL && ttl_ms != IRI_CACHE_FOREVER && iridium_now_ms(satcom) - entry->stored_ms >= (uint32_t)ttl_ms) {
+        entry->valid = 0;
+        entry = NULL;
+        satcom->cache_stats.expired++;
+    }
+    if (entry != NULL) {
+        satcom->cache_stats.hits++;
+        satcom->cache_stats.command_hits[command]++;
+        iridium_copy_text(text, text_size, entry->result, entry->length);
+        result.length = entry->length;
+        result.status = SAT_OK;
+        pthread_mutex_unlock(&satcom->p_cache_mutex);
+        return result;
+    }
+    satcom->cache_stats.misses++;
+    satcom->cache_stats.command_misses[command]++;
+    uint32_t epoch = satcom->cache_epoch[command];
+    pthread_mutex_unlock(&satcom->p_cache_mutex);
+
+    result = iridium_send_command(satcom, command, NULL, NULL, 0, IRI_PRIORITY_NORMAL, true, 500, buffer, size);
+    /* only a whole answer is cached, a buffer too small for it holds part of it */
+    if (result.status != SAT_OK || result.length >= text_size) {
+        return result;
+    }
+
+    pthread_mutex_lock(&satcom->p_cache_mutex);
+    /* dropped while the modem answered, the answer may already be stale */
+    int stored = satcom->cache_epoch[command] == epoch && iridium_cache_store(satcom, command, text, result.length);
+    pthread_mutex_unlock(&satcom->p_cache_mutex);
+    if (stored && ttl_ms == IRI_CACHE_FOREVER) {
+        iridium_cache_persist(satcom, command, text);
+    }
+    return result;
+}
+
+/**
+ * @brief Run a query command through the cache, the modem is asked on a miss or an expired entry.
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command, e.g. AT_CGMI, AT_CSQ, AT_SBDSX.
+ * @return a iridium_result_t with metadata, latency_ms 0 on a hit.
+ */
+iridium_result_t iridium_query(iridium_t *satcom, iridium_command_t command) {
+    return iridium_query_command(satcom, command, NULL, 0);
+}
+
+/**
+ * @brief Run a query command through the cache with the response text in a caller buffer.
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command, e.g. AT_CGMI, AT_CSQ, AT_SBDSX.
+ * @param buffer the response text, always terminated, may be NULL when size is 0.
+ * @param size the buffer size.
+ * @return a iridium_result_t with metadata, latency_ms 0 on a hit, length >= size when the text did not fit the buffer.
+ */
+iridium_result_t iridium_query_into(iridium_t *satcom, iridium_command_t command, char *buffer, size_t size) {
+    /* only the length is wanted, nothing is written with size 0 */
+    char none[1];
+    if (buffer == NULL || size == 0) {
+        buffer = none;
+        size = 0;
+    }
+    return iridium_query_command(satcom, command, buffer, size);
+}
+
+/**
+ * @brief Drop the cached answer of a command, NVS included.
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command, IRI_COMMAND_COUNT for all.
+ */
+void iridium_cache_invalidate(iridium_t *satcom, iridium_command_t command) {
+    uint32_t mask = command == IRI_COMMAND_COUNT ? (1u << IRI_COMMAND_COUNT) - 1 : 1u << command;
+    iridium_cache_drop(satcom, mask);
+    for (int i = 0; i < IRI_COMMAND_COUNT; i++) {
+        if ((mask & (1u << i)) && satcom->cache_ttl_ms[i] == IRI_CACHE_FOREVER) {
+            iridium_cache_persist(satcom, (iridium_command_t)i, NULL);
+        }
+    }
+}
+
+/**
+ * @brief Copy the query cache counters.
+ * @param satcom the iridium_t struct pointer.
+ * @param stats the iridium_cache_stats_t to fill.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_cache_stats(iridium_t *satcom, iridium_cache_stats_t *stats) {
+    if (satcom == NULL || stats == NULL) {
+        return SAT_ERROR;
+    }
+    pthread_mutex_lock(&satcom->p_cache_mutex);
+    *stats = satcom->cache_stats;
+    pthread_mutex_unlock(&satcom->p_cache_mutex);
+    return SAT_OK;
+}
+
+/**
+ * @brief Whether a transmit window is due, on the cadence, a deadline, the byte threshold or a request.
+ * @param satcom the iridium_t struct pointer.
+ * @param now the current time in ms.
+ * @return true when a window should open.
+ */
+static bool iridium_window_due(iridium_t *satcom, uint32_t now) {
+    if (satcom->window_request) {
+        return true;
+    }
+    /* an empty outbox skips the window, nothing would be worth a session */
+    outbox_expire(satcom->outbox, now);
+    if (outbox_count(satcom->outbox) == 0 || (int32_t)(now - satcom->window_retry_ms) < 0) {
+        return false;
+    }
+    if (satcom->window_interval_ms > 0 && (int32_t)(now - satcom->window_next_ms) >= 0) {
+        return true;
+    }
+    if (satcom->window_bytes > 0 && outbox_frame_bytes(satcom->outbox) >= (size_t)satcom->window_bytes) {
+        return true;
+    }
+    uint32_t deadline;
+    return outbox_next_deadline(satcom->outbox, now, &deadline) == 0 && (int32_t)(now - deadline) >= 0;
+}
+
+/**
+ * @brief Read the MT message of a session into the message queue.
+ * @param satcom the iridium_t struct pointer.
+ * @param result the iridium_result_t of the +SBDIX session.
+ * @return 1 when a message was read, 0 otherwise.
+ */
+static uint32_t iridium_window_mt(iridium_t *satcom, iridium_result_t *result) {
+    if (result->mt_status != MT_SBD_MESSAGE_SUCCESSFULLY_RECEIVED) {
+        return 0;
+    }
+    return iridium_send(satcom, AT_SBDRT, NULL, true, 500).status == SAT_OK ? 1 : 0;
+}
+
+/**
+ * @brief Run a transmit window, wake, flush the outbox in as few sessions as possible, drain MT, sleep.
+ * @param satcom the iridium_t struct pointer.
+ */
+static void iridium_window_run(iridium_t *satcom) {
+    uint32_t start = iridium_now_ms(satcom);
+    uint32_t sessions = 0, frames = 0, records = 0, mt = 0;
+    bool failed = false;
+    satcom->window_request = 0;
+
+    /* the MO buffer is owned for the whole window */
+    pthread_mutex_lock(&satcom->p_mo_mutex);
+    iridium_power_hold(satcom);
+    if (satcom->gpio_sleep_pin_number != -1) {
+        iridium_modem_wake(satcom);
+    }
+
+    /* no signal, don't spend sessions on it */
+    iridium_result_t result = iridium_send(satcom, AT_CSQ, NULL, true, 500);
+    if (result.status != SAT_OK || satcom->signal_strength == 0) {
+        failed = true;
+    }
+
+    /* every frame carries as many records as fit the MO buffer */
+    uint8_t frame[IRI_SBD_MO_MAX];
+    while (!failed) {
+        size_t count = 0;
+        size_t length = outbox_pack(satcom->outbox, iridium_now_ms(satcom), frame, sizeof(frame), &count);
+        if (length == 0) {
+            break;
+        }
+        result = iridium_write_binary(satcom, frame, length);
+        if (result.status == SAT_OK) {
+            result = iridium_session_retry(satcom, IRI_PRIORITY_NORMAL, &sessions);
+        }
+        if (result.status != SAT_OK) {
+            failed = true;
+            break;
+        }
+        outbox_commit(satcom->outbox, count);
+        frames++;
+        records += count;
+        mt += iridium_window_mt(satcom, &result);
+    }
+
+    /* MT still queued at the gateway, clear the MO buffer so the last frame isn't sent twice */
+    if (!failed && satcom->messages_waiting > 0 && 
+        iridium_send(satcom, AT_SBDD, "0", true, 500).status == SAT_OK) {
+        for (int i = 0; i < satcom->message_size && satcom->messages_waiting > 0; i++) {
+            result = iridium_session_retry(satcom, IRI_PRIORITY_NORMAL, &sessions);
+            if (result.status != SAT_OK || iridium_window_mt(satcom, &result) == 0) {
+                break;
+            }
+            mt++;
+        }
     }
 
-    if (wait_response) {
-        iridium_queue_status_t t_status = IQS_NONE;
-        while (t_status != IQS_OPEN && satcom->p_nonce == t_nonce) {
-            vTaskDelay(pdMS_TO_TICKS(wait_interval));
-            t_status = iridium_get_iqs(satcom);
-        }
+    iridium_power_release(satcom);
+    pthread_mutex_unlock(&satcom->p_mo_mutex);
+    if (satcom->gpio_sleep_pin_number != -1) {
+        iridium_modem_sleep(satcom);
+    }
 
-        strcpy(result.result, satcom->buffer_data);
-        ESP_LOGI(TAG_IRIDIUM, "WAIT_DONE_NONCE = [%d]", t_nonce);
+    uint32_t now = iridium_now_ms(satcom);
+    uint32_t duration = now - start;
+    satcom->window_next_ms = start + satcom->window_interval_ms;
+    if (failed) {
+        satcom->window_retry_ms = now + iridium_forecast_delay(satcom, IRI_WINDOW_RETRY_MS);
     }
 
-    result.status = SAT_OK;
-    return result;
-}
+    pthread_mutex_lock(&satcom->p_metrics_mutex);
+    iridium_window_stats_t *stats = &satcom->window;
+    stats->windows++;
+    stats->failed += failed ? 1 : 0;
+    stats->sessions += sessions;
+    stats->frames += frames;
+    stats->records += records;
+    stats->mt_messages += mt;
+    stats->last_sessions = sessions;
+    if (sessions > stats->max_sessions) {
+        stats->max_sessions = sessions;
+    }
+    histogram_record(&stats->duration_ms, duration);
+    pthread_mutex_unlock(&satcom->p_metrics_mutex);
 
-void ring_satcom_task(void *pvParameters) { 
-    iridium_t* satcom = (iridium_t *)pvParameters;
-    vTaskDelay(pdMS_TO_TICKS(1000));
+    ESP_LOGI(TAG_IRIDIUM, "WINDOW %" PRIu32 " ms sessions = %" PRIu32 " frames = %" PRIu32 " records = %" PRIu32 " mt = %" PRIu32 "%s", 
+             duration, sessions, frames, records, mt, failed ? " FAILED" : "");
+}
 
-    iridium_result_t rcris = iridium_send(satcom, AT_CRIS, NULL, true, 500);
-    if (rcris.status == SAT_OK) { }
+/**
+ * @brief Copy the MT sequence window counters, duplicates dropped and MTMSN gaps seen.
+ * @param satcom the iridium_t struct pointer.
+ * @param stats the sequence_stats to fill.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when the window is off.
+ */
+iridium_status_t iridium_mt_stats(iridium_t *satcom, struct sequence_stats *stats) {
+    if (satcom->mt_sequence == NULL || stats == NULL) {
+        return SAT_ERROR;
+    }
+    sequence_get_stats(satcom->mt_sequence, stats);
+    return SAT_OK;
+}
 
-    for(;;) {
-        iridium_result_t r1 = iridium_send(satcom, AT_SBDIXA, "", true, 500);
-        if (r1.status == SAT_OK) {
-            ESP_LOGI(TAG_IRIDIUM, "RST_R1[%d] = %s", r1.status, r1.result);
+/**
+ * @brief Send the queued and resend the unacknowledged messages now, one session each.
+ * @param satcom the iridium_t struct pointer.
+ * @return the number of frames sent, -1 when a session failed or reliable delivery is off.
+ */
+int iridium_reliable_flush(iridium_t *satcom) {
+    if (satcom->reliable == NULL) {
+        return -1;
+    }
+    int frames = 0;
+    bool failed = false;
+
+    /* the MO buffer is owned for the whole flush */
+    pthread_mutex_lock(&satcom->p_mo_mutex);
+    iridium_power_hold(satcom);
+
+    /* one frame per session so a lost frame costs only its own resend */
+    uint8_t frame[IRI_SBD_MO_MAX];
+    uint16_t seq;
+    size_t length;
+    while ((length = reliable_next(satcom->reliable, iridium_now_ms(satcom), frame, sizeof(frame), &seq)) > 0) {
+        iridium_result_t result = iridium_write_binary(satcom, frame, length);
+        if (result.status == SAT_OK) {
+            result = iridium_session_retry(satcom, IRI_PRIORITY_NORMAL, NULL);
         }
-        if (satcom->status_outbound == MO_TRANSFERRED_SUCCESSFULLY ||
-            satcom->status_outbound == MO_TRANSFERRED_SUCCESSFULLY_TOO_BIG ||
-            satcom->status_outbound == MO_TRANSFERRED_SUCCESSFULLY_LOC_NOT_ACCEPTED) {
-            if (satcom->messages_waiting == 0) {
-                break;
-            }
-            vTaskDelay(pdMS_TO_TICKS(5000));
-            iridium_result_t r2 = iridium_send(satcom, AT_SBDRT, NULL, true, 500);
-            if (r2.status == SAT_OK) {
-                ESP_LOGI(TAG_IRIDIUM, "RST_R2[%d] = %s", r2.status, r2.result);
-            }
+        if (result.status != SAT_OK) {
+            failed = true;
+            break;
         }
-        vTaskDelay(pdMS_TO_TICKS(10000));
+        reliable_sent(satcom->reliable, seq, iridium_now_ms(satcom));
+        frames++;
+        /* an acknowledgement is read like any MT message */
+        iridium_window_mt(satcom, &result);
     }
 
-    iridium_result_t r2 = iridium_send(satcom, AT_SBDRT, NULL, true, 500);
-    if (r2.status == SAT_OK) {
-        ESP_LOGI(TAG_IRIDIUM, "RST_R3[%d] = %s", r2.status, r2.result);
+    /* a ring drain would otherwise send the last frame again */
+    if (frames > 0) {
+        iridium_send(satcom, AT_SBDD, "0", true, 500);
     }
 
-    satcom->ring_task_running = 0;
-    vTaskDelete(NULL);
-}
+    iridium_power_release(satcom);
+    pthread_mutex_unlock(&satcom->p_mo_mutex);
 
-void uart_satcom_task(void *pvParameters) { 
-    iridium_t* satcom = (iridium_t *)pvParameters;
-    uint8_t* dtmp = (uint8_t*) malloc(IRI_RD_BUF_SIZE);
-    uart_event_t event;
-    struct stack_t *s = newStack();
-    for(;;) {
-        if(xQueueReceive(satcom->uart_queue, (void * )&event, (portTickType)portMAX_DELAY)) {
-            bzero(dtmp, IRI_RD_BUF_SIZE);
-            switch(event.type) {
-                case UART_DATA:
-                    uart_read_bytes(satcom->uart_number, dtmp, event.size, portMAX_DELAY);
-                    
-                    ESP_LOGI(TAG_IRIDIUM, "R:%s-", dtmp);
-
-                    char* pch = NULL;
-                    pch = strtok((char*)dtmp, "\r\n");
-                    while (pch != NULL) {
-                        /* AT Command Check */
-                        if (startsWith("AT", pch)) {
-                            push(s, pch);
-                        } else {
-                            if (strcmp("SBDRING", pch) == 0) {
-                                if (satcom->ring_task_running == 0) {
-                                    satcom->ring_task_running = 1;
-                                    xTaskCreate(&ring_satcom_task, 
-                                                "ring_satcom_task", 
-                                                4096,
-                                                satcom, 
-                                                12, NULL);
-                                }
-                                break;
-                            }
-                            if (strcmp ("ERROR", pch) == 0) {
-                                continue;
-                            }
-                            if (strcmp ("OK", pch) == 0) {
-                                // Process 
-                                char data[100];
-                                char command[20];
-
-                                data[0] = '\0';
-
-                                while (top(s) != NULL) {
-                                    // Grab top value / pop
-                                    char* tmp = top(s);
-
-                                    ESP_LOGI(TAG_IRIDIUM, "TMP:[%s]", tmp); 
-                                    if (startsWith("AT", tmp)) {
-                                         strcpy(command, tmp);
-                                    } else {
-                                        strcat(data, tmp);
-                                    }  
-                                    pop(s);
-                                }
-
-                                ESP_LOGI(TAG_IRIDIUM, "P: %s = %s", command, data);
-                                strcpy(satcom->buffer_data, data);
-
-                                if (iridium_satcom_process_result(satcom, command, data) == SAT_OK) {
-                                    ESP_LOGI(TAG_IRIDIUM, "OK_R[%d]: %s = %s ", satcom->p_nonce, command, pch); 
-                                } else {
-                                    ESP_LOGI(TAG_IRIDIUM, "ERROR_R[%d]: %s = %s ", satcom->p_nonce, command, pch); 
-                                }
-                                /* Clean up after AT processing */
-                                clear_stack(s);
-                                iridium_update_iqs(satcom, IQS_OPEN);
-                            } else {
-                                push(s, pch); 
-                            }
-                        }
-                        pch = strtok(NULL, "\r\n");
-                    }
-                    break;
-                case UART_FIFO_OVF:
-                    uart_flush_input(satcom->uart_number);
-                    xQueueReset(satcom->uart_queue);
-                    break;
-                case UART_BUFFER_FULL:
-                    uart_flush_input(satcom->uart_number);
-                    xQueueReset(satcom->uart_queue);
-                    break;
-                case UART_BREAK:
-                    break;
-                case UART_PARITY_ERR:
-                    break;
-                case UART_FRAME_ERR:
-                    break;
-                case UART_PATTERN_DET:
-                    break;
-                default:
-                    break;
-            }
-        }
+    satcom->reliable_retry_ms = iridium_now_ms(satcom);
+    if (failed) {
+        satcom->reliable_retry_ms += iridium_forecast_delay(satcom, IRI_WINDOW_RETRY_MS);
     }
-    free(dtmp);
-    dtmp = NULL;
-    destroy_stack(&s);
-    vTaskDelete(NULL);
+    ESP_LOGI(TAG_IRIDIUM, "RELIABLE frames = %d pending = %u%s", frames, 
+             (unsigned)reliable_count(satcom->reliable), failed ? " FAILED" : "");
+    return failed ? -1 : frames;
 }
 
-void buffer_satcom_task(void *pvParameters) { 
+void window_satcom_task(void *pvParameters) { 
     iridium_t* satcom = (iridium_t *)pvParameters;
-    iridium_queue_status_t t_status = IQS_NONE;
-
     int delay_ms = satcom->buffer_delay_ms;
-    for(;;) {
-        /* waiting for buffer message event */
-        t_status = iridium_get_iqs(satcom);
-        if (t_status == IQS_OPEN) {
-            iridium_message_t rcv_msg;
-            if (xQueueReceive(satcom->buffer_queue, (void *)&rcv_msg, 0) == pdTRUE) {
-                ESP_LOGI(TAG_IRIDIUM, "SENT_TO_UART_FROM_BUFFER[%d] = %s", rcv_msg.nonce, rcv_msg.data);
-                iridium_send_raw(satcom, rcv_msg.data, rcv_msg.nonce);
-            }
+
+    while (!satcom->stopping) {
+        uint32_t now = iridium_now_ms(satcom);
+        if (satcom->outbox != NULL && iridium_window_due(satcom, now)) {
+            iridium_window_run(satcom);
         }
-        vTaskDelay(pdMS_TO_TICKS(delay_ms));
+        if (satcom->reliable != NULL && (int32_t)(now - satcom->reliable_retry_ms) >= 0 && 
+            reliable_due(satcom->reliable, now)) {
+            iridium_reliable_flush(satcom);
+        }
+        iridium_sleep_ms(satcom, delay_ms);
     }
+    iridium_task_exit(satcom);
     vTaskDelete(NULL);
-} 
+}
 
-void message_satcom_task(void *pvParameters) { 
-    iridium_t* satcom = (iridium_t *)pvParameters;
-    int delay_ms = satcom->buffer_delay_ms;
+/**
+ * @brief Queue a message for reliable delivery, it is resent until the backend acknowledges it.
+ * @param satcom the iridium_t struct pointer.
+ * @param data the message bytes.
+ * @param size the message size, 1 to IRI_SBD_MO_MAX - RELIABLE_HEADER bytes.
+ * @param seq the sequence number the acknowledgement refers to, can be NULL.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when every slot is taken or reliable delivery is off.
+ */
+iridium_status_t iridium_reliable_send(iridium_t *satcom, const uint8_t *data, size_t size, uint16_t *seq) {
+    if (satcom->reliable == NULL) {
+        return SAT_ERROR;
+    }
+    int pushed = reliable_push(satcom->reliable, data, size);
+    if (pushed < 0) {
+        return SAT_ERROR;
+    }
+    if (seq != NULL) {
+        *seq = (uint16_t)pushed;
+    }
+    return SAT_OK;
+}
 
-    for(;;) {
-        iridium_message_t rcv_msg;
-        if (xQueueReceive(satcom->message_queue, (void *)&rcv_msg, 0) == pdTRUE) {
-           satcom->message_callback(satcom, rcv_msg.data);
-        }
-        vTaskDelay(pdMS_TO_TICKS(delay_ms));
+/**
+ * @brief Whether a message still waits for its acknowledgement.
+ * @param satcom the iridium_t struct pointer.
+ * @param seq the sequence number from iridium_reliable_send().
+ * @return 1 while it is kept, 0 once the backend acknowledged it.
+ */
+int iridium_reliable_pending(iridium_t *satcom, uint16_t seq) {
+    return satcom->reliable != NULL ? reliable_pending(satcom->reliable, seq) : 0;
+}
+
+/**
+ * @brief Copy the reliable delivery statistics.
+ * @param satcom the iridium_t struct pointer.
+ * @param stats the reliable_stats to fill.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when reliable delivery is off.
+ */
+iridium_status_t iridium_reliable_stats(iridium_t *satcom, struct reliable_stats *stats) {
+    if (satcom->reliable == NULL || stats == NULL) {
+        return SAT_ERROR;
     }
-    vTaskDelete(NULL);
-}  
+    reliable_get_stats(satcom->reliable, stats);
+    return SAT_OK;
+}
 
 /**
- * @brief Create a default iridium configuration.
- * @return a valid iridium_t struct configuration.
+ * @brief Turn a delay into the outbox time it ends at.
+ * @param satcom the iridium_t struct pointer.
+ * @param delay_ms the delay, 0 = none.
+ * @return the time in ms, 0 = none.
  */
-iridium_t* iridium_default_configuration() {
-    iridium_t *satcom = malloc(sizeof(iridium_t));
-    satcom->buffer_size = 10; // item size
-    satcom->buffer_delay_ms = 1000; // ms
-    satcom->task_message_stack_depth = 4096;
-    satcom->task_buffer_stack_depth = 2024;
-    satcom->task_uart_stack_depth = 4096;
-    satcom->gpio_sleep_pin_number = -1;
-    satcom->gpio_net_pin_number = -1;
-    return satcom;
+static uint32_t iridium_schedule_time(iridium_t *satcom, uint32_t delay_ms) {
+    if (delay_ms == 0) {
+        return 0;
+    }
+    /* 0 means none */
+    uint32_t at = iridium_now_ms(satcom) + delay_ms;
+    return at == 0 ? 1 : at;
 }
 
-int iridium_is_available(iridium_t *satcom) {
-    if (satcom->gpio_net_pin_number != -1) {
-        return gpio_get_level(satcom->gpio_net_pin_number);
+/**
+ * @brief Copy the airtime budget counters and what is left of the rate, day and month.
+ * @param satcom the iridium_t struct pointer.
+ * @param stats the budget_stats to fill.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when the budget is off.
+ */
+iridium_status_t iridium_budget_stats(iridium_t *satcom, struct budget_stats *stats) {
+    if (satcom->budget == NULL || stats == NULL) {
+        return SAT_ERROR;
     }
-    return -1;
+    budget_get_stats(satcom->budget, iridium_now_ms(satcom), stats);
+    return SAT_OK;
 }
 
 /**
- * @brief Modem specs.
- * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ * @brief Queue a record for the next transmit window.
+ * @param satcom the iridium_t struct pointer.
+ * @param data the record bytes.
+ * @param size the record size, 1 to OUTBOX_RECORD_MAX bytes.
+ * @param max_delay_ms send within this time (opens a window early), 0 = next window.
+ * @param ttl_ms drop the record if it could not be sent within this time, 0 = keep until sent.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when the outbox is full or the scheduler is off.
  */
-iridium_status_t iridium_system_spec(iridium_t *satcom) {
-    /* AT system details */
-    iridium_result_t r;
+iridium_status_t iridium_schedule(iridium_t *satcom, const uint8_t *data, size_t size, uint32_t max_delay_ms,
+                                  uint32_t ttl_ms) {
+    if (satcom->outbox == NULL) {
+        return SAT_ERROR;
+    }
+    return outbox_push(satcom->outbox, data, size, iridium_schedule_time(satcom, max_delay_ms), 
+                       iridium_schedule_time(satcom, ttl_ms)) == 0 ? SAT_OK : SAT_ERROR;
+}
 
-    r = iridium_send(satcom, AT_CGMI, NULL, true, 500);
-    if (r.status != SAT_OK) {
-        return r.status;
+/**
+ * @brief Set the latest value of a key for the next transmit window, replacing the unsent one.
+ * @param satcom the iridium_t struct pointer.
+ * @param key the key, e.g. one per sensor; keys are not sent, put an id in the record if the backend needs it.
+ * @param data the record bytes.
+ * @param size the record size, 1 to IRI_OUTBOX_VALUE_MAX bytes.
+ * @param max_delay_ms send within this time (opens a window early), 0 = next window. A replaced record's earlier deadline is kept.
+ * @param ttl_ms drop the record if it could not be sent within this time, 0 = keep until sent.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when IRI_OUTBOX_KEYS other keys are in use or the scheduler is off.
+ */
+iridium_status_t iridium_schedule_latest(iridium_t *satcom, uint8_t key, const uint8_t *data, size_t size,
+                                         uint32_t max_delay_ms, uint32_t ttl_ms) {
+    if (satcom->outbox == NULL) {
+        return SAT_ERROR;
     }
+    return outbox_put(satcom->outbox, key, data, size, iridium_schedule_time(satcom, max_delay_ms), 
+                      iridium_schedule_time(satcom, ttl_ms)) == 0 ? SAT_OK : SAT_ERROR;
+}
 
-    r = iridium_send(satcom, AT_CGMM, NULL, true, 500);
-    if (r.status != SAT_OK) {
-        return r.status;
+/**
+ * @brief Number of values of a key replaced before they were sent.
+ * @param satcom the iridium_t struct pointer.
+ * @param key the key.
+ * @param overwrites the count to fill.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when the key was never scheduled.
+ */
+iridium_status_t iridium_schedule_overwrites(iridium_t *satcom, uint8_t key, uint32_t *overwrites) {
+    if (satcom->outbox == NULL || overwrites == NULL) {
+        return SAT_ERROR;
     }
+    return outbox_key_overwrites(satcom->outbox, key, overwrites) == 0 ? SAT_OK : SAT_ERROR;
+}
 
-    return r.status;
+/**
+ * @brief Open a transmit window now, e.g. before a planned shutdown.
+ * @param satcom the iridium_t struct pointer.
+ */
+void iridium_window_open(iridium_t *satcom) {
+    satcom->window_request = 1;
 }
 
 /**
- * @brief Toggle modem to sleep.
+ * @brief Copy the transmit window statistics.
+ * @param satcom the iridium_t struct pointer.
+ * @param stats the iridium_window_stats_t to fill.
  * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
  */
-iridium_status_t iridium_modem_sleep(iridium_t *satcom) {
-    /* turn off modem */
-    esp_err_t err = gpio_set_level(satcom->gpio_sleep_pin_number, IRI_GPIO_SLP_OFF);
-    if (err != ESP_OK) {
+iridium_status_t iridium_window_stats(iridium_t *satcom, iridium_window_stats_t *stats) {
+    if (satcom->outbox == NULL || stats == NULL) {
+        return SAT_ERROR;
+    }
+    pthread_mutex_lock(&satcom->p_metrics_mutex);
+    *stats = satcom->window;
+    pthread_mutex_unlock(&satcom->p_metrics_mutex);
+    outbox_get_stats(satcom->outbox, &stats->outbox);
+    stats->queued = outbox_count(satcom->outbox);
+    return SAT_OK;
+}
+
+/**
+ * @brief Initialize the driver state (locks, queues, counters) without the UART or tasks.
+ * @param satcom the iridium_t struct pointer.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_init(iridium_t *satcom) {
+    /* init pthread_mutex handles */
+    pthread_mutex_init(&(satcom->p_status_mutex), NULL);
+    pthread_mutex_init(&(satcom->p_nonce_mutex), NULL);
+    pthread_cond_init(&(satcom->p_done_cond), NULL);
+    pthread_mutex_init(&(satcom->p_mo_mutex), NULL);
+    pthread_mutex_init(&(satcom->p_metrics_mutex), NULL);
+    pthread_mutex_init(&(satcom->p_cache_mutex), NULL);
+    pthread_mutex_init(&(satcom->p_capture_mutex), NULL);
+    trace_init(&satcom->trace, satcom->trace_entries, IRI_TRACE_DEPTH);
+    memset(&satcom->metrics, 0, sizeof(satcom->metrics));
+    satcom->metrics_dump_ms = 0;
+    satcom->mo_preempt = 0;
+    satcom->stopping = 0;
+    satcom->tasks_running = 0;
+    /* iridium_config() drives the SLP pin high before this */
+    memset(&satcom->power, 0, sizeof(satcom->power));
+    satcom->power_state = IRI_POWER_IDLE;
+    satcom->power_since_ms = iridium_now_ms(satcom);
+    satcom->power_active_ms = satcom->power_since_ms;
+    satcom->power_hold = 0;
+    satcom->indicators_enabled = -1;
+    memset(&satcom->time, 0, sizeof(satcom->time));
+    satcom->time_refresh_pending = 0;
+    memset(satcom->cache, 0, sizeof(satcom->cache));
+    memset(&satcom->cache_stats, 0, sizeof(satcom->cache_stats));
+    memset(satcom->cache_epoch, 0, sizeof(satcom->cache_epoch));
+    iridium_cache_load(satcom);
+    /* the scheduler only costs memory when it is configured */
+    memset(&satcom->window, 0, sizeof(satcom->window));
+    satcom->window_next_ms = iridium_now_ms(satcom) + satcom->window_interval_ms;
+    satcom->window_retry_ms = iridium_now_ms(satcom);
+    satcom->window_request = 0;
+    if (satcom->task_window_stack_depth == 0) {
+        satcom->task_window_stack_depth = IRI_TASK_WINDOW_STACK;
+    }
+    if (satcom->forecast_samples > 0 && satcom->forecast == NULL) {
+        satcom->forecast = newForecast(satcom->forecast_samples, IRI_FORECAST_BIN_MS);
+        if (satcom->forecast == NULL) {
+            return SAT_ERROR;
+        }
+    }
+    if ((satcom->window_interval_ms > 0 || satcom->window_bytes > 0) && satcom->outbox == NULL) {
+        satcom->outbox = newOutbox(IRI_OUTBOX_SIZE, IRI_OUTBOX_KEYS, IRI_OUTBOX_VALUE_MAX);
+        if (satcom->outbox == NULL) {
+            return SAT_ERROR;
+        }
+    }
+    /* ordering needs the window too, a held duplicate would be delivered twice */
+    satcom->mt_msn = -1;
+    if ((satcom->mt_dedup || satcom->mt_order_depth > 0) && satcom->mt_sequence == NULL) {
+        satcom->mt_sequence = newSequence(satcom->mt_order_depth, sizeof(iridium_message_t), satcom->mt_order_hold_ms);
+        if (satcom->mt_sequence == NULL) {
+            return SAT_ERROR;
+        }
+    }
+    satcom->reliable_retry_ms = iridium_now_ms(satcom);
+    if (satcom->reliable_slots > 0 && satcom->reliable == NULL) {
+        satcom->reliable = newReliable(satcom->reliable_slots, IRI_SBD_MO_MAX - RELIABLE_HEADER, 
+                                       satcom->reliable_ack_timeout_ms);
+        if (satcom->reliable == NULL) {
+            return SAT_ERROR;
+        }
+        if (satcom->reliable_persist) {
+            iridium_reliable_load(satcom);
+            struct reliable_store store = { satcom, &iridium_reliable_save, &iridium_reliable_save_sequence };
+            reliable_set_store(satcom->reliable, &store);
+        }
+    }
+    const struct budget_config *limits = &satcom->budget_limits;
+    bool limited = limits->sessions_per_hour > 0 || limits->day_sessions > 0 || limits->day_bytes > 0 || 
+                   limits->month_sessions > 0 || limits->month_bytes > 0;
+    if (limited && satcom->budget == NULL) {
+        satcom->budget = newBudget(limits);
+        if (satcom->budget == NULL) {
+            return SAT_ERROR;
+        }
+        if (satcom->budget_persist) {
+            iridium_budget_load(satcom);
+            struct budget_store store = { satcom, &iridium_budget_save };
+            budget_set_store(satcom->budget, &store);
+        }
+    }
+
+    if (satcom->buffer_delay_ms == 0) {
+        satcom->buffer_delay_ms = 1000; // ms
+    }
+
+    satcom->c_nonce = 0;
+    satcom->p_nonce = 0;
+    satcom->orphaned_lines = 0;
+    /* echo state is unknown until the first ATE completes */
+    satcom->echo_enabled = -1;
+    memset(&satcom->pending, 0, sizeof(satcom->pending));
+    satcom->completion_index = 0;
+    memset(satcom->completions, 0, sizeof(satcom->completions));
+    satcom->ring_pending = 0;
+    satcom->ring_coalesced = 0;
+    satcom->urc_dropped = 0;
+    satcom->line_length = 0;
+    satcom->line_truncated = 0;
+    satcom->status = IQS_OPEN;
+    if (satcom->task_urc_stack_depth == 0) {
+        satcom->task_urc_stack_depth = IRI_TASK_URC_STACK;
+    }
+    satcom->urc_queue = xQueueCreate(IRI_URC_QUEUE_DEPTH, sizeof(iridium_urc_event_t));
+    if (satcom->message_size == 0) {
+        satcom->message_size = IRI_MT_QUEUE_DEPTH;
+    }
+    size_t depth[DISPATCH_CLASSES] = { IRI_QUEUE_URGENT_DEPTH, satcom->buffer_size, IRI_QUEUE_BACKGROUND_DEPTH };
+    satcom->buffer_queue = newDispatch(sizeof(iridium_command_item_t), depth, IRI_QUEUE_PROMOTE_MS);
+    satcom->message_queue = xQueueCreate(satcom->message_size, sizeof(iridium_message_t));
+
+    if (satcom->urc_queue == NULL || satcom->buffer_queue == NULL || satcom->message_queue == NULL) {
         return SAT_ERROR;
     }
 
     return SAT_OK;
 }
 
+/**
+ * @brief Fail the outstanding command and release the modem for the next one.
+ * @param satcom the iridium_t struct pointer.
+ * @param error the iridium_error_t reported to the waiter.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when no command is outstanding.
+ */
+iridium_status_t iridium_cancel(iridium_t *satcom, iridium_error_t error) {
+    int nonce = satcom->pending.nonce;
+    if (nonce == 0) {
+        return SAT_ERROR;
+    }
+    iridium_complete(satcom, nonce, error, -1, -1);
+    return SAT_OK;
+}
+
 /**
  * @brief Configure iridium modem via UART connection. 
  * @param satcom the iridium_t struct pointer.
@@ -683,7 +3237,15 @@ iridium_status_t iridium_config(iridium_t *satcom) {
         slp_conf.mode = GPIO_MODE_OUTPUT;
         slp_conf.pin_bit_mask = ((1ULL<<satcom->gpio_sleep_pin_number) | (1ULL<<satcom->gpio_sleep_pin_number));
         slp_conf.pull_down_en = GPIO_PULLDOWN_ENABLE;
+        /* GPIO_PULLDOWN_ENABLE is the value of GPIO_PULLUP_ENABLE, kept as it always was */
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 10
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wenum-conversion"
+#endif
         slp_conf.pull_up_en = GPIO_PULLDOWN_ENABLE;
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 10
+#pragma GCC diagnostic pop
+#endif
 
         esp_err_t err = gpio_config(&slp_conf);
         if (err != ESP_OK) {
@@ -691,7 +3253,7 @@ iridium_status_t iridium_config(iridium_t *satcom) {
         }
 
         /* turn on modem */
-        vTaskDelay(pdMS_TO_TICKS(IRI_GPIO_CONF_BUFF));
+        iridium_sleep_ms(satcom, IRI_GPIO_CONF_BUFF);
         gpio_set_level(satcom->gpio_sleep_pin_number, IRI_GPIO_SLP_ON);
     }
    
@@ -707,7 +3269,7 @@ iridium_status_t iridium_config(iridium_t *satcom) {
         }
 
         /* settle delay */
-        vTaskDelay(pdMS_TO_TICKS(IRI_GPIO_CONF_BUFF));
+        iridium_sleep_ms(satcom, IRI_GPIO_CONF_BUFF);
     }
 
 
@@ -726,27 +3288,18 @@ iridium_status_t iridium_config(iridium_t *satcom) {
         .source_clk = UART_SCLK_DEFAULT
     };
 
-    esp_log_level_set(TAG_IRIDIUM, ESP_LOG_INFO);
 
-    /* init pthread_mutex handles */
-    pthread_mutex_init(&(satcom->p_status_mutex), NULL);
-    pthread_mutex_init(&(satcom->p_nonce_mutex), NULL);
+    /* track the heap the driver takes for the footprint report */
+    size_t heap_before = esp_get_free_heap_size();
 
-    if (satcom->buffer_delay_ms == 0) {
-        satcom->buffer_delay_ms = 1000; // ms
+    if (iridium_init(satcom) != SAT_OK) {
+        return SAT_ERROR;
     }
 
-    satcom->c_nonce = 0;
-    satcom->p_nonce = 0;
-    satcom->ring_task_running = 0;
-    satcom->status = IQS_OPEN;
-    satcom->buffer_queue = xQueueCreate(satcom->buffer_size, sizeof(iridium_message_t));
-    satcom->message_queue = xQueueCreate(20, sizeof(iridium_message_t));
-
     /* install uart drivers */
     if (uart_driver_install(satcom->uart_number, 
-                            IRI_BUF_SIZE * 2, 
-                            IRI_BUF_SIZE * 2, 20, 
+                            IRI_UART_RX_BUF_SIZE, 
+                            IRI_UART_TX_BUF_SIZE, IRI_UART_EVENT_DEPTH, 
                             &satcom->uart_queue, 0) != ESP_OK) {
         return SAT_ERROR;
     }
@@ -763,36 +3316,129 @@ iridium_status_t iridium_config(iridium_t *satcom) {
     ESP_ERROR_CHECK(uart_param_config(satcom->uart_number, &uart_config));
     /*if (uart_param_config(satcom->uart_number, &uart_config) != ESP_OK) { return SAT_ERROR; }*/
 
+    /* counted out by each task, iridium_deinit() waits for them */
+    satcom->tasks_running = 4 + (satcom->outbox != NULL || satcom->reliable != NULL);
+
     /* start message processing tasks */
     xTaskCreate(&message_satcom_task, 
                 "message_satcom_task", 
                 satcom->task_message_stack_depth, 
                 satcom, 
-                12, NULL);
+                12, &satcom->task_message_handle);
 
     /* start uart processing tasks */
     xTaskCreate(&uart_satcom_task, 
                 "uart_satcom_task", 
                 satcom->task_uart_stack_depth,
                 satcom, 
-                12, NULL);
+                12, &satcom->task_uart_handle);
+
+    /* start urc processing tasks */
+    xTaskCreate(&urc_satcom_task, 
+                "urc_satcom_task", 
+                satcom->task_urc_stack_depth, 
+                satcom, 
+                12, &satcom->task_urc_handle);
 
     /* start buffer processing tasks */
     xTaskCreate(&buffer_satcom_task, 
                 "buffer_satcom_task", 
                 satcom->task_buffer_stack_depth, 
                 satcom, 
-                12, NULL);
+                12, &satcom->task_buffer_handle);
+
+    /* start transmit window tasks, they also flush reliable delivery */
+    if (satcom->outbox != NULL || satcom->reliable != NULL) {
+        xTaskCreate(&window_satcom_task, 
+                    "window_satcom_task", 
+                    satcom->task_window_stack_depth, 
+                    satcom, 
+                    12, &satcom->task_window_handle);
+    }
 
     /* 1000ms delay */
-    vTaskDelay(pdMS_TO_TICKS(1000));
+    iridium_sleep_ms(satcom, 1000);
 
-    /* AT check */
+    satcom->heap_footprint = heap_before - esp_get_free_heap_size();
+
+    /* AT check, sets the echo mode so responses can be matched */
     iridium_result_t r;
-    r = iridium_send(satcom, AT, NULL, true, 500);
+    r = iridium_config_echo(satcom, satcom->command_echo != 0);
     if (r.status != SAT_OK) {
         return r.status;
     }
 
     return r.status;
+}
+
+/**
+ * @brief Wait until no more than the given number of driver tasks run.
+ * @param satcom the iridium_t struct pointer.
+ * @param running the number of tasks left running.
+ */
+static void iridium_tasks_wait(iridium_t *satcom, int running) {
+    for (;;) {
+        pthread_mutex_lock(&satcom->p_status_mutex);
+        int left = satcom->tasks_running;
+        pthread_mutex_unlock(&satcom->p_status_mutex);
+        if (left <= running) {
+            return;
+        }
+        iridium_sleep_ms(satcom, 10);
+    }
+}
+
+/**
+ * @brief Stop the driver tasks and release what iridium_config() took, the struct itself stays.
+ * @param satcom the iridium_t struct pointer.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when the driver was not configured.
+ */
+iridium_status_t iridium_deinit(iridium_t *satcom) {
+    if (satcom->buffer_queue == NULL) {
+        return SAT_ERROR;
+    }
+
+    /* 
+        The service tasks go first, a session in progress (window, ring drain) ends on its own
+        and still needs the buffer task for its timeouts. The UART and buffer tasks follow.
+    */
+    satcom->stopping = 1;
+    iridium_urc_event_t wake = { URC_NONE, { -1, -1 } };
+    xQueueSend(satcom->urc_queue, &wake, 0);
+    iridium_tasks_wait(satcom, 2);
+
+    /* no UART queue when iridium_config() failed before the tasks were started */
+    satcom->stopping = 2;
+    if (satcom->uart_queue != NULL) {
+        uart_event_t event = { .type = UART_EVENT_MAX };
+        xQueueSend(satcom->uart_queue, &event, 0);
+    }
+    iridium_tasks_wait(satcom, 0);
+
+    iridium_capture_stop(satcom);
+    uart_driver_delete(satcom->uart_number);
+    satcom->uart_queue = NULL;
+    if (satcom->gpio_sleep_pin_number != -1) {
+        gpio_set_level(satcom->gpio_sleep_pin_number, IRI_GPIO_SLP_OFF);
+    }
+
+    vQueueDelete(satcom->urc_queue);
+    vQueueDelete(satcom->message_queue);
+    satcom->urc_queue = NULL;
+    satcom->message_queue = NULL;
+    destroy_dispatch(&satcom->buffer_queue);
+    destroy_outbox(&satcom->outbox);
+    destroy_forecast(&satcom->forecast);
+    destroy_sequence(&satcom->mt_sequence);
+    destroy_reliable(&satcom->reliable);
+    destroy_budget(&satcom->budget);
+
+    pthread_mutex_destroy(&satcom->p_status_mutex);
+    pthread_mutex_destroy(&satcom->p_nonce_mutex);
+    pthread_cond_destroy(&satcom->p_done_cond);
+    pthread_mutex_destroy(&satcom->p_mo_mutex);
+    pthread_mutex_destroy(&satcom->p_metrics_mutex);
+    pthread_mutex_destroy(&satcom->p_cache_mutex);
+    pthread_mutex_destroy(&satcom->p_capture_mutex);
+    return SAT_OK;
 }
\ No newline at end of file
@@ -36,20 +36,203 @@ extern "C" {
 #include "esp_event.h"
 #include "nvs_flash.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "spi_flash_mmap.h" // or #include "esp_spi_flash.h"
 #include "driver/uart.h" 
 #include "driver/gpio.h"
 #include "freertos/queue.h"
 
 #include "stack.h"
+#include "dispatch.h"
+#include "histogram.h"
+#include "trace.h"
+#include "capture.h"
+#include "outbox.h"
+#include "forecast.h"
+#include "reliable.h"
+#include "sequence.h"
+#include "budget.h"
+#include "vclock.h"
 
-#define IRI_BUF_SIZE    (4096)
-#define IRI_RD_BUF_SIZE (IRI_BUF_SIZE)
+/*
+    Protocol limits (Iridium 9602/9603 ISU AT command reference). Every
+    driver buffer below is derived from these, the modem can't produce more.
+*/
+#define IRI_SBD_MO_MAX      (340)   // max MO message size in bytes (+SBDWB)
+#define IRI_SBD_MT_MAX      (270)   // max MT message size in bytes (+SBDRT/+SBDRB)
+#define IRI_SBD_TEXT_MAX    (120)   // max MO text message size in bytes (+SBDWT)
+#define IRI_ID_MAX          (40)    // +CGMI/+CGMM identification strings
+#define IRI_AT_OVERHEAD     (16)    // longest "AT+XXXXXX=" prefix, "\r" and terminator
+
+#define IRI_CMD_MAX         (IRI_SBD_TEXT_MAX + IRI_AT_OVERHEAD)    // longest command written to the modem
+#define IRI_LINE_MAX        (IRI_SBD_MT_MAX + IRI_AT_OVERHEAD)      // longest response line (+SBDRT payload)
+#define IRI_RESPONSE_MAX    (IRI_LINE_MAX)                          // response data collected per command
+#define IRI_MESSAGE_MAX     (IRI_SBD_MT_MAX + 1)                    // queued command / MT message payload
+
+/*
+    Memory profiles. The default profile suits ESP32/ESP32-S3 boards, define
+    IRI_PROFILE_COMPACT for smaller parts (ESP32-C3). Each value can also be
+    overridden individually with a compile definition.
+*/
+#ifdef IRI_PROFILE_COMPACT
+#define IRI_PROFILE(full, compact) (compact)
+#define IRI_PROFILE_NAME "compact"
+#else
+#define IRI_PROFILE(full, compact) (full)
+#define IRI_PROFILE_NAME "default"
+#endif
+
+#ifndef IRI_UART_RX_BUF_SIZE
+#define IRI_UART_RX_BUF_SIZE        IRI_PROFILE(1024, 256)  // must be > SOC_UART_FIFO_LEN (128)
+#endif
+#ifndef IRI_UART_TX_BUF_SIZE
+#define IRI_UART_TX_BUF_SIZE        IRI_PROFILE(512, 0)     // 0 = uart_write_bytes blocks until sent
+#endif
+#ifndef IRI_UART_EVENT_DEPTH
+#define IRI_UART_EVENT_DEPTH        IRI_PROFILE(16, 8)
+#endif
+#ifndef IRI_CMD_QUEUE_DEPTH
+#define IRI_CMD_QUEUE_DEPTH         IRI_PROFILE(4, 2)
+#endif
+#ifndef IRI_QUEUE_URGENT_DEPTH
+#define IRI_QUEUE_URGENT_DEPTH      IRI_PROFILE(2, 1)
+#endif
+#ifndef IRI_QUEUE_BACKGROUND_DEPTH
+#define IRI_QUEUE_BACKGROUND_DEPTH  IRI_PROFILE(4, 2)
+#endif
+#ifndef IRI_QUEUE_PROMOTE_MS
+#define IRI_QUEUE_PROMOTE_MS        (30000) // queued this long lifts a command one priority class
+#endif
+#ifndef IRI_MT_QUEUE_DEPTH
+#define IRI_MT_QUEUE_DEPTH          IRI_PROFILE(4, 2)
+#endif
+#ifndef IRI_MT_ORDER_HOLD_MS
+#define IRI_MT_ORDER_HOLD_MS        (300000)    // an MT message waits this long for an earlier MTMSN
+#endif
+#ifndef IRI_TASK_UART_STACK
+#define IRI_TASK_UART_STACK         IRI_PROFILE(4096, 3072)
+#endif
+#ifndef IRI_TASK_MESSAGE_STACK
+#define IRI_TASK_MESSAGE_STACK      IRI_PROFILE(4096, 3072)
+#endif
+#ifndef IRI_TASK_BUFFER_STACK
+#define IRI_TASK_BUFFER_STACK       IRI_PROFILE(2048, 2048)
+#endif
+#ifndef IRI_TASK_URC_STACK
+#define IRI_TASK_URC_STACK          IRI_PROFILE(4096, 3072)
+#endif
+#ifndef IRI_URC_QUEUE_DEPTH
+#define IRI_URC_QUEUE_DEPTH         IRI_PROFILE(8, 4)
+#endif
+
+#ifndef IRI_OUTBOX_SIZE
+#define IRI_OUTBOX_SIZE             IRI_PROFILE(2048, 512)  // transmit scheduler records, 10 bytes overhead each
+#endif
+#ifndef IRI_OUTBOX_KEYS
+#define IRI_OUTBOX_KEYS             IRI_PROFILE(16, 4)      // keys of iridium_schedule_latest()
+#endif
+#ifndef IRI_OUTBOX_VALUE_MAX
+#define IRI_OUTBOX_VALUE_MAX        IRI_PROFILE(64, 32)     // largest iridium_schedule_latest() record
+#endif
+#ifndef IRI_TASK_WINDOW_STACK
+#define IRI_TASK_WINDOW_STACK       IRI_PROFILE(4096, 3072)
+#endif
+#ifndef IRI_WINDOW_RETRY_MS
+#define IRI_WINDOW_RETRY_MS         (60000) // a window that could not send waits this long before the next try
+#endif
+
+/* end-to-end delivery, MO messages kept until the backend acknowledges them in an MT message */
+#ifndef IRI_RELIABLE_SLOTS
+#define IRI_RELIABLE_SLOTS          IRI_PROFILE(16, 4)      // messages awaiting an acknowledgement, 340 bytes each
+#endif
+#ifndef IRI_RELIABLE_ACK_TIMEOUT_MS
+#define IRI_RELIABLE_ACK_TIMEOUT_MS (1800000)   // resend a message the backend has not acknowledged by then
+#endif
+
+/* airtime budget, every +SBDIX and +SBDIXA asks it first, active when budget_limits has a limit */
+#ifndef IRI_BUDGET_RESERVE_NORMAL
+#define IRI_BUDGET_RESERVE_NORMAL       (1)     // sessions normal traffic leaves in the bucket for urgent
+#endif
+#ifndef IRI_BUDGET_RESERVE_BACKGROUND
+#define IRI_BUDGET_RESERVE_BACKGROUND   (2)     // sessions background traffic leaves in the bucket
+#endif
+
+/* Iridium system time, -MSSTM counts 90 ms ticks from the epoch of the current era */
+#ifndef IRI_MSSTM_EPOCH_MS
+#define IRI_MSSTM_EPOCH_MS          (1399818235000ULL)  // 2014-05-11 14:23:55 UTC
+#endif
+#define IRI_MSSTM_TICK_MS           (90)
+#ifndef IRI_TIME_REFRESH_MS
+#define IRI_TIME_REFRESH_MS         (6 * 3600 * 1000)   // resync after a session once the sync is this old
+#endif
+
+/* signal history and the transmit time predictor consulted by the retry back-off */
+#ifndef IRI_FORECAST_SAMPLES
+#define IRI_FORECAST_SAMPLES        IRI_PROFILE(256, 64)    // +CSQ / +CIEV samples, 8 bytes each
+#endif
+#ifndef IRI_FORECAST_BIN_MS
+#define IRI_FORECAST_BIN_MS         (30000)     // resolution of the trend and pass period
+#endif
+#ifndef IRI_FORECAST_HORIZON_MS
+#define IRI_FORECAST_HORIZON_MS     (600000)    // longest a retry waits for a better pass
+#endif
+
+/* query cache in front of iridium_query(), per command TTL in cache_ttl_ms */
+#ifndef IRI_CACHE_SLOTS
+#define IRI_CACHE_SLOTS             (6)
+#endif
+#define IRI_CACHE_OFF               (0)         // cache_ttl_ms, always asks the modem
+#define IRI_CACHE_FOREVER           (-1)        // cache_ttl_ms, never expires and persists in NVS
+#ifndef IRI_CACHE_CSQ_TTL_MS
+#define IRI_CACHE_CSQ_TTL_MS        (10000)     // +CSQ takes seconds, the signal changes slower than apps poll
+#endif
+#ifndef IRI_CACHE_SBDSX_TTL_MS
+#define IRI_CACHE_SBDSX_TTL_MS      (5000)      // also dropped by sessions, buffer writes and rings
+#endif
+#ifndef IRI_CACHE_CONFIG_TTL_MS
+#define IRI_CACHE_CONFIG_TTL_MS     (3600000)   // +SBDMTA?, written through by iridium_config_ring()
+#endif
+#ifndef IRI_CACHE_NVS_NAMESPACE
+#define IRI_CACHE_NVS_NAMESPACE     "iridium"
+#endif
+
+/* binary trace, 0 = off, 1 = commands and events, 2 = every RX chunk and line */
+#ifndef IRI_TRACE_LEVEL
+#define IRI_TRACE_LEVEL             IRI_PROFILE(2, 1)
+#endif
+#ifndef IRI_TRACE_DEPTH
+#define IRI_TRACE_DEPTH             ((IRI_TRACE_LEVEL) > 0 ? IRI_PROFILE(128, 32) : 1) // power of two
+#endif
+
+#define IRI_RESULT_MAX      (50)    // response text copied into iridium_result_t, see iridium_send_into
+#define IRI_COMPLETION_SLOTS (4)
+
+#define IRI_RD_BUF_SIZE (IRI_UART_RX_BUF_SIZE)
 #define IRI_BUFF_DELAY  (100)
 #define IRI_GPIO_CONF_BUFF (100)
 #define IRI_GPIO_SLP_ON 1
 #define IRI_GPIO_SLP_OFF 0
 
+/* power manager, readiness probing after a wake and the 9603 current draw per state */
+#ifndef IRI_POWER_PROBE_MS
+#define IRI_POWER_PROBE_MS          (100)       // AT probe timeout while the modem boots
+#endif
+#ifndef IRI_POWER_WAKE_TIMEOUT_MS
+#define IRI_POWER_WAKE_TIMEOUT_MS   (10000)     // give up probing, queued commands run into their timeouts
+#endif
+#ifndef IRI_POWER_SUPPLY_MV
+#define IRI_POWER_SUPPLY_MV         (5000)
+#endif
+#ifndef IRI_POWER_SLEEP_UA
+#define IRI_POWER_SLEEP_UA          (20)        // SLP pin low
+#endif
+#ifndef IRI_POWER_IDLE_UA
+#define IRI_POWER_IDLE_UA           (34000)     // awake, receiver on (also while booting)
+#endif
+#ifndef IRI_POWER_SESSION_UA
+#define IRI_POWER_SESSION_UA        (145000)    // average over a +SBDIX session
+#endif
+
 /**
  * @brief the enum to represent the AT commands. 
  */
@@ -70,8 +253,14 @@ typedef enum iridium_command {
     AT_SBDIXA       = 12,
     AT_K0           = 13,
     AT_SBDMTAQ      = 14,
+    AT_CIER         = 15,
+    AT_SBDWB        = 16,
+    AT_E            = 17,
+    AT_SBDD         = 18,
 } iridium_command_t;
 
+#define IRI_COMMAND_COUNT   (AT_SBDD + 1)
+
 /**
  * @brief the iridium command status.
  */
@@ -80,6 +269,36 @@ typedef enum iridium_status {
     SAT_OK          = 1 
 } iridium_status_t;
 
+/**
+ * @brief the detailed reason a command did not complete with OK.
+ */
+typedef enum iridium_error {
+    IRI_ERR_NONE            = 0,  // command completed with OK.
+    IRI_ERR_MODEM           = 1,  // modem replied ERROR.
+    IRI_ERR_TIMEOUT         = 2,  // no final result code within the command timeout.
+    IRI_ERR_UART_OVERFLOW   = 3,  // UART FIFO/buffer overflow, the response was lost.
+    IRI_ERR_QUEUE_FULL      = 4,  // the command could not be queued.
+    IRI_ERR_INVALID_ARG     = 5,  // the command argument is missing or too long.
+    IRI_ERR_PARSE           = 6,  // the response could not be parsed.
+    IRI_ERR_SBDWB_TIMEOUT   = 7,  // +SBDWB 1, insufficient bytes before the modem timeout.
+    IRI_ERR_SBDWB_CHECKSUM  = 8,  // +SBDWB 2, checksum mismatch.
+    IRI_ERR_SBDWB_SIZE      = 9,  // +SBDWB 3, message size is not correct.
+    IRI_ERR_SESSION         = 10, // +SBDIX session failed, see the result mo_status.
+    IRI_ERR_PREEMPTED       = 11, // retries abandoned for an urgent message.
+    IRI_ERR_NO_SERVICE      = 12, // -MSSTM: no network service, system time unknown.
+    IRI_ERR_BUDGET          = 13, // +SBDIX not started, the airtime budget is spent.
+    IRI_ERR_TRUNCATED       = 14  // a line or the response did not fit IRI_LINE_MAX / IRI_RESPONSE_MAX, it was not processed.
+} iridium_error_t;
+
+/**
+ * @brief the dispatch priority of a command, urgent commands are written first.
+ */
+typedef enum iridium_priority {
+    IRI_PRIORITY_URGENT     = DISPATCH_URGENT,      // alarms, preempts the retry back-off of other messages
+    IRI_PRIORITY_NORMAL     = DISPATCH_NORMAL,      // default for iridium_send
+    IRI_PRIORITY_BACKGROUND = DISPATCH_BACKGROUND   // polling (CSQ) and housekeeping
+} iridium_priority_t;
+
 /**
  * @brief the iridium UART queue status.
  */
@@ -89,6 +308,29 @@ typedef enum iridium_queue_status {
     IQS_WAITING     = 1 
 } iridium_queue_status_t;
 
+/**
+ * @brief the unsolicited result codes (URC) the modem can emit at any time.
+ */
+typedef enum iridium_urc {
+    URC_NONE        = 0,
+    URC_SBDRING     = 1, // SBDRING, MT message waiting at the GSS (+SBDMTA=1)
+    URC_CIEV        = 2, // +CIEV:<indicator>,<value> (+CIER)
+    URC_AREG        = 3  // +AREG:<event>,<reg error> (+SBDAREG)
+} iridium_urc_t;
+
+/**
+ * @brief a parsed URC handed to the URC handlers.
+ * 
+ * @paragraph
+ * 
+ * URC_CIEV   values[0] = 0 signal / 1 service, values[1] = value
+ * URC_AREG   values[0] = event, values[1] = registration error
+ */
+typedef struct iridium_urc_event {
+    iridium_urc_t type;
+    int values[2];
+} iridium_urc_event_t;
+
 typedef enum iridium_mt_status {
     /* <MT status> */
     MT_NO_SBD_MESSAGE_RECEIVED              = 0, // No SBD message to receive from the GSS.
@@ -122,6 +364,139 @@ typedef enum iridium_mo_status {
     MO_PLL_LOCK_FAILURE                             = 65  // PLL lock failure; hardware error during attempted transmit.
 } iridium_mo_status_t;
 
+#define IRI_MO_STATUS_COUNT (MO_PLL_LOCK_FAILURE + 1)
+
+/**
+ * @brief the power state of the modem, driven through the SLP pin.
+ */
+typedef enum iridium_power_state {
+    IRI_POWER_SLEEP     = 0, // SLP pin low, commands are queued until the next wake
+    IRI_POWER_WAKING    = 1, // SLP pin high, probing with AT until the modem answers
+    IRI_POWER_IDLE      = 2, // awake, commands are dispatched
+    IRI_POWER_SESSION   = 3  // +SBDIX/+SBDIXA in progress, transmitter active
+} iridium_power_state_t;
+
+#define IRI_POWER_STATES (IRI_POWER_SESSION + 1)
+
+/**
+ * @brief the completion record of a command, kept until its waiter collects it.
+ */
+typedef struct iridium_completion {
+    int nonce;
+    iridium_error_t error;
+    int mo_status;
+    int mt_status;
+    uint32_t latency_ms;
+    size_t length;                  // response text in completion_data
+} iridium_completion_t;
+
+/**
+ * @brief the outstanding command, responses are matched against it by echo and prefix.
+ */
+typedef struct iridium_pending {
+    int nonce;                      // 0 when no command is outstanding
+    iridium_command_t command;
+    char echo[IRI_CMD_MAX];         // the command as echoed by the modem (without "\r")
+    const char *prefix;             // expected response prefix ("+CSQ"), NULL for any data
+    size_t prefix_length;           // strlen of prefix
+    int echo_seen;
+    int prefix_seen;
+    char response[IRI_RESPONSE_MAX];
+    size_t response_length;
+    int response_overflow;          // a line did not fit response, the response is incomplete
+    uint32_t sent_ms;
+    uint32_t deadline_ms;           // 0 when no command is outstanding
+    const uint8_t *binary_data;     // +SBDWB payload written on READY
+    size_t binary_size;
+} iridium_pending_t;
+
+/**
+ * @brief the session metrics of a driver instance, counters run from iridium_config().
+ */
+typedef struct iridium_metrics {
+    struct histogram_t latency[IRI_COMMAND_COUNT];  // UART write to OK (ms) per iridium_command_t
+    uint32_t errors[IRI_COMMAND_COUNT];             // completions other than OK per iridium_command_t
+    uint32_t bytes_tx;                              // bytes written to the UART
+    uint32_t bytes_rx;                              // bytes read from the UART
+    uint32_t sessions;                              // +SBDIX/+SBDIXA sessions with an <MO status>
+    uint32_t session_mo[IRI_MO_STATUS_COUNT];       // sessions per iridium_mo_status_t
+    uint32_t retries;                               // +SBDIX retries of iridium_tx_message
+    uint32_t uart_overflows;
+    struct dispatch_stats queue[DISPATCH_CLASSES];  // command queue per priority, filled by the snapshot
+    uint32_t uptime_ms;                             // time of the snapshot
+} iridium_metrics_t;
+
+/**
+ * @brief the power accounting of a driver instance, counters run from iridium_config().
+ */
+typedef struct iridium_power_stats {
+    iridium_power_state_t state;                    // state at the time of the snapshot
+    uint32_t time_ms[IRI_POWER_STATES];             // time spent per iridium_power_state_t
+    uint64_t energy_uj[IRI_POWER_STATES];           // estimated from the IRI_POWER_*_UA draw, filled by the snapshot
+    uint64_t energy_total_uj;
+    uint32_t wakes;
+    uint32_t wake_failures;                         // no answer within IRI_POWER_WAKE_TIMEOUT_MS
+    uint32_t sleeps;
+    uint32_t deferred;                              // commands queued while the modem was asleep or waking
+    struct histogram_t wake_latency;                // SLP high to first answer (ms)
+} iridium_power_stats_t;
+
+/**
+ * @brief the transmit window statistics, counters run from iridium_config().
+ */
+typedef struct iridium_window_stats {
+    uint32_t windows;                               // windows opened
+    uint32_t failed;                                // windows that left records queued
+    uint32_t sessions;                              // +SBDIX sessions of all windows, retries included
+    uint32_t frames;                                // SBD messages sent
+    uint32_t records;                               // records sent
+    uint32_t mt_messages;                           // MT messages read in windows
+    uint32_t last_sessions;                         // sessions of the last window
+    uint32_t max_sessions;                          // most sessions in one window
+    struct histogram_t duration_ms;                 // window open to modem sleep
+    struct outbox_stats outbox;                     // filled by the snapshot
+    size_t queued;                                  // records waiting, filled by the snapshot
+} iridium_window_stats_t;
+
+/**
+ * @brief the Iridium system time sync, UTC = local clock + offset.
+ */
+typedef struct iridium_time {
+    int valid;                                      // a -MSSTM answer was received
+    uint32_t ticks;                                 // last -MSSTM tick count
+    uint64_t utc_ms;                                // UTC of the last sync
+    uint64_t local_us;                              // driver clock at the last sync
+    int32_t drift_ppm;                              // local clock drift against the last two syncs
+    uint32_t syncs;                                 // -MSSTM answers
+    uint32_t no_service;                            // -MSSTM: no network service
+} iridium_time_t;
+
+/**
+ * @brief a cached query result, only successful answers are kept.
+ */
+typedef struct iridium_cache_entry {
+    int valid;
+    iridium_command_t command;
+    uint32_t stored_ms;                             // driver clock when the answer came in
+    size_t length;
+    char result[IRI_RESULT_MAX];                    // longer answers are not cached
+} iridium_cache_entry_t;
+
+/**
+ * @brief the query cache counters.
+ */
+typedef struct iridium_cache_stats {
+    uint32_t hits;                                  // answered from the cache
+    uint32_t misses;                                // asked the modem, expired included
+    uint32_t expired;                               // entry older than its TTL
+    uint32_t invalidated;                           // entries dropped by commands and events
+    uint32_t evicted;                               // entries replaced for lack of a slot
+    uint32_t nvs_loaded;                            // IRI_CACHE_FOREVER entries restored at init
+    uint32_t nvs_stored;
+    uint32_t command_hits[IRI_COMMAND_COUNT];
+    uint32_t command_misses[IRI_COMMAND_COUNT];
+} iridium_cache_stats_t;
+
 /**
  * @brief the core iridum struct with all configuration / status values.
  * 
@@ -134,10 +509,12 @@ typedef enum iridium_mo_status {
  */
 typedef struct iridium {
     QueueHandle_t uart_queue;
-    QueueHandle_t buffer_queue;
+    struct dispatch_t *buffer_queue;
     QueueHandle_t message_queue;
+    QueueHandle_t urc_queue;
     /* signal */
     int signal_strength;
+    int service_available;
     /* messaging */
     int status_inbound;
     int status_outbound;
@@ -146,58 +523,209 @@ typedef struct iridium {
     int bytes_received;
     int messages_waiting;
     /* about */
-    char manufacturer_identification[20];
-    char model_identification[50];
+    char manufacturer_identification[IRI_ID_MAX];
+    char model_identification[IRI_ID_MAX];
     /* quene processing */
     int c_nonce;
     int p_nonce;
     int buffer_size;
+    int message_size;
     int buffer_delay_ms;
     int uart_number;
     int uart_txn_number;
     int uart_rxd_number;
     int uart_rts_number;
     int uart_cts_number;
-    int ring_task_running;
-    char buffer_data[100];
+    /* uart line assembly */
+    char line_buffer[IRI_LINE_MAX];
+    int line_length;
+    int line_truncated;             // the line ran past IRI_LINE_MAX - 1, the rest was dropped
+    /* urc routing */
+    volatile int ring_pending;
+    int ring_coalesced;
+    int urc_dropped;
     iridium_queue_status_t status;
     pthread_mutex_t p_status_mutex;
     pthread_mutex_t p_nonce_mutex;
+    pthread_cond_t p_done_cond;
+    pthread_mutex_t p_mo_mutex;
+    int mo_preempt;
+    /* outstanding command */
+    iridium_pending_t pending;
+    int command_echo;               // configured echo mode, 1 = ATE1, 0 = ATE0
+    int echo_enabled;               // modem echo state, -1 = unknown
+    int orphaned_lines;
+    int sbdwb_status;
+    struct iridium_completion completions[IRI_COMPLETION_SLOTS];
+    char completion_data[IRI_COMPLETION_SLOTS][IRI_RESPONSE_MAX];   // response text, until the waiter copies it
+    int completion_index;
     /* stack sizes */
     int task_message_stack_depth;
     int task_buffer_stack_depth;
     int task_uart_stack_depth;
+    int task_urc_stack_depth;
+    int task_window_stack_depth;
+    TaskHandle_t task_message_handle;
+    TaskHandle_t task_buffer_handle;
+    TaskHandle_t task_uart_handle;
+    TaskHandle_t task_urc_handle;
+    TaskHandle_t task_window_handle;
+    volatile int stopping;          // iridium_deinit(), 1 = service tasks, 2 = UART and dispatch tasks
+    int tasks_running;
+    /* session metrics */
+    iridium_metrics_t metrics;
+    pthread_mutex_t p_metrics_mutex;
+    int metrics_interval_ms;        // period of metrics_callback, 0 = off
+    uint32_t metrics_dump_ms;
+    /* binary trace of the hot paths */
+    struct trace_t trace;
+    struct trace_entry trace_entries[IRI_TRACE_DEPTH];
+    /* time source of every timestamp, sleep and timeout, NULL = system clock */
+    const struct vclock_t *clock;
+    /* UART session capture, NULL when off, set and recorded under p_capture_mutex */
+    struct capture_t *capture;
+    pthread_mutex_t p_capture_mutex;
+    /* power manager, active when gpio_sleep_pin_number is set */
+    iridium_power_state_t power_state;
+    int power_idle_ms;              // awake and idle this long puts the modem to sleep, 0 = manual
+    int power_hold;                 // iridium_power_hold() count, keeps the modem awake
+    uint32_t power_since_ms;        // entry time of power_state
+    uint32_t power_active_ms;       // last command completion
+    iridium_power_stats_t power;
+    int indicators_enabled;         // last +CIER setting, restored after a wake, -1 = never set
+    /* transmit scheduler, active when window_interval_ms or window_bytes is set */
+    struct outbox_t *outbox;
+    int window_interval_ms;         // cadence of the transmit windows, 0 = deadlines and bytes only
+    int window_bytes;               // queued frame bytes that open a window early, 0 = off
+    uint32_t window_next_ms;        // next window on the cadence
+    uint32_t window_retry_ms;       // no window before this after a failed one
+    volatile int window_request;    // iridium_window_open() was called
+    iridium_window_stats_t window;
+    /* MT sequence window, filters by MTMSN before message_callback */
+    struct sequence_t *mt_sequence;
+    int mt_dedup;                   // drop MT messages whose MTMSN was delivered, 0 = deliver every read
+    int mt_order_depth;             // MT messages held to deliver in MTMSN order, 0 = as received
+    int mt_order_hold_ms;           // a missing MTMSN is given up after this
+    int mt_msn;                     // MTMSN of the MT buffer, -1 before the first MT message
+    /* end-to-end delivery, active when reliable_slots is set */
+    struct reliable_t *reliable;
+    int reliable_slots;             // messages kept until acknowledged, 0 = off
+    int reliable_ack_timeout_ms;    // resend an unacknowledged message after this
+    int reliable_persist;           // keep the unacknowledged messages in NVS across boots
+    uint32_t reliable_retry_ms;     // no flush before this after a failed one
+    /* airtime budget, active when any limit of budget_limits is set */
+    struct budget_t *budget;
+    struct budget_config budget_limits;     // session rate, per priority reserve, daily and monthly caps
+    int budget_persist;             // keep the counters in NVS across boots
+    uint32_t mo_bytes;              // size of the MO buffer, what the next session sends
+    /* Iridium system time */
+    iridium_time_t time;
+    int time_refresh_ms;            // resync age, piggybacked on +SBDIX sessions, 0 = manual only
+    volatile int time_refresh_pending;  // 1 = a resync is due after a session, 2 = its -MSSTM is queued
+    /* signal forecast */
+    struct forecast_t *forecast;
+    int forecast_samples;           // history size, 0 = off
+    int forecast_horizon_ms;        // longest forecast wait added to a retry back-off, 0 = fixed back-off
+    /* query cache */
+    int cache_ttl_ms[IRI_COMMAND_COUNT];    // per command, IRI_CACHE_OFF / IRI_CACHE_FOREVER / ms
+    int cache_persist;                      // keep IRI_CACHE_FOREVER entries in NVS across boots
+    iridium_cache_entry_t cache[IRI_CACHE_SLOTS];
+    iridium_cache_stats_t cache_stats;
+    uint32_t cache_epoch[IRI_COMMAND_COUNT];    // bumped when a command's answer is dropped
+    pthread_mutex_t p_cache_mutex;
+    /* measured heap usage of iridium_config() */
+    size_t heap_footprint;
     /* callbacks */ 
     void (*callback) (struct iridium* satcom, iridium_command_t command, iridium_status_t status);
     void (*message_callback) (struct iridium* satcom, char* data);
+    void (*urc_callback) (struct iridium* satcom, iridium_urc_event_t* event);
+    void (*metrics_callback) (struct iridium* satcom, const iridium_metrics_t* metrics);
+    void *user_data;                // caller context for the callbacks, untouched by the driver
     /* gpio pins */
     int gpio_sleep_pin_number;
     int gpio_net_pin_number;
 } iridium_t;
 
 /**
- * @brief the iridium message for the modem.
+ * @brief a queued command, sized for the longest command written to the modem.
  */
-typedef struct iridium_message {
-  char data[50];
+typedef struct iridium_command_item {
+  char data[IRI_CMD_MAX];
   int size;
   int nonce;
   int command;
+  const uint8_t *binary;    // +SBDWB payload
+  size_t binary_size;
+} iridium_command_item_t;
+
+/**
+ * @brief an MT message received from the modem.
+ */
+typedef struct iridium_message {
+  char data[IRI_MESSAGE_MAX];
+  int size;
+  int mtmsn;                // MTMSN of an MT message, -1 when unknown
 } iridium_message_t;
 
 /**
  * @brief the iridium result from the modem.
  */
 typedef struct iridium_result {
-    char result[50];
+    char result[IRI_RESULT_MAX];    // the first IRI_RESULT_MAX - 1 bytes of the response text, empty with a caller buffer
+    size_t length;          // exact length of the response text, not counting the terminator
     iridium_status_t status;
+    iridium_error_t error;
+    int mo_status;          // +SBDIX <MO status>, -1 when not a session
+    int mt_status;          // +SBDIX <MT status>, -1 when not a session
+    uint32_t latency_ms;    // UART write to final result code
 } iridium_result_t;
 
+/**
+ * @brief the memory budget of a configured driver instance (bytes).
+ */
+typedef struct iridium_footprint {
+    size_t driver_struct;       // sizeof(iridium_t)
+    size_t uart_rx_buffer;      // uart driver RX ring buffer
+    size_t uart_tx_buffer;      // uart driver TX ring buffer
+    size_t uart_event_queue;    // uart driver event queue storage
+    size_t rx_chunk_buffer;     // uart_satcom_task read buffer
+    size_t command_queue;       // buffer_queue storage, all priority classes
+    size_t message_queue;       // message_queue storage
+    size_t urc_queue;           // urc_queue storage
+    size_t mt_window;           // MT messages held for MTMSN order, 0 when not ordering
+    size_t outbox;              // transmit scheduler records, 0 when the scheduler is off
+    size_t forecast;            // signal history, 0 when the forecast is off
+    size_t reliable;            // unacknowledged messages, 0 when reliable delivery is off
+    size_t budget;              // airtime budget, 0 when off
+    size_t task_stacks;         // stacks of the driver tasks
+    size_t task_stack_unused;   // measured stack high-water marks, 0 before iridium_config()
+    size_t heap_total;          // sum of the heap allocations above
+    size_t heap_measured;       // free heap delta measured across iridium_config()
+} iridium_footprint_t;
+
 /**
  * @brief callbacks required for message/event data.
  */
 typedef void (*callback_t) (iridium_t* satcom, iridium_command_t command, iridium_status_t status);
 typedef void (*message_callback_t) (iridium_t* satcom, char* data);
+typedef void (*urc_callback_t) (iridium_t* satcom, iridium_urc_event_t* event);
+typedef void (*metrics_callback_t) (iridium_t* satcom, const iridium_metrics_t* metrics);
+
+/**
+ * @brief Recognise an unsolicited result code (URC) line. 
+ * @param line the response line without line terminators.
+ * @param event the iridium_urc_event_t to fill, can be NULL.
+ * @return the iridium_urc_t of the line or URC_NONE.
+ */
+iridium_urc_t iridium_urc_parse(const char *line, iridium_urc_event_t *event);
+
+/**
+ * @brief Feed raw bytes from the UART bus into the response parser. 
+ * @param satcom the iridium_t struct pointer.
+ * @param data the received bytes.
+ * @param size the number of received bytes.
+ */
+void iridium_rx_feed(iridium_t *satcom, const uint8_t *data, size_t size);
 
 /**
  * @brief Process data returned to device from UART bus. 
@@ -234,7 +762,7 @@ iridium_queue_status_t iridium_get_iqs(iridium_t* satcom);
 /**
  * @brief Send data payload across the UART bus.
  * @param satcom the iridium_t struct pointer.
- * @param data the data to be sent. 
+ * @param data the data to be sent, shorter than IRI_CMD_MAX. 
  * @param nonce the nonce used to track responses. 
  * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
  */
@@ -251,6 +779,54 @@ iridium_status_t iridium_send_raw(iridium_t* satcom, char *data, int nonce);
  */
 iridium_result_t iridium_send(iridium_t* satcom, iridium_command_t command, char *rdata, bool wait_response, int wait_interval);
 
+/** 
+ * @brief Send AT command with data at a dispatch priority.  
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command.
+ * @param rdata the raw data. 
+ * @param priority the iridium_priority_t of the command.
+ * @param wait_response wait for a responce from the modem.
+ * @param wait_interval the amount of time in ms for wait interval check.
+ * @return a iridium_result_t with metadata, IRI_ERR_QUEUE_FULL when the priority class is full.
+ */
+iridium_result_t iridium_send_priority(iridium_t* satcom, iridium_command_t command, char *rdata, iridium_priority_t priority, bool wait_response, int wait_interval);
+
+/** 
+ * @brief Send AT command with data and wait for the response text in a caller buffer.  
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command.
+ * @param rdata the raw data. 
+ * @param priority the iridium_priority_t of the command.
+ * @param buffer the response text, always terminated, may be NULL when size is 0.
+ * @param size the buffer size.
+ * @return a iridium_result_t with metadata, length >= size when the text did not fit the buffer.
+ */
+iridium_result_t iridium_send_into(iridium_t* satcom, iridium_command_t command, char *rdata, iridium_priority_t priority, char *buffer, size_t size);
+
+/**
+ * @brief Command queue statistics of a priority class (depth, wait times, rejects).
+ * @param satcom the iridium_t struct pointer.
+ * @param priority the iridium_priority_t class.
+ * @param stats the dispatch_stats to fill.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_queue_stats(iridium_t* satcom, iridium_priority_t priority, struct dispatch_stats *stats);
+
+/**
+ * @brief Initialize the driver state (locks, queues, counters) without the UART or tasks.
+ * @param satcom the iridium_t struct pointer.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_init(iridium_t *satcom);
+
+/**
+ * @brief Fail the outstanding command and release the modem for the next one.
+ * @param satcom the iridium_t struct pointer.
+ * @param error the iridium_error_t reported to the waiter.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when no command is outstanding.
+ */
+iridium_status_t iridium_cancel(iridium_t *satcom, iridium_error_t error);
+
 /**
  * @brief Configure iridium modem via UART connection. 
  * @param satcom the iridium_t struct pointer.
@@ -258,6 +834,13 @@ iridium_result_t iridium_send(iridium_t* satcom, iridium_command_t command, char
  */
 iridium_status_t iridium_config(iridium_t *satcom);
 
+/**
+ * @brief Stop the driver tasks and release what iridium_config() took, the struct itself stays.
+ * @param satcom the iridium_t struct pointer.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when the driver was not configured.
+ */
+iridium_status_t iridium_deinit(iridium_t *satcom);
+
 /**
  * @brief Enabled or disable the ring notification on the modem.  
  * @param satcom the iridium_t struct pointer.
@@ -266,6 +849,22 @@ iridium_status_t iridium_config(iridium_t *satcom);
  */
 iridium_result_t iridium_config_ring(iridium_t *satcom, bool enabled);
 
+/**
+ * @brief Enabled or disable the +CIEV signal/service indicator events.  
+ * @param satcom the iridium_t struct pointer.
+ * @param enabled the indicator events.
+ * @return a iridium_result_t with metadata.
+ */
+iridium_result_t iridium_config_indicators(iridium_t *satcom, bool enabled);
+
+/**
+ * @brief Enabled or disable the command echo (ATE1/ATE0) on the modem.  
+ * @param satcom the iridium_t struct pointer.
+ * @param enabled the command echo, disabled saves UART bandwidth and parse work.
+ * @return a iridium_result_t with metadata.
+ */
+iridium_result_t iridium_config_echo(iridium_t *satcom, bool enabled);
+
 /**
  * @brief Transmit a message to the iridium network.
  * @param satcom the iridium_t struct pointer.
@@ -274,6 +873,33 @@ iridium_result_t iridium_config_ring(iridium_t *satcom, bool enabled);
  */
 iridium_result_t iridium_tx_message(iridium_t *satcom, char *message);
 
+/**
+ * @brief Transmit a message to the iridium network at a dispatch priority.
+ * @param satcom the iridium_t struct pointer.
+ * @param message to be sent.
+ * @param priority the iridium_priority_t, IRI_PRIORITY_URGENT preempts the retry back-off of other messages.
+ * @return a iridium_result_t with metadata.
+ */
+iridium_result_t iridium_tx_message_priority(iridium_t *satcom, char *message, iridium_priority_t priority);
+
+/**
+ * @brief Write a binary message to the MO buffer (+SBDWB).
+ * @param satcom the iridium_t struct pointer.
+ * @param data the message bytes.
+ * @param size the message size, 1 to IRI_SBD_MO_MAX bytes.
+ * @return a iridium_result_t with metadata.
+ */
+iridium_result_t iridium_write_binary(iridium_t *satcom, const uint8_t *data, size_t size);
+
+/**
+ * @brief Transmit a binary message to the iridium network (+SBDWB then +SBDIX).
+ * @param satcom the iridium_t struct pointer.
+ * @param data the message bytes.
+ * @param size the message size, 1 to IRI_SBD_MO_MAX bytes.
+ * @return a iridium_result_t with metadata.
+ */
+iridium_result_t iridium_tx_binary(iridium_t *satcom, const uint8_t *data, size_t size);
+
 /**
  * @brief Create a default iridium configuration.
  * @return a valid iridium_t struct configuration.
@@ -287,11 +913,267 @@ iridium_t* iridium_default_configuration();
 iridium_status_t iridium_system_spec(iridium_t *satcom);
 
 /**
- * @brief Toggle modem to sleep.
+ * @brief Compute the memory budget of the driver instance.
+ * @param satcom the iridium_t struct pointer.
+ * @param footprint the iridium_footprint_t to fill.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_footprint(iridium_t *satcom, iridium_footprint_t *footprint);
+
+/**
+ * @brief Log the static and heap usage of the driver instance.
+ * @param satcom the iridium_t struct pointer.
+ */
+void iridium_footprint_report(iridium_t *satcom);
+
+/**
+ * @brief Copy the session metrics of the driver instance.
+ * @param satcom the iridium_t struct pointer.
+ * @param metrics the iridium_metrics_t to fill.
  * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
  */
+iridium_status_t iridium_metrics_snapshot(iridium_t *satcom, iridium_metrics_t *metrics);
+
+/**
+ * @brief Clear the session metrics of the driver instance.
+ * @param satcom the iridium_t struct pointer.
+ */
+void iridium_metrics_reset(iridium_t *satcom);
+
+/**
+ * @brief Log a session metrics snapshot, usable as the metrics_callback.
+ * @param satcom the iridium_t struct pointer.
+ * @param metrics the snapshot to log.
+ */
+void iridium_metrics_report(iridium_t *satcom, const iridium_metrics_t *metrics);
+
+/**
+ * @brief Copy the binary trace of the driver instance, oldest event first.
+ * @param satcom the iridium_t struct pointer.
+ * @param entries the storage for the events.
+ * @param max the number of entries.
+ * @param dropped the number of events lost to overwrites, can be NULL.
+ * @return the number of copied events.
+ */
+size_t iridium_trace_snapshot(iridium_t *satcom, struct trace_entry *entries, size_t max, uint32_t *dropped);
+
+/**
+ * @brief Log the binary trace as IRTRACE hex lines for tools/iridium_trace.
+ * @param satcom the iridium_t struct pointer.
+ */
+void iridium_trace_dump(iridium_t *satcom);
+
+/**
+ * @brief Record all UART bytes in both directions into a capture (tools/iridium_replay).
+ * @param satcom the iridium_t struct pointer.
+ * @param capture an initialized capture writer, must stay valid until iridium_capture_stop().
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ * @note call after iridium_config(), the capture lock is created there.
+ */
+iridium_status_t iridium_capture_start(iridium_t *satcom, struct capture_t *capture);
+
+/**
+ * @brief Stop recording, the capture writer can be closed afterwards.
+ * @param satcom the iridium_t struct pointer.
+ */
+void iridium_capture_stop(iridium_t *satcom);
+
+/**
+ * @brief Put the modem to sleep through the SLP pin, only when it is idle.
+ * @param satcom the iridium_t struct pointer.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when busy, held or no SLP pin is set.
+ */
 iridium_status_t iridium_modem_sleep(iridium_t *satcom);
 
+/**
+ * @brief Wake the modem and wait until it answers AT.
+ * @param satcom the iridium_t struct pointer.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_modem_wake(iridium_t *satcom);
+
+/**
+ * @brief Keep the modem awake across a sequence of commands (e.g. +SBDWB then +SBDIX).
+ * @param satcom the iridium_t struct pointer.
+ */
+void iridium_power_hold(iridium_t *satcom);
+
+/**
+ * @brief Release a iridium_power_hold(), the idle timeout starts again.
+ * @param satcom the iridium_t struct pointer.
+ */
+void iridium_power_release(iridium_t *satcom);
+
+/**
+ * @brief Queue a record for the next transmit window.
+ * @param satcom the iridium_t struct pointer.
+ * @param data the record bytes.
+ * @param size the record size, 1 to OUTBOX_RECORD_MAX bytes.
+ * @param max_delay_ms send within this time (opens a window early), 0 = next window.
+ * @param ttl_ms drop the record if it could not be sent within this time, 0 = keep until sent.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when the outbox is full or the scheduler is off.
+ */
+iridium_status_t iridium_schedule(iridium_t *satcom, const uint8_t *data, size_t size, uint32_t max_delay_ms,
+                                  uint32_t ttl_ms);
+
+/**
+ * @brief Set the latest value of a key for the next transmit window, replacing the unsent one.
+ * @param satcom the iridium_t struct pointer.
+ * @param key the key, e.g. one per sensor; keys are not sent, put an id in the record if the backend needs it.
+ * @param data the record bytes.
+ * @param size the record size, 1 to IRI_OUTBOX_VALUE_MAX bytes.
+ * @param max_delay_ms send within this time (opens a window early), 0 = next window. A replaced record's earlier deadline is kept.
+ * @param ttl_ms drop the record if it could not be sent within this time, 0 = keep until sent.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when IRI_OUTBOX_KEYS other keys are in use or the scheduler is off.
+ */
+iridium_status_t iridium_schedule_latest(iridium_t *satcom, uint8_t key, const uint8_t *data, size_t size,
+                                         uint32_t max_delay_ms, uint32_t ttl_ms);
+
+/**
+ * @brief Number of values of a key replaced before they were sent.
+ * @param satcom the iridium_t struct pointer.
+ * @param key the key.
+ * @param overwrites the count to fill.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when the key was never scheduled.
+ */
+iridium_status_t iridium_schedule_overwrites(iridium_t *satcom, uint8_t key, uint32_t *overwrites);
+
+/**
+ * @brief Open a transmit window now, e.g. before a planned shutdown.
+ * @param satcom the iridium_t struct pointer.
+ */
+void iridium_window_open(iridium_t *satcom);
+
+/**
+ * @brief Copy the transmit window statistics.
+ * @param satcom the iridium_t struct pointer.
+ * @param stats the iridium_window_stats_t to fill.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_window_stats(iridium_t *satcom, iridium_window_stats_t *stats);
+
+/**
+ * @brief Copy the MT sequence window counters, duplicates dropped and MTMSN gaps seen.
+ * @param satcom the iridium_t struct pointer.
+ * @param stats the sequence_stats to fill.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when the window is off.
+ */
+iridium_status_t iridium_mt_stats(iridium_t *satcom, struct sequence_stats *stats);
+
+/**
+ * @brief Queue a message for reliable delivery, it is resent until the backend acknowledges it.
+ * @param satcom the iridium_t struct pointer.
+ * @param data the message bytes.
+ * @param size the message size, 1 to IRI_SBD_MO_MAX - RELIABLE_HEADER bytes.
+ * @param seq the sequence number the acknowledgement refers to, can be NULL.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when every slot is taken or reliable delivery is off.
+ */
+iridium_status_t iridium_reliable_send(iridium_t *satcom, const uint8_t *data, size_t size, uint16_t *seq);
+
+/**
+ * @brief Send the queued and resend the unacknowledged messages now, one session each.
+ * @param satcom the iridium_t struct pointer.
+ * @return the number of frames sent, -1 when a session failed or reliable delivery is off.
+ */
+int iridium_reliable_flush(iridium_t *satcom);
+
+/**
+ * @brief Whether a message still waits for its acknowledgement.
+ * @param satcom the iridium_t struct pointer.
+ * @param seq the sequence number from iridium_reliable_send().
+ * @return 1 while it is kept, 0 once the backend acknowledged it.
+ */
+int iridium_reliable_pending(iridium_t *satcom, uint16_t seq);
+
+/**
+ * @brief Copy the reliable delivery statistics.
+ * @param satcom the iridium_t struct pointer.
+ * @param stats the reliable_stats to fill.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when reliable delivery is off.
+ */
+iridium_status_t iridium_reliable_stats(iridium_t *satcom, struct reliable_stats *stats);
+
+/**
+ * @brief Copy the airtime budget counters and what is left of the rate, day and month.
+ * @param satcom the iridium_t struct pointer.
+ * @param stats the budget_stats to fill.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when the budget is off.
+ */
+iridium_status_t iridium_budget_stats(iridium_t *satcom, struct budget_stats *stats);
+
+/**
+ * @brief Convert a -MSSTM tick count to UTC.
+ * @param ticks the 90 ms tick count.
+ * @return the UTC time in ms since the Unix epoch.
+ */
+uint64_t iridium_msstm_to_utc_ms(uint32_t ticks);
+
+/**
+ * @brief Read the Iridium system time (AT-MSSTM) and sync the clock offset.
+ * @param satcom the iridium_t struct pointer.
+ * @return a iridium_result_t with metadata, IRI_ERR_NO_SERVICE without network.
+ */
+iridium_result_t iridium_time_sync(iridium_t *satcom);
+
+/**
+ * @brief The current UTC time from the last sync, no modem traffic.
+ * @param satcom the iridium_t struct pointer.
+ * @param utc_ms the UTC time in ms since the Unix epoch.
+ * @param age_ms the time since the sync, can be NULL.
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR before the first sync.
+ */
+iridium_status_t iridium_time_utc_ms(iridium_t *satcom, uint64_t *utc_ms, uint32_t *age_ms);
+
+/**
+ * @brief Predict the best time to start a session from the signal history.
+ * @param satcom the iridium_t struct pointer.
+ * @param horizon_ms the longest acceptable wait.
+ * @param estimate the forecast_estimate to fill (delay, success probability, trend, pass period).
+ * @return a iridium_status_t with SAT_OK, SAT_ERROR when the forecast is off or has no samples.
+ */
+iridium_status_t iridium_forecast(iridium_t *satcom, uint32_t horizon_ms, struct forecast_estimate *estimate);
+
+/**
+ * @brief Run a query command through the cache, the modem is asked on a miss or an expired entry.
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command, e.g. AT_CGMI, AT_CSQ, AT_SBDSX.
+ * @return a iridium_result_t with metadata, latency_ms 0 on a hit.
+ */
+iridium_result_t iridium_query(iridium_t *satcom, iridium_command_t command);
+
+/**
+ * @brief Run a query command through the cache with the response text in a caller buffer.
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command, e.g. AT_CGMI, AT_CSQ, AT_SBDSX.
+ * @param buffer the response text, always terminated, may be NULL when size is 0.
+ * @param size the buffer size.
+ * @return a iridium_result_t with metadata, latency_ms 0 on a hit, length >= size when the text did not fit the buffer.
+ */
+iridium_result_t iridium_query_into(iridium_t *satcom, iridium_command_t command, char *buffer, size_t size);
+
+/**
+ * @brief Drop the cached answer of a command, NVS included.
+ * @param satcom the iridium_t struct pointer.
+ * @param command the iridium modem AT command, IRI_COMMAND_COUNT for all.
+ */
+void iridium_cache_invalidate(iridium_t *satcom, iridium_command_t command);
+
+/**
+ * @brief Copy the query cache counters.
+ * @param satcom the iridium_t struct pointer.
+ * @param stats the iridium_cache_stats_t to fill.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_cache_stats(iridium_t *satcom, iridium_cache_stats_t *stats);
+
+/**
+ * @brief Copy the power accounting, time and estimated energy per state.
+ * @param satcom the iridium_t struct pointer.
+ * @param stats the iridium_power_stats_t to fill.
+ * @return a iridium_status_t with SAT_OK or SAT_ERROR value.
+ */
+iridium_status_t iridium_power_stats(iridium_t *satcom, iridium_power_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,856 @@
+/**
+ * @file iridium.hpp
+ * @brief A header-only C++ layer over the iridium driver
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This header file wraps iridium.h for C++17 and C++20 firmware:
+ *
+ * - Modem owns the driver. The constructor runs iridium_config() and starts the worker tasks,
+ *   the destructor stops them and calls iridium_deinit(). It can't be copied or moved, the
+ *   driver tasks and the workers hold its address.
+ * - MoMessage and MtMessage are move-only handles to buffers of fixed pools inside the Modem,
+ *   IRI_CPP_MO_BUFFERS of IRI_SBD_MO_MAX bytes and IRI_CPP_MT_BUFFERS of IRI_MESSAGE_MAX bytes.
+ *   A buffer goes back to its pool when its handle is destroyed. With C++20 they give
+ *   std::span views of their bytes.
+ * - Result, Session and Signal type the iridium_result_t of a command, a +SBDIX session and
+ *   a +CSQ answer.
+ *
+ * With C++20 coroutines every command also has an async_ form to co_await. The awaiter lives
+ * in the coroutine frame and is handed to one of IRI_CPP_WORKERS tasks, which runs the blocking
+ * call, so a task can have as many operations outstanding as there are workers and more queue
+ * up. The coroutine is resumed by poll() on the task that drives it, never on a worker.
+ * async_receive() waits for the next MT message the same way.
+ *
+ * Nothing here allocates from the heap, the pools and the queues are part of the Modem and
+ * the awaiters are part of the coroutine frames. The frames of Task coroutines come from the
+ * Modem too, IRI_CPP_FRAMES of IRI_CPP_FRAME_SIZE bytes, so a Task takes its Modem& as the
+ * first parameter. What is allocated is the driver's own, in iridium_default_configuration()
+ * and iridium_config(). Operations still queued when the Modem is destroyed are never resumed,
+ * no Task may still be suspended then and no message handle may outlive the Modem.
+ *
+ * Usage example:
+ * @code
+ * iri::Modem modem([](iridium_t &satcom) { satcom.uart_number = UART_NUM_1; });
+ *
+ * iri::Task report(iri::Modem &modem)
+ * {
+ *   iri::MoMessage message = modem.message();
+ *   message.assign(position, sizeof(position));
+ *   iri::Session session = co_await modem.async_transmit(std::move(message));
+ *   iri::MtMessage reply = co_await modem.async_receive();
+ * }
+ *
+ * report(modem);
+ * for (;;)
+ *   modem.poll(std::chrono::milliseconds(1000));
+ * @endcode
+ */
+
+#ifndef IRIDIUM_HPP_INCLUDED
+#define IRIDIUM_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <exception>
+#include <mutex>
+#include <condition_variable>
+#include <string_view>
+#include <utility>
+
+#include "iridium.h"
+
+#if defined(__has_include)
+#if __has_include(<span>) && __cplusplus >= 202002L
+#include <span>
+#define IRI_CPP_SPAN 1
+#endif
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#include <coroutine>
+#define IRI_CPP_COROUTINES 1
+#endif
+#endif
+
+#ifndef IRI_CPP_MO_BUFFERS
+#define IRI_CPP_MO_BUFFERS IRI_PROFILE(4, 2)     // MoMessage buffers of a Modem
+#endif
+#ifndef IRI_CPP_MT_BUFFERS
+#define IRI_CPP_MT_BUFFERS IRI_PROFILE(4, 2)     // MtMessage buffers, received and not yet released
+#endif
+#ifndef IRI_CPP_WORKERS
+#define IRI_CPP_WORKERS (2)                      // operations run at the same time
+#endif
+#ifndef IRI_CPP_WORKER_STACK
+#define IRI_CPP_WORKER_STACK (4096)
+#endif
+#ifndef IRI_CPP_FRAMES
+#define IRI_CPP_FRAMES IRI_PROFILE(4, 3)         // coroutine frames of Tasks running at the same time
+#endif
+#ifndef IRI_CPP_FRAME_SIZE
+#define IRI_CPP_FRAME_SIZE IRI_PROFILE(1024, 512) // bytes per frame, awaiters and locals included
+#endif
+
+namespace iri
+{
+
+/**
+ * @brief iridium_error_t
+ */
+enum class Error : int
+{
+  None = IRI_ERR_NONE,
+  Modem = IRI_ERR_MODEM,
+  Timeout = IRI_ERR_TIMEOUT,
+  UartOverflow = IRI_ERR_UART_OVERFLOW,
+  QueueFull = IRI_ERR_QUEUE_FULL,
+  InvalidArg = IRI_ERR_INVALID_ARG,
+  Parse = IRI_ERR_PARSE,
+  SbdwbTimeout = IRI_ERR_SBDWB_TIMEOUT,
+  SbdwbChecksum = IRI_ERR_SBDWB_CHECKSUM,
+  SbdwbSize = IRI_ERR_SBDWB_SIZE,
+  Session = IRI_ERR_SESSION,
+  Preempted = IRI_ERR_PREEMPTED,
+  NoService = IRI_ERR_NO_SERVICE,
+  Budget = IRI_ERR_BUDGET,
+  Truncated = IRI_ERR_TRUNCATED,
+};
+
+/**
+ * @brief iridium_priority_t
+ */
+enum class Priority : int
+{
+  Urgent = IRI_PRIORITY_URGENT,
+  Normal = IRI_PRIORITY_NORMAL,
+  Background = IRI_PRIORITY_BACKGROUND,
+};
+
+/**
+ * @brief The outcome of a command
+ */
+class Result
+{
+public:
+  Result()
+  {
+    std::memset(&result_, 0, sizeof result_);
+    result_.status = SAT_ERROR;
+    result_.mo_status = -1;
+    result_.mt_status = -1;
+  }
+  explicit Result(const iridium_result_t &result) : result_(result) {}
+
+  bool ok() const { return result_.status == SAT_OK; }
+  explicit operator bool() const { return ok(); }
+  Error error() const { return static_cast<Error>(result_.error); }
+  /** The response text, "+CSQ:4", empty when it went to a caller buffer */
+  std::string_view text() const { return std::string_view(result_.result, strnlen(result_.result, sizeof result_.result)); }
+  /** Exact length of the response text, more than text() or the caller buffer holds when it did not fit */
+  std::size_t length() const { return result_.length; }
+  std::chrono::milliseconds latency() const { return std::chrono::milliseconds(result_.latency_ms); }
+  const iridium_result_t &raw() const { return result_; }
+
+protected:
+  iridium_result_t result_;
+};
+
+/**
+ * @brief The outcome of a +SBDIX session, after its retries
+ */
+class Session : public Result
+{
+public:
+  using Result::Result;
+
+  /** The MO message went through */
+  bool sent() const { return ok() && result_.mo_status >= MO_TRANSFERRED_SUCCESSFULLY && result_.mo_status <= MO_TRANSFERRED_SUCCESSFULLY_LOC_NOT_ACCEPTED; }
+  /** -1 when no session ran */
+  iridium_mo_status_t mo_status() const { return static_cast<iridium_mo_status_t>(result_.mo_status); }
+  /** -1 when no session ran */
+  iridium_mt_status_t mt_status() const { return static_cast<iridium_mt_status_t>(result_.mt_status); }
+  bool mt_received() const { return result_.mt_status == MT_SBD_MESSAGE_SUCCESSFULLY_RECEIVED; }
+};
+
+/**
+ * @brief The outcome of a +CSQ query
+ */
+class Signal : public Result
+{
+public:
+  using Result::Result;
+
+  /** Signal strength 0 to 5, -1 without an answer */
+  int bars() const
+  {
+    std::string_view answer = text();
+    std::size_t colon = answer.find(':');
+    if (!ok() || colon == std::string_view::npos || colon + 1 >= answer.size())
+      return -1;
+    char digit = answer[colon + 1];
+    return digit >= '0' && digit <= '5' ? digit - '0' : -1;
+  }
+};
+
+/**
+ * @brief Fixed buffers handed out one at a time
+ */
+template <std::size_t Count, std::size_t Size>
+class BufferPool
+{
+public:
+  static constexpr std::size_t slot_size = Size;
+
+  struct Slot
+  {
+    alignas(std::max_align_t) std::uint8_t data[Size];
+    std::size_t size;
+    bool used;
+  };
+
+  /** An empty buffer, nullptr when all are in use */
+  Slot *take()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (Slot &slot : slots_)
+    {
+      if (slot.used)
+        continue;
+      slot.used = true;
+      slot.size = 0;
+      return &slot;
+    }
+    return nullptr;
+  }
+
+  void give(Slot *slot)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    slot->used = false;
+  }
+
+  std::size_t available()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t count = 0;
+    for (const Slot &slot : slots_)
+      count += !slot.used;
+    return count;
+  }
+
+private:
+  std::mutex mutex_;
+  Slot slots_[Count] = {};
+};
+
+/**
+ * @brief Move-only handle to a pool buffer, empty when the pool was exhausted
+ */
+template <typename Pool>
+class PooledBuffer
+{
+public:
+  PooledBuffer() = default;
+  PooledBuffer(Pool *pool, typename Pool::Slot *slot) : pool_(pool), slot_(slot) {}
+  PooledBuffer(PooledBuffer &&other) noexcept : pool_(other.pool_), slot_(std::exchange(other.slot_, nullptr)) {}
+  PooledBuffer &operator=(PooledBuffer &&other) noexcept
+  {
+    if (this != &other)
+    {
+      reset();
+      pool_ = other.pool_;
+      slot_ = std::exchange(other.slot_, nullptr);
+    }
+    return *this;
+  }
+  PooledBuffer(const PooledBuffer &) = delete;
+  PooledBuffer &operator=(const PooledBuffer &) = delete;
+  ~PooledBuffer() { reset(); }
+
+  explicit operator bool() const { return slot_ != nullptr; }
+  std::size_t size() const { return slot_ != nullptr ? slot_->size : 0; }
+  static constexpr std::size_t capacity() { return Pool::slot_size; }
+
+  /** Gives the buffer back to its pool */
+  void reset()
+  {
+    if (slot_ != nullptr)
+      pool_->give(slot_);
+    slot_ = nullptr;
+  }
+
+protected:
+  Pool *pool_ = nullptr;
+  typename Pool::Slot *slot_ = nullptr;
+};
+
+using MoPool = BufferPool<IRI_CPP_MO_BUFFERS, IRI_SBD_MO_MAX>;
+using MtPool = BufferPool<IRI_CPP_MT_BUFFERS, IRI_MESSAGE_MAX>;
+using FramePool = BufferPool<IRI_CPP_FRAMES, IRI_CPP_FRAME_SIZE>;
+
+/**
+ * @brief An MO message, up to IRI_SBD_MO_MAX bytes
+ */
+class MoMessage : public PooledBuffer<MoPool>
+{
+public:
+  using PooledBuffer::PooledBuffer;
+
+  std::uint8_t *data() { return slot_ != nullptr ? slot_->data : nullptr; }
+  const std::uint8_t *data() const { return slot_ != nullptr ? slot_->data : nullptr; }
+
+  /** Copies the bytes in, false without a buffer or when they don't fit */
+  bool assign(const void *bytes, std::size_t size)
+  {
+    if (slot_ == nullptr || size > capacity())
+      return false;
+    std::memcpy(slot_->data, bytes, size);
+    slot_->size = size;
+    return true;
+  }
+
+  /** Sets the size after writing to data() directly */
+  bool resize(std::size_t size)
+  {
+    if (slot_ == nullptr || size > capacity())
+      return false;
+    slot_->size = size;
+    return true;
+  }
+
+#ifdef IRI_CPP_SPAN
+  std::span<std::uint8_t> bytes() { return std::span<std::uint8_t>(data(), size()); }
+  std::span<const std::uint8_t> bytes() const { return std::span<const std::uint8_t>(data(), size()); }
+#endif
+};
+
+/**
+ * @brief A received MT message
+ */
+class MtMessage : public PooledBuffer<MtPool>
+{
+public:
+  using PooledBuffer::PooledBuffer;
+
+  const std::uint8_t *data() const { return slot_ != nullptr ? slot_->data : nullptr; }
+  std::string_view text() const { return std::string_view(reinterpret_cast<const char *>(data()), size()); }
+
+#ifdef IRI_CPP_SPAN
+  std::span<const std::uint8_t> bytes() const { return std::span<const std::uint8_t>(data(), size()); }
+#endif
+};
+
+#ifdef IRI_CPP_COROUTINES
+
+class Modem;
+
+/**
+ * @brief A fire-and-forget coroutine, it runs until its first co_await and is resumed by poll()
+ *
+ * The first parameter of a Task coroutine is the Modem&, its frame comes from the Modem's
+ * IRI_CPP_FRAMES pool. When no frame is free or the frame is larger than IRI_CPP_FRAME_SIZE
+ * the coroutine does not start and the Task is false.
+ */
+class Task
+{
+public:
+  struct promise_type
+  {
+    Task get_return_object() noexcept { return Task(true); }
+    static Task get_return_object_on_allocation_failure() noexcept { return Task(false); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+
+    template <typename... Args>
+    static void *operator new(std::size_t size, Modem &modem, Args &&...) noexcept;
+    static void operator delete(void *frame) noexcept;
+  };
+
+  explicit operator bool() const { return started_; }
+
+private:
+  explicit Task(bool started) : started_(started) {}
+  bool started_;
+};
+
+/**
+ * @brief An awaiter queued on the Modem, part of the awaiting coroutine's frame
+ */
+struct Pending
+{
+  Pending *next = nullptr;
+  void (*run)(Pending *pending, iridium_t *satcom) = nullptr;     /**< nullptr when nothing runs on a worker */
+  std::coroutine_handle<> handle;
+};
+
+/**
+ * @brief An intrusive FIFO of awaiters
+ */
+struct PendingList
+{
+  Pending *head = nullptr;
+  Pending *tail = nullptr;
+
+  void push(Pending *pending)
+  {
+    pending->next = nullptr;
+    if (tail != nullptr)
+      tail->next = pending;
+    else
+      head = pending;
+    tail = pending;
+  }
+
+  Pending *pop()
+  {
+    Pending *pending = head;
+    if (pending != nullptr)
+    {
+      head = pending->next;
+      if (head == nullptr)
+        tail = nullptr;
+    }
+    return pending;
+  }
+};
+
+/**
+ * @brief A blocking call run on a worker, co_await gives its result
+ */
+template <typename T, typename Work>
+class Operation : private Pending
+{
+public:
+  Operation(Modem &modem, Work &&work) : modem_(modem), work_(std::move(work))
+  {
+    run = &Operation::execute;
+  }
+  Operation(const Operation &) = delete;
+  Operation &operator=(const Operation &) = delete;
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> handle);
+  T await_resume() { return std::move(value_); }
+
+private:
+  static void execute(Pending *pending, iridium_t *satcom)
+  {
+    Operation *operation = static_cast<Operation *>(pending);
+    operation->value_ = operation->work_(satcom);
+  }
+
+  Modem &modem_;
+  Work work_;
+  T value_;
+};
+
+/**
+ * @brief Waits for the next MT message, co_await gives it
+ */
+class Receive : private Pending
+{
+public:
+  explicit Receive(Modem &modem) : modem_(modem) {}
+  Receive(const Receive &) = delete;
+  Receive &operator=(const Receive &) = delete;
+
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<> handle);
+  MtMessage await_resume() { return std::move(message_); }
+
+private:
+  friend class Modem;
+  Modem &modem_;
+  MtMessage message_;
+};
+
+#endif
+
+/**
+ * @brief The driver, its worker tasks and its buffers
+ */
+class Modem
+{
+public:
+  /**
+   * @brief Configures and starts the driver
+   *
+   * @param configure Called with the default configuration before iridium_config(), sets the
+   *        UART, the pins and the features. message_callback is taken over by receive().
+   */
+  template <typename Configure>
+  explicit Modem(Configure &&configure)
+  {
+    satcom_ = iridium_default_configuration();
+    if (satcom_ == nullptr)
+      return;
+    configure(*satcom_);
+    satcom_->user_data = this;
+    satcom_->message_callback = &Modem::on_message;
+    /* the URC task reports signal changes through it unconditionally */
+    if (satcom_->callback == nullptr)
+      satcom_->callback = &Modem::on_status;
+    status_ = iridium_config(satcom_);
+    if (status_ != SAT_OK)
+      return;
+#ifdef IRI_CPP_COROUTINES
+    for (TaskHandle_t &worker : workers_)
+    {
+      if (xTaskCreate(&Modem::worker_task, "iridium_cpp_worker", IRI_CPP_WORKER_STACK, this, 11, &worker) == pdPASS)
+        running_++;
+    }
+#endif
+  }
+
+  Modem() : Modem([](iridium_t &) {}) {}
+
+  ~Modem()
+  {
+#ifdef IRI_CPP_COROUTINES
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      stopping_ = true;
+      requests_ready_.notify_all();
+      stopped_.wait(lock, [this] { return running_ == 0; });
+    }
+#endif
+    if (satcom_ != nullptr)
+    {
+      iridium_deinit(satcom_);
+      free(satcom_);
+    }
+  }
+
+  Modem(const Modem &) = delete;
+  Modem &operator=(const Modem &) = delete;
+  Modem(Modem &&) = delete;
+  Modem &operator=(Modem &&) = delete;
+
+  /** iridium_config() succeeded */
+  bool ok() const { return satcom_ != nullptr && status_ == SAT_OK; }
+  explicit operator bool() const { return ok(); }
+  /** The driver, for the rest of the C API */
+  iridium_t *get() { return satcom_; }
+
+  /** An empty MO buffer, empty when all IRI_CPP_MO_BUFFERS are in use */
+  MoMessage message()
+  {
+    return MoMessage(&mo_pool_, mo_pool_.take());
+  }
+
+  /** The oldest MT message received, empty when there is none */
+  MtMessage receive()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return MtMessage(&mt_pool_, mt_pop());
+  }
+
+  /** MT messages dropped because every MT buffer was held */
+  std::uint32_t mt_dropped()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return mt_dropped_;
+  }
+
+  /**
+   * @brief Sends a command and waits for its answer, iridium_send_priority()
+   */
+  Result send(iridium_command_t command, const char *data = nullptr, Priority priority = Priority::Normal)
+  {
+    return Result(iridium_send_priority(satcom_, command, const_cast<char *>(data), static_cast<iridium_priority_t>(priority), true, 500));
+  }
+
+  /**
+   * @brief Sends a command and waits for its answer in a caller buffer, iridium_send_into()
+   */
+  Result send(iridium_command_t command, char *buffer, std::size_t size, const char *data = nullptr,
+              Priority priority = Priority::Normal)
+  {
+    return Result(iridium_send_into(satcom_, command, const_cast<char *>(data), static_cast<iridium_priority_t>(priority), buffer, size));
+  }
+
+  /**
+   * @brief Runs a query through the cache, iridium_query()
+   */
+  Result query(iridium_command_t command)
+  {
+    return Result(iridium_query(satcom_, command));
+  }
+
+  /**
+   * @brief Runs a query through the cache with the answer in a caller buffer, iridium_query_into()
+   */
+  Result query(iridium_command_t command, char *buffer, std::size_t size)
+  {
+    return Result(iridium_query_into(satcom_, command, buffer, size));
+  }
+
+  Signal signal()
+  {
+    return Signal(iridium_query(satcom_, AT_CSQ));
+  }
+
+  /**
+   * @brief Writes the message with +SBDWB and starts sessions until it went through, iridium_tx_binary()
+   */
+  Session transmit(const MoMessage &message)
+  {
+    return Session(iridium_tx_binary(satcom_, message.data(), message.size()));
+  }
+
+  /**
+   * @brief Sends a text message, iridium_tx_message_priority()
+   */
+  Session transmit(std::string_view text, Priority priority = Priority::Normal)
+  {
+    char message[IRI_SBD_TEXT_MAX + 1];
+    if (text.size() >= sizeof message)
+    {
+      iridium_result_t result = Session().raw();
+      result.error = IRI_ERR_INVALID_ARG;
+      return Session(result);
+    }
+    std::memcpy(message, text.data(), text.size());
+    message[text.size()] = '\0';
+    return Session(iridium_tx_message_priority(satcom_, message, static_cast<iridium_priority_t>(priority)));
+  }
+
+#ifdef IRI_CPP_COROUTINES
+  auto async_send(iridium_command_t command, const char *data = nullptr, Priority priority = Priority::Normal)
+  {
+    return operation<Result>([this, command, data, priority](iridium_t *) { return send(command, data, priority); });
+  }
+
+  auto async_query(iridium_command_t command)
+  {
+    return operation<Result>([this, command](iridium_t *) { return query(command); });
+  }
+
+  auto async_signal()
+  {
+    return operation<Signal>([this](iridium_t *) { return signal(); });
+  }
+
+  /** The message is held by the operation and released once it went through or failed */
+  auto async_transmit(MoMessage message)
+  {
+    return operation<Session>([this, message = std::move(message)](iridium_t *) { return transmit(message); });
+  }
+
+  Receive async_receive()
+  {
+    return Receive(*this);
+  }
+
+  /**
+   * @brief Resumes the coroutines whose operations completed, on the calling task
+   *
+   * @param wait How long to wait for the first completion
+   * @return The number of coroutines resumed
+   */
+  std::size_t poll(std::chrono::milliseconds wait = std::chrono::milliseconds(0))
+  {
+    PendingList done;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      completed_.wait_for(lock, wait, [this] { return done_.head != nullptr; });
+      done = done_;
+      done_ = PendingList();
+    }
+    std::size_t resumed = 0;
+    /* a resumed coroutine can queue a new operation, the list is ours */
+    while (Pending *pending = done.pop())
+    {
+      pending->handle.resume();
+      resumed++;
+    }
+    return resumed;
+  }
+#endif
+
+private:
+#ifdef IRI_CPP_COROUTINES
+  template <typename T, typename Work> friend class Operation;
+  friend class Receive;
+  friend struct Task::promise_type;
+
+  template <typename T, typename Work>
+  Operation<T, Work> operation(Work &&work)
+  {
+    return Operation<T, Work>(*this, std::forward<Work>(work));
+  }
+
+  void submit(Pending *pending)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    requests_.push(pending);
+    requests_ready_.notify_one();
+  }
+
+  /**
+   * @brief Hands the next MT message to a receiver, or queues the receiver
+   *
+   * @return false when a message was waiting and the coroutine goes on at once
+   */
+  bool receive_or_wait(Receive *receive)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    MtPool::Slot *slot = mt_pop();
+    if (slot != nullptr)
+    {
+      receive->message_ = MtMessage(&mt_pool_, slot);
+      return false;
+    }
+    receivers_.push(receive);
+    return true;
+  }
+
+  static void worker_task(void *parameters)
+  {
+    static_cast<Modem *>(parameters)->work();
+    vTaskDelete(NULL);
+  }
+
+  void work()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;)
+    {
+      requests_ready_.wait(lock, [this] { return stopping_ || requests_.head != nullptr; });
+      if (stopping_)
+        break;
+      Pending *pending = requests_.pop();
+      lock.unlock();
+      pending->run(pending, satcom_);
+      lock.lock();
+      done_.push(pending);
+      completed_.notify_all();
+    }
+    running_--;
+    stopped_.notify_all();
+  }
+#endif
+
+  /**
+   * @brief Takes the oldest queued MT message
+   *
+   * @note The caller holds the mutex
+   */
+  MtPool::Slot *mt_pop()
+  {
+    if (mt_count_ == 0)
+      return nullptr;
+    MtPool::Slot *slot = mt_queue_[mt_head_];
+    mt_head_ = (mt_head_ + 1) % IRI_CPP_MT_BUFFERS;
+    mt_count_--;
+    return slot;
+  }
+
+  static void on_message(iridium_t *satcom, char *data)
+  {
+    Modem *modem = static_cast<Modem *>(satcom->user_data);
+    MtPool::Slot *slot = modem->mt_pool_.take();
+    std::lock_guard<std::mutex> lock(modem->mutex_);
+    if (slot == nullptr)
+    {
+      modem->mt_dropped_++;
+      return;
+    }
+    slot->size = strnlen(data, MtPool::slot_size);
+    std::memcpy(slot->data, data, slot->size);
+#ifdef IRI_CPP_COROUTINES
+    /* a waiting receiver takes it directly */
+    Pending *pending = modem->receivers_.pop();
+    if (pending != nullptr)
+    {
+      static_cast<Receive *>(pending)->message_ = MtMessage(&modem->mt_pool_, slot);
+      modem->done_.push(pending);
+      modem->completed_.notify_all();
+      return;
+    }
+#endif
+    /* one slot per buffer, the queue can't overflow */
+    modem->mt_queue_[(modem->mt_head_ + modem->mt_count_) % IRI_CPP_MT_BUFFERS] = slot;
+    modem->mt_count_++;
+  }
+
+  static void on_status(iridium_t *, iridium_command_t, iridium_status_t) {}
+
+  iridium_t *satcom_ = nullptr;
+  iridium_status_t status_ = SAT_ERROR;
+  std::mutex mutex_;                                             /**< Guards the queues below */
+  MoPool mo_pool_;
+  MtPool mt_pool_;
+  MtPool::Slot *mt_queue_[IRI_CPP_MT_BUFFERS] = {};     /**< Received, not yet taken */
+  std::size_t mt_head_ = 0;
+  std::size_t mt_count_ = 0;
+  std::uint32_t mt_dropped_ = 0;
+#ifdef IRI_CPP_COROUTINES
+  PendingList requests_;                   /**< Operations waiting for a worker */
+  PendingList done_;                       /**< Completed, waiting for poll() */
+  PendingList receivers_;                  /**< async_receive() waiting for a message */
+  std::condition_variable requests_ready_;
+  std::condition_variable completed_;
+  std::condition_variable stopped_;
+  TaskHandle_t workers_[IRI_CPP_WORKERS] = {};
+  int running_ = 0;
+  bool stopping_ = false;
+  FramePool frame_pool_;
+#endif
+};
+
+#ifdef IRI_CPP_COROUTINES
+
+/**
+ * @brief Kept in front of a coroutine frame so it finds its way back to the pool
+ */
+struct FrameHeader
+{
+  FramePool *pool;
+  FramePool::Slot *slot;
+};
+
+constexpr std::size_t frame_header_size =
+    (sizeof(FrameHeader) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+template <typename... Args>
+void *Task::promise_type::operator new(std::size_t size, Modem &modem, Args &&...) noexcept
+{
+  if (size + frame_header_size > FramePool::slot_size)
+    return nullptr;
+  FramePool::Slot *slot = modem.frame_pool_.take();
+  if (slot == nullptr)
+    return nullptr;
+  FrameHeader *header = reinterpret_cast<FrameHeader *>(slot->data);
+  header->pool = &modem.frame_pool_;
+  header->slot = slot;
+  return slot->data + frame_header_size;
+}
+
+inline void Task::promise_type::operator delete(void *frame) noexcept
+{
+  FrameHeader *header = reinterpret_cast<FrameHeader *>(static_cast<std::uint8_t *>(frame) - frame_header_size);
+  header->pool->give(header->slot);
+}
+
+template <typename T, typename Work>
+void Operation<T, Work>::await_suspend(std::coroutine_handle<> handle)
+{
+  this->handle = handle;
+  modem_.submit(this);
+}
+
+inline bool Receive::await_suspend(std::coroutine_handle<> handle)
+{
+  this->handle = handle;
+  return modem_.receive_or_wait(this);
+}
+
+#endif
+
+} // namespace iri
+
+#endif /* IRIDIUM_HPP_INCLUDED */
@@ -0,0 +1,578 @@
+/**
+ * @file outbox.c
+ * @brief Implementation of the record outbox
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This file contains the implementation of the outbox declared in outbox.h. Every
+ * record is stored in the byte ring as a 10 byte header (length, flags, deadline, expiry)
+ * followed by its bytes, records may wrap around the end of the ring. A sent or expired
+ * record is flagged gone and its bytes are reclaimed once it reaches the head. Keyed
+ * records live in their slot, a slot stays with its key once assigned.
+ */
+
+#include "outbox.h"
+
+#define OUTBOX_HEADER 10
+
+#define OUTBOX_PACKED 0x01       /**< In the last frame built */
+#define OUTBOX_GONE 0x02         /**< Sent or expired, waiting to be reclaimed */
+
+/**
+ * @brief A record header
+ */
+struct outbox_record
+{
+  size_t size;
+  uint8_t flags;
+  uint32_t deadline_ms;
+  uint32_t expires_ms;
+};
+
+static void outbox_write(struct outbox_t *outbox, size_t offset, const uint8_t *data, size_t length)
+{
+  offset %= outbox->capacity;
+  size_t first = outbox->capacity - offset < length ? outbox->capacity - offset : length;
+  memcpy(outbox->ring + offset, data, first);
+  memcpy(outbox->ring, data + first, length - first);
+}
+
+static void outbox_read(const struct outbox_t *outbox, size_t offset, uint8_t *data, size_t length)
+{
+  offset %= outbox->capacity;
+  size_t first = outbox->capacity - offset < length ? outbox->capacity - offset : length;
+  memcpy(data, outbox->ring + offset, first);
+  memcpy(data + first, outbox->ring, length - first);
+}
+
+static uint32_t outbox_u32(const uint8_t *bytes)
+{
+  return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+/**
+ * @brief Reads the header of the record at offset
+ */
+static void outbox_header(const struct outbox_t *outbox, size_t offset, struct outbox_record *record)
+{
+  uint8_t header[OUTBOX_HEADER];
+  outbox_read(outbox, offset, header, sizeof header);
+  record->size = header[0];
+  record->flags = header[1];
+  record->deadline_ms = outbox_u32(header + 2);
+  record->expires_ms = outbox_u32(header + 6);
+}
+
+static void outbox_set_flags(struct outbox_t *outbox, size_t offset, uint8_t flags)
+{
+  outbox_write(outbox, offset + 1, &flags, 1);
+}
+
+/**
+ * @brief Whether deadline a is more urgent than b, 0 meaning none
+ */
+static int outbox_before(uint32_t a, uint32_t b, uint32_t now_ms)
+{
+  if (a == 0)
+    return 0;
+  /* relative to now so the ms counter may wrap */
+  return b == 0 || (int32_t)(a - now_ms) < (int32_t)(b - now_ms);
+}
+
+static int outbox_expired(uint32_t expires_ms, uint32_t now_ms)
+{
+  return expires_ms != 0 && (int32_t)(now_ms - expires_ms) >= 0;
+}
+
+/**
+ * @brief Frees the bytes of the gone records at the head
+ *
+ * @note The caller holds the mutex
+ */
+static void outbox_reclaim(struct outbox_t *outbox)
+{
+  while (outbox->stored > 0)
+  {
+    struct outbox_record record;
+    outbox_header(outbox, outbox->head, &record);
+    if (!(record.flags & OUTBOX_GONE))
+      break;
+    outbox->head = (outbox->head + OUTBOX_HEADER + record.size) % outbox->capacity;
+    outbox->used -= OUTBOX_HEADER + record.size;
+    outbox->stored--;
+  }
+  if (outbox->stored == 0)
+    outbox->head = 0;
+}
+
+/**
+ * @brief Drops the records past their expiry
+ *
+ * @note The caller holds the mutex
+ */
+static size_t outbox_evict(struct outbox_t *outbox, uint32_t now_ms)
+{
+  size_t expired = 0;
+  size_t offset = outbox->head;
+  for (size_t i = 0; i < outbox->stored; i++)
+  {
+    struct outbox_record record;
+    outbox_header(outbox, offset, &record);
+    if (!(record.flags & OUTBOX_GONE) && outbox_expired(record.expires_ms, now_ms))
+    {
+      outbox_set_flags(outbox, offset, OUTBOX_GONE);
+      outbox->count--;
+      outbox->payload -= record.size;
+      expired++;
+    }
+    offset += OUTBOX_HEADER + record.size;
+  }
+  for (size_t i = 0; i < outbox->keys; i++)
+  {
+    struct outbox_slot *slot = &outbox->slots[i];
+    if (!slot->pending || !outbox_expired(slot->expires_ms, now_ms))
+      continue;
+    slot->pending = 0;
+    slot->packed = 0;
+    outbox->pending--;
+    outbox->payload -= slot->length;
+    expired++;
+  }
+  outbox->stats.expired += expired;
+  outbox_reclaim(outbox);
+  return expired;
+}
+
+/**
+ * @brief Finds the slot of a key
+ *
+ * @note The caller holds the mutex
+ */
+static struct outbox_slot *outbox_slot(struct outbox_t *outbox, uint8_t key, int assign)
+{
+  struct outbox_slot *free_slot = NULL;
+  for (size_t i = 0; i < outbox->keys; i++)
+  {
+    struct outbox_slot *slot = &outbox->slots[i];
+    if (slot->assigned && slot->key == key)
+      return slot;
+    if (!slot->assigned && free_slot == NULL)
+      free_slot = slot;
+  }
+  if (!assign || free_slot == NULL)
+    return NULL;
+  free_slot->assigned = 1;
+  free_slot->key = key;
+  return free_slot;
+}
+
+/**
+ * @brief Creates a new empty outbox
+ *
+ * @param capacity Size of the record storage in bytes
+ * @param keys Number of keys for outbox_put(), 0 for events only
+ * @param value_max Largest keyed record, up to OUTBOX_RECORD_MAX
+ * @return Pointer to the newly created outbox, or NULL if allocation failed
+ */
+struct outbox_t *newOutbox(size_t capacity, size_t keys, size_t value_max)
+{
+  if (capacity == 0 || value_max > OUTBOX_RECORD_MAX || (keys > 0 && value_max == 0))
+    return NULL;
+  struct outbox_t *outbox = calloc(1, sizeof *outbox);
+  if (outbox == NULL)
+    return NULL;
+  outbox->ring = malloc(capacity);
+  uint8_t *values = NULL;
+  if (keys > 0)
+  {
+    outbox->slots = calloc(keys, sizeof *outbox->slots);
+    values = malloc(keys * value_max);
+  }
+  if (outbox->ring == NULL || (keys > 0 && (outbox->slots == NULL || values == NULL)))
+  {
+    free(values);
+    free(outbox->slots);
+    free(outbox->ring);
+    free(outbox);
+    return NULL;
+  }
+  for (size_t i = 0; i < keys; i++)
+    outbox->slots[i].data = values + i * value_max;
+  outbox->keys = keys;
+  outbox->value_max = value_max;
+  outbox->capacity = capacity;
+  pthread_mutex_init(&outbox->mutex, NULL);
+  return outbox;
+}
+
+/**
+ * @brief Copies a record into the outbox
+ *
+ * @param outbox Pointer to the outbox
+ * @param data The record
+ * @param length The record length, 1 to OUTBOX_RECORD_MAX bytes
+ * @param deadline_ms Time the record should be sent by, 0 for none
+ * @param expires_ms Time the record is dropped unsent, 0 for never
+ * @return 0 on success, -1 if the record is invalid or the outbox is full
+ *
+ * @note A full outbox is counted in the rejected statistic, queued records are
+ *       never overwritten
+ */
+int outbox_push(struct outbox_t *outbox, const void *data, size_t length, uint32_t deadline_ms, uint32_t expires_ms)
+{
+  if (data == NULL || length == 0 || length > OUTBOX_RECORD_MAX)
+    return -1;
+
+  pthread_mutex_lock(&outbox->mutex);
+  if (outbox->capacity - outbox->used < OUTBOX_HEADER + length)
+  {
+    outbox->stats.rejected++;
+    pthread_mutex_unlock(&outbox->mutex);
+    return -1;
+  }
+
+  uint8_t header[OUTBOX_HEADER] = {
+    (uint8_t)length, 0, 
+    (uint8_t)deadline_ms, (uint8_t)(deadline_ms >> 8), (uint8_t)(deadline_ms >> 16), (uint8_t)(deadline_ms >> 24),
+    (uint8_t)expires_ms, (uint8_t)(expires_ms >> 8), (uint8_t)(expires_ms >> 16), (uint8_t)(expires_ms >> 24)
+  };
+  size_t tail = outbox->head + outbox->used;
+  outbox_write(outbox, tail, header, sizeof header);
+  outbox_write(outbox, tail + OUTBOX_HEADER, data, length);
+  outbox->used += OUTBOX_HEADER + length;
+  outbox->stored++;
+  outbox->count++;
+  outbox->payload += length;
+
+  outbox->stats.pushed++;
+  if (outbox->used > outbox->stats.high_water)
+    outbox->stats.high_water = outbox->used;
+  pthread_mutex_unlock(&outbox->mutex);
+  return 0;
+}
+
+/**
+ * @brief Sets the record of a key, replacing its pending record
+ *
+ * @param outbox Pointer to the outbox
+ * @param key The key
+ * @param data The record
+ * @param length The record length, 1 to value_max bytes
+ * @param deadline_ms Time the record should be sent by, 0 for none, the earlier deadline
+ *        of a replaced record is kept
+ * @param expires_ms Time the record is dropped unsent, 0 for never
+ * @return 0 on success, -1 if the record is invalid or every slot belongs to another key
+ */
+int outbox_put(struct outbox_t *outbox, uint8_t key, const void *data, size_t length, uint32_t deadline_ms,
+               uint32_t expires_ms)
+{
+  if (data == NULL || length == 0 || length > outbox->value_max)
+    return -1;
+
+  pthread_mutex_lock(&outbox->mutex);
+  struct outbox_slot *slot = outbox_slot(outbox, key, 1);
+  if (slot == NULL)
+  {
+    outbox->stats.rejected++;
+    pthread_mutex_unlock(&outbox->mutex);
+    return -1;
+  }
+  if (slot->pending)
+  {
+    slot->overwrites++;
+    outbox->stats.overwrites++;
+    outbox->payload -= slot->length;
+    /* the replaced record was due earlier, its urgency carries over */
+    if (slot->deadline_ms != 0 && (deadline_ms == 0 || (int32_t)(slot->deadline_ms - deadline_ms) < 0))
+      deadline_ms = slot->deadline_ms;
+  }
+  else
+  {
+    slot->pending = 1;
+    outbox->pending++;
+  }
+  memcpy(slot->data, data, length);
+  slot->length = (uint8_t)length;
+  slot->deadline_ms = deadline_ms;
+  slot->expires_ms = expires_ms;
+  slot->version++;
+  outbox->payload += length;
+  outbox->stats.pushed++;
+  pthread_mutex_unlock(&outbox->mutex);
+  return 0;
+}
+
+/**
+ * @brief Number of records of a key replaced before they were sent
+ *
+ * @param outbox Pointer to the outbox
+ * @param key The key
+ * @param overwrites Pointer to store the count
+ * @return 0 on success, -1 if the key was never put
+ */
+int outbox_key_overwrites(struct outbox_t *outbox, uint8_t key, uint32_t *overwrites)
+{
+  pthread_mutex_lock(&outbox->mutex);
+  struct outbox_slot *slot = outbox_slot(outbox, key, 0);
+  if (slot != NULL)
+    *overwrites = slot->overwrites;
+  pthread_mutex_unlock(&outbox->mutex);
+  return slot != NULL ? 0 : -1;
+}
+
+/**
+ * @brief Drops the records past their expiry
+ *
+ * @param outbox Pointer to the outbox
+ * @param now_ms The current time in ms
+ * @return The number of records dropped
+ */
+size_t outbox_expire(struct outbox_t *outbox, uint32_t now_ms)
+{
+  pthread_mutex_lock(&outbox->mutex);
+  size_t expired = outbox_evict(outbox, now_ms);
+  pthread_mutex_unlock(&outbox->mutex);
+  return expired;
+}
+
+/**
+ * @brief Builds a frame from the most urgent records, without removing them
+ *
+ * Records with a deadline go first, earliest first, then the keyed records, then the
+ * other events in the order they were pushed. Packing stops at the first record that
+ * does not fit, so a record is never overtaken by a less urgent one.
+ *
+ * @param outbox Pointer to the outbox
+ * @param now_ms The current time in ms, expired records are dropped first
+ * @param frame The frame buffer
+ * @param max Size of the frame buffer
+ * @param records Pointer to store the number of records packed
+ * @return The frame length, 0 if the outbox is empty
+ */
+size_t outbox_pack(struct outbox_t *outbox, uint32_t now_ms, uint8_t *frame, size_t max, size_t *records)
+{
+  size_t length = 0;
+  size_t packed = 0;
+
+  pthread_mutex_lock(&outbox->mutex);
+  outbox_evict(outbox, now_ms);
+  /* a frame that was never committed gives its records back */
+  for (size_t i = 0; i < outbox->keys; i++)
+    outbox->slots[i].packed = 0;
+  size_t offset = outbox->head;
+  for (size_t i = 0; i < outbox->stored; i++)
+  {
+    struct outbox_record record;
+    outbox_header(outbox, offset, &record);
+    if (record.flags & OUTBOX_PACKED)
+      outbox_set_flags(outbox, offset, 0);
+    offset += OUTBOX_HEADER + record.size;
+  }
+
+  for (int full = 0; !full;)
+  {
+    /* the most urgent record not packed yet, a slot wins a tie as it comes first */
+    struct outbox_slot *best_slot = NULL;
+    size_t best_offset = 0;
+    struct outbox_record best = { 0 };
+    int found = 0;
+    for (size_t i = 0; i < outbox->keys; i++)
+    {
+      struct outbox_slot *slot = &outbox->slots[i];
+      if (!slot->pending || slot->packed)
+        continue;
+      if (!found || outbox_before(slot->deadline_ms, best.deadline_ms, now_ms))
+      {
+        best_slot = slot;
+        best.size = slot->length;
+        best.deadline_ms = slot->deadline_ms;
+        found = 1;
+      }
+    }
+    offset = outbox->head;
+    for (size_t i = 0; i < outbox->stored; i++)
+    {
+      struct outbox_record record;
+      outbox_header(outbox, offset, &record);
+      if (!(record.flags & (OUTBOX_GONE | OUTBOX_PACKED)) && 
+          (!found || outbox_before(record.deadline_ms, best.deadline_ms, now_ms)))
+      {
+        best_slot = NULL;
+        best_offset = offset;
+        best = record;
+        found = 1;
+      }
+      offset += OUTBOX_HEADER + record.size;
+    }
+    full = !found || length + 1 + best.size > max;
+    if (full)
+      break;
+
+    frame[length] = (uint8_t)best.size;
+    if (best_slot != NULL)
+    {
+      best_slot->packed = 1;
+      best_slot->packed_version = best_slot->version;
+      memcpy(frame + length + 1, best_slot->data, best.size);
+    }
+    else
+    {
+      outbox_set_flags(outbox, best_offset, OUTBOX_PACKED);
+      outbox_read(outbox, best_offset + OUTBOX_HEADER, frame + length + 1, best.size);
+    }
+    length += 1 + best.size;
+    packed++;
+  }
+  pthread_mutex_unlock(&outbox->mutex);
+
+  *records = packed;
+  return length;
+}
+
+/**
+ * @brief Removes the records of the last frame built after it was sent
+ *
+ * @param outbox Pointer to the outbox
+ * @param records The number of records packed into the frame
+ */
+void outbox_commit(struct outbox_t *outbox, size_t records)
+{
+  pthread_mutex_lock(&outbox->mutex);
+  size_t bytes = 0;
+  for (size_t i = 0; i < outbox->keys && records > 0; i++)
+  {
+    struct outbox_slot *slot = &outbox->slots[i];
+    if (!slot->packed)
+      continue;
+    slot->packed = 0;
+    records--;
+    outbox->stats.committed++;
+    bytes += 1 + slot->length;
+    /* replaced since the frame was built, the newer record still has to go */
+    if (slot->version != slot->packed_version)
+      continue;
+    slot->pending = 0;
+    outbox->pending--;
+    outbox->payload -= slot->length;
+  }
+  size_t offset = outbox->head;
+  for (size_t i = 0; i < outbox->stored && records > 0; i++)
+  {
+    struct outbox_record record;
+    outbox_header(outbox, offset, &record);
+    if (record.flags == OUTBOX_PACKED)
+    {
+      outbox_set_flags(outbox, offset, OUTBOX_GONE);
+      outbox->count--;
+      outbox->payload -= record.size;
+      outbox->stats.committed++;
+      bytes += 1 + record.size;
+      records--;
+    }
+    offset += OUTBOX_HEADER + record.size;
+  }
+  if (bytes > 0)
+  {
+    outbox->stats.frames++;
+    outbox->stats.frame_bytes += bytes;
+  }
+  outbox_reclaim(outbox);
+  pthread_mutex_unlock(&outbox->mutex);
+}
+
+/**
+ * @brief Number of queued records
+ *
+ * @param outbox Pointer to the outbox
+ * @return The number of records
+ */
+size_t outbox_count(struct outbox_t *outbox)
+{
+  pthread_mutex_lock(&outbox->mutex);
+  size_t count = outbox->count + outbox->pending;
+  pthread_mutex_unlock(&outbox->mutex);
+  return count;
+}
+
+/**
+ * @brief Bytes a flush would send, length prefixes included
+ *
+ * @param outbox Pointer to the outbox
+ * @return The number of frame bytes
+ */
+size_t outbox_frame_bytes(struct outbox_t *outbox)
+{
+  pthread_mutex_lock(&outbox->mutex);
+  size_t bytes = outbox->payload + outbox->count + outbox->pending;
+  pthread_mutex_unlock(&outbox->mutex);
+  return bytes;
+}
+
+/**
+ * @brief Earliest deadline of the queued records
+ *
+ * @param outbox Pointer to the outbox
+ * @param now_ms The current time in ms, deadlines are compared relative to it
+ * @param deadline_ms Pointer to store the deadline
+ * @return 0 on success, -1 if no queued record has a deadline
+ */
+int outbox_next_deadline(struct outbox_t *outbox, uint32_t now_ms, uint32_t *deadline_ms)
+{
+  uint32_t earliest = 0;
+
+  pthread_mutex_lock(&outbox->mutex);
+  size_t offset = outbox->head;
+  for (size_t i = 0; i < outbox->stored; i++)
+  {
+    struct outbox_record record;
+    outbox_header(outbox, offset, &record);
+    offset += OUTBOX_HEADER + record.size;
+    if (!(record.flags & OUTBOX_GONE) && outbox_before(record.deadline_ms, earliest, now_ms))
+      earliest = record.deadline_ms;
+  }
+  for (size_t i = 0; i < outbox->keys; i++)
+  {
+    struct outbox_slot *slot = &outbox->slots[i];
+    if (slot->pending && outbox_before(slot->deadline_ms, earliest, now_ms))
+      earliest = slot->deadline_ms;
+  }
+  pthread_mutex_unlock(&outbox->mutex);
+
+  if (earliest == 0)
+    return -1;
+  *deadline_ms = earliest;
+  return 0;
+}
+
+/**
+ * @brief Copies the statistics
+ *
+ * @param outbox Pointer to the outbox
+ * @param stats Pointer to the statistics to fill
+ */
+void outbox_get_stats(struct outbox_t *outbox, struct outbox_stats *stats)
+{
+  pthread_mutex_lock(&outbox->mutex);
+  *stats = outbox->stats;
+  pthread_mutex_unlock(&outbox->mutex);
+}
+
+/**
+ * @brief Completely destroys the outbox and frees all associated memory
+ *
+ * @param outbox Pointer to a pointer to the outbox to destroy
+ *
+ * @note If *outbox is NULL, this function has no effect
+ */
+void destroy_outbox(struct outbox_t **outbox)
+{
+  if (*outbox == NULL)
+    return;
+  if ((*outbox)->slots != NULL)
+    free((*outbox)->slots[0].data);
+  free((*outbox)->slots);
+  free((*outbox)->ring);
+  pthread_mutex_destroy(&(*outbox)->mutex);
+  free(*outbox);
+  *outbox = NULL;
+}
@@ -0,0 +1,234 @@
+/**
+ * @file outbox.h
+ * @brief A bounded record outbox that packs records into SBD frames
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This header file provides the outbox of the transmit scheduler. Records of up to
+ * OUTBOX_RECORD_MAX bytes are queued in a fixed byte ring, each with an optional deadline
+ * (send by) and expiry (drop unsent after). A frame is built from the most urgent records
+ * as long as they fit, earliest deadline first, then the rest in the order they were
+ * pushed, every record prefixed with its length byte:
+ *
+ *   [length][record bytes][length][record bytes]...
+ *
+ * so one SBD message carries as many records as possible and the backend splits them
+ * again. Packing does not remove records, they are committed once the frame was sent,
+ * a failed session leaves them queued for the next one. Expired records are dropped before
+ * a frame is built, so no session is spent on data nobody wants any more.
+ *
+ * Besides the FIFO events, a record can be put under a key (outbox_put()). A keyed record
+ * replaces the pending record of its key instead of queueing behind it, so periodic state
+ * (position, battery) takes one slot per key however long the link is down, and the first
+ * frame after an outage carries the current values. Keyed records are packed ahead of
+ * the events, a value replaced between pack and commit stays pending.
+ *
+ * All operations are serialized with an internal mutex.
+ *
+ * Usage example:
+ * @code
+ * struct outbox_t *outbox = newOutbox(2048, 8, 32);
+ * outbox_push(outbox, record, sizeof(record), 0, 0);
+ * outbox_put(outbox, KEY_POSITION, position, sizeof(position), 0, now_ms + 3600000);
+ * size_t records;
+ * size_t length = outbox_pack(outbox, now_ms, frame, 340, &records);
+ * if (send(frame, length) == 0)
+ *   outbox_commit(outbox, records);
+ * destroy_outbox(&outbox);
+ * @endcode
+ */
+
+#ifndef OUTBOX_H_INCLUDED
+#define OUTBOX_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define OUTBOX_RECORD_MAX 255    /**< Largest record, its length must fit the prefix byte */
+
+/**
+ * @brief Outbox statistics
+ */
+struct outbox_stats
+{
+  uint32_t pushed;               /**< Records accepted */
+  uint32_t rejected;             /**< Records refused because the outbox was full */
+  uint32_t committed;            /**< Records sent */
+  uint32_t expired;              /**< Records dropped unsent past their expiry */
+  uint32_t frames;               /**< Frames committed */
+  uint32_t frame_bytes;          /**< Bytes of the committed frames, prefixes included */
+  uint32_t overwrites;           /**< Keyed records replaced before they were sent */
+  size_t high_water;             /**< Most bytes ever stored at once */
+};
+
+/**
+ * @brief A key and its pending record
+ */
+struct outbox_slot
+{
+  uint8_t assigned;              /**< The slot belongs to key */
+  uint8_t pending;               /**< A record waits to be sent */
+  uint8_t packed;                /**< In the last frame built */
+  uint8_t key;
+  uint8_t length;
+  uint32_t deadline_ms;
+  uint32_t expires_ms;
+  uint32_t version;              /**< Bumped by every outbox_put() */
+  uint32_t packed_version;       /**< Version in the last frame built */
+  uint32_t overwrites;           /**< Records of this key replaced before they were sent */
+  uint8_t *data;                 /**< value_max bytes */
+};
+
+/**
+ * @brief Main outbox structure
+ */
+struct outbox_t
+{
+  uint8_t *ring;                 /**< Record storage, capacity bytes */
+  size_t capacity;               /**< Size of the storage */
+  size_t head;                   /**< Offset of the oldest record */
+  size_t used;                   /**< Bytes stored, headers included */
+  size_t stored;                 /**< Records in the ring, gone ones not reclaimed yet included */
+  size_t count;                  /**< Number of queued records */
+  size_t payload;                /**< Bytes of the records alone */
+  struct outbox_slot *slots;     /**< keys keyed slots */
+  size_t keys;
+  size_t value_max;              /**< Largest keyed record */
+  size_t pending;                /**< Keyed records waiting */
+  struct outbox_stats stats;     /**< Statistics */
+  pthread_mutex_t mutex;         /**< Serializes every operation */
+};
+
+/**
+ * @brief Creates a new empty outbox
+ *
+ * @param capacity Size of the record storage in bytes, each record takes 10 bytes more
+ * @param keys Number of keys for outbox_put(), 0 for events only
+ * @param value_max Largest keyed record, up to OUTBOX_RECORD_MAX
+ * @return Pointer to the newly created outbox, or NULL if allocation failed
+ *
+ * @note This function allocates memory. Use destroy_outbox() to free it.
+ */
+struct outbox_t *newOutbox(size_t capacity, size_t keys, size_t value_max);
+
+/**
+ * @brief Copies a record into the outbox
+ *
+ * @param outbox Pointer to the outbox
+ * @param data The record
+ * @param length The record length, 1 to OUTBOX_RECORD_MAX bytes
+ * @param deadline_ms Time the record should be sent by, 0 for none
+ * @param expires_ms Time the record is dropped unsent, 0 for never
+ * @return 0 on success, -1 if the record is invalid or the outbox is full
+ */
+int outbox_push(struct outbox_t *outbox, const void *data, size_t length, uint32_t deadline_ms, uint32_t expires_ms);
+
+/**
+ * @brief Sets the record of a key, replacing its pending record
+ *
+ * @param outbox Pointer to the outbox
+ * @param key The key
+ * @param data The record
+ * @param length The record length, 1 to value_max bytes
+ * @param deadline_ms Time the record should be sent by, 0 for none, the earlier deadline
+ *        of a replaced record is kept
+ * @param expires_ms Time the record is dropped unsent, 0 for never
+ * @return 0 on success, -1 if the record is invalid or every slot belongs to another key
+ */
+int outbox_put(struct outbox_t *outbox, uint8_t key, const void *data, size_t length, uint32_t deadline_ms,
+               uint32_t expires_ms);
+
+/**
+ * @brief Number of records of a key replaced before they were sent
+ *
+ * @param outbox Pointer to the outbox
+ * @param key The key
+ * @param overwrites Pointer to store the count
+ * @return 0 on success, -1 if the key was never put
+ */
+int outbox_key_overwrites(struct outbox_t *outbox, uint8_t key, uint32_t *overwrites);
+
+/**
+ * @brief Drops the records past their expiry
+ *
+ * @param outbox Pointer to the outbox
+ * @param now_ms The current time in ms
+ * @return The number of records dropped
+ */
+size_t outbox_expire(struct outbox_t *outbox, uint32_t now_ms);
+
+/**
+ * @brief Builds a frame from the most urgent records, without removing them
+ *
+ * @param outbox Pointer to the outbox
+ * @param now_ms The current time in ms, expired records are dropped first
+ * @param frame The frame buffer
+ * @param max Size of the frame buffer
+ * @param records Pointer to store the number of records packed
+ * @return The frame length, 0 if the outbox is empty
+ */
+size_t outbox_pack(struct outbox_t *outbox, uint32_t now_ms, uint8_t *frame, size_t max, size_t *records);
+
+/**
+ * @brief Removes the records of the last frame built after it was sent
+ *
+ * @param outbox Pointer to the outbox
+ * @param records The number of records packed into the frame
+ */
+void outbox_commit(struct outbox_t *outbox, size_t records);
+
+/**
+ * @brief Number of queued records
+ *
+ * @param outbox Pointer to the outbox
+ * @return The number of records
+ */
+size_t outbox_count(struct outbox_t *outbox);
+
+/**
+ * @brief Bytes a flush would send, length prefixes included
+ *
+ * @param outbox Pointer to the outbox
+ * @return The number of frame bytes
+ */
+size_t outbox_frame_bytes(struct outbox_t *outbox);
+
+/**
+ * @brief Earliest deadline of the queued records
+ *
+ * @param outbox Pointer to the outbox
+ * @param now_ms The current time in ms, deadlines are compared relative to it
+ * @param deadline_ms Pointer to store the deadline
+ * @return 0 on success, -1 if no queued record has a deadline
+ */
+int outbox_next_deadline(struct outbox_t *outbox, uint32_t now_ms, uint32_t *deadline_ms);
+
+/**
+ * @brief Copies the statistics
+ *
+ * @param outbox Pointer to the outbox
+ * @param stats Pointer to the statistics to fill
+ */
+void outbox_get_stats(struct outbox_t *outbox, struct outbox_stats *stats);
+
+/**
+ * @brief Completely destroys the outbox and frees all associated memory
+ *
+ * @param outbox Pointer to a pointer to the outbox to destroy
+ *
+ * @note The pointer is set to NULL after destruction.
+ */
+void destroy_outbox(struct outbox_t **outbox);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OUTBOX_H_INCLUDED */
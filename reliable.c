@@ -0,0 +1,423 @@
+/**
+ * @file reliable.c
+ * @brief Implementation of the reliable delivery outbox
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This file contains the implementation of the outbox declared in reliable.h. Sequence
+ * numbers wrap at 16 bits, the age of a message is its distance back from next_seq.
+ * The store callbacks run with the mutex held.
+ */
+
+#include "reliable.h"
+
+#define RELIABLE_ACK_RANGES 64   /**< Ranges of one acknowledgement that are applied */
+
+/**
+ * @brief An inclusive sequence number range, first > last wraps
+ */
+struct reliable_range
+{
+  uint16_t first;
+  uint16_t last;
+};
+
+static int reliable_in_range(const struct reliable_range *range, uint16_t seq)
+{
+  return (uint16_t)(seq - range->first) <= (uint16_t)(range->last - range->first);
+}
+
+static int reliable_number(const char **text, uint16_t *value)
+{
+  const char *p = *text;
+  uint32_t number = 0;
+  if (*p < '0' || *p > '9')
+    return -1;
+  while (*p >= '0' && *p <= '9')
+  {
+    number = number * 10 + (uint32_t)(*p++ - '0');
+    if (number > 0xffff)
+      return -1;
+  }
+  *value = (uint16_t)number;
+  *text = p;
+  return 0;
+}
+
+/**
+ * @brief Parses the ranges after the prefix, -1 on malformed text
+ */
+static int reliable_parse(const char *text, struct reliable_range *ranges, size_t max)
+{
+  size_t count = 0;
+  while (*text != '\0' && *text != '\r' && *text != '\n')
+  {
+    struct reliable_range range;
+    if (reliable_number(&text, &range.first) != 0)
+      return -1;
+    range.last = range.first;
+    if (*text == '-')
+    {
+      text++;
+      if (reliable_number(&text, &range.last) != 0)
+        return -1;
+    }
+    if (count < max)
+      ranges[count++] = range;
+    if (*text == ',')
+      text++;
+    else if (*text != '\0' && *text != '\r' && *text != '\n')
+      return -1;
+  }
+  return (int)count;
+}
+
+/**
+ * @brief Queues unacknowledged messages whose acknowledgement is overdue
+ *
+ * @note The caller holds the mutex
+ */
+static void reliable_expire(struct reliable_t *reliable, uint32_t now_ms)
+{
+  for (size_t i = 0; i < reliable->slots; i++)
+  {
+    struct reliable_entry *entry = &reliable->entries[i];
+    if (entry->state == RELIABLE_SENT && now_ms - entry->sent_ms >= reliable->ack_timeout_ms)
+    {
+      entry->state = RELIABLE_QUEUED;
+      reliable->stats.timeouts++;
+    }
+  }
+}
+
+/**
+ * @brief Creates a new empty reliable outbox
+ *
+ * @param slots Number of messages kept until acknowledged
+ * @param payload_max Largest message, at most the MO buffer less RELIABLE_HEADER
+ * @param ack_timeout_ms Resend a message unacknowledged this long after its send
+ * @return Pointer to the newly created outbox, or NULL if allocation failed
+ */
+struct reliable_t *newReliable(size_t slots, size_t payload_max, uint32_t ack_timeout_ms)
+{
+  if (slots == 0 || payload_max == 0 || payload_max > 0xffff)
+    return NULL;
+  struct reliable_t *reliable = calloc(1, sizeof *reliable);
+  if (reliable == NULL)
+    return NULL;
+  reliable->entries = calloc(slots, sizeof *reliable->entries);
+  uint8_t *data = malloc(slots * payload_max);
+  if (reliable->entries == NULL || data == NULL)
+  {
+    free(data);
+    free(reliable->entries);
+    free(reliable);
+    return NULL;
+  }
+  for (size_t i = 0; i < slots; i++)
+    reliable->entries[i].data = data + i * payload_max;
+  reliable->slots = slots;
+  reliable->payload_max = payload_max;
+  reliable->ack_timeout_ms = ack_timeout_ms;
+  pthread_mutex_init(&reliable->mutex, NULL);
+  return reliable;
+}
+
+/**
+ * @brief Sets the persistence callbacks
+ *
+ * @param reliable Pointer to the outbox
+ * @param store The callbacks, copied
+ */
+void reliable_set_store(struct reliable_t *reliable, const struct reliable_store *store)
+{
+  pthread_mutex_lock(&reliable->mutex);
+  reliable->store = *store;
+  pthread_mutex_unlock(&reliable->mutex);
+}
+
+/**
+ * @brief Loads a persisted message back into its slot, queued for a resend
+ *
+ * @param reliable Pointer to the outbox
+ * @param slot The slot it was saved from
+ * @param seq Its sequence number
+ * @param data The message
+ * @param length The message length
+ * @return 0 on success, -1 if the slot or the length is out of range
+ */
+int reliable_restore(struct reliable_t *reliable, size_t slot, uint16_t seq, const uint8_t *data, size_t length)
+{
+  if (slot >= reliable->slots || length == 0 || length > reliable->payload_max)
+    return -1;
+  pthread_mutex_lock(&reliable->mutex);
+  struct reliable_entry *entry = &reliable->entries[slot];
+  entry->state = RELIABLE_QUEUED;
+  entry->attempts = 1;
+  entry->seq = seq;
+  entry->length = (uint16_t)length;
+  entry->sent_ms = 0;
+  memcpy(entry->data, data, length);
+  pthread_mutex_unlock(&reliable->mutex);
+  return 0;
+}
+
+/**
+ * @brief Sets the next sequence number, e.g. the persisted one after a reboot
+ *
+ * @param reliable Pointer to the outbox
+ * @param next The sequence number of the next message
+ */
+void reliable_set_sequence(struct reliable_t *reliable, uint16_t next)
+{
+  pthread_mutex_lock(&reliable->mutex);
+  reliable->next_seq = next;
+  pthread_mutex_unlock(&reliable->mutex);
+}
+
+/**
+ * @brief Queues a message
+ *
+ * @param reliable Pointer to the outbox
+ * @param data The message
+ * @param length The message length, 1 to payload_max bytes
+ * @return The sequence number, or -1 if the message is invalid or every slot is taken
+ */
+int reliable_push(struct reliable_t *reliable, const void *data, size_t length)
+{
+  if (length == 0 || length > reliable->payload_max)
+    return -1;
+  pthread_mutex_lock(&reliable->mutex);
+  size_t slot = 0;
+  while (slot < reliable->slots && reliable->entries[slot].state != RELIABLE_FREE)
+    slot++;
+  if (slot == reliable->slots)
+  {
+    reliable->stats.rejected++;
+    pthread_mutex_unlock(&reliable->mutex);
+    return -1;
+  }
+  struct reliable_entry *entry = &reliable->entries[slot];
+  entry->state = RELIABLE_QUEUED;
+  entry->attempts = 0;
+  entry->seq = reliable->next_seq++;
+  entry->length = (uint16_t)length;
+  entry->sent_ms = 0;
+  memcpy(entry->data, data, length);
+  reliable->stats.pushed++;
+  if (reliable->store.save)
+    reliable->store.save(reliable->store.ctx, slot, entry->seq, entry->data, length);
+  if (reliable->store.save_sequence)
+    reliable->store.save_sequence(reliable->store.ctx, reliable->next_seq);
+  int seq = entry->seq;
+  pthread_mutex_unlock(&reliable->mutex);
+  return seq;
+}
+
+/**
+ * @brief Checks whether a message is waiting for a send or a resend
+ *
+ * @param reliable Pointer to the outbox
+ * @param now_ms The current time, unacknowledged messages past ack_timeout_ms are queued
+ * @return 1 when reliable_next() has a frame, 0 otherwise
+ */
+int reliable_due(struct reliable_t *reliable, uint32_t now_ms)
+{
+  int due = 0;
+  pthread_mutex_lock(&reliable->mutex);
+  reliable_expire(reliable, now_ms);
+  for (size_t i = 0; i < reliable->slots && !due; i++)
+    due = reliable->entries[i].state == RELIABLE_QUEUED;
+  pthread_mutex_unlock(&reliable->mutex);
+  return due;
+}
+
+/**
+ * @brief Builds the frame of the oldest queued message
+ *
+ * @param reliable Pointer to the outbox
+ * @param now_ms The current time, unacknowledged messages past ack_timeout_ms are queued
+ * @param frame Output buffer
+ * @param capacity Size of the output buffer
+ * @param seq Set to the sequence number of the frame
+ * @return The frame length, 0 when nothing is queued
+ */
+size_t reliable_next(struct reliable_t *reliable, uint32_t now_ms, uint8_t *frame, size_t capacity, uint16_t *seq)
+{
+  pthread_mutex_lock(&reliable->mutex);
+  reliable_expire(reliable, now_ms);
+  struct reliable_entry *oldest = NULL;
+  for (size_t i = 0; i < reliable->slots; i++)
+  {
+    struct reliable_entry *entry = &reliable->entries[i];
+    if (entry->state == RELIABLE_QUEUED &&
+        (oldest == NULL || (uint16_t)(reliable->next_seq - entry->seq) > (uint16_t)(reliable->next_seq - oldest->seq)))
+      oldest = entry;
+  }
+  size_t length = 0;
+  if (oldest != NULL && (size_t)RELIABLE_HEADER + oldest->length <= capacity)
+  {
+    frame[0] = RELIABLE_FRAME_DATA;
+    frame[1] = (uint8_t)oldest->seq;
+    frame[2] = (uint8_t)(oldest->seq >> 8);
+    memcpy(frame + RELIABLE_HEADER, oldest->data, oldest->length);
+    length = RELIABLE_HEADER + oldest->length;
+    *seq = oldest->seq;
+  }
+  pthread_mutex_unlock(&reliable->mutex);
+  return length;
+}
+
+/**
+ * @brief Records that a frame went through the gateway
+ *
+ * @param reliable Pointer to the outbox
+ * @param seq The sequence number from reliable_next()
+ * @param now_ms The time of the session
+ */
+void reliable_sent(struct reliable_t *reliable, uint16_t seq, uint32_t now_ms)
+{
+  pthread_mutex_lock(&reliable->mutex);
+  for (size_t i = 0; i < reliable->slots; i++)
+  {
+    struct reliable_entry *entry = &reliable->entries[i];
+    if (entry->state == RELIABLE_QUEUED && entry->seq == seq)
+    {
+      entry->state = RELIABLE_SENT;
+      entry->sent_ms = now_ms;
+      if (entry->attempts++ > 0)
+        reliable->stats.resent++;
+      reliable->stats.sent++;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&reliable->mutex);
+}
+
+/**
+ * @brief Applies an MT acknowledgement
+ *
+ * @param reliable Pointer to the outbox
+ * @param text The MT message
+ * @param now_ms The current time
+ * @return The number of messages acknowledged, -1 if the text is not an acknowledgement
+ */
+int reliable_ack(struct reliable_t *reliable, const char *text, uint32_t now_ms)
+{
+  size_t prefix = strlen(RELIABLE_ACK_PREFIX);
+  struct reliable_range ranges[RELIABLE_ACK_RANGES];
+  if (strncmp(text, RELIABLE_ACK_PREFIX, prefix) != 0)
+    return -1;
+  int count = reliable_parse(text + prefix, ranges, RELIABLE_ACK_RANGES);
+  if (count < 0)
+    return -1;
+
+  pthread_mutex_lock(&reliable->mutex);
+  reliable->stats.acks++;
+  uint32_t listed = 0;
+  for (int r = 0; r < count; r++)
+    listed += (uint32_t)(uint16_t)(ranges[r].last - ranges[r].first) + 1;
+
+  /* free the acknowledged slots, remember the latest send among them */
+  int acked = 0;
+  int any_sent = 0;
+  uint32_t latest_ms = 0;
+  for (size_t i = 0; i < reliable->slots; i++)
+  {
+    struct reliable_entry *entry = &reliable->entries[i];
+    if (entry->state == RELIABLE_FREE)
+      continue;
+    int match = 0;
+    for (int r = 0; r < count && !match; r++)
+      match = reliable_in_range(&ranges[r], entry->seq);
+    if (!match)
+      continue;
+    if (entry->state == RELIABLE_SENT && (!any_sent || (int32_t)(entry->sent_ms - latest_ms) > 0))
+    {
+      latest_ms = entry->sent_ms;
+      any_sent = 1;
+    }
+    entry->state = RELIABLE_FREE;
+    acked++;
+    if (reliable->store.save)
+      reliable->store.save(reliable->store.ctx, i, entry->seq, NULL, 0);
+  }
+
+  /* sent before an acknowledged message but not acknowledged itself, lost on the way */
+  for (size_t i = 0; i < reliable->slots && any_sent; i++)
+  {
+    struct reliable_entry *entry = &reliable->entries[i];
+    if (entry->state == RELIABLE_SENT && (int32_t)(latest_ms - entry->sent_ms) > 0)
+    {
+      entry->state = RELIABLE_QUEUED;
+      reliable->stats.gaps++;
+    }
+  }
+  reliable_expire(reliable, now_ms);
+  reliable->stats.acked += acked;
+  reliable->stats.duplicates += listed - (uint32_t)acked;
+  pthread_mutex_unlock(&reliable->mutex);
+  return acked;
+}
+
+/**
+ * @brief Checks whether a message still waits for its acknowledgement
+ *
+ * @param reliable Pointer to the outbox
+ * @param seq The sequence number from reliable_push()
+ * @return 1 while it is kept, 0 once it was acknowledged
+ */
+int reliable_pending(struct reliable_t *reliable, uint16_t seq)
+{
+  int pending = 0;
+  pthread_mutex_lock(&reliable->mutex);
+  for (size_t i = 0; i < reliable->slots && !pending; i++)
+    pending = reliable->entries[i].state != RELIABLE_FREE && reliable->entries[i].seq == seq;
+  pthread_mutex_unlock(&reliable->mutex);
+  return pending;
+}
+
+/**
+ * @brief Number of messages kept
+ *
+ * @param reliable Pointer to the outbox
+ * @return The number of messages not acknowledged yet
+ */
+size_t reliable_count(struct reliable_t *reliable)
+{
+  size_t count = 0;
+  pthread_mutex_lock(&reliable->mutex);
+  for (size_t i = 0; i < reliable->slots; i++)
+    count += reliable->entries[i].state != RELIABLE_FREE;
+  pthread_mutex_unlock(&reliable->mutex);
+  return count;
+}
+
+/**
+ * @brief Copies the delivery statistics
+ *
+ * @param reliable Pointer to the outbox
+ * @param stats Pointer to the statistics to fill
+ */
+void reliable_get_stats(struct reliable_t *reliable, struct reliable_stats *stats)
+{
+  pthread_mutex_lock(&reliable->mutex);
+  *stats = reliable->stats;
+  pthread_mutex_unlock(&reliable->mutex);
+}
+
+/**
+ * @brief Destroys a reliable outbox
+ *
+ * @param reliable Double pointer to the outbox to destroy
+ */
+void destroy_reliable(struct reliable_t **reliable)
+{
+  if (*reliable == NULL)
+    return;
+  free((*reliable)->entries[0].data);
+  free((*reliable)->entries);
+  pthread_mutex_destroy(&(*reliable)->mutex);
+  free(*reliable);
+  *reliable = NULL;
+}
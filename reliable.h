@@ -0,0 +1,252 @@
+/**
+ * @file reliable.h
+ * @brief Sequence numbered MO delivery with selective resends on MT acknowledgements
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This header file provides the device side of an end-to-end delivery protocol on top
+ * of SBD. A successful +SBDIX only means the gateway has the message, this layer keeps
+ * every message until the backend acknowledges it.
+ *
+ * MO data frame, sent with +SBDWB:
+ * @code
+ * RELIABLE_FRAME_DATA <seq:u16 LE> <payload>
+ * @endcode
+ * MT acknowledgement, plain text so it survives +SBDRT:
+ * @code
+ * ACK:12-40,43,45-47
+ * @endcode
+ * Every listed sequence number (ranges inclusive, decimal) was processed. A sent message
+ * that is not listed while one sent after it is, is a gap and queued for resend right
+ * away. A message that stays unacknowledged for ack_timeout_ms is resent as well. Only
+ * those messages go out again, never the whole window.
+ *
+ * Messages are kept in a fixed set of slots. A store callback sees every change of a
+ * slot and of the next sequence number so the outbox survives a reboot (the driver puts
+ * it in NVS), reliable_restore() loads it back.
+ *
+ * All operations are serialized with an internal mutex.
+ *
+ * Usage example:
+ * @code
+ * struct reliable_t *reliable = newReliable(16, 337, 1800000);
+ * reliable_push(reliable, data, size);
+ * uint16_t seq;
+ * size_t length = reliable_next(reliable, now_ms, frame, sizeof(frame), &seq);
+ * if (length > 0 && send(frame, length) == 0)
+ *   reliable_sent(reliable, seq, now_ms);
+ * reliable_ack(reliable, mt_text, now_ms);
+ * destroy_reliable(&reliable);
+ * @endcode
+ */
+
+#ifndef RELIABLE_H_INCLUDED
+#define RELIABLE_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define RELIABLE_FRAME_DATA 0xD1         /**< First byte of an MO data frame */
+#define RELIABLE_HEADER 3                /**< Type byte and sequence number */
+#define RELIABLE_ACK_PREFIX "ACK:"       /**< An MT message starting with this is an acknowledgement */
+
+/**
+ * @brief State of a slot
+ */
+enum reliable_state
+{
+  RELIABLE_FREE = 0,
+  RELIABLE_QUEUED,               /**< Waiting for its first send or a resend */
+  RELIABLE_SENT,                 /**< Sent, waiting for the acknowledgement */
+};
+
+/**
+ * @brief Delivery statistics
+ */
+struct reliable_stats
+{
+  uint32_t pushed;               /**< Messages accepted */
+  uint32_t rejected;             /**< Messages refused because every slot was taken */
+  uint32_t sent;                 /**< Frames sent, resends included */
+  uint32_t resent;               /**< Frames sent again */
+  uint32_t acked;                /**< Messages acknowledged */
+  uint32_t acks;                 /**< Acknowledgements parsed */
+  uint32_t duplicates;           /**< Acknowledged sequence numbers no slot was waiting for */
+  uint32_t gaps;                 /**< Resends queued because a later message was acknowledged */
+  uint32_t timeouts;             /**< Resends queued because the acknowledgement was late */
+};
+
+/**
+ * @brief A message slot
+ */
+struct reliable_entry
+{
+  uint8_t state;                 /**< enum reliable_state */
+  uint8_t attempts;              /**< Sends so far */
+  uint16_t seq;
+  uint16_t length;
+  uint32_t sent_ms;              /**< Time of the last send */
+  uint8_t *data;                 /**< payload_max bytes */
+};
+
+/**
+ * @brief Persistence of the slots and the next sequence number
+ */
+struct reliable_store
+{
+  void *ctx;
+  void (*save)(void *ctx, size_t slot, uint16_t seq, const uint8_t *data, size_t length);  /**< length 0 frees the slot */
+  void (*save_sequence)(void *ctx, uint16_t next);
+};
+
+/**
+ * @brief Main reliable delivery structure
+ */
+struct reliable_t
+{
+  struct reliable_entry *entries;          /**< slots entries */
+  size_t slots;
+  size_t payload_max;                      /**< Largest message */
+  uint32_t ack_timeout_ms;                 /**< Resend a message unacknowledged this long */
+  uint16_t next_seq;                       /**< Sequence number of the next message */
+  struct reliable_store store;             /**< Persistence, callbacks NULL when off */
+  struct reliable_stats stats;             /**< Statistics */
+  pthread_mutex_t mutex;                   /**< Serializes every operation */
+};
+
+/**
+ * @brief Creates a new empty reliable outbox
+ *
+ * @param slots Number of messages kept until acknowledged
+ * @param payload_max Largest message, at most the MO buffer less RELIABLE_HEADER
+ * @param ack_timeout_ms Resend a message unacknowledged this long after its send
+ * @return Pointer to the newly created outbox, or NULL if allocation failed
+ *
+ * @note The caller is responsible for destroying the outbox
+ */
+struct reliable_t *newReliable(size_t slots, size_t payload_max, uint32_t ack_timeout_ms);
+
+/**
+ * @brief Sets the persistence callbacks
+ *
+ * @param reliable Pointer to the outbox
+ * @param store The callbacks, copied
+ */
+void reliable_set_store(struct reliable_t *reliable, const struct reliable_store *store);
+
+/**
+ * @brief Loads a persisted message back into its slot, queued for a resend
+ *
+ * @param reliable Pointer to the outbox
+ * @param slot The slot it was saved from
+ * @param seq Its sequence number
+ * @param data The message
+ * @param length The message length
+ * @return 0 on success, -1 if the slot or the length is out of range
+ */
+int reliable_restore(struct reliable_t *reliable, size_t slot, uint16_t seq, const uint8_t *data, size_t length);
+
+/**
+ * @brief Sets the next sequence number, e.g. the persisted one after a reboot
+ *
+ * @param reliable Pointer to the outbox
+ * @param next The sequence number of the next message
+ */
+void reliable_set_sequence(struct reliable_t *reliable, uint16_t next);
+
+/**
+ * @brief Queues a message
+ *
+ * @param reliable Pointer to the outbox
+ * @param data The message
+ * @param length The message length, 1 to payload_max bytes
+ * @return The sequence number, or -1 if the message is invalid or every slot is taken
+ */
+int reliable_push(struct reliable_t *reliable, const void *data, size_t length);
+
+/**
+ * @brief Checks whether a message is waiting for a send or a resend
+ *
+ * @param reliable Pointer to the outbox
+ * @param now_ms The current time, unacknowledged messages past ack_timeout_ms are queued
+ * @return 1 when reliable_next() has a frame, 0 otherwise
+ */
+int reliable_due(struct reliable_t *reliable, uint32_t now_ms);
+
+/**
+ * @brief Builds the frame of the oldest queued message
+ *
+ * @param reliable Pointer to the outbox
+ * @param now_ms The current time, unacknowledged messages past ack_timeout_ms are queued
+ * @param frame Output buffer
+ * @param capacity Size of the output buffer
+ * @param seq Set to the sequence number of the frame
+ * @return The frame length, 0 when nothing is queued
+ *
+ * @note The message stays queued until reliable_sent()
+ */
+size_t reliable_next(struct reliable_t *reliable, uint32_t now_ms, uint8_t *frame, size_t capacity, uint16_t *seq);
+
+/**
+ * @brief Records that a frame went through the gateway
+ *
+ * @param reliable Pointer to the outbox
+ * @param seq The sequence number from reliable_next()
+ * @param now_ms The time of the session
+ */
+void reliable_sent(struct reliable_t *reliable, uint16_t seq, uint32_t now_ms);
+
+/**
+ * @brief Applies an MT acknowledgement
+ *
+ * @param reliable Pointer to the outbox
+ * @param text The MT message
+ * @param now_ms The current time
+ * @return The number of messages acknowledged, -1 if the text is not an acknowledgement
+ */
+int reliable_ack(struct reliable_t *reliable, const char *text, uint32_t now_ms);
+
+/**
+ * @brief Checks whether a message still waits for its acknowledgement
+ *
+ * @param reliable Pointer to the outbox
+ * @param seq The sequence number from reliable_push()
+ * @return 1 while it is kept, 0 once it was acknowledged
+ */
+int reliable_pending(struct reliable_t *reliable, uint16_t seq);
+
+/**
+ * @brief Number of messages kept
+ *
+ * @param reliable Pointer to the outbox
+ * @return The number of messages not acknowledged yet
+ */
+size_t reliable_count(struct reliable_t *reliable);
+
+/**
+ * @brief Copies the delivery statistics
+ *
+ * @param reliable Pointer to the outbox
+ * @param stats Pointer to the statistics to fill
+ */
+void reliable_get_stats(struct reliable_t *reliable, struct reliable_stats *stats);
+
+/**
+ * @brief Destroys a reliable outbox
+ *
+ * @param reliable Double pointer to the outbox to destroy
+ */
+void destroy_reliable(struct reliable_t **reliable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RELIABLE_H_INCLUDED */
@@ -0,0 +1,250 @@
+/**
+ * @file sequence.c
+ * @brief Implementation of the sequence number window
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This file contains the implementation of the window declared in sequence.h. Numbers
+ * wrap at 16 bits, the distance between two numbers is taken as a signed 16-bit value.
+ */
+
+#include "sequence.h"
+
+static int16_t sequence_distance(uint16_t seq, uint16_t from)
+{
+  return (int16_t)(uint16_t)(seq - from);
+}
+
+/**
+ * @brief Delivers the held items that are next in order
+ *
+ * @note The caller holds the mutex
+ */
+static size_t sequence_drain(struct sequence_t *sequence, void (*deliver)(void *ctx, const void *item), void *ctx)
+{
+  size_t delivered = 0;
+  for (size_t i = 0; i < sequence->depth; i++)
+  {
+    struct sequence_slot *slot = &sequence->slots[i];
+    if (!slot->used || slot->seq != sequence->expected)
+      continue;
+    slot->used = 0;
+    sequence->expected++;
+    deliver(ctx, slot->item);
+    sequence->stats.delivered++;
+    sequence->stats.reordered++;
+    delivered++;
+    /* the next one can be in any slot, start over */
+    i = (size_t)-1;
+  }
+  return delivered;
+}
+
+/**
+ * @brief Gives up on the missing numbers before the lowest held item
+ *
+ * @note The caller holds the mutex
+ */
+static size_t sequence_skip(struct sequence_t *sequence, void (*deliver)(void *ctx, const void *item), void *ctx)
+{
+  struct sequence_slot *lowest = NULL;
+  for (size_t i = 0; i < sequence->depth; i++)
+  {
+    struct sequence_slot *slot = &sequence->slots[i];
+    if (slot->used && (lowest == NULL || sequence_distance(slot->seq, lowest->seq) < 0))
+      lowest = slot;
+  }
+  if (lowest == NULL)
+    return 0;
+  sequence->expected = lowest->seq;
+  return sequence_drain(sequence, deliver, ctx);
+}
+
+/**
+ * @brief Number of held items and the time the oldest was held
+ *
+ * @note The caller holds the mutex
+ */
+static size_t sequence_held(struct sequence_t *sequence, uint32_t now_ms, uint32_t *waited_ms)
+{
+  size_t held = 0;
+  *waited_ms = 0;
+  for (size_t i = 0; i < sequence->depth; i++)
+  {
+    struct sequence_slot *slot = &sequence->slots[i];
+    if (!slot->used)
+      continue;
+    held++;
+    if (now_ms - slot->since_ms > *waited_ms)
+      *waited_ms = now_ms - slot->since_ms;
+  }
+  return held;
+}
+
+/**
+ * @brief Creates a new sequence window
+ *
+ * @param depth Items held to restore the order, 0 to deliver out of order
+ * @param item_size Size of an item
+ * @param hold_ms Skip a gap once the oldest held item waited this long
+ * @return Pointer to the newly created window, or NULL if allocation failed
+ */
+struct sequence_t *newSequence(size_t depth, size_t item_size, uint32_t hold_ms)
+{
+  struct sequence_t *sequence = calloc(1, sizeof *sequence);
+  if (sequence == NULL)
+    return NULL;
+  if (depth > 0)
+  {
+    sequence->slots = calloc(depth, sizeof *sequence->slots);
+    uint8_t *items = malloc(depth * item_size);
+    if (sequence->slots == NULL || items == NULL)
+    {
+      free(items);
+      free(sequence->slots);
+      free(sequence);
+      return NULL;
+    }
+    for (size_t i = 0; i < depth; i++)
+      sequence->slots[i].item = items + i * item_size;
+  }
+  sequence->depth = depth;
+  sequence->item_size = item_size;
+  sequence->hold_ms = hold_ms;
+  pthread_mutex_init(&sequence->mutex, NULL);
+  return sequence;
+}
+
+/**
+ * @brief Takes an item
+ *
+ * @param sequence Pointer to the window
+ * @param seq Its sequence number
+ * @param item The item, copied when held
+ * @param now_ms The current time
+ * @param deliver Called for the item and the held items it releases, in order
+ * @param ctx Passed to deliver
+ * @return The enum sequence_verdict
+ */
+int sequence_push(struct sequence_t *sequence, uint16_t seq, const void *item, uint32_t now_ms,
+                  void (*deliver)(void *ctx, const void *item), void *ctx)
+{
+  pthread_mutex_lock(&sequence->mutex);
+  sequence->stats.received++;
+  if (!sequence->started)
+  {
+    sequence->started = 1;
+    sequence->highest = seq;
+    sequence->seen = 1;
+    sequence->expected = seq;
+  }
+  else
+  {
+    int distance = sequence_distance(seq, sequence->highest);
+    if (distance > 0)
+    {
+      sequence->stats.gaps += distance - 1;
+      sequence->seen = distance < SEQUENCE_WINDOW ? sequence->seen << distance | 1 : 1;
+      sequence->highest = seq;
+    }
+    else if (-distance >= SEQUENCE_WINDOW || (sequence->seen >> -distance & 1))
+    {
+      /* too old to tell counts as seen, a repeated command is worse than a lost one */
+      sequence->stats.duplicates++;
+      pthread_mutex_unlock(&sequence->mutex);
+      return SEQUENCE_DUPLICATE;
+    }
+    else
+    {
+      sequence->seen |= (uint64_t)1 << -distance;
+      sequence->stats.late++;
+    }
+  }
+
+  /* out of order delivery, or a number whose gap was already skipped */
+  if (sequence->depth == 0 || sequence_distance(seq, sequence->expected) < 0)
+  {
+    deliver(ctx, item);
+    sequence->stats.delivered++;
+    pthread_mutex_unlock(&sequence->mutex);
+    return SEQUENCE_DELIVERED;
+  }
+
+  if (seq == sequence->expected)
+  {
+    sequence->expected++;
+    deliver(ctx, item);
+    sequence->stats.delivered++;
+    sequence_drain(sequence, deliver, ctx);
+    pthread_mutex_unlock(&sequence->mutex);
+    return SEQUENCE_DELIVERED;
+  }
+
+  /* ahead of the order, a free slot is always left by the skip below */
+  struct sequence_slot *slot = sequence->slots;
+  while (slot->used)
+    slot++;
+  slot->used = 1;
+  slot->seq = seq;
+  slot->since_ms = now_ms;
+  memcpy(slot->item, item, sequence->item_size);
+  uint32_t waited_ms;
+  if (sequence_held(sequence, now_ms, &waited_ms) == sequence->depth)
+    sequence_skip(sequence, deliver, ctx);
+  int verdict = slot->used ? SEQUENCE_HELD : SEQUENCE_DELIVERED;
+  pthread_mutex_unlock(&sequence->mutex);
+  return verdict;
+}
+
+/**
+ * @brief Releases held items whose gap waited hold_ms
+ *
+ * @param sequence Pointer to the window
+ * @param now_ms The current time
+ * @param deliver Called for every released item, in order
+ * @param ctx Passed to deliver
+ * @return The number of items delivered
+ */
+size_t sequence_release(struct sequence_t *sequence, uint32_t now_ms, void (*deliver)(void *ctx, const void *item),
+                        void *ctx)
+{
+  size_t delivered = 0;
+  uint32_t waited_ms;
+  pthread_mutex_lock(&sequence->mutex);
+  while (sequence_held(sequence, now_ms, &waited_ms) > 0 && waited_ms >= sequence->hold_ms)
+    delivered += sequence_skip(sequence, deliver, ctx);
+  pthread_mutex_unlock(&sequence->mutex);
+  return delivered;
+}
+
+/**
+ * @brief Copies the window statistics
+ *
+ * @param sequence Pointer to the window
+ * @param stats Pointer to the statistics to fill
+ */
+void sequence_get_stats(struct sequence_t *sequence, struct sequence_stats *stats)
+{
+  uint32_t waited_ms;
+  pthread_mutex_lock(&sequence->mutex);
+  *stats = sequence->stats;
+  stats->held = (uint32_t)sequence_held(sequence, 0, &waited_ms);
+  pthread_mutex_unlock(&sequence->mutex);
+}
+
+/**
+ * @brief Destroys a sequence window
+ *
+ * @param sequence Double pointer to the window to destroy
+ */
+void destroy_sequence(struct sequence_t **sequence)
+{
+  if (*sequence == NULL)
+    return;
+  if ((*sequence)->slots != NULL)
+    free((*sequence)->slots[0].item);
+  free((*sequence)->slots);
+  pthread_mutex_destroy(&(*sequence)->mutex);
+  free(*sequence);
+  *sequence = NULL;
+}
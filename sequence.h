@@ -0,0 +1,157 @@
+/**
+ * @file sequence.h
+ * @brief A sequence number window that drops duplicates, counts gaps and restores order
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This header file provides the MT message filter of the driver. Every MT message has the
+ * gateway's MTMSN, a 16-bit number that grows by one per message. A retried session or a
+ * second +SBDRT of the same buffer hands the same message over twice, a message that was
+ * never read leaves a hole.
+ *
+ * The window remembers the highest number seen and which of the SEQUENCE_WINDOW numbers
+ * below it arrived, so a number seen before is a duplicate. A number more than one above
+ * the highest opens a gap, one that arrives afterwards is counted late.
+ *
+ * With a depth, items ahead of the next expected number are held until the missing ones
+ * arrive. The held items are released in order, and a gap is skipped once depth items
+ * wait or the oldest held item waited hold_ms. Without depth every new item is delivered
+ * as it comes.
+ *
+ * All operations are serialized with an internal mutex, the deliver callback runs with
+ * the mutex held so items leave in order whichever task releases them.
+ *
+ * Usage example:
+ * @code
+ * struct sequence_t *sequence = newSequence(4, sizeof(message), 300000);
+ * sequence_push(sequence, mtmsn, &message, now_ms, &deliver, ctx);
+ * sequence_release(sequence, now_ms, &deliver, ctx);
+ * destroy_sequence(&sequence);
+ * @endcode
+ */
+
+#ifndef SEQUENCE_H_INCLUDED
+#define SEQUENCE_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define SEQUENCE_WINDOW 64       /**< Numbers below the highest remembered for duplicates */
+
+/**
+ * @brief Outcome of sequence_push()
+ */
+enum sequence_verdict
+{
+  SEQUENCE_DELIVERED = 0,        /**< Delivered, with any held items it released */
+  SEQUENCE_HELD,                 /**< Waiting for an earlier number */
+  SEQUENCE_DUPLICATE,            /**< Seen before, dropped */
+};
+
+/**
+ * @brief Window statistics
+ */
+struct sequence_stats
+{
+  uint32_t received;             /**< Items pushed */
+  uint32_t delivered;            /**< Items delivered */
+  uint32_t duplicates;           /**< Items dropped as seen before */
+  uint32_t gaps;                 /**< Numbers found missing */
+  uint32_t late;                 /**< Missing numbers that arrived after all */
+  uint32_t reordered;            /**< Items held before delivery */
+  uint32_t held;                 /**< Items held right now, filled by the snapshot */
+};
+
+/**
+ * @brief A held item
+ */
+struct sequence_slot
+{
+  uint8_t used;
+  uint16_t seq;
+  uint32_t since_ms;             /**< Time it was held */
+  uint8_t *item;                 /**< item_size bytes */
+};
+
+/**
+ * @brief Main sequence window structure
+ */
+struct sequence_t
+{
+  struct sequence_slot *slots;   /**< depth held items */
+  size_t depth;                  /**< 0 delivers out of order */
+  size_t item_size;
+  uint32_t hold_ms;              /**< Longest wait for a missing number */
+  int started;                   /**< A number was seen */
+  uint16_t highest;              /**< Highest number seen */
+  uint64_t seen;                 /**< Bit n set when highest - n was seen */
+  uint16_t expected;             /**< Next number in order */
+  struct sequence_stats stats;   /**< Statistics */
+  pthread_mutex_t mutex;         /**< Serializes every operation */
+};
+
+/**
+ * @brief Creates a new sequence window
+ *
+ * @param depth Items held to restore the order, 0 to deliver out of order
+ * @param item_size Size of an item
+ * @param hold_ms Skip a gap once the oldest held item waited this long
+ * @return Pointer to the newly created window, or NULL if allocation failed
+ *
+ * @note The caller is responsible for destroying the window
+ */
+struct sequence_t *newSequence(size_t depth, size_t item_size, uint32_t hold_ms);
+
+/**
+ * @brief Takes an item
+ *
+ * @param sequence Pointer to the window
+ * @param seq Its sequence number
+ * @param item The item, copied when held
+ * @param now_ms The current time
+ * @param deliver Called for the item and the held items it releases, in order
+ * @param ctx Passed to deliver
+ * @return The enum sequence_verdict
+ */
+int sequence_push(struct sequence_t *sequence, uint16_t seq, const void *item, uint32_t now_ms,
+                  void (*deliver)(void *ctx, const void *item), void *ctx);
+
+/**
+ * @brief Releases held items whose gap waited hold_ms
+ *
+ * @param sequence Pointer to the window
+ * @param now_ms The current time
+ * @param deliver Called for every released item, in order
+ * @param ctx Passed to deliver
+ * @return The number of items delivered
+ */
+size_t sequence_release(struct sequence_t *sequence, uint32_t now_ms, void (*deliver)(void *ctx, const void *item),
+                        void *ctx);
+
+/**
+ * @brief Copies the window statistics
+ *
+ * @param sequence Pointer to the window
+ * @param stats Pointer to the statistics to fill
+ */
+void sequence_get_stats(struct sequence_t *sequence, struct sequence_stats *stats);
+
+/**
+ * @brief Destroys a sequence window
+ *
+ * @param sequence Double pointer to the window to destroy
+ */
+void destroy_sequence(struct sequence_t **sequence);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SEQUENCE_H_INCLUDED */
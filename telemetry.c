@@ -0,0 +1,399 @@
+/**
+ * @file telemetry.c
+ * @brief Implementation of the telemetry encoder
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This file contains the implementation of the encoder and decoder declared in
+ * telemetry.h. Bits are written most significant first, a frame buffer is zeroed by
+ * telemetry_begin() so writes only ever set bits.
+ */
+
+#include "telemetry.h"
+
+static const double telemetry_scale[TELEMETRY_DECIMALS_MAX + 1] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+/**
+ * @brief Bit reader over a frame
+ */
+struct telemetry_reader
+{
+  const uint8_t *frame;
+  size_t bits;
+  size_t bit;
+};
+
+static uint32_t telemetry_hash(const uint8_t *data, size_t length)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++)
+    hash = (hash ^ data[i]) * 16777619u;
+  return hash;
+}
+
+static void telemetry_schema_update(struct telemetry_schema *schema)
+{
+  uint8_t descriptor[TELEMETRY_DESCRIPTOR_MAX];
+  uint32_t hash = telemetry_hash(descriptor, telemetry_schema_serialize(schema, descriptor, sizeof descriptor));
+  schema->id = (uint8_t)(hash ^ hash >> 8 ^ hash >> 16 ^ hash >> 24);
+}
+
+static uint8_t telemetry_width(uint32_t range)
+{
+  uint8_t bits = 0;
+  while (range)
+  {
+    bits++;
+    range >>= 1;
+  }
+  return bits;
+}
+
+static int telemetry_put(struct telemetry_encoder *encoder, uint32_t value, unsigned bits)
+{
+  if (encoder->bit + bits > encoder->capacity * 8)
+    return -1;
+  while (bits > 0)
+  {
+    unsigned room = 8 - encoder->bit % 8;
+    unsigned n = bits < room ? bits : room;
+    uint32_t chunk = (value >> (bits - n)) & ((1u << n) - 1);
+    encoder->frame[encoder->bit / 8] |= (uint8_t)(chunk << (room - n));
+    encoder->bit += n;
+    bits -= n;
+  }
+  return 0;
+}
+
+static int telemetry_get(struct telemetry_reader *reader, unsigned bits, uint32_t *value)
+{
+  if (reader->bit + bits > reader->bits)
+    return -1;
+  uint32_t result = 0;
+  while (bits > 0)
+  {
+    unsigned room = 8 - reader->bit % 8;
+    unsigned n = bits < room ? bits : room;
+    uint32_t byte = reader->frame[reader->bit / 8];
+    result = result << n | ((byte >> (room - n)) & ((1u << n) - 1));
+    reader->bit += n;
+    bits -= n;
+  }
+  *value = result;
+  return 0;
+}
+
+/**
+ * @brief Empties a schema
+ *
+ * @param schema Pointer to the schema
+ */
+void telemetry_schema_init(struct telemetry_schema *schema)
+{
+  memset(schema, 0, sizeof *schema);
+  telemetry_schema_update(schema);
+}
+
+/**
+ * @brief Appends a field to a schema
+ *
+ * @param schema Pointer to the schema
+ * @param name Field name, up to TELEMETRY_NAME_MAX - 1 characters
+ * @param min Smallest value
+ * @param max Largest value
+ * @param decimals Precision, 0 to TELEMETRY_DECIMALS_MAX, min and max times 10^decimals
+ *        must fit an int32
+ * @param flags TELEMETRY_DELTA or 0
+ * @return 0 on success, -1 if the schema is full or the field is invalid
+ */
+int telemetry_schema_field(struct telemetry_schema *schema, const char *name, double min, double max,
+                           int decimals, int flags)
+{
+  if (schema->count == TELEMETRY_FIELDS_MAX || decimals < 0 || decimals > TELEMETRY_DECIMALS_MAX ||
+      strlen(name) >= TELEMETRY_NAME_MAX || (flags & ~TELEMETRY_DELTA) != 0)
+    return -1;
+  double low = min * telemetry_scale[decimals];
+  double high = max * telemetry_scale[decimals];
+  if (!(low >= INT32_MIN && high <= INT32_MAX && low <= high))
+    return -1;
+
+  struct telemetry_field *field = &schema->fields[schema->count++];
+  memset(field, 0, sizeof *field);
+  strcpy(field->name, name);
+  field->min = (int32_t)(low < 0 ? low - 0.5 : low + 0.5);
+  field->max = (int32_t)(high < 0 ? high - 0.5 : high + 0.5);
+  field->decimals = (uint8_t)decimals;
+  field->flags = (uint8_t)flags;
+  field->bits = telemetry_width((uint32_t)((int64_t)field->max - field->min));
+  telemetry_schema_update(schema);
+  return 0;
+}
+
+/**
+ * @brief Serializes a schema into its descriptor
+ *
+ * @param schema Pointer to the schema
+ * @param descriptor Output buffer, TELEMETRY_DESCRIPTOR_MAX bytes always suffice
+ * @param capacity Size of the output buffer
+ * @return The descriptor length, or 0 if it does not fit
+ */
+size_t telemetry_schema_serialize(const struct telemetry_schema *schema, uint8_t *descriptor, size_t capacity)
+{
+  size_t length = 0;
+  if (capacity < 2)
+    return 0;
+  descriptor[length++] = TELEMETRY_VERSION;
+  descriptor[length++] = (uint8_t)schema->count;
+  for (size_t i = 0; i < schema->count; i++)
+  {
+    const struct telemetry_field *field = &schema->fields[i];
+    size_t name = strlen(field->name);
+    if (length + 1 + name + 10 > capacity)
+      return 0;
+    descriptor[length++] = (uint8_t)name;
+    memcpy(descriptor + length, field->name, name);
+    length += name;
+    descriptor[length++] = field->decimals;
+    descriptor[length++] = field->flags;
+    int32_t bounds[2] = { field->min, field->max };
+    for (int b = 0; b < 2; b++)
+    {
+      uint32_t value = (uint32_t)bounds[b];
+      for (int k = 0; k < 4; k++)
+        descriptor[length++] = (uint8_t)(value >> (8 * k));
+    }
+  }
+  return length;
+}
+
+/**
+ * @brief Rebuilds a schema from its descriptor
+ *
+ * @param schema Pointer to the schema to fill
+ * @param descriptor The descriptor
+ * @param length Length of the descriptor
+ * @return 0 on success, -1 on an unknown version or a malformed descriptor
+ */
+int telemetry_schema_parse(struct telemetry_schema *schema, const uint8_t *descriptor, size_t length)
+{
+  memset(schema, 0, sizeof *schema);
+  if (length < 2 || descriptor[0] != TELEMETRY_VERSION || descriptor[1] > TELEMETRY_FIELDS_MAX)
+    return -1;
+  size_t count = descriptor[1];
+  size_t offset = 2;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (offset >= length)
+      return -1;
+    size_t name = descriptor[offset++];
+    if (name >= TELEMETRY_NAME_MAX || offset + name + 10 > length)
+      return -1;
+    struct telemetry_field *field = &schema->fields[i];
+    memcpy(field->name, descriptor + offset, name);
+    offset += name;
+    field->decimals = descriptor[offset++];
+    field->flags = descriptor[offset++];
+    uint32_t bounds[2] = { 0, 0 };
+    for (int b = 0; b < 2; b++)
+    {
+      for (int k = 0; k < 4; k++)
+        bounds[b] |= (uint32_t)descriptor[offset++] << (8 * k);
+    }
+    field->min = (int32_t)bounds[0];
+    field->max = (int32_t)bounds[1];
+    if (field->decimals > TELEMETRY_DECIMALS_MAX || field->min > field->max)
+      return -1;
+    field->bits = telemetry_width((uint32_t)((int64_t)field->max - field->min));
+  }
+  if (offset != length)
+    return -1;
+  schema->count = count;
+  telemetry_schema_update(schema);
+  return 0;
+}
+
+/**
+ * @brief Binds an encoder to a schema and clears its statistics
+ *
+ * @param encoder Pointer to the encoder
+ * @param schema Pointer to the schema, it must outlive the encoder
+ */
+void telemetry_encoder_init(struct telemetry_encoder *encoder, const struct telemetry_schema *schema)
+{
+  memset(encoder, 0, sizeof *encoder);
+  encoder->schema = schema;
+}
+
+/**
+ * @brief Starts a frame
+ *
+ * @param encoder Pointer to the encoder
+ * @param frame Output buffer, typically IRI_SBD_MO_MAX bytes
+ * @param capacity Size of the output buffer, at least TELEMETRY_FRAME_HEADER
+ */
+void telemetry_begin(struct telemetry_encoder *encoder, uint8_t *frame, size_t capacity)
+{
+  memset(frame, 0, capacity);
+  encoder->frame = frame;
+  encoder->capacity = capacity;
+  encoder->bit = TELEMETRY_FRAME_HEADER * 8;
+  encoder->records = 0;
+}
+
+/**
+ * @brief Appends a record to the frame
+ *
+ * @param encoder Pointer to the encoder
+ * @param values One value per field, in schema order, clamped to the field range
+ * @return 0 on success, -1 if the record does not fit (the frame is left as it was)
+ */
+int telemetry_add(struct telemetry_encoder *encoder, const double *values)
+{
+  const struct telemetry_schema *schema = encoder->schema;
+  if (encoder->records == TELEMETRY_RECORDS_MAX || encoder->capacity < TELEMETRY_FRAME_HEADER)
+  {
+    encoder->stats.full++;
+    return -1;
+  }
+
+  int32_t quantized[TELEMETRY_FIELDS_MAX];
+  uint32_t clamped = 0;
+  for (size_t i = 0; i < schema->count; i++)
+  {
+    const struct telemetry_field *field = &schema->fields[i];
+    double value = values[i] * telemetry_scale[field->decimals];
+    if (!(value >= field->min))
+    {
+      quantized[i] = field->min;
+      clamped++;
+    }
+    else if (value > field->max)
+    {
+      quantized[i] = field->max;
+      clamped++;
+    }
+    else
+    {
+      int64_t rounded = (int64_t)(value < 0 ? value - 0.5 : value + 0.5);
+      quantized[i] = (int32_t)(rounded > field->max ? field->max : rounded);
+    }
+  }
+
+  size_t start = encoder->bit;
+  int status = 0;
+  for (size_t i = 0; i < schema->count && status == 0; i++)
+  {
+    const struct telemetry_field *field = &schema->fields[i];
+    if (encoder->records == 0 || !(field->flags & TELEMETRY_DELTA))
+    {
+      status = telemetry_put(encoder, (uint32_t)((int64_t)quantized[i] - field->min), field->bits);
+      continue;
+    }
+    /* zigzag, small steps either way stay small */
+    int64_t delta = (int64_t)quantized[i] - encoder->previous[i];
+    uint64_t zigzag = delta < 0 ? ((uint64_t)(-delta) << 1) - 1 : (uint64_t)delta << 1;
+    do
+    {
+      uint32_t group = (uint32_t)(zigzag & ((1u << TELEMETRY_VARINT_BITS) - 1));
+      zigzag >>= TELEMETRY_VARINT_BITS;
+      status = telemetry_put(encoder, (zigzag != 0) << TELEMETRY_VARINT_BITS | group, TELEMETRY_VARINT_BITS + 1);
+    } while (zigzag != 0 && status == 0);
+  }
+
+  if (status != 0)
+  {
+    /* clear the partial record */
+    if (start % 8)
+      encoder->frame[start / 8] &= (uint8_t)(0xff << (8 - start % 8));
+    size_t first = (start + 7) / 8;
+    size_t last = (encoder->bit + 7) / 8;
+    if (last > first)
+      memset(encoder->frame + first, 0, last - first);
+    encoder->bit = start;
+    encoder->stats.full++;
+    return -1;
+  }
+
+  memcpy(encoder->previous, quantized, schema->count * sizeof quantized[0]);
+  encoder->records++;
+  encoder->stats.records++;
+  encoder->stats.clamped += clamped;
+  return 0;
+}
+
+/**
+ * @brief Finishes the frame
+ *
+ * @param encoder Pointer to the encoder
+ * @return The frame length, 0 when it holds no record
+ */
+size_t telemetry_end(struct telemetry_encoder *encoder)
+{
+  if (encoder->records == 0)
+    return 0;
+  size_t length = (encoder->bit + 7) / 8;
+  encoder->frame[0] = encoder->schema->id;
+  encoder->frame[1] = (uint8_t)encoder->records;
+  encoder->stats.frames++;
+  encoder->stats.frame_bytes += length;
+  return length;
+}
+
+/**
+ * @brief Decodes a frame
+ *
+ * @param schema Pointer to the schema the frame was encoded with
+ * @param frame The frame
+ * @param length Length of the frame
+ * @param values Output, schema->count values per record, record after record
+ * @param max_records Number of records values has room for
+ * @return The number of records, or -1 on a schema id mismatch, a truncated frame or
+ *         more records than max_records
+ */
+long telemetry_decode(const struct telemetry_schema *schema, const uint8_t *frame, size_t length,
+                      double *values, size_t max_records)
+{
+  if (length < TELEMETRY_FRAME_HEADER || frame[0] != schema->id || frame[1] > max_records)
+    return -1;
+  struct telemetry_reader reader = { frame, length * 8, TELEMETRY_FRAME_HEADER * 8 };
+  size_t records = frame[1];
+  int32_t previous[TELEMETRY_FIELDS_MAX];
+  for (size_t r = 0; r < records; r++)
+  {
+    for (size_t i = 0; i < schema->count; i++)
+    {
+      const struct telemetry_field *field = &schema->fields[i];
+      int64_t quantized;
+      uint32_t value;
+      if (r == 0 || !(field->flags & TELEMETRY_DELTA))
+      {
+        if (telemetry_get(&reader, field->bits, &value) != 0)
+          return -1;
+        quantized = (int64_t)field->min + value;
+      }
+      else
+      {
+        uint64_t zigzag = 0;
+        unsigned shift = 0;
+        uint32_t more;
+        do
+        {
+          if (shift > 64 - TELEMETRY_VARINT_BITS || telemetry_get(&reader, 1, &more) != 0 ||
+              telemetry_get(&reader, TELEMETRY_VARINT_BITS, &value) != 0)
+            return -1;
+          zigzag |= (uint64_t)value << shift;
+          shift += TELEMETRY_VARINT_BITS;
+        } while (more);
+        int64_t delta = (zigzag & 1) ? -(int64_t)((zigzag + 1) >> 1) : (int64_t)(zigzag >> 1);
+        quantized = previous[i] + delta;
+      }
+      if (quantized < field->min || quantized > field->max)
+        return -1;
+      previous[i] = (int32_t)quantized;
+      values[r * schema->count + i] = quantized / telemetry_scale[field->decimals];
+    }
+  }
+  return (long)records;
+}
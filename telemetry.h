@@ -0,0 +1,212 @@
+/**
+ * @file telemetry.h
+ * @brief A schema-driven, bit-packed record encoder for SBD messages
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This header file provides a compact binary alternative to sending numbers as text.
+ * A schema declares every field with a range and a number of decimals, so a value is
+ * stored as the integer (value * 10^decimals - min) in just the bits its range needs:
+ * a latitude of -90 to 90 with 5 decimals takes 25 bits instead of 9 to 13 characters.
+ *
+ * Records are packed into self-contained frames, one per SBD message:
+ * @code
+ * <schema id:1 byte> <records:1 byte> <bit stream, zero padded>
+ * @endcode
+ * The first record of a frame is absolute, later records store TELEMETRY_DELTA fields
+ * as the zigzag difference to the previous record in groups of TELEMETRY_VARINT_BITS bits,
+ * each preceded by a continuation bit. A slowly moving GPS position costs a few bits per
+ * sample instead of 25. A lost message never breaks the decoding of the next one.
+ *
+ * The schema serializes to a descriptor,
+ * @code
+ * <version:1 byte> <fields:1 byte>
+ * <name length:1 byte> <name> <decimals:1 byte> <flags:1 byte> <min:i32 LE> <max:i32 LE>  per field
+ * @endcode
+ * which the host decoder (tools/iridium_telemetry.c, built from this file) parses back
+ * byte for byte. The schema id in every frame is a hash of the descriptor, a frame is
+ * never decoded with the wrong schema.
+ *
+ * An encoder is not synchronized, the owner serializes access.
+ *
+ * Usage example:
+ * @code
+ * struct telemetry_schema schema;
+ * telemetry_schema_init(&schema);
+ * telemetry_schema_field(&schema, "lat", -90, 90, 5, TELEMETRY_DELTA);
+ * telemetry_schema_field(&schema, "lon", -180, 180, 5, TELEMETRY_DELTA);
+ * struct telemetry_encoder encoder;
+ * telemetry_encoder_init(&encoder, &schema);
+ * telemetry_begin(&encoder, frame, 340);
+ * while (telemetry_add(&encoder, sample) == 0)
+ *   next(sample);
+ * iridium_tx_binary(satcom, frame, telemetry_end(&encoder));
+ * @endcode
+ */
+
+#ifndef TELEMETRY_H_INCLUDED
+#define TELEMETRY_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_FIELDS_MAX 32          /**< Fields of a schema */
+#define TELEMETRY_NAME_MAX 16            /**< Field name, terminator included */
+#define TELEMETRY_DECIMALS_MAX 9
+#define TELEMETRY_RECORDS_MAX 255        /**< Records of a frame, the count is one byte */
+#define TELEMETRY_FRAME_HEADER 2
+#define TELEMETRY_VARINT_BITS 4          /**< Delta bits per continuation bit */
+#define TELEMETRY_DESCRIPTOR_MAX (2 + TELEMETRY_FIELDS_MAX * (TELEMETRY_NAME_MAX + 10))
+
+#define TELEMETRY_DELTA 0x01             /**< Field flag, delta coded after the first record */
+
+/**
+ * @brief A field of a schema
+ */
+struct telemetry_field
+{
+  char name[TELEMETRY_NAME_MAX];
+  int32_t min;                   /**< Smallest value, in units of 10^-decimals */
+  int32_t max;                   /**< Largest value, in units of 10^-decimals */
+  uint8_t decimals;              /**< Precision */
+  uint8_t flags;                 /**< TELEMETRY_DELTA */
+  uint8_t bits;                  /**< Width of an absolute value */
+};
+
+/**
+ * @brief A record layout
+ */
+struct telemetry_schema
+{
+  size_t count;                                       /**< Number of fields */
+  struct telemetry_field fields[TELEMETRY_FIELDS_MAX];
+  uint8_t id;                                         /**< Hash of the descriptor */
+};
+
+/**
+ * @brief Encoder statistics
+ */
+struct telemetry_stats
+{
+  uint32_t records;              /**< Records encoded */
+  uint32_t frames;               /**< Frames ended with records */
+  uint32_t frame_bytes;          /**< Bytes of those frames, headers included */
+  uint32_t full;                 /**< Records refused because the frame was full */
+  uint32_t clamped;              /**< Values outside the range of their field */
+};
+
+/**
+ * @brief Frame encoder state
+ */
+struct telemetry_encoder
+{
+  const struct telemetry_schema *schema;
+  uint8_t *frame;                                /**< Frame being written */
+  size_t capacity;
+  size_t bit;                                    /**< Bits written, header included */
+  size_t records;                                /**< Records in the frame */
+  int32_t previous[TELEMETRY_FIELDS_MAX];        /**< Quantized previous record */
+  struct telemetry_stats stats;                  /**< Statistics */
+};
+
+/**
+ * @brief Empties a schema
+ *
+ * @param schema Pointer to the schema
+ */
+void telemetry_schema_init(struct telemetry_schema *schema);
+
+/**
+ * @brief Appends a field to a schema
+ *
+ * @param schema Pointer to the schema
+ * @param name Field name, up to TELEMETRY_NAME_MAX - 1 characters
+ * @param min Smallest value
+ * @param max Largest value
+ * @param decimals Precision, 0 to TELEMETRY_DECIMALS_MAX, min and max times 10^decimals
+ *        must fit an int32
+ * @param flags TELEMETRY_DELTA or 0
+ * @return 0 on success, -1 if the schema is full or the field is invalid
+ */
+int telemetry_schema_field(struct telemetry_schema *schema, const char *name, double min, double max,
+                           int decimals, int flags);
+
+/**
+ * @brief Serializes a schema into its descriptor
+ *
+ * @param schema Pointer to the schema
+ * @param descriptor Output buffer, TELEMETRY_DESCRIPTOR_MAX bytes always suffice
+ * @param capacity Size of the output buffer
+ * @return The descriptor length, or 0 if it does not fit
+ */
+size_t telemetry_schema_serialize(const struct telemetry_schema *schema, uint8_t *descriptor, size_t capacity);
+
+/**
+ * @brief Rebuilds a schema from its descriptor
+ *
+ * @param schema Pointer to the schema to fill
+ * @param descriptor The descriptor
+ * @param length Length of the descriptor
+ * @return 0 on success, -1 on an unknown version or a malformed descriptor
+ */
+int telemetry_schema_parse(struct telemetry_schema *schema, const uint8_t *descriptor, size_t length);
+
+/**
+ * @brief Binds an encoder to a schema and clears its statistics
+ *
+ * @param encoder Pointer to the encoder
+ * @param schema Pointer to the schema, it must outlive the encoder
+ */
+void telemetry_encoder_init(struct telemetry_encoder *encoder, const struct telemetry_schema *schema);
+
+/**
+ * @brief Starts a frame
+ *
+ * @param encoder Pointer to the encoder
+ * @param frame Output buffer, typically IRI_SBD_MO_MAX bytes
+ * @param capacity Size of the output buffer, at least TELEMETRY_FRAME_HEADER
+ */
+void telemetry_begin(struct telemetry_encoder *encoder, uint8_t *frame, size_t capacity);
+
+/**
+ * @brief Appends a record to the frame
+ *
+ * @param encoder Pointer to the encoder
+ * @param values One value per field, in schema order, clamped to the field range
+ * @return 0 on success, -1 if the record does not fit (the frame is left as it was)
+ */
+int telemetry_add(struct telemetry_encoder *encoder, const double *values);
+
+/**
+ * @brief Finishes the frame
+ *
+ * @param encoder Pointer to the encoder
+ * @return The frame length, 0 when it holds no record
+ */
+size_t telemetry_end(struct telemetry_encoder *encoder);
+
+/**
+ * @brief Decodes a frame
+ *
+ * @param schema Pointer to the schema the frame was encoded with
+ * @param frame The frame
+ * @param length Length of the frame
+ * @param values Output, schema->count values per record, record after record
+ * @param max_records Number of records values has room for
+ * @return The number of records, or -1 on a schema id mismatch, a truncated frame or
+ *         more records than max_records
+ */
+long telemetry_decode(const struct telemetry_schema *schema, const uint8_t *frame, size_t length,
+                      double *values, size_t max_records);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TELEMETRY_H_INCLUDED */
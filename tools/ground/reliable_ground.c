@@ -0,0 +1,146 @@
+/**
+ * @file reliable_ground.c
+ * @brief Implementation of the reliable delivery backend
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This file contains the implementation of the backend declared in reliable_ground.h.
+ * Frames are parsed with the constants of the device header so both ends agree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reliable_ground.h"
+#include "../../reliable.h"
+
+static int ground_test(const uint8_t *bits, uint16_t seq)
+{
+  return bits[seq >> 3] >> (seq & 7) & 1;
+}
+
+static void ground_set(uint8_t *bits, uint16_t seq)
+{
+  bits[seq >> 3] |= (uint8_t)(1 << (seq & 7));
+}
+
+static void ground_clear(uint8_t *bits, uint16_t seq)
+{
+  bits[seq >> 3] &= (uint8_t)~(1 << (seq & 7));
+}
+
+/**
+ * @brief Creates a backend that has seen nothing
+ *
+ * @return Pointer to the backend, or NULL if allocation failed
+ */
+struct reliable_ground *newReliableGround(void)
+{
+  return calloc(1, sizeof(struct reliable_ground));
+}
+
+/**
+ * @brief Takes an MO message
+ *
+ * @param ground Pointer to the backend
+ * @param frame The MO message
+ * @param length The MO message length
+ * @param payload Set to the application payload inside frame
+ * @param payload_length Set to the payload length
+ * @return 1 for a new message, 0 for a duplicate, -1 if it is not a data frame
+ */
+int reliable_ground_receive(struct reliable_ground *ground, const uint8_t *frame, size_t length,
+                            const uint8_t **payload, size_t *payload_length)
+{
+  if (length <= RELIABLE_HEADER || frame[0] != RELIABLE_FRAME_DATA)
+  {
+    ground->stats.invalid++;
+    return -1;
+  }
+  uint16_t seq = (uint16_t)(frame[1] | frame[2] << 8);
+  *payload = frame + RELIABLE_HEADER;
+  *payload_length = length - RELIABLE_HEADER;
+  ground->stats.frames++;
+  if (!ground_test(ground->unacked, seq))
+  {
+    ground_set(ground->unacked, seq);
+    ground->pending++;
+  }
+  if (ground_test(ground->seen, seq))
+  {
+    ground->stats.duplicates++;
+    return 0;
+  }
+  ground_set(ground->seen, seq);
+  /* half the sequence space back is the previous lap */
+  ground_clear(ground->seen, (uint16_t)(seq + 32768));
+  ground->stats.delivered++;
+  return 1;
+}
+
+/**
+ * @brief Builds the acknowledgement of the messages received since the last one
+ *
+ * @param ground Pointer to the backend
+ * @param text Output buffer, terminated
+ * @param capacity Size of the output buffer, RELIABLE_GROUND_ACK_MAX for an MT message
+ * @return The text length, 0 when nothing waits for an acknowledgement
+ */
+size_t reliable_ground_ack(struct reliable_ground *ground, char *text, size_t capacity)
+{
+  size_t length = strlen(RELIABLE_ACK_PREFIX);
+  if (ground->pending == 0 || capacity <= length)
+    return 0;
+  memcpy(text, RELIABLE_ACK_PREFIX, length);
+
+  uint32_t seq = 0;
+  size_t ranges = 0;
+  while (seq < 65536)
+  {
+    if (ground->unacked[seq >> 3] == 0)
+    {
+      seq = (seq | 7) + 1;
+      continue;
+    }
+    if (!ground_test(ground->unacked, (uint16_t)seq))
+    {
+      seq++;
+      continue;
+    }
+    uint32_t last = seq;
+    while (last + 1 < 65536 && ground_test(ground->unacked, (uint16_t)(last + 1)))
+      last++;
+
+    char range[16];
+    int n = last == seq ? snprintf(range, sizeof range, "%s%u", ranges ? "," : "", (unsigned)seq)
+                        : snprintf(range, sizeof range, "%s%u-%u", ranges ? "," : "", (unsigned)seq, (unsigned)last);
+    if (length + n + 1 > capacity)
+      break;
+    memcpy(text + length, range, n);
+    length += n;
+    ranges++;
+    for (uint32_t s = seq; s <= last; s++)
+      ground_clear(ground->unacked, (uint16_t)s);
+    ground->pending -= last - seq + 1;
+    seq = last + 1;
+  }
+  if (ranges == 0)
+    return 0;
+  text[length] = '\0';
+  ground->stats.acks++;
+  return length;
+}
+
+/**
+ * @brief Destroys a backend
+ *
+ * @param ground Double pointer to the backend to destroy
+ */
+void destroy_reliable_ground(struct reliable_ground **ground)
+{
+  if (*ground == NULL)
+    return;
+  free(*ground);
+  *ground = NULL;
+}
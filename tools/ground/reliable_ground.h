@@ -0,0 +1,114 @@
+/**
+ * @file reliable_ground.h
+ * @brief Backend side of the reliable delivery protocol in reliable.h
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * A reference for the server that receives the MO messages of a device (from a webhook
+ * like examples/api/main.go or the simulated gateway of tools/iridium_sim). Every data
+ * frame is delivered to the application once, whatever the number of copies the device
+ * sends, and its sequence number is remembered for the next acknowledgement:
+ * @code
+ * ACK:12-40,43,45-47
+ * @endcode
+ * sent back as an MT message. Duplicates are acknowledged again, a copy means the device
+ * missed the first acknowledgement. An acknowledgement never exceeds the capacity given
+ * (270 bytes fit any MT message), sequence numbers that do not fit wait for the next one.
+ *
+ * Seen sequence numbers are kept in a bitmap of the whole 16-bit space; receiving N
+ * forgets N + 32768, so a sequence number is reused after the wrap without being taken
+ * for a duplicate. Not synchronized, the owner serializes access.
+ *
+ * Usage example:
+ * @code
+ * struct reliable_ground *ground = newReliableGround();
+ * const uint8_t *payload;
+ * size_t length;
+ * if (reliable_ground_receive(ground, frame, size, &payload, &length) == 1)
+ *   store(payload, length);
+ * char ack[RELIABLE_GROUND_ACK_MAX];
+ * if (reliable_ground_ack(ground, ack, sizeof ack) > 0)
+ *   send_mt(ack);
+ * destroy_reliable_ground(&ground);
+ * @endcode
+ */
+
+#ifndef RELIABLE_GROUND_H_INCLUDED
+#define RELIABLE_GROUND_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RELIABLE_GROUND_ACK_MAX 270      /**< Largest MT message of a 9602/9603 */
+
+/**
+ * @brief Backend statistics
+ */
+struct reliable_ground_stats
+{
+  uint32_t frames;               /**< Data frames received */
+  uint32_t delivered;            /**< Messages delivered once */
+  uint32_t duplicates;           /**< Copies of messages already delivered */
+  uint32_t invalid;              /**< MO messages that are not data frames */
+  uint32_t acks;                 /**< Acknowledgements built */
+};
+
+/**
+ * @brief Backend state
+ */
+struct reliable_ground
+{
+  uint8_t seen[65536 / 8];       /**< Delivered sequence numbers */
+  uint8_t unacked[65536 / 8];    /**< Received since the last acknowledgement */
+  uint32_t pending;              /**< Bits set in unacked */
+  struct reliable_ground_stats stats;
+};
+
+/**
+ * @brief Creates a backend that has seen nothing
+ *
+ * @return Pointer to the backend, or NULL if allocation failed
+ *
+ * @note The caller is responsible for destroying the backend
+ */
+struct reliable_ground *newReliableGround(void);
+
+/**
+ * @brief Takes an MO message
+ *
+ * @param ground Pointer to the backend
+ * @param frame The MO message
+ * @param length The MO message length
+ * @param payload Set to the application payload inside frame
+ * @param payload_length Set to the payload length
+ * @return 1 for a new message, 0 for a duplicate, -1 if it is not a data frame
+ */
+int reliable_ground_receive(struct reliable_ground *ground, const uint8_t *frame, size_t length,
+                            const uint8_t **payload, size_t *payload_length);
+
+/**
+ * @brief Builds the acknowledgement of the messages received since the last one
+ *
+ * @param ground Pointer to the backend
+ * @param text Output buffer, terminated
+ * @param capacity Size of the output buffer, RELIABLE_GROUND_ACK_MAX for an MT message
+ * @return The text length, 0 when nothing waits for an acknowledgement
+ */
+size_t reliable_ground_ack(struct reliable_ground *ground, char *text, size_t capacity);
+
+/**
+ * @brief Destroys a backend
+ *
+ * @param ground Double pointer to the backend to destroy
+ */
+void destroy_reliable_ground(struct reliable_ground **ground);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RELIABLE_GROUND_H_INCLUDED */
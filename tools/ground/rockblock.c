@@ -0,0 +1,557 @@
+/**
+ * @file rockblock.c
+ * @brief Implementation of the RockBLOCK delivery decoder
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This file contains the implementation of the decoder declared in rockblock.h. The
+ * SWAR hex step classifies and converts 8 characters per 64-bit word: with the top bit
+ * of every byte clear, adding 0x80 - lo sets it for bytes >= lo and adding 0x7f - hi for
+ * bytes > hi, without carries between bytes.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rockblock.h"
+
+#define ROCKBLOCK_RECORDS_PER_ROW (ROCKBLOCK_DATA_MAX / 2)  /**< Shortest record is 2 bytes */
+#define ROCKBLOCK_ONES 0x0101010101010101ull
+#define ROCKBLOCK_HIGH 0x8080808080808080ull
+
+static const int8_t rockblock_nibbles[256] = {
+  ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5, ['5'] = 6, ['6'] = 7, ['7'] = 8,
+  ['8'] = 9, ['9'] = 10, ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+  ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};  /* nibble + 1, 0 is not a digit */
+
+/**
+ * @brief Decodes hex digits, either case
+ *
+ * @param hex The digits
+ * @param length Number of digits, even
+ * @param out Buffer of length / 2 bytes
+ * @return The number of bytes, or -1 on an odd length or a character that is not a digit
+ */
+long rockblock_hex_decode_scalar(const char *hex, size_t length, uint8_t *out)
+{
+  if (length % 2 != 0)
+    return -1;
+  for (size_t i = 0; i < length; i += 2)
+  {
+    int high = rockblock_nibbles[(uint8_t)hex[i]] - 1;
+    int low = rockblock_nibbles[(uint8_t)hex[i + 1]] - 1;
+    if ((high | low) < 0)
+      return -1;
+    out[i / 2] = (uint8_t)(high << 4 | low);
+  }
+  return (long)(length / 2);
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/**
+ * @brief Decodes 8 hex characters into 4 bytes
+ */
+static int rockblock_hex_word(const char *hex, uint8_t *out)
+{
+  uint64_t word;
+  memcpy(&word, hex, sizeof word);
+  if (word & ROCKBLOCK_HIGH)
+    return -1;
+  uint64_t digit = (word + 0x50 * ROCKBLOCK_ONES) & ~(word + 0x46 * ROCKBLOCK_ONES) & ROCKBLOCK_HIGH;
+  uint64_t lower = word | 0x20 * ROCKBLOCK_ONES;
+  uint64_t alpha = (lower + 0x1f * ROCKBLOCK_ONES) & ~(lower + 0x19 * ROCKBLOCK_ONES) & ROCKBLOCK_HIGH;
+  if ((digit | alpha) != ROCKBLOCK_HIGH)
+    return -1;
+
+  /* first character in the low byte, 'a' & 0x0f is 1 */
+  uint64_t nibbles = (word & 0x0f * ROCKBLOCK_ONES) + (alpha >> 7) * 9;
+  uint64_t pairs = ((nibbles << 4) | (nibbles >> 8)) & 0x00ff00ff00ff00ffull;
+  pairs = (pairs | pairs >> 8) & 0x0000ffff0000ffffull;
+  uint32_t bytes = (uint32_t)(pairs | pairs >> 16);
+  memcpy(out, &bytes, sizeof bytes);
+  return 0;
+}
+#endif
+
+/**
+ * @brief Decodes hex digits, either case
+ *
+ * @param hex The digits
+ * @param length Number of digits, even
+ * @param out Buffer of length / 2 bytes
+ * @return The number of bytes, or -1 on an odd length or a character that is not a digit
+ */
+long rockblock_hex_decode(const char *hex, size_t length, uint8_t *out)
+{
+  if (length % 2 != 0)
+    return -1;
+  size_t done = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  for (; done + 16 <= length; done += 16)
+  {
+    if (rockblock_hex_word(hex + done, out + done / 2) != 0 ||
+        rockblock_hex_word(hex + done + 8, out + done / 2 + 4) != 0)
+      return -1;
+  }
+#endif
+  if (rockblock_hex_decode_scalar(hex + done, length - done, out + done / 2) < 0)
+    return -1;
+  return (long)(length / 2);
+}
+
+/**
+ * @brief Splits a frame packed by outbox_pack() into records
+ *
+ * @param frame The payload
+ * @param length Length of the payload
+ * @param offsets Filled with the start of every record in the frame, can be NULL
+ * @param max Size of offsets, the count is exact even when it is exceeded
+ * @return The number of records, or -1 if a length runs past the frame or is 0
+ */
+long rockblock_frame_split(const uint8_t *frame, size_t length, uint32_t *offsets, size_t max)
+{
+  long count = 0;
+  size_t offset = 0;
+  while (offset < length)
+  {
+    size_t record = frame[offset];
+    if (record == 0 || offset + 1 + record > length)
+      return -1;
+    if (offsets && (size_t)count < max)
+      offsets[count] = (uint32_t)(offset + 1);
+    count++;
+    offset += 1 + record;
+  }
+  return count;
+}
+
+/**
+ * @brief Parses an unsigned decimal field, the whole value must be digits
+ */
+static int rockblock_unsigned(const char *value, size_t length, uint64_t *out)
+{
+  if (length == 0 || length > 19)
+    return -1;
+  uint64_t result = 0;
+  for (size_t i = 0; i < length; i++)
+  {
+    unsigned digit = (unsigned)(value[i] - '0');
+    if (digit > 9)
+      return -1;
+    result = result * 10 + digit;
+  }
+  *out = result;
+  return 0;
+}
+
+/**
+ * @brief Parses a signed decimal fraction like 52.3867 or -0.2938
+ */
+static int rockblock_decimal(const char *value, size_t length, double *out)
+{
+  size_t i = 0;
+  int negative = 0;
+  if (i < length && (value[i] == '-' || value[i] == '+'))
+    negative = value[i++] == '-';
+  double result = 0;
+  double scale = 0;
+  size_t digits = 0;
+  for (; i < length; i++)
+  {
+    if (value[i] == '.' && scale == 0)
+    {
+      scale = 1;
+      continue;
+    }
+    unsigned digit = (unsigned)(value[i] - '0');
+    if (digit > 9)
+      return -1;
+    result = result * 10 + digit;
+    scale *= 10;
+    digits++;
+  }
+  if (digits == 0)
+    return -1;
+  if (scale > 1)
+    result /= scale;
+  *out = negative ? -result : result;
+  return 0;
+}
+
+/**
+ * @brief Days since 1970-01-01 of a proleptic Gregorian date
+ */
+static int64_t rockblock_days(int year, int month, int day)
+{
+  year -= month <= 2;
+  int era = (year >= 0 ? year : year - 399) / 400;
+  int yoe = year - era * 400;
+  int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return (int64_t)era * 146097 + doe - 719468;
+}
+
+/**
+ * @brief Parses "YY-MM-DD HH:MM:SS", the separators may be percent or plus encoded
+ */
+static int rockblock_time(const char *value, size_t length, int64_t *out)
+{
+  int fields[6];
+  int field = 0;
+  size_t i = 0;
+  while (field < 6)
+  {
+    int number = 0;
+    size_t digits = 0;
+    while (i < length && (unsigned)(value[i] - '0') <= 9)
+    {
+      number = number * 10 + (value[i++] - '0');
+      digits++;
+    }
+    if (digits == 0 || digits > 4)
+      return -1;
+    fields[field++] = number;
+    if (field == 6)
+      break;
+    /* '-', ':', ' ', '+', "%20", "%3A" */
+    if (i < length && value[i] == '%')
+      i += 3;
+    else
+      i++;
+    if (i >= length)
+      return -1;
+  }
+  if (i != length || fields[1] < 1 || fields[1] > 12 || fields[2] < 1 || fields[2] > 31 ||
+      fields[3] > 23 || fields[4] > 59 || fields[5] > 60)
+    return -1;
+  int year = fields[0] < 100 ? 2000 + fields[0] : fields[0];
+  *out = rockblock_days(year, fields[1], fields[2]) * 86400 + fields[3] * 3600 + fields[4] * 60 + fields[5];
+  return 0;
+}
+
+/**
+ * @brief Reads the fields of a form-encoded webhook body
+ *
+ * @param body The body, it must outlive the message (data_hex points into it)
+ * @param length Length of the body
+ * @param message Pointer to the message to fill
+ * @return ROCKBLOCK_OK, or ROCKBLOCK_ERR_FIELD if imei, momsn or data is missing or a
+ *         numeric field does not parse, unknown fields are ignored
+ */
+int rockblock_parse(const char *body, size_t length, struct rockblock_message *message)
+{
+  memset(message, 0, sizeof *message);
+  int seen = 0;
+  const char *end = body + length;
+  while (body < end)
+  {
+    const char *pair_end = memchr(body, '&', end - body);
+    if (pair_end == NULL)
+      pair_end = end;
+    const char *equals = memchr(body, '=', pair_end - body);
+    if (equals != NULL)
+    {
+      size_t key = equals - body;
+      const char *value = equals + 1;
+      size_t value_length = pair_end - value;
+      uint64_t number = 0;
+      int status = 0;
+#define ROCKBLOCK_KEY(name) (key == sizeof(name) - 1 && memcmp(body, name, key) == 0)
+      if (ROCKBLOCK_KEY("data"))
+      {
+        message->data_hex = value;
+        message->data_hex_length = value_length;
+        seen |= 1;
+      }
+      else if (ROCKBLOCK_KEY("imei"))
+      {
+        status = rockblock_unsigned(value, value_length, &message->imei);
+        seen |= 2;
+      }
+      else if (ROCKBLOCK_KEY("momsn"))
+      {
+        status = rockblock_unsigned(value, value_length, &number);
+        message->momsn = (uint32_t)number;
+        seen |= 4;
+      }
+      else if (ROCKBLOCK_KEY("serial"))
+      {
+        status = rockblock_unsigned(value, value_length, &number);
+        message->serial = (uint32_t)number;
+      }
+      else if (ROCKBLOCK_KEY("transmit_time"))
+      {
+        status = rockblock_time(value, value_length, &message->transmit_time);
+      }
+      else if (ROCKBLOCK_KEY("iridium_latitude"))
+      {
+        status = rockblock_decimal(value, value_length, &message->latitude);
+      }
+      else if (ROCKBLOCK_KEY("iridium_longitude"))
+      {
+        status = rockblock_decimal(value, value_length, &message->longitude);
+      }
+      else if (ROCKBLOCK_KEY("iridium_cep"))
+      {
+        status = rockblock_unsigned(value, value_length, &number);
+        message->cep = (uint32_t)number;
+      }
+#undef ROCKBLOCK_KEY
+      if (status != 0)
+        return ROCKBLOCK_ERR_FIELD;
+    }
+    body = pair_end + 1;
+  }
+  return seen == 7 ? ROCKBLOCK_OK : ROCKBLOCK_ERR_FIELD;
+}
+
+/**
+ * @brief Creates a new empty table
+ *
+ * @param capacity Number of rows, every row reserves ROCKBLOCK_DATA_MAX bytes of payload
+ * @return Pointer to the newly created table, or NULL if allocation failed
+ */
+struct rockblock_table *newRockblockTable(size_t capacity)
+{
+  struct rockblock_table *table = calloc(1, sizeof *table);
+  if (table == NULL)
+    return NULL;
+  table->capacity = capacity;
+  table->imei = malloc(capacity * sizeof *table->imei);
+  table->serial = malloc(capacity * sizeof *table->serial);
+  table->momsn = malloc(capacity * sizeof *table->momsn);
+  table->transmit_time = malloc(capacity * sizeof *table->transmit_time);
+  table->latitude = malloc(capacity * sizeof *table->latitude);
+  table->longitude = malloc(capacity * sizeof *table->longitude);
+  table->cep = malloc(capacity * sizeof *table->cep);
+  table->data_offset = malloc((capacity + 1) * sizeof *table->data_offset);
+  table->data = malloc(capacity * ROCKBLOCK_DATA_MAX);
+  table->record_row = malloc(capacity * ROCKBLOCK_RECORDS_PER_ROW * sizeof *table->record_row);
+  table->record_offset = malloc(capacity * ROCKBLOCK_RECORDS_PER_ROW * sizeof *table->record_offset);
+  table->record_length = malloc(capacity * ROCKBLOCK_RECORDS_PER_ROW);
+  if (capacity == 0 || !table->imei || !table->serial || !table->momsn || !table->transmit_time ||
+      !table->latitude || !table->longitude || !table->cep || !table->data_offset || !table->data ||
+      !table->record_row || !table->record_offset || !table->record_length)
+  {
+    destroy_rockblock_table(&table);
+    return NULL;
+  }
+  table->data_offset[0] = 0;
+  return table;
+}
+
+/**
+ * @brief Parses, decodes and appends a delivery
+ *
+ * @param table Pointer to the table
+ * @param body The form-encoded webhook body
+ * @param length Length of the body
+ * @param records Non-zero to split the payload into outbox records
+ * @return ROCKBLOCK_OK, ROCKBLOCK_ERR_FRAME when the row was added without records, or
+ *         ROCKBLOCK_ERR_FIELD, ROCKBLOCK_ERR_HEX, ROCKBLOCK_ERR_FULL when it was not
+ */
+int rockblock_table_add(struct rockblock_table *table, const char *body, size_t length, int records)
+{
+  if (table->rows == table->capacity)
+    return ROCKBLOCK_ERR_FULL;
+  struct rockblock_message message;
+  if (rockblock_parse(body, length, &message) != ROCKBLOCK_OK)
+  {
+    table->stats.field_errors++;
+    return ROCKBLOCK_ERR_FIELD;
+  }
+  uint8_t *data = table->data + table->data_length;
+  long size = -1;
+  if (message.data_hex_length <= 2 * ROCKBLOCK_DATA_MAX)
+    size = rockblock_hex_decode(message.data_hex, message.data_hex_length, data);
+  if (size < 0)
+  {
+    table->stats.hex_errors++;
+    return ROCKBLOCK_ERR_HEX;
+  }
+
+  size_t row = table->rows++;
+  table->imei[row] = message.imei;
+  table->serial[row] = message.serial;
+  table->momsn[row] = message.momsn;
+  table->transmit_time[row] = message.transmit_time;
+  table->latitude[row] = message.latitude;
+  table->longitude[row] = message.longitude;
+  table->cep[row] = message.cep;
+  table->data_length += size;
+  table->data_offset[row + 1] = (uint32_t)table->data_length;
+  table->stats.messages++;
+  table->stats.bytes += size;
+  if (!records)
+    return ROCKBLOCK_OK;
+
+  uint32_t *offsets = table->record_offset + table->records;
+  long count = rockblock_frame_split(data, size, offsets, ROCKBLOCK_RECORDS_PER_ROW);
+  if (count < 0)
+  {
+    table->stats.frame_errors++;
+    return ROCKBLOCK_ERR_FRAME;
+  }
+  uint32_t base = table->data_offset[row];
+  for (long i = 0; i < count; i++)
+  {
+    table->record_row[table->records] = (uint32_t)row;
+    table->record_length[table->records] = data[offsets[i] - 1];
+    table->record_offset[table->records] = base + offsets[i];
+    table->records++;
+  }
+  table->stats.records += count;
+  return ROCKBLOCK_OK;
+}
+
+/**
+ * @brief Empties a table, the statistics are kept
+ *
+ * @param table Pointer to the table
+ */
+void rockblock_table_clear(struct rockblock_table *table)
+{
+  table->rows = 0;
+  table->records = 0;
+  table->data_length = 0;
+}
+
+/**
+ * @brief Writes the file header
+ *
+ * @param file The output
+ * @return 0 on success, -1 on a write error
+ */
+int rockblock_write_header(FILE *file)
+{
+  uint8_t header[ROCKBLOCK_HEADER_SIZE] = { 'I', 'R', 'C', 'L', ROCKBLOCK_VERSION };
+  return fwrite(header, 1, sizeof header, file) == sizeof header ? 0 : -1;
+}
+
+/**
+ * @brief Checks the file header
+ *
+ * @param file The input
+ * @return 0 on success, -1 if the magic or version does not match
+ */
+int rockblock_read_header(FILE *file)
+{
+  uint8_t header[ROCKBLOCK_HEADER_SIZE];
+  if (fread(header, 1, sizeof header, file) != sizeof header)
+    return -1;
+  return memcmp(header, ROCKBLOCK_MAGIC, 4) == 0 && header[4] == ROCKBLOCK_VERSION ? 0 : -1;
+}
+
+/**
+ * @brief Writes the rows of a table as one block
+ *
+ * @param table Pointer to the table
+ * @param file The output, after the header
+ * @return 0 on success, -1 on a write error
+ */
+int rockblock_table_write(const struct rockblock_table *table, FILE *file)
+{
+  size_t rows = table->rows;
+  size_t records = table->records;
+  uint32_t counts[3] = { (uint32_t)rows, (uint32_t)records, (uint32_t)table->data_length };
+  struct
+  {
+    const void *column;
+    size_t size;
+  } columns[] = {
+    { counts, sizeof counts },
+    { table->imei, rows * sizeof *table->imei },
+    { table->serial, rows * sizeof *table->serial },
+    { table->momsn, rows * sizeof *table->momsn },
+    { table->transmit_time, rows * sizeof *table->transmit_time },
+    { table->latitude, rows * sizeof *table->latitude },
+    { table->longitude, rows * sizeof *table->longitude },
+    { table->cep, rows * sizeof *table->cep },
+    { table->data_offset, (rows + 1) * sizeof *table->data_offset },
+    { table->data, table->data_length },
+    { table->record_row, records * sizeof *table->record_row },
+    { table->record_offset, records * sizeof *table->record_offset },
+    { table->record_length, records },
+  };
+  for (size_t i = 0; i < sizeof columns / sizeof columns[0]; i++)
+  {
+    if (fwrite(columns[i].column, 1, columns[i].size, file) != columns[i].size)
+      return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Reads the next block into a cleared table
+ *
+ * @param table Pointer to the table, its capacity must hold the block
+ * @param file The input, after the header
+ * @return 1 when a block was read, 0 at the end of the file, -1 on a truncated or
+ *         oversized block
+ */
+int rockblock_table_read(struct rockblock_table *table, FILE *file)
+{
+  uint32_t counts[3];
+  size_t got = fread(counts, 1, sizeof counts, file);
+  if (got == 0)
+    return 0;
+  if (got != sizeof counts || counts[0] > table->capacity ||
+      counts[1] > table->capacity * ROCKBLOCK_RECORDS_PER_ROW ||
+      counts[2] > table->capacity * ROCKBLOCK_DATA_MAX)
+    return -1;
+  size_t rows = counts[0];
+  size_t records = counts[1];
+  struct
+  {
+    void *column;
+    size_t size;
+  } columns[] = {
+    { table->imei, rows * sizeof *table->imei },
+    { table->serial, rows * sizeof *table->serial },
+    { table->momsn, rows * sizeof *table->momsn },
+    { table->transmit_time, rows * sizeof *table->transmit_time },
+    { table->latitude, rows * sizeof *table->latitude },
+    { table->longitude, rows * sizeof *table->longitude },
+    { table->cep, rows * sizeof *table->cep },
+    { table->data_offset, (rows + 1) * sizeof *table->data_offset },
+    { table->data, counts[2] },
+    { table->record_row, records * sizeof *table->record_row },
+    { table->record_offset, records * sizeof *table->record_offset },
+    { table->record_length, records },
+  };
+  for (size_t i = 0; i < sizeof columns / sizeof columns[0]; i++)
+  {
+    if (fread(columns[i].column, 1, columns[i].size, file) != columns[i].size)
+      return -1;
+  }
+  table->rows = rows;
+  table->records = records;
+  table->data_length = counts[2];
+  return 1;
+}
+
+/**
+ * @brief Destroys a table
+ *
+ * @param table Double pointer to the table to destroy
+ */
+void destroy_rockblock_table(struct rockblock_table **table)
+{
+  if (*table == NULL)
+    return;
+  free((*table)->imei);
+  free((*table)->serial);
+  free((*table)->momsn);
+  free((*table)->transmit_time);
+  free((*table)->latitude);
+  free((*table)->longitude);
+  free((*table)->cep);
+  free((*table)->data_offset);
+  free((*table)->data);
+  free((*table)->record_row);
+  free((*table)->record_offset);
+  free((*table)->record_length);
+  free(*table);
+  *table = NULL;
+}
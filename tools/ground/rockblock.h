@@ -0,0 +1,244 @@
+/**
+ * @file rockblock.h
+ * @brief Bulk decoder of RockBLOCK webhook deliveries into a columnar table
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This header file provides the ground side counterpart of the driver: RockBLOCK POSTs
+ * every MO message to a webhook as a form-encoded body
+ *
+ *   imei=300434063839690&serial=1234&momsn=12&transmit_time=21-10-31%2010%3A41%3A50&
+ *   iridium_latitude=52.3867&iridium_longitude=0.2938&iridium_cep=8&data=48656c6c6f
+ *
+ * (examples/api/main.go handles one at a time). rockblock_parse() reads the fields of a
+ * body in place without copying, rockblock_hex_decode() decodes the hex data 16 characters
+ * per step with 64-bit SWAR arithmetic (a scalar table handles the tail and big-endian
+ * hosts), and rockblock_frame_split() splits the payload of a transmit window frame,
+ *
+ *   [length][record bytes][length][record bytes]...
+ *
+ * as packed by outbox_pack() on the device, back into records.
+ *
+ * A table collects decoded messages column by column and is written as one block of a
+ * columnar file, all integers in host (little-endian) byte order:
+ * @code
+ * "IRCL" <version:1 byte>                                         header
+ * <rows:u32> <records:u32> <data_length:u32>                      block, repeated
+ * imei:u64[rows] serial:u32[rows] momsn:u32[rows] transmit_time:i64[rows]
+ * latitude:f64[rows] longitude:f64[rows] cep:u32[rows] data_offset:u32[rows + 1]
+ * data:u8[data_length] record_row:u32[records] record_offset:u32[records]
+ * record_length:u8[records]
+ * @endcode
+ * data holds the decoded payloads back to back, a record points into the payload of
+ * its row. A table is not synchronized, the owner serializes access.
+ *
+ * Usage example:
+ * @code
+ * struct rockblock_table *table = newRockblockTable(4096);
+ * rockblock_write_header(file);
+ * rockblock_table_add(table, body, length, 1);
+ * rockblock_table_write(table, file);
+ * rockblock_table_clear(table);
+ * destroy_rockblock_table(&table);
+ * @endcode
+ */
+
+#ifndef ROCKBLOCK_H_INCLUDED
+#define ROCKBLOCK_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define ROCKBLOCK_MAGIC "IRCL"
+#define ROCKBLOCK_VERSION 1
+#define ROCKBLOCK_HEADER_SIZE 5
+#define ROCKBLOCK_DATA_MAX 340         /**< Largest MO payload (9603), 680 hex characters */
+
+/**
+ * @brief Outcome of adding a delivery
+ */
+enum rockblock_status
+{
+  ROCKBLOCK_OK = 0,
+  ROCKBLOCK_ERR_FIELD = -1,      /**< A field is missing or malformed */
+  ROCKBLOCK_ERR_HEX = -2,        /**< data is not an even run of hex digits or too long */
+  ROCKBLOCK_ERR_FRAME = -3,      /**< A record length runs past the payload, the row is kept */
+  ROCKBLOCK_ERR_FULL = -4,       /**< The table has no row left */
+};
+
+/**
+ * @brief A delivery, data_hex points into the parsed body
+ */
+struct rockblock_message
+{
+  uint64_t imei;
+  uint32_t serial;
+  uint32_t momsn;                /**< MO sequence number */
+  int64_t transmit_time;         /**< Gateway time, UTC seconds since 1970 */
+  double latitude;
+  double longitude;
+  uint32_t cep;                  /**< Position accuracy in km */
+  const char *data_hex;
+  size_t data_hex_length;
+};
+
+/**
+ * @brief Table statistics, running totals across clears
+ */
+struct rockblock_stats
+{
+  uint64_t messages;             /**< Rows added */
+  uint64_t records;              /**< Records split from the rows */
+  uint64_t bytes;                /**< Payload bytes decoded */
+  uint64_t field_errors;
+  uint64_t hex_errors;
+  uint64_t frame_errors;
+};
+
+/**
+ * @brief Columnar table of decoded deliveries
+ */
+struct rockblock_table
+{
+  size_t rows;
+  size_t capacity;               /**< Rows before the table is full */
+  uint64_t *imei;
+  uint32_t *serial;
+  uint32_t *momsn;
+  int64_t *transmit_time;
+  double *latitude;
+  double *longitude;
+  uint32_t *cep;
+  uint32_t *data_offset;         /**< Start of a row's payload in data, rows + 1 entries */
+  uint8_t *data;                 /**< Payloads back to back, capacity * ROCKBLOCK_DATA_MAX bytes */
+  size_t data_length;
+  size_t records;
+  uint32_t *record_row;          /**< Row of a record */
+  uint32_t *record_offset;       /**< Start of a record in data */
+  uint8_t *record_length;
+  struct rockblock_stats stats;  /**< Statistics */
+};
+
+/**
+ * @brief Reads the fields of a form-encoded webhook body
+ *
+ * @param body The body, it must outlive the message (data_hex points into it)
+ * @param length Length of the body
+ * @param message Pointer to the message to fill
+ * @return ROCKBLOCK_OK, or ROCKBLOCK_ERR_FIELD if imei, momsn or data is missing or a
+ *         numeric field does not parse, unknown fields are ignored
+ */
+int rockblock_parse(const char *body, size_t length, struct rockblock_message *message);
+
+/**
+ * @brief Decodes hex digits, either case
+ *
+ * @param hex The digits
+ * @param length Number of digits, even
+ * @param out Buffer of length / 2 bytes
+ * @return The number of bytes, or -1 on an odd length or a character that is not a digit
+ */
+long rockblock_hex_decode(const char *hex, size_t length, uint8_t *out);
+
+/**
+ * @brief Reference decoder of rockblock_hex_decode(), one character at a time
+ *
+ * @param hex The digits
+ * @param length Number of digits, even
+ * @param out Buffer of length / 2 bytes
+ * @return The number of bytes, or -1 on an odd length or a character that is not a digit
+ */
+long rockblock_hex_decode_scalar(const char *hex, size_t length, uint8_t *out);
+
+/**
+ * @brief Splits a frame packed by outbox_pack() into records
+ *
+ * @param frame The payload
+ * @param length Length of the payload
+ * @param offsets Filled with the start of every record in the frame, can be NULL
+ * @param max Size of offsets, the count is exact even when it is exceeded
+ * @return The number of records, or -1 if a length runs past the frame or is 0
+ */
+long rockblock_frame_split(const uint8_t *frame, size_t length, uint32_t *offsets, size_t max);
+
+/**
+ * @brief Creates a new empty table
+ *
+ * @param capacity Number of rows, every row reserves ROCKBLOCK_DATA_MAX bytes of payload
+ * @return Pointer to the newly created table, or NULL if allocation failed
+ *
+ * @note The caller is responsible for destroying the table
+ */
+struct rockblock_table *newRockblockTable(size_t capacity);
+
+/**
+ * @brief Parses, decodes and appends a delivery
+ *
+ * @param table Pointer to the table
+ * @param body The form-encoded webhook body
+ * @param length Length of the body
+ * @param records Non-zero to split the payload into outbox records
+ * @return ROCKBLOCK_OK, ROCKBLOCK_ERR_FRAME when the row was added without records, or
+ *         ROCKBLOCK_ERR_FIELD, ROCKBLOCK_ERR_HEX, ROCKBLOCK_ERR_FULL when it was not
+ */
+int rockblock_table_add(struct rockblock_table *table, const char *body, size_t length, int records);
+
+/**
+ * @brief Empties a table, the statistics are kept
+ *
+ * @param table Pointer to the table
+ */
+void rockblock_table_clear(struct rockblock_table *table);
+
+/**
+ * @brief Writes the file header
+ *
+ * @param file The output
+ * @return 0 on success, -1 on a write error
+ */
+int rockblock_write_header(FILE *file);
+
+/**
+ * @brief Checks the file header
+ *
+ * @param file The input
+ * @return 0 on success, -1 if the magic or version does not match
+ */
+int rockblock_read_header(FILE *file);
+
+/**
+ * @brief Writes the rows of a table as one block
+ *
+ * @param table Pointer to the table
+ * @param file The output, after the header
+ * @return 0 on success, -1 on a write error
+ */
+int rockblock_table_write(const struct rockblock_table *table, FILE *file);
+
+/**
+ * @brief Reads the next block into a cleared table
+ *
+ * @param table Pointer to the table, its capacity must hold the block
+ * @param file The input, after the header
+ * @return 1 when a block was read, 0 at the end of the file, -1 on a truncated or
+ *         oversized block
+ */
+int rockblock_table_read(struct rockblock_table *table, FILE *file);
+
+/**
+ * @brief Destroys a table
+ *
+ * @param table Double pointer to the table to destroy
+ */
+void destroy_rockblock_table(struct rockblock_table **table);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ROCKBLOCK_H_INCLUDED */
@@ -0,0 +1,455 @@
+/**
+ * @file host_modem.c
+ * @brief Implementation of the simulated modem declared in host_modem.h
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_port.h"
+#include "host_modem.h"
+#include "driver/gpio.h"
+
+static void host_modem_reply(struct host_modem *modem, const char *text)
+{
+  host_uart_inject(modem->port, (const uint8_t *)text, strlen(text));
+}
+
+static void host_modem_sleep(struct host_modem *modem, uint32_t ms)
+{
+  if (ms > 0)
+    modem->clock->sleep_us(modem->clock, (uint64_t)ms * 1000);
+}
+
+/**
+ * @brief Driver writes, runs on the driver task, only buffers
+ */
+static void host_modem_tx(void *ctx, int port, const uint8_t *data, size_t length)
+{
+  struct host_modem *modem = ctx;
+  (void)port;
+  pthread_mutex_lock(&modem->mutex);
+  size_t room = sizeof modem->input - modem->input_length;
+  size_t n = length < room ? length : room;
+  memcpy(modem->input + modem->input_length, data, n);
+  modem->input_length += n;
+  pthread_cond_broadcast(&modem->input_ready);
+  pthread_mutex_unlock(&modem->mutex);
+}
+
+/**
+ * @brief +SBDIX/+SBDIXA, the MO buffer goes out and one MT message comes in
+ */
+static void host_modem_session(struct host_modem *modem, char *response, size_t size)
+{
+  host_modem_sleep(modem, modem->session_ms);
+
+  pthread_mutex_lock(&modem->mutex);
+  modem->sessions++;
+  if (modem->fail_sessions > 0 || modem->csq == 0)
+  {
+    if (modem->fail_sessions > 0)
+      modem->fail_sessions--;
+    modem->sessions_failed++;
+    snprintf(response, size, "+SBDIX: %d, %u, 2, %u, 0, 0\r\n\r\nOK\r\n", 
+             modem->csq == 0 ? 32 : modem->fail_status, (unsigned)modem->momsn, (unsigned)modem->mtmsn);
+    pthread_mutex_unlock(&modem->mutex);
+    return;
+  }
+
+  /* the system time comes with the first satellite contact */
+  modem->network_time = 1;
+  uint8_t mo[HOST_MODEM_SBD_MAX];
+  size_t mo_length = modem->mo_length;
+  if (mo_length > 0)
+  {
+    modem->momsn++;
+    modem->delivered++;
+    memcpy(mo, modem->mo, mo_length);
+  }
+  void (*deliver)(void *, const uint8_t *, size_t) = modem->deliver;
+  void *deliver_ctx = modem->deliver_ctx;
+  int mt_status = 0;
+  size_t mt_length = 0;
+  if (modem->mt_count > 0)
+  {
+    snprintf(modem->mt, sizeof modem->mt, "%s", modem->mt_queue[modem->mt_head]);
+    modem->mt_head = (modem->mt_head + 1) % HOST_MODEM_MT_MAX;
+    modem->mt_count--;
+    modem->mtmsn++;
+    mt_status = 1;
+    mt_length = strlen(modem->mt);
+  }
+  snprintf(response, size, "+SBDIX: 0, %u, %d, %u, %zu, %d\r\n\r\nOK\r\n", 
+           (unsigned)modem->momsn, mt_status, (unsigned)modem->mtmsn, mt_length, modem->mt_count);
+  pthread_mutex_unlock(&modem->mutex);
+
+  /* the backend sees the message once the session is over, its answer goes out with a later one */
+  if (deliver != NULL && mo_length > 0)
+    deliver(deliver_ctx, mo, mo_length);
+}
+
+/**
+ * @brief Whether a command would be answered, tracks power cycles of the SLP pin
+ */
+static int host_modem_ready(struct host_modem *modem)
+{
+  if (modem->sleep_pin < 0)
+    return 1;
+  if (!gpio_get_level(modem->sleep_pin))
+    return 0;
+  uint64_t now = modem->clock->now_us(modem->clock);
+  uint32_t changes = host_gpio_changes(modem->sleep_pin);
+  if (changes != modem->pin_changes)
+  {
+    /* power cycled since the last command, boot counts from the first command after it */
+    modem->pin_changes = changes;
+    modem->powered_us = now;
+    modem->boots++;
+    modem->echo = 1;
+    pthread_mutex_lock(&modem->mutex);
+    modem->mo_length = 0;
+    pthread_mutex_unlock(&modem->mutex);
+  }
+  return now - modem->powered_us >= (uint64_t)modem->boot_ms * 1000;
+}
+
+/**
+ * @brief Answers one command line
+ */
+static void host_modem_command(struct host_modem *modem, const char *line)
+{
+  char response[HOST_MODEM_LINE_MAX + 64];
+  response[0] = '\0';
+
+  host_modem_sleep(modem, modem->response_ms);
+  if (modem->echo)
+  {
+    char echo[HOST_MODEM_LINE_MAX + 2];
+    snprintf(echo, sizeof echo, "%s\r", line);
+    host_modem_reply(modem, echo);
+  }
+
+  if (strcmp(line, "AT") == 0 || strcmp(line, "AT&w0") == 0 || strcmp(line, "AT&K0") == 0 || 
+      strncmp(line, "AT+CIER=", 8) == 0)
+  {
+    snprintf(response, sizeof response, "\r\nOK\r\n");
+  }
+  else if (strncmp(line, "AT+SBDMTA=", 10) == 0)
+  {
+    modem->ring_alert = atoi(line + 10) != 0;
+    snprintf(response, sizeof response, "\r\nOK\r\n");
+  }
+  else if (strcmp(line, "AT+SBDMTA?") == 0)
+  {
+    snprintf(response, sizeof response, "\r\n+SBDMTA:%d\r\n\r\nOK\r\n", modem->ring_alert);
+  }
+  else if (strncmp(line, "ATE", 3) == 0)
+  {
+    modem->echo = atoi(line + 3) != 0;
+    snprintf(response, sizeof response, "\r\nOK\r\n");
+  }
+  else if (strcmp(line, "AT+CSQ") == 0)
+  {
+    snprintf(response, sizeof response, "\r\n+CSQ:%d\r\n\r\nOK\r\n", modem->csq);
+  }
+  else if (strcmp(line, "AT+CGMI") == 0)
+  {
+    snprintf(response, sizeof response, "\r\nIridium\r\n\r\nOK\r\n");
+  }
+  else if (strcmp(line, "AT+CGMM") == 0)
+  {
+    snprintf(response, sizeof response, "\r\nIRIDIUM 9600 Family SBD Transceiver\r\n\r\nOK\r\n");
+  }
+  else if (strcmp(line, "AT+CRIS") == 0)
+  {
+    snprintf(response, sizeof response, "\r\n+CRIS: 000,%03d\r\n\r\nOK\r\n", modem->mt_count > 0 ? 2 : 0);
+  }
+  else if (strcmp(line, "AT-MSSTM") == 0)
+  {
+    uint64_t ticks = modem->clock->now_us(modem->clock) / 90000;
+    if (modem->network_time)
+      snprintf(response, sizeof response, "\r\n-MSSTM: %08llx\r\n\r\nOK\r\n", (unsigned long long)ticks);
+    else
+      snprintf(response, sizeof response, "\r\n-MSSTM: no network service\r\n\r\nOK\r\n");
+  }
+  else if (strcmp(line, "AT+SBDSX") == 0)
+  {
+    pthread_mutex_lock(&modem->mutex);
+    snprintf(response, sizeof response, "\r\n+SBDSX: %d, %u, 0, %u, %d, %d\r\n\r\nOK\r\n", 
+             modem->mo_length > 0, (unsigned)modem->momsn, (unsigned)modem->mtmsn, 0, modem->mt_count);
+    pthread_mutex_unlock(&modem->mutex);
+  }
+  else if (strncmp(line, "AT+SBDWT=", 9) == 0)
+  {
+    /* the modem refuses a text longer than its MO buffer rather than cutting it */
+    size_t length = strlen(line + 9);
+    if (length >= sizeof modem->mo)
+      snprintf(response, sizeof response, "\r\nERROR\r\n");
+    else
+    {
+      pthread_mutex_lock(&modem->mutex);
+      memcpy(modem->mo, line + 9, length + 1);
+      modem->mo_length = length;
+      pthread_mutex_unlock(&modem->mutex);
+      snprintf(response, sizeof response, "\r\nOK\r\n");
+    }
+  }
+  else if (strncmp(line, "AT+SBDD", 7) == 0)
+  {
+    /* 0 clears the MO buffer, 1 the MT buffer, 2 both */
+    int buffers = atoi(line + 7);
+    pthread_mutex_lock(&modem->mutex);
+    if (buffers == 0 || buffers == 2)
+      modem->mo_length = 0;
+    if (buffers == 1 || buffers == 2)
+      modem->mt[0] = '\0';
+    pthread_mutex_unlock(&modem->mutex);
+    snprintf(response, sizeof response, "\r\n0\r\n\r\nOK\r\n");
+  }
+  else if (strncmp(line, "AT+SBDWB=", 9) == 0)
+  {
+    int length = atoi(line + 9);
+    if (length < 1 || length > HOST_MODEM_SBD_MAX)
+    {
+      snprintf(response, sizeof response, "\r\n3\r\n\r\nOK\r\n");
+    }
+    else
+    {
+      modem->binary_expected = (size_t)length + 2;
+      modem->binary_length = 0;
+      snprintf(response, sizeof response, "\r\nREADY\r\n");
+    }
+  }
+  else if (strcmp(line, "AT+SBDIX") == 0 || strcmp(line, "AT+SBDIXA") == 0)
+  {
+    char session[128];
+    host_modem_session(modem, session, sizeof session);
+    snprintf(response, sizeof response, "\r\n%s", session);
+  }
+  else if (strcmp(line, "AT+SBDRT") == 0)
+  {
+    pthread_mutex_lock(&modem->mutex);
+    snprintf(response, sizeof response, "\r\n+SBDRT:\r\n%s\r\nOK\r\n", modem->mt);
+    pthread_mutex_unlock(&modem->mutex);
+  }
+  else
+  {
+    snprintf(response, sizeof response, "\r\nERROR\r\n");
+  }
+
+  modem->commands++;
+  host_modem_reply(modem, response);
+}
+
+/**
+ * @brief Checks a complete +SBDWB payload and its checksum
+ */
+static void host_modem_binary(struct host_modem *modem)
+{
+  size_t length = modem->binary_length - 2;
+  uint16_t checksum = 0;
+  for (size_t i = 0; i < length; i++)
+    checksum += modem->binary[i];
+  int ok = checksum == (uint16_t)(modem->binary[length] << 8 | modem->binary[length + 1]);
+  if (ok)
+  {
+    pthread_mutex_lock(&modem->mutex);
+    memcpy(modem->mo, modem->binary, length);
+    modem->mo_length = length;
+    pthread_mutex_unlock(&modem->mutex);
+  }
+  modem->binary_expected = 0;
+  host_modem_reply(modem, ok ? "\r\n0\r\n\r\nOK\r\n" : "\r\n2\r\n\r\nOK\r\n");
+}
+
+static void *host_modem_main(void *arg)
+{
+  struct host_modem *modem = arg;
+  char line[HOST_MODEM_LINE_MAX];
+  size_t line_length = 0;
+
+  pthread_mutex_lock(&modem->mutex);
+  while (modem->running)
+  {
+    if (modem->input_length == 0)
+    {
+      pthread_cond_wait(&modem->input_ready, &modem->mutex);
+      continue;
+    }
+    uint8_t input[sizeof modem->input];
+    size_t length = modem->input_length;
+    memcpy(input, modem->input, length);
+    modem->input_length = 0;
+    pthread_mutex_unlock(&modem->mutex);
+
+    for (size_t i = 0; i < length; i++)
+    {
+      if (modem->binary_expected > 0)
+      {
+        modem->binary[modem->binary_length++] = input[i];
+        if (modem->binary_length == modem->binary_expected)
+          host_modem_binary(modem);
+        continue;
+      }
+      if (input[i] == '\r')
+      {
+        line[line_length] = '\0';
+        if (line_length > 0 && host_modem_ready(modem))
+          host_modem_command(modem, line);
+        line_length = 0;
+      }
+      else if (input[i] != '\n' && line_length < sizeof line - 1)
+      {
+        line[line_length++] = (char)input[i];
+      }
+    }
+    pthread_mutex_lock(&modem->mutex);
+  }
+  pthread_mutex_unlock(&modem->mutex);
+  return NULL;
+}
+
+/**
+ * @brief Starts the modem and attaches it to a host port UART
+ *
+ * @param modem Pointer to the modem
+ * @param port The host port UART the driver uses
+ * @param clock The clock of the driver
+ * @return 0 on success, -1 if the thread could not start
+ */
+int host_modem_init(struct host_modem *modem, int port, const struct vclock_t *clock)
+{
+  memset(modem, 0, sizeof *modem);
+  modem->port = port;
+  modem->clock = clock;
+  modem->response_ms = 20;
+  modem->session_ms = 8000;
+  modem->echo = 1;
+  modem->csq = 4;
+  modem->fail_status = 32;
+  modem->sleep_pin = -1;
+  modem->running = 1;
+  pthread_mutex_init(&modem->mutex, NULL);
+  pthread_cond_init(&modem->input_ready, NULL);
+  if (pthread_create(&modem->thread, NULL, host_modem_main, modem) != 0)
+    return -1;
+  host_uart_set_tx(port, host_modem_tx, modem);
+  return 0;
+}
+
+/**
+ * @brief Fails the next sessions
+ *
+ * @param modem Pointer to the modem
+ * @param count Number of sessions to fail
+ * @param mo_status The <MO status> they report
+ */
+void host_modem_fail_sessions(struct host_modem *modem, int count, int mo_status)
+{
+  pthread_mutex_lock(&modem->mutex);
+  modem->fail_sessions = count;
+  modem->fail_status = mo_status;
+  pthread_mutex_unlock(&modem->mutex);
+}
+
+/**
+ * @brief Queues an MT message at the gateway
+ *
+ * @param modem Pointer to the modem
+ * @param text The message
+ * @return 0 on success, -1 if the queue is full
+ */
+int host_modem_queue_mt(struct host_modem *modem, const char *text)
+{
+  pthread_mutex_lock(&modem->mutex);
+  if (modem->mt_count == HOST_MODEM_MT_MAX)
+  {
+    pthread_mutex_unlock(&modem->mutex);
+    return -1;
+  }
+  int tail = (modem->mt_head + modem->mt_count) % HOST_MODEM_MT_MAX;
+  snprintf(modem->mt_queue[tail], sizeof modem->mt_queue[tail], "%s", text);
+  modem->mt_count++;
+  pthread_mutex_unlock(&modem->mutex);
+  return 0;
+}
+
+/**
+ * @brief Sends an SBDRING unsolicited result code
+ *
+ * @param modem Pointer to the modem
+ */
+void host_modem_ring(struct host_modem *modem)
+{
+  host_modem_reply(modem, "SBDRING\r\n");
+}
+
+/**
+ * @brief Loses MT messages at the gateway, the next queued message comes with a higher MTMSN
+ *
+ * @param modem Pointer to the modem
+ * @param count Number of MTMSNs skipped
+ */
+void host_modem_skip_mt(struct host_modem *modem, int count)
+{
+  pthread_mutex_lock(&modem->mutex);
+  modem->mtmsn += count;
+  pthread_mutex_unlock(&modem->mutex);
+}
+
+/**
+ * @brief Hands every MO message delivered to the gateway to a backend
+ *
+ * @param modem Pointer to the modem
+ * @param deliver The backend, NULL to stop
+ * @param ctx Passed to the callback
+ */
+void host_modem_set_delivery(struct host_modem *modem, void (*deliver)(void *ctx, const uint8_t *data, size_t length),
+                             void *ctx)
+{
+  pthread_mutex_lock(&modem->mutex);
+  modem->deliver = deliver;
+  modem->deliver_ctx = ctx;
+  pthread_mutex_unlock(&modem->mutex);
+}
+
+/**
+ * @brief Powers the modem from the SLP pin, off while the pin is low
+ *
+ * @param modem Pointer to the modem
+ * @param sleep_pin The SLP pin, -1 for always on
+ * @param boot_ms Time from power on to the first answer
+ */
+void host_modem_power(struct host_modem *modem, int sleep_pin, uint32_t boot_ms)
+{
+  pthread_mutex_lock(&modem->mutex);
+  modem->sleep_pin = sleep_pin;
+  modem->boot_ms = boot_ms;
+  /* already running counts as booted */
+  modem->pin_changes = sleep_pin >= 0 ? host_gpio_changes(sleep_pin) : 0;
+  modem->powered_us = 0;
+  pthread_mutex_unlock(&modem->mutex);
+}
+
+/**
+ * @brief Stops the modem thread and detaches it from the UART
+ *
+ * @param modem Pointer to the modem
+ */
+void host_modem_stop(struct host_modem *modem)
+{
+  host_uart_set_tx(modem->port, NULL, NULL);
+  pthread_mutex_lock(&modem->mutex);
+  modem->running = 0;
+  pthread_cond_broadcast(&modem->input_ready);
+  pthread_mutex_unlock(&modem->mutex);
+  pthread_join(modem->thread, NULL);
+  pthread_mutex_destroy(&modem->mutex);
+  pthread_cond_destroy(&modem->input_ready);
+}
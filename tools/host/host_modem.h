@@ -0,0 +1,164 @@
+/**
+ * @file host_modem.h
+ * @brief A simulated Iridium 9602/9603 modem on a host port UART
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * Answers the AT commands the driver writes on a host port UART with the responses
+ * of a real modem, from its own thread and on the given clock, so +SBDIX sessions
+ * take their airtime in virtual time. Signal, session outcomes and the MT queue at
+ * the gateway are scripted by the scenario.
+ *
+ * Usage example:
+ * @code
+ * struct host_modem modem;
+ * host_modem_init(&modem, UART_NUM_1, &sim.clock);
+ * host_modem_fail_sessions(&modem, 3, MO_NO_NETWORK_SERVICE);
+ * host_modem_queue_mt(&modem, "hello");
+ * host_modem_ring(&modem);
+ * host_modem_set_delivery(&modem, &ground_receive, &ground);
+ * @endcode
+ */
+
+#ifndef HOST_MODEM_H_INCLUDED
+#define HOST_MODEM_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "../../vclock.h"
+
+#define HOST_MODEM_MT_MAX 16
+#define HOST_MODEM_LINE_MAX 512
+#define HOST_MODEM_SBD_MAX 340
+
+/**
+ * @brief Simulated modem state
+ */
+struct host_modem
+{
+  int port;                                     /**< Host port UART */
+  const struct vclock_t *clock;                 /**< Time of responses and sessions */
+  uint32_t response_ms;                         /**< Latency of a plain command */
+  uint32_t session_ms;                          /**< Airtime of a +SBDIX session */
+  int echo;                                     /**< ATE state */
+  int csq;                                      /**< Signal 0-5 */
+  int fail_sessions;                            /**< Sessions still to fail */
+  int fail_status;                              /**< <MO status> of a failed session */
+  int network_time;                             /**< System time received, -MSSTM has no service before */
+  int ring_alert;                               /**< +SBDMTA mode */
+  uint32_t momsn;                               /**< MO sequence number */
+  uint32_t mtmsn;                               /**< MT sequence number */
+  char mo[HOST_MODEM_SBD_MAX + 1];              /**< MO buffer */
+  size_t mo_length;
+  char mt[HOST_MODEM_SBD_MAX + 1];              /**< MT buffer */
+  char mt_queue[HOST_MODEM_MT_MAX][HOST_MODEM_SBD_MAX + 1];  /**< MT messages at the gateway */
+  int mt_head;
+  int mt_count;
+  size_t binary_expected;                       /**< +SBDWB bytes still expected, 0 in command mode */
+  uint8_t binary[HOST_MODEM_SBD_MAX + 2];
+  size_t binary_length;
+  uint8_t input[HOST_MODEM_LINE_MAX * 4];       /**< Bytes written by the driver */
+  size_t input_length;
+  uint32_t commands;                            /**< Commands answered */
+  uint32_t sessions;                            /**< +SBDIX/+SBDIXA sessions */
+  uint32_t sessions_failed;
+  uint32_t delivered;                           /**< MO messages delivered to the gateway */
+  void (*deliver)(void *ctx, const uint8_t *data, size_t length);  /**< Gateway to backend, NULL when off */
+  void *deliver_ctx;
+  int sleep_pin;                                /**< SLP pin, -1 when always on */
+  uint32_t boot_ms;                             /**< Power on to the first answer */
+  uint32_t pin_changes;                         /**< SLP level changes seen so far */
+  uint64_t powered_us;                          /**< First command seen after power on */
+  uint32_t boots;
+  int running;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t input_ready;
+};
+
+/**
+ * @brief Starts the modem and attaches it to a host port UART
+ *
+ * @param modem Pointer to the modem
+ * @param port The host port UART the driver uses
+ * @param clock The clock of the driver
+ * @return 0 on success, -1 if the thread could not start
+ */
+int host_modem_init(struct host_modem *modem, int port, const struct vclock_t *clock);
+
+/**
+ * @brief Fails the next sessions
+ *
+ * @param modem Pointer to the modem
+ * @param count Number of sessions to fail
+ * @param mo_status The <MO status> they report
+ */
+void host_modem_fail_sessions(struct host_modem *modem, int count, int mo_status);
+
+/**
+ * @brief Queues an MT message at the gateway
+ *
+ * @param modem Pointer to the modem
+ * @param text The message
+ * @return 0 on success, -1 if the queue is full
+ */
+int host_modem_queue_mt(struct host_modem *modem, const char *text);
+
+/**
+ * @brief Hands every MO message delivered to the gateway to a backend
+ *
+ * The callback runs on the modem thread after the session, without the modem mutex,
+ * so it can queue MT messages and ring.
+ *
+ * @param modem Pointer to the modem
+ * @param deliver The backend, NULL to stop
+ * @param ctx Passed to the callback
+ */
+void host_modem_set_delivery(struct host_modem *modem, void (*deliver)(void *ctx, const uint8_t *data, size_t length),
+                             void *ctx);
+
+/**
+ * @brief Loses MT messages at the gateway, the next queued message comes with a higher MTMSN
+ *
+ * @param modem Pointer to the modem
+ * @param count Number of MTMSNs skipped
+ */
+void host_modem_skip_mt(struct host_modem *modem, int count);
+
+/**
+ * @brief Sends an SBDRING unsolicited result code
+ *
+ * @param modem Pointer to the modem
+ */
+void host_modem_ring(struct host_modem *modem);
+
+/**
+ * @brief Powers the modem from the SLP pin, off while the pin is low
+ *
+ * Commands are dropped while the modem is off and for boot_ms after it is powered
+ * on, and a power cycle resets the echo and clears the MO buffer.
+ *
+ * @param modem Pointer to the modem
+ * @param sleep_pin The SLP pin, -1 for always on
+ * @param boot_ms Time from power on to the first answer
+ */
+void host_modem_power(struct host_modem *modem, int sleep_pin, uint32_t boot_ms);
+
+/**
+ * @brief Stops the modem thread and detaches it from the UART
+ *
+ * @param modem Pointer to the modem
+ */
+void host_modem_stop(struct host_modem *modem);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_MODEM_H_INCLUDED */
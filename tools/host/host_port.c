@@ -0,0 +1,591 @@
+/**
+ * @file host_port.c
+ * @brief Implementation of the host port declared in host_port.h
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "host_port.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "driver/uart.h"
+#include "driver/gpio.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "nvs.h"
+
+esp_log_level_t host_log_level = ESP_LOG_WARN;
+
+/*
+    Time
+*/
+static uint64_t host_monotonic_us(void)
+{
+  static uint64_t start_us = 0;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t us = (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+  if (start_us == 0)
+    start_us = us;
+  return us - start_us;
+}
+
+int64_t esp_timer_get_time(void)
+{
+  return (int64_t)host_monotonic_us();
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+  return (TickType_t)(host_monotonic_us() / 1000u / portTICK_PERIOD_MS);
+}
+
+/**
+ * @brief Absolute CLOCK_REALTIME deadline for a pthread timed wait
+ */
+static struct timespec host_deadline(TickType_t ticks)
+{
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  uint64_t ns = (uint64_t)ticks * portTICK_PERIOD_MS * 1000000u + (uint64_t)deadline.tv_nsec;
+  deadline.tv_sec += ns / 1000000000u;
+  deadline.tv_nsec = ns % 1000000000u;
+  return deadline;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  struct timespec delay = { .tv_sec = (ticks * portTICK_PERIOD_MS) / 1000, 
+                            .tv_nsec = (long)((ticks * portTICK_PERIOD_MS) % 1000) * 1000000L };
+  while (nanosleep(&delay, &delay) != 0 && errno == EINTR)
+    ;
+}
+
+/*
+    Tasks
+*/
+struct host_task
+{
+  pthread_t thread;
+  TaskFunction_t function;
+  void *parameters;
+};
+
+static void *host_task_main(void *arg)
+{
+  struct host_task *task = arg;
+  task->function(task->parameters);
+  return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters, 
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+  (void)name;
+  (void)stack_depth;
+  (void)priority;
+  struct host_task *task = calloc(1, sizeof *task);
+  if (task == NULL)
+    return pdFAIL;
+  task->function = function;
+  task->parameters = parameters;
+  if (pthread_create(&task->thread, NULL, host_task_main, task) != 0)
+  {
+    free(task);
+    return pdFAIL;
+  }
+  pthread_detach(task->thread);
+  if (handle)
+    *handle = task;
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+  if (task == NULL)
+    pthread_exit(NULL);
+  /* other tasks run until the process exits */
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+  (void)task;
+  return 0;
+}
+
+/*
+    Queues
+*/
+struct host_queue
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t changed;
+  uint8_t *items;
+  size_t item_size;
+  size_t capacity;
+  size_t head;
+  size_t count;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+  struct host_queue *queue = calloc(1, sizeof *queue);
+  if (queue == NULL)
+    return NULL;
+  queue->items = malloc((size_t)length * item_size);
+  if (queue->items == NULL)
+  {
+    free(queue);
+    return NULL;
+  }
+  queue->item_size = item_size;
+  queue->capacity = length;
+  pthread_mutex_init(&queue->mutex, NULL);
+  pthread_cond_init(&queue->changed, NULL);
+  return queue;
+}
+
+/**
+ * @brief Waits for a queue condition, forever for portMAX_DELAY
+ *
+ * @return 0 when woken, ETIMEDOUT when the wait expired
+ */
+static int host_queue_wait(struct host_queue *queue, TickType_t wait, const struct timespec *deadline)
+{
+  if (wait == portMAX_DELAY)
+    return pthread_cond_wait(&queue->changed, &queue->mutex);
+  return pthread_cond_timedwait(&queue->changed, &queue->mutex, deadline);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+  struct timespec deadline = host_deadline(wait == portMAX_DELAY ? 0 : wait);
+  pthread_mutex_lock(&queue->mutex);
+  while (queue->count == queue->capacity)
+  {
+    if (wait == 0 || host_queue_wait(queue, wait, &deadline) == ETIMEDOUT)
+    {
+      pthread_mutex_unlock(&queue->mutex);
+      return pdFALSE;
+    }
+  }
+  memcpy(queue->items + ((queue->head + queue->count) % queue->capacity) * queue->item_size, item, queue->item_size);
+  queue->count++;
+  pthread_cond_broadcast(&queue->changed);
+  pthread_mutex_unlock(&queue->mutex);
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+  struct timespec deadline = host_deadline(wait == portMAX_DELAY ? 0 : wait);
+  pthread_mutex_lock(&queue->mutex);
+  while (queue->count == 0)
+  {
+    if (wait == 0 || host_queue_wait(queue, wait, &deadline) == ETIMEDOUT)
+    {
+      pthread_mutex_unlock(&queue->mutex);
+      return pdFALSE;
+    }
+  }
+  memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+  queue->head = (queue->head + 1) % queue->capacity;
+  queue->count--;
+  pthread_cond_broadcast(&queue->changed);
+  pthread_mutex_unlock(&queue->mutex);
+  return pdTRUE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+  pthread_mutex_lock(&queue->mutex);
+  queue->head = 0;
+  queue->count = 0;
+  pthread_cond_broadcast(&queue->changed);
+  pthread_mutex_unlock(&queue->mutex);
+  return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+  pthread_mutex_lock(&queue->mutex);
+  UBaseType_t count = (UBaseType_t)queue->count;
+  pthread_mutex_unlock(&queue->mutex);
+  return count;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+  if (queue == NULL)
+    return;
+  pthread_mutex_destroy(&queue->mutex);
+  pthread_cond_destroy(&queue->changed);
+  free(queue->items);
+  free(queue);
+}
+
+/*
+    UART
+*/
+struct host_uart
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t readable;
+  uint8_t *rx;
+  size_t rx_capacity;
+  size_t rx_head;
+  size_t rx_count;
+  QueueHandle_t events;
+  host_uart_tx_t tx;
+  void *tx_ctx;
+};
+
+static struct host_uart host_uarts[UART_NUM_MAX] = {
+  [0 ... UART_NUM_MAX - 1] = { .mutex = PTHREAD_MUTEX_INITIALIZER, .readable = PTHREAD_COND_INITIALIZER }
+};
+
+esp_err_t uart_driver_install(uart_port_t port, int rx_buffer_size, int tx_buffer_size, int queue_size, 
+                              QueueHandle_t *queue, int intr_alloc_flags)
+{
+  (void)tx_buffer_size;
+  (void)intr_alloc_flags;
+  if (port < 0 || port >= UART_NUM_MAX || rx_buffer_size <= 0)
+    return ESP_ERR_INVALID_ARG;
+  struct host_uart *uart = &host_uarts[port];
+  pthread_mutex_lock(&uart->mutex);
+  free(uart->rx);
+  uart->rx = malloc(rx_buffer_size);
+  uart->rx_capacity = rx_buffer_size;
+  uart->rx_head = 0;
+  uart->rx_count = 0;
+  uart->events = (queue != NULL && queue_size > 0) ? xQueueCreate(queue_size, sizeof(uart_event_t)) : NULL;
+  if (queue)
+    *queue = uart->events;
+  pthread_mutex_unlock(&uart->mutex);
+  return uart->rx == NULL ? ESP_ERR_NO_MEM : ESP_OK;
+}
+
+esp_err_t uart_driver_delete(uart_port_t port)
+{
+  if (port < 0 || port >= UART_NUM_MAX)
+    return ESP_ERR_INVALID_ARG;
+  struct host_uart *uart = &host_uarts[port];
+  pthread_mutex_lock(&uart->mutex);
+  free(uart->rx);
+  uart->rx = NULL;
+  uart->rx_capacity = 0;
+  uart->rx_count = 0;
+  pthread_mutex_unlock(&uart->mutex);
+  return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *config)
+{
+  (void)config;
+  return (port >= 0 && port < UART_NUM_MAX) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t uart_set_pin(uart_port_t port, int tx, int rx, int rts, int cts)
+{
+  (void)tx;
+  (void)rx;
+  (void)rts;
+  (void)cts;
+  return (port >= 0 && port < UART_NUM_MAX) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+int uart_write_bytes(uart_port_t port, const void *data, size_t size)
+{
+  if (port < 0 || port >= UART_NUM_MAX)
+    return -1;
+  struct host_uart *uart = &host_uarts[port];
+  pthread_mutex_lock(&uart->mutex);
+  host_uart_tx_t tx = uart->tx;
+  void *ctx = uart->tx_ctx;
+  pthread_mutex_unlock(&uart->mutex);
+  if (tx)
+    tx(ctx, port, data, size);
+  return (int)size;
+}
+
+int uart_read_bytes(uart_port_t port, void *buffer, uint32_t length, TickType_t wait)
+{
+  if (port < 0 || port >= UART_NUM_MAX)
+    return -1;
+  struct host_uart *uart = &host_uarts[port];
+  struct timespec deadline = host_deadline(wait == portMAX_DELAY ? 0 : wait);
+  pthread_mutex_lock(&uart->mutex);
+  while (uart->rx_count == 0 && wait != 0)
+  {
+    int rc = (wait == portMAX_DELAY) ? pthread_cond_wait(&uart->readable, &uart->mutex) 
+                                     : pthread_cond_timedwait(&uart->readable, &uart->mutex, &deadline);
+    if (rc == ETIMEDOUT)
+      break;
+  }
+  size_t n = uart->rx_count < length ? uart->rx_count : length;
+  for (size_t i = 0; i < n; i++)
+  {
+    ((uint8_t *)buffer)[i] = uart->rx[uart->rx_head];
+    uart->rx_head = (uart->rx_head + 1) % uart->rx_capacity;
+  }
+  uart->rx_count -= n;
+  pthread_mutex_unlock(&uart->mutex);
+  return (int)n;
+}
+
+esp_err_t uart_flush_input(uart_port_t port)
+{
+  if (port < 0 || port >= UART_NUM_MAX)
+    return ESP_ERR_INVALID_ARG;
+  struct host_uart *uart = &host_uarts[port];
+  pthread_mutex_lock(&uart->mutex);
+  uart->rx_head = 0;
+  uart->rx_count = 0;
+  pthread_mutex_unlock(&uart->mutex);
+  return ESP_OK;
+}
+
+esp_err_t uart_wait_tx_done(uart_port_t port, TickType_t wait)
+{
+  (void)wait;
+  return (port >= 0 && port < UART_NUM_MAX) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+void host_uart_set_tx(int port, host_uart_tx_t tx, void *ctx)
+{
+  if (port < 0 || port >= UART_NUM_MAX)
+    return;
+  struct host_uart *uart = &host_uarts[port];
+  pthread_mutex_lock(&uart->mutex);
+  uart->tx = tx;
+  uart->tx_ctx = ctx;
+  pthread_mutex_unlock(&uart->mutex);
+}
+
+int host_uart_inject(int port, const uint8_t *data, size_t length)
+{
+  if (port < 0 || port >= UART_NUM_MAX || length == 0)
+    return -1;
+  struct host_uart *uart = &host_uarts[port];
+  pthread_mutex_lock(&uart->mutex);
+  if (uart->rx == NULL || uart->rx_count + length > uart->rx_capacity)
+  {
+    QueueHandle_t events = uart->events;
+    pthread_mutex_unlock(&uart->mutex);
+    uart_event_t full = { .type = UART_BUFFER_FULL, .size = 0 };
+    if (events)
+      xQueueSend(events, &full, 0);
+    return -1;
+  }
+  for (size_t i = 0; i < length; i++)
+    uart->rx[(uart->rx_head + uart->rx_count + i) % uart->rx_capacity] = data[i];
+  uart->rx_count += length;
+  QueueHandle_t events = uart->events;
+  pthread_cond_broadcast(&uart->readable);
+  pthread_mutex_unlock(&uart->mutex);
+
+  /* like the ESP-IDF driver, the event reports what was buffered */
+  uart_event_t event = { .type = UART_DATA, .size = length };
+  if (events)
+    xQueueSend(events, &event, portMAX_DELAY);
+  return 0;
+}
+
+size_t host_uart_pending(int port)
+{
+  if (port < 0 || port >= UART_NUM_MAX)
+    return 0;
+  struct host_uart *uart = &host_uarts[port];
+  pthread_mutex_lock(&uart->mutex);
+  size_t count = uart->rx_count;
+  pthread_mutex_unlock(&uart->mutex);
+  return count;
+}
+
+/*
+    GPIO
+*/
+#define HOST_GPIO_COUNT 64
+
+static int host_gpio_levels[HOST_GPIO_COUNT];
+static uint32_t host_gpio_change_count[HOST_GPIO_COUNT];
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+  (void)config;
+  return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level)
+{
+  if (pin < 0 || pin >= HOST_GPIO_COUNT)
+    return ESP_ERR_INVALID_ARG;
+  if (host_gpio_levels[pin] != (level ? 1 : 0))
+    host_gpio_change_count[pin]++;
+  host_gpio_levels[pin] = level ? 1 : 0;
+  return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t pin)
+{
+  if (pin < 0 || pin >= HOST_GPIO_COUNT)
+    return 0;
+  return host_gpio_levels[pin];
+}
+
+uint32_t host_gpio_changes(int pin)
+{
+  if (pin < 0 || pin >= HOST_GPIO_COUNT)
+    return 0;
+  return host_gpio_change_count[pin];
+}
+
+esp_err_t gpio_set_direction(gpio_num_t pin, gpio_mode_t mode)
+{
+  (void)mode;
+  return (pin >= 0 && pin < HOST_GPIO_COUNT) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+/*
+    System and log
+*/
+uint32_t esp_get_free_heap_size(void)
+{
+  return 0;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+  (void)tag;
+  (void)level;
+}
+
+/*
+    NVS, one in-memory namespace per process
+*/
+#define HOST_NVS_KEYS 32
+#define HOST_NVS_KEY_MAX 16
+#define HOST_NVS_VALUE_MAX 512
+
+struct host_nvs_entry
+{
+  char key[HOST_NVS_KEY_MAX];
+  uint8_t value[HOST_NVS_VALUE_MAX];
+  size_t length;
+  int used;
+};
+
+static struct host_nvs_entry host_nvs[HOST_NVS_KEYS];
+static pthread_mutex_t host_nvs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct host_nvs_entry *host_nvs_find(const char *key, int create)
+{
+  struct host_nvs_entry *free_entry = NULL;
+  for (int i = 0; i < HOST_NVS_KEYS; i++)
+  {
+    if (host_nvs[i].used && strncmp(host_nvs[i].key, key, HOST_NVS_KEY_MAX) == 0)
+      return &host_nvs[i];
+    if (!host_nvs[i].used && free_entry == NULL)
+      free_entry = &host_nvs[i];
+  }
+  if (!create || free_entry == NULL)
+    return NULL;
+  snprintf(free_entry->key, sizeof free_entry->key, "%s", key);
+  free_entry->used = 1;
+  free_entry->length = 0;
+  return free_entry;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle)
+{
+  (void)name;
+  (void)mode;
+  *handle = 1;
+  return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+  (void)handle;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+  (void)handle;
+  return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *length)
+{
+  (void)handle;
+  pthread_mutex_lock(&host_nvs_mutex);
+  struct host_nvs_entry *entry = host_nvs_find(key, 0);
+  if (entry == NULL)
+  {
+    pthread_mutex_unlock(&host_nvs_mutex);
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  if (value == NULL)
+  {
+    *length = entry->length;
+    pthread_mutex_unlock(&host_nvs_mutex);
+    return ESP_OK;
+  }
+  if (*length < entry->length)
+  {
+    pthread_mutex_unlock(&host_nvs_mutex);
+    return ESP_FAIL;
+  }
+  memcpy(value, entry->value, entry->length);
+  *length = entry->length;
+  pthread_mutex_unlock(&host_nvs_mutex);
+  return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+  (void)handle;
+  if (length > HOST_NVS_VALUE_MAX)
+    return ESP_ERR_INVALID_ARG;
+  pthread_mutex_lock(&host_nvs_mutex);
+  struct host_nvs_entry *entry = host_nvs_find(key, 1);
+  if (entry == NULL)
+  {
+    pthread_mutex_unlock(&host_nvs_mutex);
+    return ESP_ERR_NO_MEM;
+  }
+  memcpy(entry->value, value, length);
+  entry->length = length;
+  pthread_mutex_unlock(&host_nvs_mutex);
+  return ESP_OK;
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *value, size_t *length)
+{
+  return nvs_get_blob(handle, key, value, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+  return nvs_set_blob(handle, key, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+  (void)handle;
+  pthread_mutex_lock(&host_nvs_mutex);
+  struct host_nvs_entry *entry = host_nvs_find(key, 0);
+  if (entry)
+    entry->used = 0;
+  pthread_mutex_unlock(&host_nvs_mutex);
+  return entry ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
@@ -0,0 +1,70 @@
+/**
+ * @file host_port.h
+ * @brief Host (Linux) port of the ESP-IDF/FreeRTOS APIs used by the iridium driver
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * Builds iridium.c unmodified on the host for replay, benchmarks and tools. Tasks are
+ * detached pthreads, queues are mutex/condvar rings and the UART driver is a byte
+ * buffer: whatever the host writes with host_uart_inject() is read by the driver as
+ * modem output, and every uart_write_bytes() is handed to the transmit hook.
+ */
+
+#ifndef HOST_PORT_H_INCLUDED
+#define HOST_PORT_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+/**
+ * @brief Receives the bytes the driver writes to a UART port
+ */
+typedef void (*host_uart_tx_t)(void *ctx, int port, const uint8_t *data, size_t length);
+
+/**
+ * @brief Sets the transmit hook of a UART port
+ *
+ * @param port The UART port
+ * @param tx The hook, NULL drops transmitted bytes
+ * @param ctx Passed to the hook
+ */
+void host_uart_set_tx(int port, host_uart_tx_t tx, void *ctx);
+
+/**
+ * @brief Delivers modem output to the driver, as a single UART_DATA event
+ *
+ * @param port The UART port
+ * @param data The bytes
+ * @param length The number of bytes
+ * @return 0 on success, -1 if the RX buffer overflowed (a UART_BUFFER_FULL event is posted)
+ */
+int host_uart_inject(int port, const uint8_t *data, size_t length);
+
+/**
+ * @brief Number of injected bytes the driver has not read yet
+ *
+ * @param port The UART port
+ * @return The number of buffered bytes
+ */
+size_t host_uart_pending(int port);
+
+/**
+ * @brief Number of level changes of a GPIO pin, lets a simulated peripheral see pulses
+ *
+ * @param pin The GPIO pin
+ * @return The number of gpio_set_level() calls that changed the level
+ */
+uint32_t host_gpio_changes(int pin);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_PORT_H_INCLUDED */
@@ -0,0 +1,150 @@
+/**
+ * @file host_serial.c
+ * @brief Implementation of the serial bridge
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This file contains the implementation of the serial bridge declared in host_serial.h.
+ * The reader polls with a short timeout so host_serial_close() never waits on a
+ * blocked read().
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "host_port.h"
+#include "host_serial.h"
+
+#define HOST_SERIAL_POLL_MS 100
+
+static speed_t host_serial_speed(int baud)
+{
+  switch (baud)
+  {
+  case 9600:
+    return B9600;
+  case 19200:
+    return B19200;
+  case 38400:
+    return B38400;
+  case 57600:
+    return B57600;
+  case 115200:
+    return B115200;
+  default:
+    return 0;
+  }
+}
+
+static void host_serial_tx(void *ctx, int port, const uint8_t *data, size_t length)
+{
+  struct host_serial *serial = ctx;
+  (void)port;
+  while (length > 0)
+  {
+    ssize_t n = write(serial->fd, data, length);
+    if (n < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      return;
+    }
+    serial->tx_bytes += n;
+    data += n;
+    length -= n;
+  }
+}
+
+static void *host_serial_reader(void *arg)
+{
+  struct host_serial *serial = arg;
+  uint8_t buffer[256];
+  while (serial->running)
+  {
+    struct pollfd input = { .fd = serial->fd, .events = POLLIN };
+    if (poll(&input, 1, HOST_SERIAL_POLL_MS) <= 0)
+      continue;
+    ssize_t n = read(serial->fd, buffer, sizeof buffer);
+    if (n <= 0)
+      continue;
+    serial->rx_bytes += n;
+    if (host_uart_inject(serial->port, buffer, n) != 0)
+      serial->rx_overflows++;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Opens a tty in raw mode and bridges it to a host port UART
+ *
+ * @param serial Pointer to the bridge
+ * @param path The tty, e.g. /dev/ttyUSB0 or /dev/pts/3
+ * @param port The host port UART the driver uses
+ * @param baud The baud rate, 9600 to 115200 (the 9602/9603 default is 19200)
+ * @return 0 on success, -1 with errno set if the tty could not be opened or configured
+ */
+int host_serial_open(struct host_serial *serial, const char *path, int port, int baud)
+{
+  memset(serial, 0, sizeof *serial);
+  speed_t speed = host_serial_speed(baud);
+  if (speed == 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  serial->fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (serial->fd < 0)
+    return -1;
+
+  struct termios tty;
+  if (tcgetattr(serial->fd, &tty) != 0)
+  {
+    close(serial->fd);
+    return -1;
+  }
+  /* 8N1, no flow control (the driver sends AT&K0), no line discipline */
+  cfmakeraw(&tty);
+  tty.c_cflag |= CLOCAL | CREAD;
+  tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+  tty.c_cc[VMIN] = 0;
+  tty.c_cc[VTIME] = 0;
+  cfsetispeed(&tty, speed);
+  cfsetospeed(&tty, speed);
+  if (tcsetattr(serial->fd, TCSANOW, &tty) != 0)
+  {
+    close(serial->fd);
+    return -1;
+  }
+  tcflush(serial->fd, TCIOFLUSH);
+  /* writes block, reads are polled */
+  fcntl(serial->fd, F_SETFL, fcntl(serial->fd, F_GETFL) & ~O_NONBLOCK);
+
+  serial->port = port;
+  serial->running = 1;
+  if (pthread_create(&serial->reader, NULL, host_serial_reader, serial) != 0)
+  {
+    close(serial->fd);
+    return -1;
+  }
+  host_uart_set_tx(port, host_serial_tx, serial);
+  return 0;
+}
+
+/**
+ * @brief Stops the reader, detaches the UART and closes the tty
+ *
+ * @param serial Pointer to the bridge
+ */
+void host_serial_close(struct host_serial *serial)
+{
+  host_uart_set_tx(serial->port, NULL, NULL);
+  serial->running = 0;
+  pthread_join(serial->reader, NULL);
+  close(serial->fd);
+}
@@ -0,0 +1,69 @@
+/**
+ * @file host_serial.h
+ * @brief Connects a host port UART to a serial device or PTY
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * Opens a tty (/dev/ttyUSB0, an FTDI cable on the bench, or a PTY) in raw 8N1 mode and
+ * bridges it to a host port UART: bytes the driver writes go out on the tty, a reader
+ * thread injects whatever the modem sends as UART_DATA events. With it iridium.c runs
+ * unmodified on Linux against real hardware.
+ *
+ * Usage example:
+ * @code
+ * struct host_serial serial;
+ * if (host_serial_open(&serial, "/dev/ttyUSB0", UART_NUM_1, 19200) == 0)
+ * {
+ *   iridium_config(satcom);
+ *   host_serial_close(&serial);
+ * }
+ * @endcode
+ */
+
+#ifndef HOST_SERIAL_H_INCLUDED
+#define HOST_SERIAL_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * @brief Serial bridge state
+ */
+struct host_serial
+{
+  int fd;                        /**< The tty */
+  int port;                      /**< Host port UART */
+  pthread_t reader;              /**< Injects tty input */
+  volatile int running;
+  uint64_t rx_bytes;             /**< Bytes read from the tty */
+  uint64_t tx_bytes;             /**< Bytes written to the tty */
+  uint32_t rx_overflows;         /**< Reads the driver RX buffer had no room for */
+};
+
+/**
+ * @brief Opens a tty in raw mode and bridges it to a host port UART
+ *
+ * @param serial Pointer to the bridge
+ * @param path The tty, e.g. /dev/ttyUSB0 or /dev/pts/3
+ * @param port The host port UART the driver uses
+ * @param baud The baud rate, 9600 to 115200 (the 9602/9603 default is 19200)
+ * @return 0 on success, -1 with errno set if the tty could not be opened or configured
+ */
+int host_serial_open(struct host_serial *serial, const char *path, int port, int baud);
+
+/**
+ * @brief Stops the reader, detaches the UART and closes the tty
+ *
+ * @param serial Pointer to the bridge
+ */
+void host_serial_close(struct host_serial *serial);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_SERIAL_H_INCLUDED */
@@ -0,0 +1,9 @@
+/**
+ * @file esp_event.h
+ * @brief Host port placeholder, nothing from this header is used by the driver
+ */
+
+#ifndef HOST_ESP_EVENT_H_INCLUDED
+#define HOST_ESP_EVENT_H_INCLUDED
+
+#endif /* HOST_ESP_EVENT_H_INCLUDED */
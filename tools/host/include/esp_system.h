@@ -0,0 +1,13 @@
+/**
+ * @file esp_system.h
+ * @brief Host port of esp_get_free_heap_size, always 0 on the host
+ */
+
+#ifndef HOST_ESP_SYSTEM_H_INCLUDED
+#define HOST_ESP_SYSTEM_H_INCLUDED
+
+#include <stdint.h>
+
+uint32_t esp_get_free_heap_size(void);
+
+#endif /* HOST_ESP_SYSTEM_H_INCLUDED */
@@ -0,0 +1,13 @@
+/**
+ * @file esp_timer.h
+ * @brief Host port of esp_timer_get_time
+ */
+
+#ifndef HOST_ESP_TIMER_H_INCLUDED
+#define HOST_ESP_TIMER_H_INCLUDED
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
+
+#endif /* HOST_ESP_TIMER_H_INCLUDED */
@@ -0,0 +1,39 @@
+/**
+ * @file FreeRTOS.h
+ * @brief Host port of the FreeRTOS types used by the iridium driver
+ *
+ * Only what iridium.c needs, implemented with pthreads in host_port.c.
+ */
+
+#ifndef HOST_FREERTOS_H_INCLUDED
+#define HOST_FREERTOS_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef TickType_t portTickType;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef int esp_err_t;
+
+typedef struct host_queue *QueueHandle_t;
+typedef struct host_task *TaskHandle_t;
+
+#define portMAX_DELAY       ((TickType_t)0xffffffffu)
+#define portTICK_PERIOD_MS  1
+#define pdMS_TO_TICKS(ms)   ((TickType_t)((ms) / portTICK_PERIOD_MS))
+#define pdTRUE              1
+#define pdFALSE             0
+#define pdPASS              pdTRUE
+#define pdFAIL              pdFALSE
+
+#define ESP_OK              0
+#define ESP_FAIL            -1
+#define ESP_ERR_NO_MEM      0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+#define ESP_ERROR_CHECK(x)  ((void)(x))
+
+#endif /* HOST_FREERTOS_H_INCLUDED */
@@ -0,0 +1,18 @@
+/**
+ * @file queue.h
+ * @brief Host port of the FreeRTOS queue API
+ */
+
+#ifndef HOST_QUEUE_H_INCLUDED
+#define HOST_QUEUE_H_INCLUDED
+
+#include "FreeRTOS.h"
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait);
+BaseType_t xQueueReset(QueueHandle_t queue);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+void vQueueDelete(QueueHandle_t queue);
+
+#endif /* HOST_QUEUE_H_INCLUDED */
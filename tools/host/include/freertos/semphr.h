@@ -0,0 +1,11 @@
+/**
+ * @file semphr.h
+ * @brief Host port placeholder, the driver only uses queues
+ */
+
+#ifndef HOST_SEMPHR_H_INCLUDED
+#define HOST_SEMPHR_H_INCLUDED
+
+#include "queue.h"
+
+#endif /* HOST_SEMPHR_H_INCLUDED */
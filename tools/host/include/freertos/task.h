@@ -0,0 +1,20 @@
+/**
+ * @file task.h
+ * @brief Host port of the FreeRTOS task API, tasks are detached pthreads
+ */
+
+#ifndef HOST_TASK_H_INCLUDED
+#define HOST_TASK_H_INCLUDED
+
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters, 
+                       UBaseType_t priority, TaskHandle_t *handle);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+#endif /* HOST_TASK_H_INCLUDED */
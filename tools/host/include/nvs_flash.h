@@ -0,0 +1,9 @@
+/**
+ * @file nvs_flash.h
+ * @brief Host port placeholder, nothing from this header is used by the driver
+ */
+
+#ifndef HOST_NVS_FLASH_H_INCLUDED
+#define HOST_NVS_FLASH_H_INCLUDED
+
+#endif /* HOST_NVS_FLASH_H_INCLUDED */
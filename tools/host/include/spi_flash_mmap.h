@@ -0,0 +1,9 @@
+/**
+ * @file spi_flash_mmap.h
+ * @brief Host port placeholder, nothing from this header is used by the driver
+ */
+
+#ifndef HOST_SPI_FLASH_MMAP_H_INCLUDED
+#define HOST_SPI_FLASH_MMAP_H_INCLUDED
+
+#endif /* HOST_SPI_FLASH_MMAP_H_INCLUDED */
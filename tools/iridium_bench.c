@@ -0,0 +1,141 @@
+/**
+ * @file iridium_bench.c
+ * @brief Times the command builder, the URC classifier and the response parser of the driver
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * Includes iridium.c, built for the host with tools/host, so the static command builder
+ * can be called directly. Each stage runs N times (-n, default 2000000) over a fixed mix
+ * of inputs and reports the mean cost per call:
+ *
+ * - build, iridium_build_message() over +CSQ, +SBDIX, +SBDWT, +SBDWB, +SBDMTA and +SBDRT
+ * - urc, iridium_urc_parse() over URC and non-URC lines
+ * - parse, iridium_satcom_process_result() over +CSQ, +SBDIX and +SBDSX responses
+ *
+ * Nothing is sent, the driver tasks are never started.
+ *
+ * Usage:
+ * @code
+ * make -C tools iridium_bench
+ * ./tools/iridium_bench
+ * ./tools/iridium_bench -n 10000000
+ * @endcode
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "host_port.h"
+#include "../iridium.c"
+
+static uint64_t bench_now_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static void bench_callback(iridium_t *satcom, iridium_command_t command, iridium_status_t status)
+{
+  (void)satcom;
+  (void)command;
+  (void)status;
+}
+
+static const iridium_command_t bench_commands[] = { AT_CSQ, AT_SBDIX, AT_SBDWT, AT_SBDWB, AT_SBDMTA, AT_SBDRT };
+static char bench_text[] = "hello world position 52.1,-8.4";
+static char bench_size[] = "120";
+static char bench_mode[] = "1";
+static char *const bench_arguments[] = { NULL, NULL, bench_text, bench_size, bench_mode, NULL };
+
+static const char *const bench_lines[] = {
+  "+CSQ:4", "OK", "+SBDIX: 0, 12, 1, 3, 22, 0", "SBDRING", "+CIEV:0,3", "READY", "ERROR", "+SBDSX: 0, 12, 0, 3, 0, 0",
+};
+
+/**
+ * @brief A response and the echo of the command it answers
+ */
+struct bench_response
+{
+  const char *echo;
+  const char *data;
+};
+
+static const struct bench_response bench_responses[] = {
+  { "AT+CSQ", "+CSQ:4" },
+  { "AT+SBDIX", "+SBDIX: 0, 12, 1, 3, 22, 0" },
+  { "AT+SBDSX", "+SBDSX: 0, 12, 0, 3, 0, 0" },
+};
+
+#define BENCH_COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+int main(int argc, char **argv)
+{
+  long calls = 2000000;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      calls = strtol(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n calls]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (calls <= 0)
+  {
+    fprintf(stderr, "calls must be positive\n");
+    return 2;
+  }
+
+  /* the locks and queues only, no UART and no tasks */
+  iridium_t *satcom = iridium_default_configuration();
+  if (satcom == NULL || iridium_init(satcom) != SAT_OK)
+  {
+    fprintf(stderr, "iridium_init failed\n");
+    return 1;
+  }
+  satcom->callback = &bench_callback;
+
+  /* every result goes into sink so the compiler keeps the calls */
+  volatile long sink = 0;
+
+  iridium_command_item_t item;
+  uint64_t start = bench_now_ns();
+  for (long i = 0; i < calls; i++)
+  {
+    size_t k = (size_t)i % BENCH_COUNT(bench_commands);
+    iridium_build_message(satcom, bench_commands[k], bench_arguments[k], NULL, 0, &item);
+    sink += item.size;
+  }
+  printf("build           %.1f ns/command\n", (double)(bench_now_ns() - start) / (double)calls);
+
+  start = bench_now_ns();
+  for (long i = 0; i < calls; i++)
+  {
+    iridium_urc_event_t event;
+    sink += iridium_urc_parse(bench_lines[(size_t)i % BENCH_COUNT(bench_lines)], &event);
+  }
+  printf("urc             %.1f ns/line\n", (double)(bench_now_ns() - start) / (double)calls);
+
+  start = bench_now_ns();
+  for (long i = 0; i < calls; i++)
+  {
+    /* the parser works in place, so each call gets its own copy */
+    const struct bench_response *response = &bench_responses[(size_t)i % BENCH_COUNT(bench_responses)];
+    char echo[16];
+    char data[64];
+    strcpy(echo, response->echo);
+    strcpy(data, response->data);
+    sink += iridium_satcom_process_result(satcom, echo, data);
+  }
+  printf("parse           %.1f ns/response\n", (double)(bench_now_ns() - start) / (double)calls);
+
+  return 0;
+}
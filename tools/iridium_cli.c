@@ -0,0 +1,443 @@
+/**
+ * @file iridium_cli.c
+ * @brief Drives and benchmarks a 9602/9603 modem from a Linux host through the driver
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * Builds iridium.c unmodified against tools/host and bridges its UART to a serial device
+ * with host/host_serial.c, so a modem on an FTDI cable (or anything behind a PTY) is
+ * talked to by the exact code that runs on the ESP32: same framing, retry back-off,
+ * URC routing and metrics. -d sim answers with the simulated modem of iridium_sim on a
+ * scaled clock instead, handy to try a command without hardware.
+ *
+ * Commands:
+ * - csq, a fresh +CSQ (the query cache is bypassed)
+ * - send TEXT, +SBDWT then +SBDIX with the retry back-off
+ * - send-binary HEX|@FILE, +SBDWB then +SBDIX with the retry back-off
+ * - receive, a mailbox check: +SBDD0, +SBDIX and +SBDRT when a message came down
+ * - drain, mailbox checks until the gateway queue is empty
+ * - status, identity, signal, +SBDSX buffers and the -MSSTM system time
+ * - bench [at|csq|sbdsx|session], -n commands or sessions back to back, reports the
+ *   latency percentiles and the command and byte throughput
+ *
+ * Usage:
+ * @code
+ * make -C tools
+ * ./tools/iridium_cli -d /dev/ttyUSB0 status
+ * ./tools/iridium_cli -d /dev/ttyUSB0 send "hello"
+ * ./tools/iridium_cli -d /dev/ttyUSB0 -n 200 bench csq
+ * ./tools/iridium_cli -d sim -m 3 drain
+ * @endcode
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "host_port.h"
+#include "host_modem.h"
+#include "host_serial.h"
+#include "../iridium.h"
+
+#define CLI_RECEIVE_WAIT_MS 2000
+
+static pthread_mutex_t cli_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cli_received = PTHREAD_COND_INITIALIZER;
+static int cli_messages = 0;
+
+static double cli_wall_s(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* the driver clock, virtual in sim mode */
+static double cli_now_s(iridium_t *satcom)
+{
+  if (satcom->clock == NULL)
+    return cli_wall_s();
+  return satcom->clock->now_us(satcom->clock) / 1e6;
+}
+
+static void cli_callback(iridium_t *satcom, iridium_command_t command, iridium_status_t status)
+{
+  (void)satcom;
+  (void)command;
+  (void)status;
+}
+
+static void cli_message_callback(iridium_t *satcom, char *data)
+{
+  (void)satcom;
+  printf("mt message      \"%s\"\n", data);
+  pthread_mutex_lock(&cli_mutex);
+  cli_messages++;
+  pthread_cond_broadcast(&cli_received);
+  pthread_mutex_unlock(&cli_mutex);
+}
+
+static void cli_result(const char *name, iridium_result_t result)
+{
+  printf("%-15s status %d error %d", name, result.status, result.error);
+  if (result.mo_status >= 0)
+    printf(" mo %d mt %d", result.mo_status, result.mt_status);
+  printf(" %u ms \"%s\"\n", result.latency_ms, result.result);
+}
+
+static int cli_csq(iridium_t *satcom)
+{
+  iridium_result_t result = iridium_send(satcom, AT_CSQ, NULL, true, 500);
+  cli_result("csq", result);
+  if (result.status != SAT_OK)
+    return 1;
+  printf("signal          %d\n", satcom->signal_strength);
+  return 0;
+}
+
+static int cli_send(iridium_t *satcom, char *text)
+{
+  iridium_result_t result = iridium_tx_message(satcom, text);
+  cli_result("send", result);
+  printf("momsn           %d\n", satcom->sequence_outbound);
+  return result.status == SAT_OK ? 0 : 1;
+}
+
+static int cli_hex_digit(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* hex bytes or @file, returns the size or -1 */
+static long cli_payload(const char *argument, uint8_t *data, size_t max)
+{
+  if (argument[0] == '@')
+  {
+    FILE *file = fopen(argument + 1, "rb");
+    if (file == NULL)
+    {
+      perror(argument + 1);
+      return -1;
+    }
+    size_t size = fread(data, 1, max + 1, file);
+    fclose(file);
+    return size > max ? -1 : (long)size;
+  }
+  size_t length = strlen(argument);
+  if (length % 2 != 0 || length / 2 > max)
+    return -1;
+  for (size_t i = 0; i < length / 2; i++)
+  {
+    int high = cli_hex_digit(argument[2 * i]);
+    int low = cli_hex_digit(argument[2 * i + 1]);
+    if (high < 0 || low < 0)
+      return -1;
+    data[i] = (uint8_t)(high << 4 | low);
+  }
+  return (long)(length / 2);
+}
+
+static int cli_send_binary(iridium_t *satcom, const char *argument)
+{
+  static uint8_t data[IRI_SBD_MO_MAX];
+  long size = cli_payload(argument, data, sizeof data);
+  if (size <= 0)
+  {
+    fprintf(stderr, "payload must be 1 to %d bytes of hex or @file\n", IRI_SBD_MO_MAX);
+    return 2;
+  }
+  iridium_result_t result = iridium_tx_binary(satcom, data, (size_t)size);
+  cli_result("send-binary", result);
+  printf("bytes           %ld\n", size);
+  return result.status == SAT_OK ? 0 : 1;
+}
+
+/* one mailbox check, returns 1 when a message came down, 0 when none, -1 on error */
+static int cli_mailbox(iridium_t *satcom)
+{
+  /* an empty MO buffer makes +SBDIX a pure mailbox check */
+  if (iridium_send(satcom, AT_SBDD, "0", true, 500).status != SAT_OK)
+    return -1;
+  iridium_result_t result = iridium_send(satcom, AT_SBDIX, NULL, true, 500);
+  cli_result("session", result);
+  if (result.status != SAT_OK)
+    return -1;
+  printf("queued          %d\n", satcom->messages_waiting);
+  if (result.mt_status != MT_SBD_MESSAGE_SUCCESSFULLY_RECEIVED)
+    return 0;
+
+  pthread_mutex_lock(&cli_mutex);
+  int before = cli_messages;
+  pthread_mutex_unlock(&cli_mutex);
+  if (iridium_send(satcom, AT_SBDRT, NULL, true, 500).status != SAT_OK)
+    return -1;
+
+  /* the text is delivered by the message task */
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += CLI_RECEIVE_WAIT_MS / 1000;
+  pthread_mutex_lock(&cli_mutex);
+  while (cli_messages == before)
+  {
+    if (pthread_cond_timedwait(&cli_received, &cli_mutex, &deadline) == ETIMEDOUT)
+      break;
+  }
+  int received = cli_messages > before;
+  pthread_mutex_unlock(&cli_mutex);
+  return received ? 1 : -1;
+}
+
+static int cli_receive(iridium_t *satcom)
+{
+  int received = cli_mailbox(satcom);
+  if (received == 0)
+    printf("mt message      none\n");
+  return received < 0 ? 1 : 0;
+}
+
+static int cli_drain(iridium_t *satcom)
+{
+  int messages = 0;
+  for (;;)
+  {
+    int received = cli_mailbox(satcom);
+    if (received < 0)
+      return 1;
+    messages += received;
+    if (received == 0 || satcom->messages_waiting <= 0)
+      break;
+  }
+  printf("drained         %d\n", messages);
+  return 0;
+}
+
+static int cli_status(iridium_t *satcom)
+{
+  /* the identity strings can be longer than iridium_result_t holds */
+  char manufacturer_text[IRI_ID_MAX], model_text[IRI_ID_MAX];
+  iridium_result_t manufacturer = iridium_query_into(satcom, AT_CGMI, manufacturer_text, sizeof manufacturer_text);
+  iridium_result_t model = iridium_query_into(satcom, AT_CGMM, model_text, sizeof model_text);
+  if (manufacturer.status != SAT_OK || model.status != SAT_OK)
+  {
+    cli_result("identity", manufacturer.status != SAT_OK ? manufacturer : model);
+    return 1;
+  }
+  printf("identity        %s%s / %s%s\n", manufacturer_text, manufacturer.length >= sizeof manufacturer_text ? "..." : "",
+         model_text, model.length >= sizeof model_text ? "..." : "");
+  if (cli_csq(satcom) != 0)
+    return 1;
+
+  iridium_result_t buffers = iridium_send(satcom, AT_SBDSX, NULL, true, 500);
+  cli_result("sbdsx", buffers);
+
+  iridium_result_t time = iridium_time_sync(satcom);
+  uint64_t utc_ms;
+  uint32_t age_ms;
+  if (time.status == SAT_OK && iridium_time_utc_ms(satcom, &utc_ms, &age_ms) == SAT_OK)
+  {
+    time_t seconds = (time_t)(utc_ms / 1000);
+    char text[32];
+    strftime(text, sizeof text, "%Y-%m-%d %H:%M:%S", gmtime(&seconds));
+    printf("system time     %s.%03u UTC\n", text, (unsigned)(utc_ms % 1000));
+  }
+  else
+  {
+    cli_result("system time", time);
+  }
+  return buffers.status == SAT_OK ? 0 : 1;
+}
+
+static int cli_bench(iridium_t *satcom, const char *kind, int count)
+{
+  iridium_command_t command;
+  if (strcmp(kind, "at") == 0)
+    command = AT;
+  else if (strcmp(kind, "csq") == 0)
+    command = AT_CSQ;
+  else if (strcmp(kind, "sbdsx") == 0)
+    command = AT_SBDSX;
+  else if (strcmp(kind, "session") == 0)
+    command = AT_SBDIX;
+  else
+    return 2;
+
+  iridium_metrics_t before;
+  iridium_metrics_t after;
+  iridium_metrics_snapshot(satcom, &before);
+  struct histogram_t latency;
+  histogram_reset(&latency);
+  int failed = 0;
+  double start = cli_now_s(satcom);
+  double wall = cli_wall_s();
+
+  for (int i = 0; i < count; i++)
+  {
+    iridium_result_t result;
+    if (command == AT_SBDIX)
+    {
+      /* a full MO session, buffer write included, without the retry back-off */
+      char text[32];
+      snprintf(text, sizeof text, "bench %d", i + 1);
+      double sent = cli_now_s(satcom);
+      result = iridium_send(satcom, AT_SBDWT, text, true, 500);
+      if (result.status == SAT_OK)
+        result = iridium_send(satcom, AT_SBDIX, NULL, true, 500);
+      result.latency_ms = (uint32_t)((cli_now_s(satcom) - sent) * 1000);
+    }
+    else
+    {
+      result = iridium_send(satcom, command, NULL, true, 500);
+    }
+    if (result.status != SAT_OK)
+      failed++;
+    histogram_record(&latency, result.latency_ms);
+  }
+
+  double elapsed = cli_now_s(satcom) - start;
+  wall = cli_wall_s() - wall;
+  iridium_metrics_snapshot(satcom, &after);
+  uint32_t bytes = (after.bytes_tx - before.bytes_tx) + (after.bytes_rx - before.bytes_rx);
+
+  printf("bench           %s x %d, %d failed\n", kind, count, failed);
+  printf("latency         p50 %u p90 %u p99 %u max %u ms, mean %.1f ms\n",
+         histogram_percentile(&latency, 50), histogram_percentile(&latency, 90),
+         histogram_percentile(&latency, 99), latency.max,
+         latency.count ? (double)latency.sum / latency.count : 0.0);
+  printf("throughput      %.1f %s/s, %.0f bytes/s (%u tx, %u rx)\n",
+         elapsed > 0 ? count / elapsed : 0.0, command == AT_SBDIX ? "sessions" : "commands",
+         elapsed > 0 ? bytes / elapsed : 0.0, after.bytes_tx - before.bytes_tx,
+         after.bytes_rx - before.bytes_rx);
+  printf("elapsed         %.3f s (wall %.3f s)\n", elapsed, wall);
+  return failed == 0 ? 0 : 1;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s -d device|sim [-b baud] [-s speedup] [-m mt] [-n count] [-v] command\n"
+                  "  csq | send TEXT | send-binary HEX|@FILE | receive | drain | status |\n"
+                  "  bench [at|csq|sbdsx|session]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+  const char *device = NULL;
+  int baud = 19200;
+  uint32_t speedup = 1000;
+  int mt = 0;
+  int count = 100;
+  int option;
+  while ((option = getopt(argc, argv, "d:b:s:m:n:v")) != -1)
+  {
+    switch (option)
+    {
+    case 'd':
+      device = optarg;
+      break;
+    case 'b':
+      baud = atoi(optarg);
+      break;
+    case 's':
+      speedup = (uint32_t)atoi(optarg);
+      break;
+    case 'm':
+      mt = atoi(optarg);
+      break;
+    case 'n':
+      count = atoi(optarg);
+      break;
+    case 'v':
+      host_log_level = ESP_LOG_INFO;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (device == NULL || optind >= argc || speedup == 0 || count <= 0)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+  const char *command = argv[optind];
+  char **arguments = argv + optind + 1;
+  int argument_count = argc - optind - 1;
+  int sim = strcmp(device, "sim") == 0;
+
+  iridium_t *satcom = iridium_default_configuration();
+  satcom->callback = &cli_callback;
+  satcom->message_callback = &cli_message_callback;
+  satcom->uart_number = UART_NUM_1;
+
+  struct vclock_sim_t clock;
+  struct host_modem modem;
+  struct host_serial serial;
+  if (sim)
+  {
+    vclock_sim_init(&clock, 0, speedup);
+    if (host_modem_init(&modem, UART_NUM_1, &clock.clock) != 0)
+    {
+      fprintf(stderr, "modem thread failed\n");
+      return 1;
+    }
+    for (int i = 0; i < mt; i++)
+    {
+      char text[32];
+      snprintf(text, sizeof text, "sim mt %d", i + 1);
+      host_modem_queue_mt(&modem, text);
+    }
+    satcom->clock = &clock.clock;
+  }
+  else if (host_serial_open(&serial, device, UART_NUM_1, baud) != 0)
+  {
+    fprintf(stderr, "%s: %s\n", device, strerror(errno));
+    return 1;
+  }
+
+  if (iridium_config(satcom) != SAT_OK)
+  {
+    fprintf(stderr, "iridium_config failed\n");
+    return 1;
+  }
+
+  int status = 2;
+  if (strcmp(command, "csq") == 0 && argument_count == 0)
+    status = cli_csq(satcom);
+  else if (strcmp(command, "send") == 0 && argument_count == 1)
+    status = cli_send(satcom, arguments[0]);
+  else if (strcmp(command, "send-binary") == 0 && argument_count == 1)
+    status = cli_send_binary(satcom, arguments[0]);
+  else if (strcmp(command, "receive") == 0 && argument_count == 0)
+    status = cli_receive(satcom);
+  else if (strcmp(command, "drain") == 0 && argument_count == 0)
+    status = cli_drain(satcom);
+  else if (strcmp(command, "status") == 0 && argument_count == 0)
+    status = cli_status(satcom);
+  else if (strcmp(command, "bench") == 0 && argument_count <= 1)
+    status = cli_bench(satcom, argument_count ? arguments[0] : "at", count);
+  if (status == 2)
+    usage(argv[0]);
+
+  /* the driver tasks never exit, detach the UART so nothing answers them */
+  if (sim)
+  {
+    host_modem_stop(&modem);
+  }
+  else
+  {
+    printf("serial          %llu bytes tx, %llu bytes rx, %u overflows\n",
+           (unsigned long long)serial.tx_bytes, (unsigned long long)serial.rx_bytes, serial.rx_overflows);
+    host_serial_close(&serial);
+  }
+  return status;
+}
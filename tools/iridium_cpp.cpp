@@ -0,0 +1,250 @@
+/**
+ * @file iridium_cpp.cpp
+ * @brief Drives the C++ layer of iridium.hpp from one task and counts its heap allocations
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * Starts an iri::Modem against the simulated modem of host/host_modem.c on a scaled vclock,
+ * like iridium_sim does for the C API. Three coroutines run at the same time from the main
+ * thread, which only calls poll():
+ *
+ * - a sender, N binary messages (-m, default 5) through MoMessage buffers, with the first
+ *   sessions failing (-f, default 2) so its operations stay outstanding through the back-off
+ * - a poller, N signal queries while the sender waits
+ * - a receiver, waiting from the start for N MT messages (at most HOST_MODEM_MT_MAX), queued
+ *   at the gateway and rung once the sender is done (a +SBDIX of the sender would take the
+ *   first one along)
+ *
+ * Every replaceable operator new is counted, the array, nothrow and aligned forms included.
+ * The layer passes when none of them ran while the coroutines did (their frames come from the
+ * Modem's pool), when every buffer went back to its pool and when the Modem destructor
+ * stopped the driver.
+ *
+ * Usage:
+ * @code
+ * make -C tools
+ * ./tools/iridium_cpp
+ * ./tools/iridium_cpp -m 12 -f 4
+ * @endcode
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+#include <unistd.h>
+
+#include "host_port.h"
+#include "host_modem.h"
+#include "../iridium.hpp"
+
+static std::atomic<unsigned> cpp_allocations{0};
+
+static void *cpp_allocate(std::size_t size, std::size_t alignment)
+{
+  cpp_allocations++;
+  if (size == 0)
+    size = 1;
+  if (alignment <= alignof(std::max_align_t))
+    return std::malloc(size);
+  return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+static void *cpp_allocate_or_abort(std::size_t size, std::size_t alignment)
+{
+  void *memory = cpp_allocate(size, alignment);
+  if (memory == nullptr)
+    std::abort();
+  return memory;
+}
+
+void *operator new(std::size_t size) { return cpp_allocate_or_abort(size, 0); }
+void *operator new[](std::size_t size) { return cpp_allocate_or_abort(size, 0); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return cpp_allocate(size, 0); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return cpp_allocate(size, 0); }
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+  return cpp_allocate_or_abort(size, (std::size_t)alignment);
+}
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+  return cpp_allocate_or_abort(size, (std::size_t)alignment);
+}
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+  return cpp_allocate(size, (std::size_t)alignment);
+}
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+  return cpp_allocate(size, (std::size_t)alignment);
+}
+
+void operator delete(void *memory) noexcept { std::free(memory); }
+void operator delete[](void *memory) noexcept { std::free(memory); }
+void operator delete(void *memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, std::size_t) noexcept { std::free(memory); }
+void operator delete(void *memory, const std::nothrow_t &) noexcept { std::free(memory); }
+void operator delete[](void *memory, const std::nothrow_t &) noexcept { std::free(memory); }
+void operator delete(void *memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void *memory, std::size_t, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, std::size_t, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void *memory, std::align_val_t, const std::nothrow_t &) noexcept { std::free(memory); }
+void operator delete[](void *memory, std::align_val_t, const std::nothrow_t &) noexcept { std::free(memory); }
+
+struct cpp_progress
+{
+  int sent = 0;
+  int failed = 0;
+  int signals = 0;
+  int received = 0;
+  int out_of_order = 0;
+  int finished = 0;
+};
+
+static iri::Task cpp_sender(iri::Modem &modem, struct host_modem *gateway, cpp_progress &progress, int messages)
+{
+  for (int i = 0; i < messages; i++)
+  {
+    iri::MoMessage message = modem.message();
+    char text[32];
+    int length = snprintf(text, sizeof text, "cpp mo %d", i + 1);
+    message.assign(text, (std::size_t)length);
+    iri::Session session = co_await modem.async_transmit(std::move(message));
+    progress.sent += session.sent();
+    progress.failed += !session.sent();
+  }
+  for (int i = 0; i < messages; i++)
+  {
+    char text[32];
+    snprintf(text, sizeof text, "cpp mt %d", i + 1);
+    host_modem_queue_mt(gateway, text);
+  }
+  host_modem_ring(gateway);
+  progress.finished++;
+}
+
+static iri::Task cpp_poller(iri::Modem &modem, cpp_progress &progress, int queries)
+{
+  for (int i = 0; i < queries; i++)
+  {
+    iri::Signal signal = co_await modem.async_signal();
+    progress.signals += signal.bars() >= 0;
+  }
+  progress.finished++;
+}
+
+static iri::Task cpp_receiver(iri::Modem &modem, cpp_progress &progress, int messages)
+{
+  for (int i = 0; i < messages; i++)
+  {
+    iri::MtMessage message = co_await modem.async_receive();
+    char expected[32];
+    snprintf(expected, sizeof expected, "cpp mt %d", i + 1);
+    progress.received++;
+    progress.out_of_order += message.text() != std::string_view(expected);
+  }
+  progress.finished++;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-s speedup] [-m messages] [-f failures] [-v]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t speedup = 1000;
+  int messages = 5;
+  int failures = 2;
+  int option;
+  while ((option = getopt(argc, argv, "s:m:f:v")) != -1)
+  {
+    switch (option)
+    {
+    case 's':
+      speedup = (uint32_t)atoi(optarg);
+      break;
+    case 'm':
+      messages = atoi(optarg);
+      break;
+    case 'f':
+      failures = atoi(optarg);
+      break;
+    case 'v':
+      host_log_level = ESP_LOG_INFO;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (optind != argc || speedup == 0 || messages <= 0 || messages > HOST_MODEM_MT_MAX)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  struct vclock_sim_t sim;
+  vclock_sim_init(&sim, 0, speedup);
+  struct host_modem modem;
+  if (host_modem_init(&modem, UART_NUM_1, &sim.clock) != 0)
+  {
+    fprintf(stderr, "modem thread failed\n");
+    return 1;
+  }
+
+  cpp_progress progress;
+  unsigned allocations = 0;
+  std::size_t mo_free = 0, mt_free = 0;
+  uint32_t dropped = 0;
+  int status = 1;
+  {
+    iri::Modem satcom([&](iridium_t &config) {
+      config.clock = &sim.clock;
+      config.uart_number = UART_NUM_1;
+    });
+    if (!satcom)
+    {
+      fprintf(stderr, "iridium_config failed\n");
+      return 1;
+    }
+
+    unsigned before = cpp_allocations;
+    host_modem_fail_sessions(&modem, failures, MO_NO_NETWORK_SERVICE);
+    bool started = cpp_sender(satcom, &modem, progress, messages) && cpp_poller(satcom, progress, messages) &&
+                   cpp_receiver(satcom, progress, messages);
+    if (!started)
+      fprintf(stderr, "no coroutine frame free\n");
+
+    /* the one task that drives all three */
+    uint64_t deadline = sim.clock.now_us(&sim.clock) + (uint64_t)messages * 600 * 1000000;
+    while (progress.finished < 3 && sim.clock.now_us(&sim.clock) < deadline)
+      satcom.poll(std::chrono::milliseconds(100));
+    allocations = cpp_allocations - before;
+
+    iri::MoMessage spare = satcom.message();
+    mo_free = spare ? 1 : 0;
+    spare.reset();
+    iri::MtMessage leftover = satcom.receive();
+    mt_free = leftover ? 0 : 1;
+    dropped = satcom.mt_dropped();
+    status = started ? 0 : 1;
+  }
+
+  printf("messages        %d, %d failing sessions, speedup %u\n", messages, failures, speedup);
+  printf("  sender        %d sent, %d failed\n", progress.sent, progress.failed);
+  printf("  poller        %d of %d answered\n", progress.signals, messages);
+  printf("  receiver      %d received, %d out of order, %u dropped\n", progress.received, progress.out_of_order,
+         dropped);
+  printf("  heap          %u operator new\n", allocations);
+  printf("modem           %u sessions, %u failed\n", modem.sessions, modem.sessions_failed);
+  int pass = status == 0 && progress.finished == 3 && progress.sent == messages && progress.signals == messages &&
+             progress.received == messages && progress.out_of_order == 0 && dropped == 0 && allocations == 0 &&
+             mo_free == 1 && mt_free == 1;
+  printf("result          %s\n", pass ? "pass" : "FAIL");
+
+  host_modem_stop(&modem);
+  return pass ? 0 : 1;
+}
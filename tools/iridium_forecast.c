@@ -0,0 +1,459 @@
+/**
+ * @file iridium_forecast.c
+ * @brief Benchmarks the signal forecast against a recorded or synthetic signal trace
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * Plays a signal trace through forecast.c, the module the driver feeds from +CSQ and
+ * +CIEV, and runs the same message load under three transmit policies:
+ *
+ * - fixed, the +SBDIX retry back-off of iridium_tx_message() as it was
+ * - retry, the back-off stretched to the forecast (what the driver does)
+ * - gate, the first attempt waits for the forecast too
+ *
+ * A session succeeds with a probability that depends on the trace signal at its start
+ * (SESSION_SUCCESS), the draws are the same for every policy. The report shows sessions
+ * spent per delivered message, delivery latency, the Brier score of the predicted
+ * success probability and the cost of forecast_sample() / forecast_predict().
+ *
+ * Traces:
+ * - a capture recorded with iridium_capture_start(), +CSQ answers and +CIEV indicators
+ * - a text file of "<seconds> <csq> [service]" lines, commas allowed, # comments
+ * - -g hours, a synthetic trace of satellite passes every -p seconds with noise and outages
+ *
+ * Usage:
+ * @code
+ * make -C tools
+ * ./tools/iridium_forecast -g 24
+ * ./tools/iridium_forecast -i 600 field_day.ircp
+ * @endcode
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "../forecast.h"
+#include "../capture.h"
+
+#define BIN_MS 30000                 /* IRI_FORECAST_BIN_MS */
+#define HORIZON_MS 600000            /* IRI_FORECAST_HORIZON_MS */
+#define SAMPLES 256                  /* IRI_FORECAST_SAMPLES */
+#define SESSION_MS 20000             /* +SBDIX airtime */
+#define ATTEMPTS 5
+
+/* success of a session per +CSQ, the ground truth of the benchmark */
+static const double SESSION_SUCCESS[6] = { 0.0, 0.30, 0.55, 0.75, 0.85, 0.92 };
+/* iridium_session_retry() back-off */
+static const uint32_t RETRY_DELAYS_MS[ATTEMPTS] = { 2000, 4000, 20000, 30000, 300000 };
+
+struct trace_point
+{
+  uint32_t time_ms;
+  uint8_t csq;
+  uint8_t service;
+};
+
+struct trace
+{
+  struct trace_point *points;
+  size_t count;
+  size_t capacity;
+};
+
+enum policy
+{
+  POLICY_FIXED,
+  POLICY_RETRY,
+  POLICY_GATE,
+  POLICIES
+};
+
+static const char *policy_names[POLICIES] = { "fixed", "retry", "gate" };
+
+struct policy_result
+{
+  uint32_t messages;
+  uint32_t delivered;
+  uint32_t sessions;
+  uint32_t failed;
+  uint64_t latency_ms;
+  uint32_t latencies[4096];
+  double brier;
+  uint32_t predictions;
+  uint32_t deferred;
+};
+
+static uint64_t bench_now_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/* xorshift, the same seed gives every policy the same session draws */
+static uint64_t rng_state;
+
+static double rng_uniform(void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int trace_add(struct trace *trace, uint32_t time_ms, int csq, int service)
+{
+  if (trace->count == trace->capacity)
+  {
+    size_t capacity = trace->capacity ? trace->capacity * 2 : 1024;
+    struct trace_point *points = realloc(trace->points, capacity * sizeof *points);
+    if (points == NULL)
+      return -1;
+    trace->points = points;
+    trace->capacity = capacity;
+  }
+  struct trace_point *point = &trace->points[trace->count++];
+  point->time_ms = time_ms;
+  point->csq = (uint8_t)(csq < 0 ? 0 : csq > 5 ? 5 : csq);
+  point->service = service != 0;
+  return 0;
+}
+
+/**
+ * @brief Signal at a time, the last report before it holds
+ */
+static const struct trace_point *trace_at(const struct trace *trace, uint32_t time_ms)
+{
+  size_t low = 0, high = trace->count;
+  while (high - low > 1)
+  {
+    size_t mid = (low + high) / 2;
+    if (trace->points[mid].time_ms <= time_ms)
+      low = mid;
+    else
+      high = mid;
+  }
+  return &trace->points[low];
+}
+
+static int trace_signal(const struct trace *trace, uint32_t time_ms)
+{
+  const struct trace_point *point = trace_at(trace, time_ms);
+  return point->service ? point->csq : 0;
+}
+
+/**
+ * @brief Satellite passes every period_s with jitter, blocked sky, noise and outages
+ */
+static void trace_generate(struct trace *trace, int hours, int period_s, uint64_t seed)
+{
+  rng_state = seed;
+  uint32_t outage_until = 0;
+  int last = -1;
+  double phase_shift = 0.0;
+  for (uint32_t t = 0; t < (uint32_t)hours * 3600; t += 10)
+  {
+    /* the pass period drifts a little from pass to pass */
+    if (t % period_s == 0)
+      phase_shift += (rng_uniform() - 0.5) * 0.1 * period_s;
+    double phase = fmod(t + phase_shift + 10.0 * period_s, period_s) / period_s;
+    double elevation = sin(M_PI * phase);
+    double level = 5.4 * pow(elevation, 0.8) - 0.6;
+    if (rng_uniform() < 0.25)
+      level += rng_uniform() < 0.5 ? -1.0 : 1.0;
+    if (outage_until <= t && rng_uniform() < 0.002)
+      outage_until = t + 60 + (uint32_t)(rng_uniform() * 600);
+    int service = t >= outage_until;
+    int csq = level < 0.0 ? 0 : level > 5.0 ? 5 : (int)(level + 0.5);
+    /* like +CIEV, only changes are reported */
+    int value = service ? csq : -1;
+    if (value != last)
+      trace_add(trace, t * 1000, csq, service);
+    last = value;
+  }
+}
+
+/**
+ * @brief "<seconds> <csq> [service]" lines
+ */
+static int trace_load_text(struct trace *trace, FILE *file)
+{
+  char line[128];
+  while (fgets(line, sizeof line, file))
+  {
+    if (line[0] == '#')
+      continue;
+    for (char *c = line; *c; c++)
+      if (*c == ',')
+        *c = ' ';
+    double seconds;
+    int csq, service = 1;
+    int fields = sscanf(line, "%lf %d %d", &seconds, &csq, &service);
+    if (fields >= 2 && trace_add(trace, (uint32_t)(seconds * 1000.0), csq, service) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief +CSQ answers and +CIEV indicators of a capture, lines are assembled across records
+ */
+static int trace_load_capture(struct trace *trace, const uint8_t *buffer, size_t size)
+{
+  size_t offset = capture_parse_header(buffer, size);
+  if (offset == 0)
+    return -1;
+  struct capture_record record;
+  uint64_t now_us = 0;
+  char line[256];
+  size_t length = 0;
+  int csq = 0, service = 1;
+  int status;
+  while ((status = capture_next(buffer, size, &offset, &record)) == 1)
+  {
+    now_us += record.delta_us;
+    if (record.direction != CAPTURE_RX)
+      continue;
+    for (uint32_t i = 0; i < record.length; i++)
+    {
+      char c = (char)record.data[i];
+      if (c != '\r' && c != '\n')
+      {
+        if (length < sizeof line - 1)
+          line[length++] = c;
+        continue;
+      }
+      line[length] = '\0';
+      length = 0;
+      int indicator, value;
+      if (sscanf(line, "+CSQ:%d", &value) == 1)
+        csq = value;
+      else if (sscanf(line, "+CIEV:%d,%d", &indicator, &value) == 2 && indicator == 0)
+        csq = value;
+      else if (sscanf(line, "+CIEV:%d,%d", &indicator, &value) == 2 && indicator == 1)
+        service = value;
+      else
+        continue;
+      if (trace_add(trace, (uint32_t)(now_us / 1000), csq, service) != 0)
+        return -1;
+    }
+  }
+  return status < 0 ? -1 : 0;
+}
+
+static int trace_load(struct trace *trace, const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    perror(path);
+    return -1;
+  }
+  char magic[4];
+  if (fread(magic, 1, sizeof magic, file) == sizeof magic && memcmp(magic, CAPTURE_MAGIC, 4) == 0)
+  {
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *buffer = malloc(size);
+    int status = -1;
+    if (buffer != NULL && fread(buffer, 1, size, file) == (size_t)size)
+      status = trace_load_capture(trace, buffer, size);
+    free(buffer);
+    fclose(file);
+    return status;
+  }
+  rewind(file);
+  int status = trace_load_text(trace, file);
+  fclose(file);
+  return status;
+}
+
+/**
+ * @brief Feeds the forecast the trace up to a time, as +CIEV would have
+ */
+static void bench_feed(struct forecast_t *forecast, const struct trace *trace, size_t *cursor, uint32_t now_ms,
+                       uint64_t *sample_ns)
+{
+  while (*cursor < trace->count && trace->points[*cursor].time_ms <= now_ms)
+  {
+    const struct trace_point *point = &trace->points[(*cursor)++];
+    uint64_t start = bench_now_ns();
+    forecast_sample(forecast, point->time_ms, point->csq, point->service);
+    *sample_ns += bench_now_ns() - start;
+  }
+}
+
+static uint32_t bench_wait(struct forecast_t *forecast, uint32_t now_ms, uint32_t delay_ms, struct policy_result *result,
+                           uint64_t *predict_ns, uint32_t *predicts)
+{
+  struct forecast_estimate estimate;
+  uint64_t start = bench_now_ns();
+  int status = forecast_predict(forecast, now_ms, HORIZON_MS, &estimate);
+  *predict_ns += bench_now_ns() - start;
+  (*predicts)++;
+  if (status != 0 || estimate.delay_ms <= delay_ms)
+    return delay_ms;
+  result->deferred++;
+  return estimate.delay_ms;
+}
+
+static void bench_policy(enum policy policy, const struct trace *trace, uint32_t interval_ms, uint64_t seed,
+                         struct policy_result *result, uint64_t *sample_ns, uint64_t *predict_ns, uint32_t *samples,
+                         uint32_t *predicts)
+{
+  struct forecast_t *forecast = newForecast(SAMPLES, BIN_MS);
+  size_t cursor = 0;
+  uint32_t end_ms = trace->points[trace->count - 1].time_ms;
+  uint32_t now_ms = trace->points[0].time_ms;
+  memset(result, 0, sizeof *result);
+  rng_state = seed;
+
+  for (uint32_t arrival = now_ms + interval_ms; arrival + HORIZON_MS < end_ms; arrival += interval_ms)
+  {
+    if (now_ms < arrival)
+      now_ms = arrival;
+    result->messages++;
+    bench_feed(forecast, trace, &cursor, now_ms, sample_ns);
+    if (policy == POLICY_GATE)
+    {
+      now_ms += bench_wait(forecast, now_ms, 0, result, predict_ns, predicts);
+      bench_feed(forecast, trace, &cursor, now_ms, sample_ns);
+    }
+
+    int delivered = 0;
+    for (int attempt = 0; attempt < ATTEMPTS && now_ms < end_ms; attempt++)
+    {
+      int csq = trace_signal(trace, now_ms);
+      float predicted = forecast_probability(forecast, (float)csq);
+      int success = rng_uniform() < SESSION_SUCCESS[csq];
+      result->brier += (predicted - success) * (predicted - success);
+      result->predictions++;
+      now_ms += SESSION_MS;
+      result->sessions++;
+      forecast_session(forecast, csq, success);
+      bench_feed(forecast, trace, &cursor, now_ms, sample_ns);
+      if (success)
+      {
+        delivered = 1;
+        break;
+      }
+      result->failed++;
+      uint32_t delay_ms = RETRY_DELAYS_MS[attempt];
+      if (policy != POLICY_FIXED)
+        delay_ms = bench_wait(forecast, now_ms, delay_ms, result, predict_ns, predicts);
+      now_ms += delay_ms;
+      bench_feed(forecast, trace, &cursor, now_ms, sample_ns);
+    }
+    if (delivered)
+    {
+      uint32_t latency = now_ms - arrival;
+      if (result->delivered < sizeof result->latencies / sizeof result->latencies[0])
+        result->latencies[result->delivered] = latency;
+      result->delivered++;
+      result->latency_ms += latency;
+    }
+  }
+
+  struct forecast_stats stats;
+  forecast_get_stats(forecast, &stats);
+  *samples += stats.samples;
+  destroy_forecast(&forecast);
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-i interval_s] [-r seed] [-g hours [-p period_s]] [trace]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t interval_s = 900;
+  uint64_t seed = 0x9e3779b97f4a7c15ull;
+  int hours = 0;
+  int period_s = 540;
+  int option;
+  while ((option = getopt(argc, argv, "i:r:g:p:")) != -1)
+  {
+    switch (option)
+    {
+    case 'i':
+      interval_s = (uint32_t)atoi(optarg);
+      break;
+    case 'r':
+      seed = strtoull(optarg, NULL, 0);
+      break;
+    case 'g':
+      hours = atoi(optarg);
+      break;
+    case 'p':
+      period_s = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if ((hours > 0) == (optind < argc) || interval_s == 0 || period_s <= 0 || seed == 0)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  struct trace trace;
+  memset(&trace, 0, sizeof trace);
+  if (hours > 0)
+    trace_generate(&trace, hours, period_s, seed);
+  else if (trace_load(&trace, argv[optind]) != 0)
+  {
+    fprintf(stderr, "cannot read trace %s\n", argv[optind]);
+    return 1;
+  }
+  if (trace.count < 2 || trace.points[trace.count - 1].time_ms < HORIZON_MS + interval_s * 1000u)
+  {
+    fprintf(stderr, "trace too short (%zu points)\n", trace.count);
+    return 1;
+  }
+
+  double span_h = (trace.points[trace.count - 1].time_ms - trace.points[0].time_ms) / 3600e3;
+  printf("trace           %zu points over %.1f h, a message every %u s\n", trace.count, span_h, interval_s);
+  printf("policy     delivered  sessions  failed  sessions/msg  latency s p50/p90/mean  brier  deferred\n");
+
+  uint64_t sample_ns = 0, predict_ns = 0;
+  uint32_t samples = 0, predicts = 0;
+  static struct policy_result results[POLICIES];
+  for (int policy = 0; policy < POLICIES; policy++)
+  {
+    struct policy_result *r = &results[policy];
+    bench_policy((enum policy)policy, &trace, interval_s * 1000u, seed, r, &sample_ns, &predict_ns, &samples, &predicts);
+    size_t kept = r->delivered < sizeof r->latencies / sizeof r->latencies[0] ? r->delivered :
+                  sizeof r->latencies / sizeof r->latencies[0];
+    qsort(r->latencies, kept, sizeof r->latencies[0], compare_u32);
+    printf("%-8s  %4u/%-4u  %8u  %6u  %12.2f  %8.0f %6.0f %6.0f  %5.3f  %8u\n", policy_names[policy], r->delivered,
+           r->messages, r->sessions, r->failed, r->delivered ? (double)r->sessions / r->delivered : 0.0,
+           kept ? r->latencies[kept / 2] / 1e3 : 0.0, kept ? r->latencies[kept * 9 / 10] / 1e3 : 0.0,
+           r->delivered ? r->latency_ms / 1e3 / r->delivered : 0.0,
+           r->predictions ? r->brier / r->predictions : 0.0, r->deferred);
+  }
+  printf("forecast_sample  %.0f ns\n", samples ? (double)sample_ns / samples : 0.0);
+  printf("forecast_predict %.0f ns\n", predicts ? (double)predict_ns / predicts : 0.0);
+
+  /* the forecast must not cost sessions, it should save them */
+  const struct policy_result *fixed = &results[POLICY_FIXED], *retry = &results[POLICY_RETRY];
+  int status = retry->delivered >= fixed->delivered * 98 / 100 && retry->failed <= fixed->failed ? 0 : 1;
+  printf("result          %s\n", status == 0 ? "pass" : "FAIL");
+  free(trace.points);
+  return status;
+}
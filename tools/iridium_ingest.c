@@ -0,0 +1,352 @@
+/**
+ * @file iridium_ingest.c
+ * @brief Bulk ingest of RockBLOCK webhook deliveries into a columnar file
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * Reads archived webhook bodies, one form-encoded body per line (what the API server
+ * logs, or the raw POST body of a single delivery), decodes them with ground/rockblock.c
+ * and writes the rows in blocks of -b to a columnar file. -r splits every payload into
+ * the records packed by the transmit scheduler (outbox_pack() on the device). The run is
+ * single threaded, so the reported rate is messages per second per core; shard the
+ * input files across processes to use more cores.
+ *
+ * -g generates N synthetic deliveries in memory (frames of 4 to 40 byte records, up to
+ * the 340 byte MO limit) and measures the ingest path -i times, plus the SWAR and the
+ * scalar hex decoder alone. -d prints the rows of a columnar file.
+ *
+ * Usage:
+ * @code
+ * make -C tools
+ * ./tools/iridium_ingest -r -o deliveries.ircl webhook-2024-05-*.log
+ * ./tools/iridium_ingest -d deliveries.ircl | head
+ * ./tools/iridium_ingest -r -g 100000 -i 10
+ * @endcode
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rockblock.h"
+
+static double ingest_wall_s(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Reads a whole file, NULL on error
+ */
+static char *ingest_read(const char *path, size_t *length)
+{
+  FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+  if (file == NULL)
+  {
+    perror(path);
+    return NULL;
+  }
+  size_t capacity = 1 << 20;
+  size_t size = 0;
+  char *buffer = malloc(capacity);
+  while (buffer != NULL)
+  {
+    size += fread(buffer + size, 1, capacity - size, file);
+    if (size < capacity)
+      break;
+    capacity *= 2;
+    char *grown = realloc(buffer, capacity);
+    if (grown == NULL)
+      free(buffer);
+    buffer = grown;
+  }
+  if (file != stdin)
+    fclose(file);
+  *length = size;
+  return buffer;
+}
+
+/**
+ * @brief Adds every line of a buffer, flushing full tables as blocks
+ */
+static int ingest_buffer(struct rockblock_table *table, const char *buffer, size_t length, int records, FILE *output)
+{
+  const char *end = buffer + length;
+  while (buffer < end)
+  {
+    const char *line_end = memchr(buffer, '\n', end - buffer);
+    if (line_end == NULL)
+      line_end = end;
+    size_t line = line_end - buffer;
+    if (line > 0 && buffer[line - 1] == '\r')
+      line--;
+    if (line > 0)
+    {
+      if (table->rows == table->capacity)
+      {
+        if (output && rockblock_table_write(table, output) != 0)
+          return -1;
+        rockblock_table_clear(table);
+      }
+      rockblock_table_add(table, buffer, line, records);
+    }
+    buffer = line_end + 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Builds n bodies with outbox frames, one per line
+ */
+static char *ingest_generate(size_t n, size_t *length)
+{
+  size_t capacity = n * 900;
+  char *buffer = malloc(capacity);
+  if (buffer == NULL)
+    return NULL;
+  size_t size = 0;
+  uint32_t seed = 1;
+  for (size_t i = 0; i < n; i++)
+  {
+    uint8_t frame[ROCKBLOCK_DATA_MAX];
+    size_t frame_length = 0;
+    for (;;)
+    {
+      seed = seed * 1103515245 + 12345;
+      size_t record = 4 + (seed >> 16) % 37;
+      if (frame_length + 1 + record > sizeof frame)
+        break;
+      frame[frame_length++] = (uint8_t)record;
+      for (size_t j = 0; j < record; j++)
+        frame[frame_length++] = (uint8_t)(seed >> (j % 24));
+    }
+    size += snprintf(buffer + size, capacity - size,
+                     "imei=3004340638%05zu&device_type=ROCKBLOCK&serial=%zu&momsn=%zu&"
+                     "transmit_time=24-05-%02zu%%20%02zu%%3A%02zu%%3A%02zu&iridium_latitude=52.%04zu&"
+                     "iridium_longitude=-0.%04zu&iridium_cep=%zu&data=",
+                     i % 100, 1000 + i % 100, i, 1 + i % 28, i % 24, i % 60, (i * 7) % 60, i % 10000,
+                     (i * 3) % 10000, 2 + i % 9);
+    static const char digits[] = "0123456789abcdef";
+    for (size_t j = 0; j < frame_length; j++)
+    {
+      buffer[size++] = digits[frame[j] >> 4];
+      buffer[size++] = digits[frame[j] & 0x0f];
+    }
+    buffer[size++] = '\n';
+  }
+  *length = size;
+  return buffer;
+}
+
+static int ingest_bench(size_t n, int iterations, int records, size_t block)
+{
+  size_t length;
+  char *buffer = ingest_generate(n, &length);
+  struct rockblock_table *table = newRockblockTable(block);
+  FILE *sink = fopen("/dev/null", "wb");
+  if (buffer == NULL || table == NULL || sink == NULL)
+  {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  double best = 0;
+  for (int i = 0; i < iterations; i++)
+  {
+    double start = ingest_wall_s();
+    ingest_buffer(table, buffer, length, records, sink);
+    rockblock_table_write(table, sink);
+    rockblock_table_clear(table);
+    double elapsed = ingest_wall_s() - start;
+    if (best == 0 || elapsed < best)
+      best = elapsed;
+  }
+  struct rockblock_stats stats = table->stats;
+
+  /* the hex decoders alone over the data fields */
+  uint8_t out[ROCKBLOCK_DATA_MAX];
+  double decoder[2];
+  size_t hex = 0;
+  for (int d = 0; d < 2; d++)
+  {
+    double start = ingest_wall_s();
+    for (int i = 0; i < iterations; i++)
+    {
+      const char *line = buffer;
+      while (line < buffer + length)
+      {
+        const char *data = strstr(line, "&data=") + 6;
+        const char *line_end = memchr(data, '\n', buffer + length - data);
+        long size = d == 0 ? rockblock_hex_decode(data, line_end - data, out) :
+                             rockblock_hex_decode_scalar(data, line_end - data, out);
+        if (size < 0)
+          return 1;
+        if (i == 0 && d == 0)
+          hex += line_end - data;
+        line = line_end + 1;
+      }
+    }
+    decoder[d] = (ingest_wall_s() - start) / iterations;
+  }
+
+  printf("messages        %zu x %d, %.1f MB of bodies\n", n, iterations, length / 1e6);
+  printf("decoded         %llu rows, %llu records, %llu errors\n", (unsigned long long)stats.messages,
+         (unsigned long long)stats.records,
+         (unsigned long long)(stats.field_errors + stats.hex_errors + stats.frame_errors));
+  printf("ingest          %.3f s, %.0f messages/s per core, %.0f MB/s\n", best, n / best, length / best / 1e6);
+  printf("hex swar        %.2f ns/byte, %.0f MB/s of hex\n", decoder[0] * 1e9 / (hex / 2), hex / decoder[0] / 1e6);
+  printf("hex scalar      %.2f ns/byte, %.0f MB/s of hex\n", decoder[1] * 1e9 / (hex / 2), hex / decoder[1] / 1e6);
+  printf("result          %s\n", stats.messages == (uint64_t)n * iterations ? "pass" : "FAIL");
+
+  fclose(sink);
+  destroy_rockblock_table(&table);
+  free(buffer);
+  return stats.messages == (uint64_t)n * iterations ? 0 : 1;
+}
+
+static int ingest_dump(const char *path, size_t block)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    perror(path);
+    return 1;
+  }
+  struct rockblock_table *table = newRockblockTable(block);
+  if (table == NULL || rockblock_read_header(file) != 0)
+  {
+    fprintf(stderr, "%s: not a columnar file\n", path);
+    return 1;
+  }
+  int status;
+  while ((status = rockblock_table_read(table, file)) == 1)
+  {
+    size_t record = 0;
+    for (size_t row = 0; row < table->rows; row++)
+    {
+      time_t seconds = (time_t)table->transmit_time[row];
+      char text[32];
+      strftime(text, sizeof text, "%Y-%m-%d %H:%M:%S", gmtime(&seconds));
+      printf("%llu %u %u %s %.4f %.4f %u %u bytes", (unsigned long long)table->imei[row], table->serial[row],
+             table->momsn[row], text, table->latitude[row], table->longitude[row], table->cep[row],
+             table->data_offset[row + 1] - table->data_offset[row]);
+      size_t first = record;
+      while (record < table->records && table->record_row[record] == row)
+        record++;
+      if (record > first)
+        printf(", %zu records", record - first);
+      printf("\n");
+    }
+    rockblock_table_clear(table);
+  }
+  fclose(file);
+  destroy_rockblock_table(&table);
+  return status < 0 ? 1 : 0;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-r] [-b rows] -o out.ircl file...|-\n"
+                  "       %s [-r] [-b rows] [-i iterations] -g messages\n"
+                  "       %s [-b rows] -d file.ircl\n", name, name, name);
+}
+
+int main(int argc, char **argv)
+{
+  const char *output_path = NULL;
+  const char *dump_path = NULL;
+  size_t generate = 0;
+  size_t block = 4096;
+  int iterations = 5;
+  int records = 0;
+  int option;
+  while ((option = getopt(argc, argv, "o:d:g:b:i:r")) != -1)
+  {
+    switch (option)
+    {
+    case 'o':
+      output_path = optarg;
+      break;
+    case 'd':
+      dump_path = optarg;
+      break;
+    case 'g':
+      generate = (size_t)atol(optarg);
+      break;
+    case 'b':
+      block = (size_t)atol(optarg);
+      break;
+    case 'i':
+      iterations = atoi(optarg);
+      break;
+    case 'r':
+      records = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (block == 0 || iterations <= 0)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+  if (dump_path)
+    return ingest_dump(dump_path, block);
+  if (generate)
+    return ingest_bench(generate, iterations, records, block);
+  if (output_path == NULL || optind >= argc)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  FILE *output = fopen(output_path, "wb");
+  struct rockblock_table *table = newRockblockTable(block);
+  if (output == NULL || table == NULL || rockblock_write_header(output) != 0)
+  {
+    perror(output_path);
+    return 1;
+  }
+  size_t bytes = 0;
+  double start = ingest_wall_s();
+  for (int i = optind; i < argc; i++)
+  {
+    size_t length;
+    char *buffer = ingest_read(argv[i], &length);
+    if (buffer == NULL)
+      return 1;
+    bytes += length;
+    int status = ingest_buffer(table, buffer, length, records, output);
+    free(buffer);
+    if (status != 0)
+    {
+      perror(output_path);
+      return 1;
+    }
+  }
+  if (rockblock_table_write(table, output) != 0 || fclose(output) != 0)
+  {
+    perror(output_path);
+    return 1;
+  }
+  double elapsed = ingest_wall_s() - start;
+
+  struct rockblock_stats stats = table->stats;
+  printf("messages        %llu, %llu records, %llu payload bytes\n", (unsigned long long)stats.messages,
+         (unsigned long long)stats.records, (unsigned long long)stats.bytes);
+  printf("rejected        %llu field, %llu hex, %llu frame (kept without records)\n",
+         (unsigned long long)stats.field_errors, (unsigned long long)stats.hex_errors,
+         (unsigned long long)stats.frame_errors);
+  printf("elapsed         %.3f s, %.0f messages/s per core, %.1f MB/s\n", elapsed,
+         elapsed > 0 ? stats.messages / elapsed : 0.0, elapsed > 0 ? bytes / elapsed / 1e6 : 0.0);
+  destroy_rockblock_table(&table);
+  return 0;
+}
@@ -0,0 +1,303 @@
+/**
+ * @file iridium_replay.c
+ * @brief Replays a captured UART session through the iridium driver on the host
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * Feeds a capture recorded with iridium_capture_start() back into the driver, built
+ * for the host with tools/host. Every captured command (TX record) is issued through
+ * the public API so it becomes the outstanding command, every modem chunk (RX record)
+ * goes through iridium_rx_feed(), the same call uart_satcom_task makes per read, so
+ * line assembly, URC routing, response matching and iridium_satcom_process_result()
+ * all run exactly as on the device.
+ *
+ * By default records are fed as fast as possible and the cost of every RX chunk is
+ * measured, -r replays with the original inter-record timing. A command the capture
+ * shows was abandoned (the next command was written before a final result code) is
+ * cancelled with IRI_ERR_TIMEOUT, like the driver timeout did on the device.
+ *
+ * Usage:
+ * @code
+ * make -C tools
+ * ./tools/iridium_replay -n 100 marginal_signal.ircp
+ * @endcode
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "host_port.h"
+#include "../iridium.h"
+
+/**
+ * @brief Captured command text to driver command, the argument follows the prefix
+ */
+struct replay_command
+{
+  const char *prefix;
+  iridium_command_t command;
+  int has_argument;
+};
+
+static const struct replay_command replay_commands[] = {
+  { "AT+SBDMTA?", AT_SBDMTAQ, 0 },
+  { "AT+SBDMTA=", AT_SBDMTA, 1 },
+  { "AT+SBDWT=", AT_SBDWT, 1 },
+  { "AT+SBDWB=", AT_SBDWB, 1 },
+  { "AT+SBDD", AT_SBDD, 1 },
+  { "AT+CIER=", AT_CIER, 1 },
+  { "AT+SBDIXA", AT_SBDIXA, 0 },
+  { "AT+SBDIX", AT_SBDIX, 0 },
+  { "AT+SBDSX", AT_SBDSX, 0 },
+  { "AT+SBDRT", AT_SBDRT, 0 },
+  { "AT+CSQ", AT_CSQ, 0 },
+  { "AT+CGMI", AT_CGMI, 0 },
+  { "AT+CGMM", AT_CGMM, 0 },
+  { "AT+CRIS", AT_CRIS, 0 },
+  { "AT-MSSTM", AT_MSSTM, 0 },
+  { "AT&w0", AT_W0, 0 },
+  { "AT&K0", AT_K0, 0 },
+  { "ATE", AT_E, 1 },
+  { "AT", AT, 0 },
+};
+
+struct replay_stats
+{
+  uint32_t records;
+  uint32_t commands;
+  uint32_t payloads;
+  uint32_t abandoned;
+  uint32_t rx_bytes;
+  uint32_t urcs;
+  uint32_t mt_messages;
+  uint64_t feed_ns;
+  struct histogram_t feed;       /* ns per RX chunk */
+};
+
+static uint64_t replay_now_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static void replay_callback(iridium_t *satcom, iridium_command_t command, iridium_status_t status)
+{
+  (void)satcom;
+  (void)command;
+  (void)status;
+}
+
+static uint8_t *replay_load(const char *path, size_t *size)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    perror(path);
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  rewind(file);
+  uint8_t *buffer = length > 0 ? malloc(length) : NULL;
+  if (buffer == NULL || fread(buffer, 1, length, file) != (size_t)length)
+  {
+    fprintf(stderr, "%s: read failed\n", path);
+    free(buffer);
+    fclose(file);
+    return NULL;
+  }
+  fclose(file);
+  *size = (size_t)length;
+  return buffer;
+}
+
+/**
+ * @brief Issues a captured command, payload bytes (+SBDWB) are not commands
+ */
+static void replay_command(iridium_t *satcom, const struct capture_record *record, struct replay_stats *stats)
+{
+  char text[IRI_CMD_MAX];
+  size_t length = strcspn((const char *)record->data, "\r");
+  if (length > record->length)
+    length = record->length;
+  if (length < 2 || length >= sizeof text || memcmp(record->data, "AT", 2) != 0)
+  {
+    stats->payloads++;
+    return;
+  }
+  memcpy(text, record->data, length);
+  text[length] = '\0';
+
+  /* the driver only writes when idle, so a pending command was given up on */
+  if (iridium_cancel(satcom, IRI_ERR_TIMEOUT) == SAT_OK)
+    stats->abandoned++;
+
+  for (size_t i = 0; i < sizeof replay_commands / sizeof replay_commands[0]; i++)
+  {
+    const struct replay_command *known = &replay_commands[i];
+    size_t prefix = strlen(known->prefix);
+    if (strncmp(text, known->prefix, prefix) != 0 || (!known->has_argument && text[prefix] != '\0'))
+      continue;
+    iridium_send(satcom, known->command, known->has_argument ? text + prefix : NULL, false, 0);
+    stats->commands++;
+    return;
+  }
+  iridium_send_raw(satcom, text, ++satcom->c_nonce);
+  stats->commands++;
+}
+
+/**
+ * @brief Empties the queues the driver tasks would consume on the device
+ */
+static void replay_drain(iridium_t *satcom, struct replay_stats *stats)
+{
+  iridium_urc_event_t event;
+  iridium_message_t message;
+  while (xQueueReceive(satcom->urc_queue, &event, 0) == pdTRUE)
+  {
+    /* what urc_satcom_task does, so the next ring is routed too */
+    if (event.type == URC_SBDRING)
+      satcom->ring_pending = 0;
+    stats->urcs++;
+  }
+  while (xQueueReceive(satcom->message_queue, &message, 0) == pdTRUE)
+    stats->mt_messages++;
+}
+
+static int replay_run(iridium_t *satcom, const uint8_t *capture, size_t size, int realtime, struct replay_stats *stats)
+{
+  size_t offset = capture_parse_header(capture, size);
+  if (offset == 0)
+  {
+    fprintf(stderr, "not a capture (magic %s version %d)\n", CAPTURE_MAGIC, CAPTURE_VERSION);
+    return -1;
+  }
+
+  struct capture_record record;
+  int status;
+  while ((status = capture_next(capture, size, &offset, &record)) == 1)
+  {
+    if (realtime && record.delta_us > 0)
+    {
+      struct timespec delay = { .tv_sec = record.delta_us / 1000000, .tv_nsec = (long)(record.delta_us % 1000000) * 1000 };
+      nanosleep(&delay, NULL);
+    }
+    stats->records++;
+
+    if (record.direction == CAPTURE_TX)
+    {
+      replay_command(satcom, &record, stats);
+    }
+    else
+    {
+      uint64_t start = replay_now_ns();
+      iridium_rx_feed(satcom, record.data, record.length);
+      uint64_t elapsed = replay_now_ns() - start;
+      stats->feed_ns += elapsed;
+      histogram_record(&stats->feed, elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed);
+      stats->rx_bytes += record.length;
+    }
+    replay_drain(satcom, stats);
+  }
+  if (status < 0)
+    fprintf(stderr, "malformed record at offset %zu\n", offset);
+  iridium_cancel(satcom, IRI_ERR_TIMEOUT);
+  return status < 0 ? -1 : 0;
+}
+
+static void replay_report(iridium_t *satcom, const struct replay_stats *stats, int runs, double wall_s)
+{
+  iridium_metrics_t metrics;
+  iridium_metrics_snapshot(satcom, &metrics);
+
+  uint32_t completed = 0, errors = 0;
+  for (int i = 0; i < IRI_COMMAND_COUNT; i++)
+  {
+    completed += metrics.latency[i].count;
+    errors += metrics.errors[i];
+  }
+
+  printf("runs            %d\n", runs);
+  printf("records         %u (%u commands, %u payloads)\n", stats->records, stats->commands, stats->payloads);
+  printf("completed       %u ok, %u error, %u abandoned\n", completed, errors, stats->abandoned);
+  printf("sessions        %u\n", metrics.sessions);
+  printf("urcs            %u, mt messages %u, orphaned lines %d\n", stats->urcs, stats->mt_messages, 
+         satcom->orphaned_lines);
+  for (int i = 0; i < IRI_COMMAND_COUNT; i++)
+    if (metrics.latency[i].count > 0 || metrics.errors[i] > 0)
+      printf("  command %-6d %u ok, %u error\n", i, metrics.latency[i].count, metrics.errors[i]);
+  printf("rx bytes        %u\n", stats->rx_bytes);
+  if (stats->feed.count > 0)
+  {
+    printf("rx feed ns      p50 %u p90 %u p99 %u max %u\n", histogram_percentile(&stats->feed, 50), 
+           histogram_percentile(&stats->feed, 90), histogram_percentile(&stats->feed, 99), stats->feed.max);
+    printf("rx throughput   %.1f MB/s (parser only)\n", stats->feed_ns ? stats->rx_bytes * 1e3 / stats->feed_ns : 0.0);
+  }
+  printf("wall            %.3f s\n", wall_s);
+}
+
+int main(int argc, char **argv)
+{
+  int realtime = 0;
+  int runs = 1;
+  int option;
+  while ((option = getopt(argc, argv, "rn:v")) != -1)
+  {
+    switch (option)
+    {
+    case 'r':
+      realtime = 1;
+      break;
+    case 'n':
+      runs = atoi(optarg);
+      break;
+    case 'v':
+      host_log_level = ESP_LOG_INFO;
+      break;
+    default:
+      optind = argc;
+      break;
+    }
+  }
+  if (optind != argc - 1 || runs < 1)
+  {
+    fprintf(stderr, "usage: %s [-r] [-n runs] [-v] capture.ircp\n"
+                    "  -r  original timing, default is as fast as possible\n"
+                    "  -n  replay the capture n times\n"
+                    "  -v  driver log\n", argv[0]);
+    return 2;
+  }
+
+  size_t size;
+  uint8_t *capture = replay_load(argv[optind], &size);
+  if (capture == NULL)
+    return 1;
+
+  iridium_t *satcom = iridium_default_configuration();
+  satcom->callback = &replay_callback;
+  satcom->uart_number = UART_NUM_1;
+  /* only the captured commands go out, no time sync after the sessions */
+  satcom->time_refresh_ms = 0;
+  if (iridium_init(satcom) != SAT_OK)
+  {
+    fprintf(stderr, "driver init failed\n");
+    return 1;
+  }
+  struct replay_stats stats;
+  memset(&stats, 0, sizeof stats);
+  uint64_t start = replay_now_ns();
+  int status = 0;
+  for (int run = 0; run < runs && status == 0; run++)
+    status = replay_run(satcom, capture, size, realtime, &stats);
+  double wall_s = (replay_now_ns() - start) / 1e9;
+
+  replay_report(satcom, &stats, runs, wall_s);
+  free(capture);
+  return status == 0 ? 0 : 1;
+}
@@ -0,0 +1,792 @@
+/**
+ * @file iridium_sim.c
+ * @brief Runs the iridium driver against a simulated modem on a simulated clock
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * Builds iridium.c unmodified against tools/host, starts it with iridium_config()
+ * like the device does, and answers it with the simulated modem in host/host_modem.c.
+ * The driver and the modem share a scaled vclock, so the retry back-off of
+ * iridium_tx_message() (minutes of airtime and delays on a real modem) and the MT
+ * drain after a SBDRING run in a fraction of a second while every task stays real.
+ *
+ * Scenarios:
+ * - retry, the next N sessions fail (-f, default 4) before the message gets through
+ * - ring, N MT messages (-m, default 3) are queued at the gateway and a ring is sent
+ * - sleep, N messages (-m) ten minutes apart with the power manager putting the modem
+ *   to sleep after 30 s idle, reports the duty cycle and estimated energy
+ * - window, a record every minute for -H hours (default 2) into the transmit scheduler with
+ *   15 minute windows, an urgent record and MT traffic on the way, reports the windows
+ * - time, -MSSTM before the first satellite contact, then the time sync piggybacked on
+ *   sessions over -H hours (default 2, 7 or more to see a refresh), reports the clock error
+ * - query, ring config, identity and a CSQ poll every second for a minute through the
+ *   query cache, a session in between, reports hits and misses per command
+ * - reliable, N messages (-m times ten) through reliable delivery to the backend of
+ *   ground/reliable_ground.c, which loses every fifth frame on its first arrival and one
+ *   acknowledgement, reports delivery and resends
+ * - mt, N MT messages (-m) after a ring, two more reads of the same MT buffer and, after a
+ *   lost MTMSN, two more messages held for order, reports the MTMSN window
+ * - budget, a flapping link against an airtime budget of 4 sessions an hour and 8 a day, then an
+ *   urgent message on the reserve and a message every 15 minutes until the daily cap, reports
+ *   what the budget allowed and the counters persisted in NVS
+ * - outage, a position and a battery value every minute under their keys, an event and a note
+ *   with a 30 minute TTL every 20 minutes and an alarm half way for -H hours (default 2) with
+ *   15 minute windows, no signal for all but the first and last 20 minutes, reports what the
+ *   backend got, the overwrites and the expired notes
+ *
+ * Usage:
+ * @code
+ * make -C tools
+ * ./tools/iridium_sim -s 1000 retry
+ * ./tools/iridium_sim -m 5 ring
+ * ./tools/iridium_sim -m 6 sleep
+ * ./tools/iridium_sim window
+ * ./tools/iridium_sim -H 13 time
+ * ./tools/iridium_sim query
+ * ./tools/iridium_sim reliable
+ * ./tools/iridium_sim mt
+ * ./tools/iridium_sim -H 3 outage
+ * ./tools/iridium_sim budget
+ * @endcode
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "host_port.h"
+#include "host_modem.h"
+#include "reliable_ground.h"
+#include "../iridium.h"
+
+static pthread_mutex_t sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int sim_messages = 0;
+
+static double sim_wall_s(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void sim_callback(iridium_t *satcom, iridium_command_t command, iridium_status_t status)
+{
+  (void)satcom;
+  (void)command;
+  (void)status;
+}
+
+static void sim_message_callback(iridium_t *satcom, char *data)
+{
+  (void)satcom;
+  printf("  mt message    \"%s\"\n", data);
+  pthread_mutex_lock(&sim_mutex);
+  sim_messages++;
+  pthread_mutex_unlock(&sim_mutex);
+}
+
+static int sim_retry(iridium_t *satcom, struct host_modem *modem, int failures)
+{
+  char message[] = "sim retry";
+  host_modem_fail_sessions(modem, failures, MO_NO_NETWORK_SERVICE);
+  iridium_result_t result = iridium_tx_message(satcom, message);
+  printf("  tx message    status %d error %d, %u sessions, %u failed, %u delivered\n", result.status,
+         result.error, modem->sessions, modem->sessions_failed, modem->delivered);
+  return result.status == SAT_OK ? 0 : 1;
+}
+
+static int sim_ring(iridium_t *satcom, struct host_modem *modem, int messages)
+{
+  for (int i = 0; i < messages; i++)
+  {
+    char text[32];
+    snprintf(text, sizeof text, "sim mt %d", i + 1);
+    host_modem_queue_mt(modem, text);
+  }
+  host_modem_ring(modem);
+
+  /* the drain is done by urc_satcom_task, wait in virtual time for the last message */
+  const struct vclock_t *clock = satcom->clock;
+  uint64_t deadline = clock->now_us(clock) + (uint64_t)messages * 60 * 1000000 + 60 * 1000000;
+  for (;;)
+  {
+    pthread_mutex_lock(&sim_mutex);
+    int received = sim_messages;
+    pthread_mutex_unlock(&sim_mutex);
+    if (received >= messages || clock->now_us(clock) > deadline)
+    {
+      printf("  mt drained    %d of %d, %u sessions\n", received, messages, modem->sessions);
+      return received >= messages ? 0 : 1;
+    }
+    clock->sleep_us(clock, 100000);
+  }
+}
+
+#define SIM_SLEEP_PIN 4
+
+static int sim_sleep(iridium_t *satcom, struct host_modem *modem, int messages)
+{
+  const struct vclock_t *clock = satcom->clock;
+  satcom->power_idle_ms = 30000;
+  host_modem_power(modem, SIM_SLEEP_PIN, 400);
+
+  int failed = 0;
+  for (int i = 0; i < messages; i++)
+  {
+    char text[32];
+    snprintf(text, sizeof text, "sim report %d", i + 1);
+    iridium_result_t result = iridium_tx_message(satcom, text);
+    if (result.status != SAT_OK)
+      failed++;
+    clock->sleep_us(clock, 600 * 1000000ull);
+  }
+
+  iridium_power_stats_t power;
+  iridium_power_stats(satcom, &power);
+  static const char *names[IRI_POWER_STATES] = { "sleep", "waking", "idle", "session" };
+  uint32_t total_ms = 0;
+  for (int i = 0; i < IRI_POWER_STATES; i++)
+    total_ms += power.time_ms[i];
+  for (int i = 0; i < IRI_POWER_STATES; i++)
+    printf("  %-12s  %8.1f s %5.1f%% %10.1f mJ\n", names[i], power.time_ms[i] / 1e3,
+           total_ms ? 100.0 * power.time_ms[i] / total_ms : 0.0, power.energy_uj[i] / 1e3);
+  /* the same time without sleeping, idle except for the sessions */
+  double always_on_mj = ((double)(total_ms - power.time_ms[IRI_POWER_SESSION]) * IRI_POWER_IDLE_UA + 
+                         (double)power.time_ms[IRI_POWER_SESSION] * IRI_POWER_SESSION_UA) * IRI_POWER_SUPPLY_MV / 1e9;
+  printf("  energy        %.1f mJ, always on %.1f mJ\n", power.energy_total_uj / 1e3, always_on_mj);
+  printf("  wakes         %u (%u failed, %u modem boots), sleeps %u, deferred %u\n", power.wakes,
+         power.wake_failures, modem->boots, power.sleeps, power.deferred);
+  if (power.wake_latency.count > 0)
+    printf("  wake ms       p50 %u max %u\n", histogram_percentile(&power.wake_latency, 50), power.wake_latency.max);
+  printf("  tx message    %d of %d delivered\n", messages - failed, messages);
+  return failed == 0 && power.sleeps > 0 ? 0 : 1;
+}
+
+static int sim_window(iridium_t *satcom, struct host_modem *modem, int hours)
+{
+  const struct vclock_t *clock = satcom->clock;
+  satcom->power_idle_ms = 30000;
+  host_modem_power(modem, SIM_SLEEP_PIN, 400);
+
+  int records = hours * 60;
+  int rejected = 0;
+  for (int i = 0; i < records; i++)
+  {
+    uint8_t record[20];
+    memset(record, 0, sizeof record);
+    snprintf((char *)record, sizeof record, "rec %d", i);
+    /* an alarm half way, it must not wait for the cadence */
+    uint32_t max_delay_ms = i == records / 2 + 7 ? 60000 : 0;
+    if (iridium_schedule(satcom, record, sizeof record, max_delay_ms, 0) != SAT_OK)
+      rejected++;
+    if (i == records / 2)
+    {
+      host_modem_queue_mt(modem, "sim window mt 1");
+      host_modem_queue_mt(modem, "sim window mt 2");
+    }
+    clock->sleep_us(clock, 60 * 1000000ull);
+  }
+  /* flush the tail */
+  iridium_window_open(satcom);
+  while (satcom->window_request)
+    clock->sleep_us(clock, 1000000);
+  clock->sleep_us(clock, 120 * 1000000ull);
+
+  iridium_window_stats_t window;
+  iridium_window_stats(satcom, &window);
+  printf("  windows       %u (%u failed), %u sessions, max %u per window\n", window.windows, window.failed,
+         window.sessions, window.max_sessions);
+  printf("  sent          %u records in %u frames, %u queued, %u rejected\n", window.records, window.frames,
+         (unsigned)window.queued, rejected);
+  printf("  mt            %u messages, received %d\n", window.mt_messages, sim_messages);
+  printf("  duration ms   p50 %u p90 %u max %u\n", histogram_percentile(&window.duration_ms, 50),
+         histogram_percentile(&window.duration_ms, 90), window.duration_ms.max);
+  printf("  modem         %u messages delivered, %u boots\n", modem->delivered, modem->boots);
+
+  iridium_power_stats_t power;
+  iridium_power_stats(satcom, &power);
+  uint32_t total_ms = 0;
+  for (int i = 0; i < IRI_POWER_STATES; i++)
+    total_ms += power.time_ms[i];
+  printf("  asleep        %.1f%%, %.1f J\n", total_ms ? 100.0 * power.time_ms[IRI_POWER_SLEEP] / total_ms : 0.0,
+         power.energy_total_uj / 1e6);
+  return window.records == (uint32_t)(records - rejected) && modem->delivered == window.frames && 
+         window.mt_messages == 2 ? 0 : 1;
+}
+
+/**
+ * @brief Clock error of the driver against the simulated modem, whose tick count starts at virtual 0
+ */
+static int64_t sim_time_error_ms(iridium_t *satcom, uint32_t *age_ms)
+{
+  uint64_t utc_ms;
+  if (iridium_time_utc_ms(satcom, &utc_ms, age_ms) != SAT_OK)
+    return INT64_MAX;
+  uint64_t expected_ms = IRI_MSSTM_EPOCH_MS + satcom->clock->now_us(satcom->clock) / 1000;
+  return (int64_t)(utc_ms - expected_ms);
+}
+
+static int sim_time(iridium_t *satcom, struct host_modem *modem, int hours)
+{
+  const struct vclock_t *clock = satcom->clock;
+  int failed = 0;
+
+  /* no satellite seen yet */
+  iridium_result_t early = iridium_time_sync(satcom);
+  printf("  before session %s\n", early.error == IRI_ERR_NO_SERVICE ? "no network service" : "unexpected answer");
+  if (early.error != IRI_ERR_NO_SERVICE)
+    failed++;
+
+  /* a session every hour, the sync rides along when it is older than time_refresh_ms */
+  int64_t worst_ms = 0;
+  for (int i = 0; i < hours; i++)
+  {
+    char text[32];
+    snprintf(text, sizeof text, "sim time %d", i + 1);
+    if (iridium_tx_message(satcom, text).status != SAT_OK)
+      failed++;
+    clock->sleep_us(clock, 3600 * 1000000ull);
+
+    uint32_t age_ms = 0;
+    int64_t error_ms = sim_time_error_ms(satcom, &age_ms);
+    if (error_ms == INT64_MAX)
+    {
+      failed++;
+      continue;
+    }
+    if (llabs(error_ms) > llabs(worst_ms))
+      worst_ms = error_ms;
+    printf("  hour %-3d      error %+lld ms, sync age %.0f s\n", i + 1, (long long)error_ms, age_ms / 1e3);
+  }
+
+  iridium_time_t time = satcom->time;
+  int expected_syncs = 1 + (hours - 1) * 3600000 / satcom->time_refresh_ms;
+  printf("  syncs         %u (expected %d), %u without service, drift %d ppm\n", time.syncs, expected_syncs,
+         time.no_service, time.drift_ppm);
+  printf("  sessions      %u, worst error %+lld ms\n", modem->sessions, (long long)worst_ms);
+  /* one 90 ms tick plus the half round trip of the estimate */
+  return failed == 0 && time.syncs == (uint32_t)expected_syncs && llabs(worst_ms) <= 100 ? 0 : 1;
+}
+
+static int sim_query(iridium_t *satcom, struct host_modem *modem)
+{
+  const struct vclock_t *clock = satcom->clock;
+  int failed = 0;
+
+  /* +SBDMTA? is written through by the ring config */
+  if (iridium_config_ring(satcom, true).status != SAT_OK)
+    failed++;
+  for (int i = 0; i < 3; i++)
+    if (iridium_system_spec(satcom) != SAT_OK)
+      failed++;
+  for (int i = 0; i < 60; i++)
+  {
+    if (iridium_query(satcom, AT_CSQ).status != SAT_OK)
+      failed++;
+    clock->sleep_us(clock, 1000000);
+  }
+  /* the session drops the cached +SBDSX even inside its TTL */
+  iridium_query(satcom, AT_SBDSX);
+  iridium_query(satcom, AT_SBDSX);
+  if (iridium_tx_message(satcom, "sim query").status != SAT_OK)
+    failed++;
+  iridium_query(satcom, AT_SBDSX);
+
+  iridium_cache_stats_t cache;
+  iridium_cache_stats(satcom, &cache);
+  static const struct { iridium_command_t command; const char *name; } queries[] = {
+    { AT_CGMI, "+CGMI" }, { AT_CGMM, "+CGMM" }, { AT_CSQ, "+CSQ" }, { AT_SBDSX, "+SBDSX" }, { AT_SBDMTAQ, "+SBDMTA?" },
+  };
+  for (size_t i = 0; i < sizeof queries / sizeof queries[0]; i++)
+    printf("  %-12s  %3u hits %3u misses\n", queries[i].name, cache.command_hits[queries[i].command],
+           cache.command_misses[queries[i].command]);
+  printf("  cache         %u hits, %u misses (%u expired), %u invalidated, %u stored in NVS\n", cache.hits,
+         cache.misses, cache.expired, cache.invalidated, cache.nvs_stored);
+  printf("  identity      %s / %s\n", satcom->manufacturer_identification, satcom->model_identification);
+  printf("  modem         %u commands\n", modem->commands);
+  return failed == 0 && cache.command_misses[AT_CGMI] == 1 && cache.command_misses[AT_CGMM] == 1 && 
+         cache.command_misses[AT_SBDMTAQ] == 0 && cache.command_misses[AT_CSQ] <= 60 / (IRI_CACHE_CSQ_TTL_MS / 1000) + 1 && 
+         cache.command_misses[AT_SBDSX] == 2 && cache.nvs_stored == 2 ? 0 : 1;
+}
+
+#define SIM_RELIABLE_MAX 256
+
+/**
+ * @brief The backend behind the simulated gateway
+ */
+struct sim_backend
+{
+  struct reliable_ground *ground;
+  struct host_modem *modem;
+  uint8_t lost[65536 / 8];               /**< Frames already lost once */
+  int copies[SIM_RELIABLE_MAX];          /**< Deliveries to the application per message */
+  uint32_t frames_lost;
+  uint32_t acks_sent;
+  uint32_t acks_lost;
+  uint32_t acks_lost_seqs;               /**< Sequence numbers of the lost acknowledgement */
+};
+
+static void sim_backend_deliver(void *ctx, const uint8_t *data, size_t length)
+{
+  struct sim_backend *backend = ctx;
+  if (length < RELIABLE_HEADER)
+    return;
+  /* every fifth frame is lost between the gateway and the backend, once */
+  uint16_t seq = (uint16_t)(data[1] | data[2] << 8);
+  if (seq % 5 == 2 && !(backend->lost[seq >> 3] >> (seq & 7) & 1))
+  {
+    backend->lost[seq >> 3] |= (uint8_t)(1 << (seq & 7));
+    backend->frames_lost++;
+    return;
+  }
+  const uint8_t *payload;
+  size_t payload_length;
+  int index;
+  if (reliable_ground_receive(backend->ground, data, length, &payload, &payload_length) == 1 && 
+      sscanf((const char *)payload, "reliable %d", &index) == 1 && index >= 0 && index < SIM_RELIABLE_MAX)
+    backend->copies[index]++;
+
+  char ack[RELIABLE_GROUND_ACK_MAX];
+  uint32_t pending = backend->ground->pending;
+  if (reliable_ground_ack(backend->ground, ack, sizeof ack) == 0)
+    return;
+  /* the third acknowledgement never reaches the device */
+  if (++backend->acks_sent == 3)
+  {
+    backend->acks_lost++;
+    backend->acks_lost_seqs += pending - backend->ground->pending;
+    return;
+  }
+  host_modem_queue_mt(backend->modem, ack);
+  host_modem_ring(backend->modem);
+}
+
+static int sim_reliable(iridium_t *satcom, struct host_modem *modem, int messages)
+{
+  const struct vclock_t *clock = satcom->clock;
+  static struct sim_backend backend;
+  backend.ground = newReliableGround();
+  backend.modem = modem;
+  if (backend.ground == NULL || messages > SIM_RELIABLE_MAX)
+    return 1;
+  host_modem_set_delivery(modem, &sim_backend_deliver, &backend);
+
+  int rejected = 0;
+  for (int i = 0; i < messages; i++)
+  {
+    char text[32];
+    int length = snprintf(text, sizeof text, "reliable %d", i) + 1;
+    if (iridium_reliable_send(satcom, (const uint8_t *)text, length, NULL) != SAT_OK)
+      rejected++;
+    clock->sleep_us(clock, 30 * 1000000ull);
+  }
+  /* until everything is acknowledged, timeouts included */
+  uint64_t deadline = clock->now_us(clock) + (uint64_t)satcom->reliable_ack_timeout_ms * 3000;
+  while (reliable_count(satcom->reliable) > 0 && clock->now_us(clock) < deadline)
+    clock->sleep_us(clock, 1000000);
+  host_modem_set_delivery(modem, NULL, NULL);
+
+  int once = 0, missing = 0;
+  for (int i = 0; i < messages; i++)
+  {
+    once += backend.copies[i] == 1;
+    missing += backend.copies[i] == 0;
+  }
+  struct reliable_stats stats;
+  iridium_reliable_stats(satcom, &stats);
+  struct reliable_ground_stats *ground = &backend.ground->stats;
+  printf("  messages      %d pushed, %d rejected, %d delivered once, %d missing\n", messages, rejected, once, missing);
+  printf("  device        %u frames, %u resent (%u gaps, %u timeouts), %u pending\n", stats.sent, stats.resent,
+         stats.gaps, stats.timeouts, (unsigned)reliable_count(satcom->reliable));
+  printf("  backend       %u frames, %u lost, %u duplicates\n", ground->frames + backend.frames_lost,
+         backend.frames_lost, ground->duplicates);
+  printf("  acks          %u sent, %u lost (%u messages), %u applied, %u messages acked\n", backend.acks_sent,
+         backend.acks_lost, backend.acks_lost_seqs, stats.acks, stats.acked);
+  printf("  modem         %u sessions, %u delivered\n", modem->sessions, modem->delivered);
+  /* only the lost frames and the messages of the lost acknowledgement go out again */
+  int pass = rejected == 0 && once == messages && reliable_count(satcom->reliable) == 0 && 
+             stats.resent <= backend.frames_lost + backend.acks_lost_seqs;
+  destroy_reliable_ground(&backend.ground);
+  return pass ? 0 : 1;
+}
+
+static int sim_mt_wait(iridium_t *satcom, int messages, uint64_t timeout_us)
+{
+  const struct vclock_t *clock = satcom->clock;
+  uint64_t deadline = clock->now_us(clock) + timeout_us;
+  for (;;)
+  {
+    pthread_mutex_lock(&sim_mutex);
+    int received = sim_messages;
+    pthread_mutex_unlock(&sim_mutex);
+    if (received >= messages || clock->now_us(clock) > deadline)
+      return received;
+    clock->sleep_us(clock, 100000);
+  }
+}
+
+static int sim_mt(iridium_t *satcom, struct host_modem *modem, int messages)
+{
+  const struct vclock_t *clock = satcom->clock;
+  for (int i = 0; i < messages; i++)
+  {
+    char text[32];
+    snprintf(text, sizeof text, "sim mt %d", i + 1);
+    host_modem_queue_mt(modem, text);
+  }
+  host_modem_ring(modem);
+  sim_mt_wait(satcom, messages, (uint64_t)messages * 60 * 1000000 + 60 * 1000000);
+
+  /* the buffer still holds the last message, reading it again must not deliver it again */
+  iridium_send(satcom, AT_SBDRT, NULL, true, 500);
+  iridium_send(satcom, AT_SBDRT, NULL, true, 500);
+
+  /* one message lost at the gateway, the two after it wait for it until the hold runs out */
+  host_modem_skip_mt(modem, 1);
+  host_modem_queue_mt(modem, "sim mt after gap 1");
+  host_modem_queue_mt(modem, "sim mt after gap 2");
+  host_modem_ring(modem);
+  int received = sim_mt_wait(satcom, messages + 2, (uint64_t)satcom->mt_order_hold_ms * 1000 + 180 * 1000000ull);
+  clock->sleep_us(clock, 5 * 1000000);
+  pthread_mutex_lock(&sim_mutex);
+  received = sim_messages;
+  pthread_mutex_unlock(&sim_mutex);
+
+  struct sequence_stats stats;
+  iridium_mt_stats(satcom, &stats);
+  printf("  mt            %d of %d delivered, %u reads\n", received, messages + 2, stats.received);
+  printf("  window        %u duplicates, %u gaps, %u late, %u reordered, %u held\n", stats.duplicates, stats.gaps,
+         stats.late, stats.reordered, stats.held);
+  return received == messages + 2 && stats.duplicates == 2 && stats.gaps == 1 && stats.reordered == 2 && 
+         stats.held == 0 ? 0 : 1;
+}
+
+#define SIM_OUTAGE_KEY_POSITION 1
+#define SIM_OUTAGE_KEY_BATTERY 2
+#define SIM_OUTAGE_EVENTS 64
+
+/**
+ * @brief What the backend got from the outage scenario
+ */
+struct sim_outage
+{
+  int events[SIM_OUTAGE_EVENTS];         /**< Copies per event */
+  int notes[SIM_OUTAGE_EVENTS];          /**< Copies per note */
+  int alarms;
+  int alarm_first;                       /**< The alarm led its frame */
+  int position;                          /**< Last minute of the position values, -1 for none */
+  int battery;
+  uint32_t values;                       /**< Keyed records received */
+};
+
+static void sim_outage_deliver(void *ctx, const uint8_t *data, size_t length)
+{
+  struct sim_outage *outage = ctx;
+  /* split the frame back into its [len][record] records */
+  for (size_t offset = 0; offset < length && offset + 1 + data[offset] <= length; offset += 1 + data[offset])
+  {
+    char record[OUTBOX_RECORD_MAX + 1];
+    memcpy(record, data + offset + 1, data[offset]);
+    record[data[offset]] = '\0';
+    int index;
+    if (strcmp(record, "alarm") == 0)
+    {
+      outage->alarms++;
+      outage->alarm_first = offset == 0;
+    }
+    else if (sscanf(record, "event %d", &index) == 1 && index >= 0 && index < SIM_OUTAGE_EVENTS)
+      outage->events[index]++;
+    else if (sscanf(record, "note %d", &index) == 1 && index >= 0 && index < SIM_OUTAGE_EVENTS)
+      outage->notes[index]++;
+    else if (sscanf(record, "pos %d", &index) == 1 && ++outage->values)
+      outage->position = index;
+    else if (sscanf(record, "bat %d", &index) == 1 && ++outage->values)
+      outage->battery = index;
+  }
+}
+
+static void sim_outage_signal(struct host_modem *modem, int csq)
+{
+  pthread_mutex_lock(&modem->mutex);
+  modem->csq = csq;
+  pthread_mutex_unlock(&modem->mutex);
+}
+
+static int sim_outage(iridium_t *satcom, struct host_modem *modem, int hours)
+{
+  const struct vclock_t *clock = satcom->clock;
+  static struct sim_outage outage = { .position = -1, .battery = -1 };
+  host_modem_set_delivery(modem, &sim_outage_deliver, &outage);
+
+  int minutes = hours * 60;
+  int events = 0, notes = 0, rejected = 0;
+  for (int i = 0; i < minutes && events < SIM_OUTAGE_EVENTS; i++)
+  {
+    if (i == 20)
+      sim_outage_signal(modem, 0);
+    if (i == minutes - 20)
+      sim_outage_signal(modem, 4);
+    char record[20];
+    int length = snprintf(record, sizeof record, "pos %d", i);
+    if (iridium_schedule_latest(satcom, SIM_OUTAGE_KEY_POSITION, (uint8_t *)record, length, 0, 0) != SAT_OK)
+      rejected++;
+    length = snprintf(record, sizeof record, "bat %d", i);
+    if (iridium_schedule_latest(satcom, SIM_OUTAGE_KEY_BATTERY, (uint8_t *)record, length, 0, 0) != SAT_OK)
+      rejected++;
+    if (i % 20 == 10)
+    {
+      length = snprintf(record, sizeof record, "event %d", events++);
+      if (iridium_schedule(satcom, (uint8_t *)record, length, 0, 0) != SAT_OK)
+        rejected++;
+    }
+    /* only worth sending within half an hour */
+    if (i % 20 == 5)
+    {
+      length = snprintf(record, sizeof record, "note %d", notes++);
+      if (iridium_schedule(satcom, (uint8_t *)record, length, 0, 30 * 60000) != SAT_OK)
+        rejected++;
+    }
+    /* in the middle of the outage, it must lead the first frame that gets through */
+    if (i == minutes / 2 && iridium_schedule(satcom, (uint8_t *)"alarm", 5, 10 * 60000, 0) != SAT_OK)
+      rejected++;
+    clock->sleep_us(clock, 60 * 1000000ull);
+  }
+  /* flush the tail */
+  iridium_window_open(satcom);
+  while (satcom->window_request)
+    clock->sleep_us(clock, 1000000);
+  clock->sleep_us(clock, 120 * 1000000ull);
+  host_modem_set_delivery(modem, NULL, NULL);
+
+  int once = 0, notes_once = 0, notes_twice = 0;
+  for (int i = 0; i < events; i++)
+    once += outage.events[i] == 1;
+  for (int i = 0; i < notes; i++)
+  {
+    notes_once += outage.notes[i] == 1;
+    notes_twice += outage.notes[i] > 1;
+  }
+  uint32_t position = 0, battery = 0;
+  iridium_schedule_overwrites(satcom, SIM_OUTAGE_KEY_POSITION, &position);
+  iridium_schedule_overwrites(satcom, SIM_OUTAGE_KEY_BATTERY, &battery);
+  iridium_window_stats_t window;
+  iridium_window_stats(satcom, &window);
+  printf("  windows       %u (%u failed), %u sessions\n", window.windows, window.failed, window.sessions);
+  printf("  events        %d pushed, %d delivered once\n", events, once);
+  printf("  notes         %d pushed, %d delivered once, %u expired\n", notes, notes_once, window.outbox.expired);
+  printf("  alarm         %d delivered, %s\n", outage.alarms, outage.alarm_first ? "first in its frame" : "behind other records");
+  printf("  values        %u delivered, last position %d battery %d of %d\n", outage.values, outage.position,
+         outage.battery, minutes - 1);
+  printf("  overwrites    %u (position %u, battery %u), %d rejected\n", window.outbox.overwrites, position, battery,
+         rejected);
+  printf("  outbox        %u frames, high water %u bytes, %u queued\n", window.outbox.frames,
+         (unsigned)window.outbox.high_water, (unsigned)window.queued);
+  return rejected == 0 && once == events && notes_twice == 0 && window.outbox.expired > 0 && 
+         notes_once + (int)window.outbox.expired == notes && outage.alarms == 1 && outage.alarm_first && 
+         outage.position == minutes - 1 && outage.battery == minutes - 1 && 
+         position > 0 && battery > 0 && window.queued == 0 ? 0 : 1;
+}
+
+static int sim_budget(iridium_t *satcom, struct host_modem *modem)
+{
+  const struct vclock_t *clock = satcom->clock;
+  char message[] = "sim budget";
+
+  /* a flapping link, the retries of one message drain the bucket down to the urgent reserve */
+  host_modem_fail_sessions(modem, 1000, MO_NO_NETWORK_SERVICE);
+  iridium_result_t flapping = iridium_tx_message(satcom, message);
+  uint32_t flapping_sessions = modem->sessions;
+  iridium_result_t next = iridium_tx_message(satcom, message);
+  host_modem_fail_sessions(modem, 0, 0);
+
+  /* the reserve is still there for an alarm, not for routine traffic */
+  iridium_result_t urgent = iridium_tx_message_priority(satcom, message, IRI_PRIORITY_URGENT);
+  iridium_result_t drained = iridium_tx_message(satcom, message);
+
+  clock->sleep_us(clock, 3600 * 1000000ull);
+  int delivered = 0, capped = 0;
+  for (int i = 0; i < 12; i++)
+  {
+    iridium_result_t result = iridium_tx_message(satcom, message);
+    delivered += result.status == SAT_OK;
+    capped += result.error == IRI_ERR_BUDGET;
+    clock->sleep_us(clock, 15 * 60 * 1000000ull);
+  }
+
+  struct budget_stats stats;
+  iridium_budget_stats(satcom, &stats);
+  struct budget_counters counters = { 0 };
+  nvs_handle_t handle;
+  size_t length = sizeof counters;
+  if (nvs_open(IRI_CACHE_NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK)
+  {
+    nvs_get_blob(handle, "iri_budget", &counters, &length);
+    nvs_close(handle);
+  }
+  printf("  flapping      error %d after %u sessions, next message error %d\n", flapping.error, flapping_sessions,
+         next.error);
+  printf("  urgent        status %d, normal after it error %d\n", urgent.status, drained.error);
+  printf("  hourly        %d delivered, %d refused\n", delivered, capped);
+  printf("  budget        %u sessions, %u bytes, %u refunded, denied %u/%u/%u (rate %u, day %u, month %u)\n",
+         stats.sessions, stats.bytes, stats.refunded, stats.denied[BUDGET_URGENT], stats.denied[BUDGET_NORMAL],
+         stats.denied[BUDGET_BACKGROUND], stats.denied_rate, stats.denied_day, stats.denied_month);
+  printf("  left          %u tokens, %u sessions today\n", stats.tokens, stats.day_sessions_left);
+  printf("  nvs           day %u, %u sessions, %u bytes\n", counters.day, counters.day_sessions, counters.day_bytes);
+  printf("  modem         %u sessions, %u delivered\n", modem->sessions, modem->delivered);
+  return flapping.error == IRI_ERR_BUDGET && flapping_sessions == 3 && next.error == IRI_ERR_BUDGET && 
+         urgent.status == SAT_OK && drained.error == IRI_ERR_BUDGET && delivered == 4 && capped == 8 && 
+         stats.denied_day == 8 && stats.day_sessions_left == 0 && modem->sessions == stats.sessions && 
+         counters.day_sessions == 8 && counters.day_bytes == stats.bytes ? 0 : 1;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-s speedup] [-f failures] [-m messages] [-H hours] [-v] retry|ring|sleep|window|time|query|reliable|mt|outage|budget\n", name);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t speedup = 1000;
+  int failures = 4;
+  int messages = 3;
+  int hours = 2;
+  int option;
+  while ((option = getopt(argc, argv, "s:f:m:H:v")) != -1)
+  {
+    switch (option)
+    {
+    case 's':
+      speedup = (uint32_t)atoi(optarg);
+      break;
+    case 'f':
+      failures = atoi(optarg);
+      break;
+    case 'm':
+      messages = atoi(optarg);
+      break;
+    case 'H':
+      hours = atoi(optarg);
+      break;
+    case 'v':
+      host_log_level = ESP_LOG_INFO;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (optind != argc - 1 || speedup == 0)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+  const char *scenario = argv[optind];
+
+  struct vclock_sim_t sim;
+  vclock_sim_init(&sim, 0, speedup);
+
+  struct host_modem modem;
+  if (host_modem_init(&modem, UART_NUM_1, &sim.clock) != 0)
+  {
+    fprintf(stderr, "modem thread failed\n");
+    return 1;
+  }
+
+  iridium_t *satcom = iridium_default_configuration();
+  satcom->clock = &sim.clock;
+  satcom->callback = &sim_callback;
+  satcom->message_callback = &sim_message_callback;
+  satcom->uart_number = UART_NUM_1;
+  if (strcmp(scenario, "sleep") == 0 || strcmp(scenario, "window") == 0)
+    satcom->gpio_sleep_pin_number = SIM_SLEEP_PIN;
+  if (strcmp(scenario, "window") == 0 || strcmp(scenario, "outage") == 0)
+    satcom->window_interval_ms = 15 * 60000;
+  if (strcmp(scenario, "reliable") == 0)
+  {
+    satcom->reliable_slots = 16;
+    satcom->reliable_ack_timeout_ms = 10 * 60000;
+  }
+  if (strcmp(scenario, "budget") == 0)
+  {
+    satcom->budget_limits.sessions_per_hour = 4;
+    satcom->budget_limits.day_sessions = 8;
+  }
+  if (strcmp(scenario, "mt") == 0)
+  {
+    satcom->mt_order_depth = 4;
+    satcom->mt_order_hold_ms = 60000;
+  }
+
+  double wall = sim_wall_s();
+  uint64_t start_us = sim.clock.now_us(&sim.clock);
+  if (iridium_config(satcom) != SAT_OK)
+  {
+    fprintf(stderr, "iridium_config failed\n");
+    return 1;
+  }
+
+  int status;
+  printf("scenario        %s, speedup %u\n", scenario, speedup);
+  if (strcmp(scenario, "retry") == 0)
+  {
+    status = sim_retry(satcom, &modem, failures);
+  }
+  else if (strcmp(scenario, "ring") == 0)
+  {
+    status = sim_ring(satcom, &modem, messages);
+  }
+  else if (strcmp(scenario, "sleep") == 0)
+  {
+    status = sim_sleep(satcom, &modem, messages);
+  }
+  else if (strcmp(scenario, "window") == 0)
+  {
+    status = sim_window(satcom, &modem, hours);
+  }
+  else if (strcmp(scenario, "time") == 0)
+  {
+    status = sim_time(satcom, &modem, hours);
+  }
+  else if (strcmp(scenario, "query") == 0)
+  {
+    status = sim_query(satcom, &modem);
+  }
+  else if (strcmp(scenario, "reliable") == 0)
+  {
+    status = sim_reliable(satcom, &modem, messages * 10);
+  }
+  else if (strcmp(scenario, "mt") == 0)
+  {
+    status = sim_mt(satcom, &modem, messages);
+  }
+  else if (strcmp(scenario, "outage") == 0)
+  {
+    status = sim_outage(satcom, &modem, hours);
+  }
+  else if (strcmp(scenario, "budget") == 0)
+  {
+    status = sim_budget(satcom, &modem);
+  }
+  else
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  double virtual_s = (sim.clock.now_us(&sim.clock) - start_us) / 1e6;
+  wall = sim_wall_s() - wall;
+  printf("commands        %u\n", modem.commands);
+  printf("virtual         %.1f s\n", virtual_s);
+  printf("wall            %.3f s\n", wall);
+  printf("result          %s\n", status == 0 ? "pass" : "FAIL");
+
+  /* the driver goes first, a task stopping on its way out may still talk to the modem */
+  iridium_deinit(satcom);
+  free(satcom);
+  host_modem_stop(&modem);
+  return status;
+}
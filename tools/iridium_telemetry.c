@@ -0,0 +1,305 @@
+/**
+ * @file iridium_telemetry.c
+ * @brief Decodes telemetry frames on the host and benchmarks the encoding
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * Built from the same telemetry.c as the device, so a schema descriptor logged or stored
+ * by the device (-s hex, -S file) decodes its frames exactly. Frames are given as hex
+ * arguments or as hex lines on stdin ("-"), every record is printed as one CSV line.
+ *
+ * -g runs a synthetic GPS track of N one-second fixes (time, position, altitude, speed,
+ * course, battery, temperature) through the encoder into 340 byte frames, decodes them
+ * again and compares the records per message and the encode cost with the same fixes
+ * sent as CSV text, one line per fix, the way a string for iridium_tx_message() would
+ * carry them. -w writes the descriptor of that track schema.
+ *
+ * Usage:
+ * @code
+ * make -C tools
+ * ./tools/iridium_telemetry -g 3600
+ * ./tools/iridium_telemetry -w gps.schema
+ * ./tools/iridium_telemetry -S gps.schema 5a1c...
+ * @endcode
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../telemetry.h"
+
+#define TELEMETRY_SBD_MAX 340
+
+static double telemetry_wall_s(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void telemetry_track_schema(struct telemetry_schema *schema)
+{
+  telemetry_schema_init(schema);
+  telemetry_schema_field(schema, "time", 0, 2147483647, 0, TELEMETRY_DELTA);
+  telemetry_schema_field(schema, "lat", -90, 90, 5, TELEMETRY_DELTA);
+  telemetry_schema_field(schema, "lon", -180, 180, 5, TELEMETRY_DELTA);
+  telemetry_schema_field(schema, "alt", -500, 9000, 1, TELEMETRY_DELTA);
+  telemetry_schema_field(schema, "speed", 0, 100, 1, TELEMETRY_DELTA);
+  telemetry_schema_field(schema, "course", 0, 360, 0, TELEMETRY_DELTA);
+  telemetry_schema_field(schema, "battery", 3, 4.3, 2, 0);
+  telemetry_schema_field(schema, "temp", -40, 85, 1, TELEMETRY_DELTA);
+}
+
+/**
+ * @brief Decodes hex into bytes, returns the length or -1
+ */
+static long telemetry_unhex(const char *hex, uint8_t *out, size_t max)
+{
+  size_t length = strcspn(hex, "\r\n");
+  if (length % 2 != 0 || length / 2 > max)
+    return -1;
+  for (size_t i = 0; i < length / 2; i++)
+  {
+    unsigned byte;
+    if (sscanf(hex + 2 * i, "%2x", &byte) != 1)
+      return -1;
+    out[i] = (uint8_t)byte;
+  }
+  return (long)(length / 2);
+}
+
+static int telemetry_print(const struct telemetry_schema *schema, const char *hex)
+{
+  uint8_t frame[TELEMETRY_SBD_MAX * 4];
+  static double values[TELEMETRY_RECORDS_MAX * TELEMETRY_FIELDS_MAX];
+  long length = telemetry_unhex(hex, frame, sizeof frame);
+  long records = length < 0 ? -1 : telemetry_decode(schema, frame, length, values, TELEMETRY_RECORDS_MAX);
+  if (records < 0)
+  {
+    fprintf(stderr, "frame does not decode with schema %02x\n", schema->id);
+    return 1;
+  }
+  for (long r = 0; r < records; r++)
+  {
+    for (size_t i = 0; i < schema->count; i++)
+      printf("%s%.*f", i ? "," : "", schema->fields[i].decimals, values[r * schema->count + i]);
+    printf("\n");
+  }
+  return 0;
+}
+
+static int telemetry_bench(size_t fixes)
+{
+  struct telemetry_schema schema;
+  telemetry_track_schema(&schema);
+  size_t fields = schema.count;
+
+  /* a walk at 5-15 m/s with slow turns, altitude and temperature drift */
+  double *track = malloc(fixes * fields * sizeof *track);
+  if (track == NULL)
+    return 1;
+  uint32_t seed = 7;
+  double lat = 52.38671, lon = -0.29384, alt = 120.0, course = 45, temp = 14.0;
+  for (size_t i = 0; i < fixes; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    double speed = 5 + (seed >> 16) % 100 / 10.0;
+    course = fmod(course + ((int)((seed >> 8) % 7) - 3) + 360, 360);
+    lat += speed * cos(course * M_PI / 180) / 111320;
+    lon += speed * sin(course * M_PI / 180) / (111320 * cos(lat * M_PI / 180));
+    alt += ((int)((seed >> 4) % 11) - 5) / 10.0;
+    temp += ((int)((seed >> 12) % 3) - 1) / 10.0;
+    double row[] = { 1714000000 + (double)i, lat, lon, alt, speed, round(course), 4.1 - i * 1e-5, temp };
+    memcpy(track + i * fields, row, sizeof row);
+  }
+
+  /* the text baseline, one CSV line per fix */
+  size_t text_messages = 0;
+  size_t text_length = 0;
+  for (size_t i = 0; i < fixes; i++)
+  {
+    char line[160];
+    size_t length = 0;
+    for (size_t f = 0; f < fields; f++)
+      length += snprintf(line + length, sizeof line - length, "%s%.*f", f ? "," : "", schema.fields[f].decimals,
+                         track[i * fields + f]);
+    if (text_length == 0 || text_length + 1 + length > TELEMETRY_SBD_MAX)
+    {
+      text_messages++;
+      text_length = length;
+    }
+    else
+    {
+      text_length += 1 + length;
+    }
+  }
+
+  uint8_t (*frames)[TELEMETRY_SBD_MAX] = malloc(fixes * TELEMETRY_SBD_MAX);
+  size_t *lengths = malloc(fixes * sizeof *lengths);
+  double *decoded = malloc(fixes * fields * sizeof *decoded);
+  if (frames == NULL || lengths == NULL || decoded == NULL)
+    return 1;
+  struct telemetry_encoder encoder;
+  telemetry_encoder_init(&encoder, &schema);
+  size_t messages = 0;
+  double start = telemetry_wall_s();
+  telemetry_begin(&encoder, frames[0], TELEMETRY_SBD_MAX);
+  for (size_t i = 0; i < fixes; i++)
+  {
+    if (telemetry_add(&encoder, track + i * fields) != 0)
+    {
+      lengths[messages] = telemetry_end(&encoder);
+      telemetry_begin(&encoder, frames[++messages], TELEMETRY_SBD_MAX);
+      telemetry_add(&encoder, track + i * fields);
+    }
+  }
+  lengths[messages++] = telemetry_end(&encoder);
+  double encode = telemetry_wall_s() - start;
+
+  size_t records = 0;
+  start = telemetry_wall_s();
+  for (size_t m = 0; m < messages; m++)
+  {
+    long count = telemetry_decode(&schema, frames[m], lengths[m], decoded + records * fields, fixes - records);
+    if (count < 0)
+    {
+      fprintf(stderr, "frame %zu does not decode\n", m);
+      return 1;
+    }
+    records += count;
+  }
+  double decode = telemetry_wall_s() - start;
+
+  /* every value must come back within half a unit of its precision */
+  double worst = 0;
+  for (size_t i = 0; i < records * fields; i++)
+  {
+    double unit = pow(10, -schema.fields[i % fields].decimals);
+    double error = fabs(decoded[i] - track[i]) / unit;
+    if (error > worst)
+      worst = error;
+  }
+  int pass = records == fixes && worst <= 0.5 + 1e-6;
+
+  uint8_t descriptor[TELEMETRY_DESCRIPTOR_MAX];
+  size_t descriptor_length = telemetry_schema_serialize(&schema, descriptor, sizeof descriptor);
+  printf("schema          %zu fields, id %02x, %zu byte descriptor\n", fields, schema.id, descriptor_length);
+  printf("fixes           %zu\n", fixes);
+  printf("text            %zu messages, %.1f fixes per message\n", text_messages, (double)fixes / text_messages);
+  printf("telemetry       %zu messages, %.1f fixes per message, %.1f bits per fix\n", messages,
+         (double)fixes / messages, 8.0 * encoder.stats.frame_bytes / fixes);
+  printf("gain            %.1fx fewer messages\n", (double)text_messages / messages);
+  printf("encode          %.0f ns per fix\n", encode * 1e9 / fixes);
+  printf("decode          %.0f ns per fix\n", decode * 1e9 / fixes);
+  printf("worst error     %.3f of the precision\n", worst);
+  printf("result          %s\n", pass ? "pass" : "FAIL");
+  free(track);
+  free(frames);
+  free(lengths);
+  free(decoded);
+  return pass ? 0 : 1;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s -g fixes\n"
+                  "       %s -w descriptor\n"
+                  "       %s -S descriptor|-s hex frame...|-\n", name, name, name);
+}
+
+int main(int argc, char **argv)
+{
+  size_t fixes = 0;
+  const char *write_path = NULL;
+  const char *schema_path = NULL;
+  const char *schema_hex = NULL;
+  int option;
+  while ((option = getopt(argc, argv, "g:w:S:s:")) != -1)
+  {
+    switch (option)
+    {
+    case 'g':
+      fixes = (size_t)atol(optarg);
+      break;
+    case 'w':
+      write_path = optarg;
+      break;
+    case 'S':
+      schema_path = optarg;
+      break;
+    case 's':
+      schema_hex = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (fixes)
+    return telemetry_bench(fixes);
+
+  struct telemetry_schema schema;
+  uint8_t descriptor[TELEMETRY_DESCRIPTOR_MAX];
+  long length = -1;
+  if (write_path)
+  {
+    telemetry_track_schema(&schema);
+    length = (long)telemetry_schema_serialize(&schema, descriptor, sizeof descriptor);
+    FILE *file = fopen(write_path, "wb");
+    if (file == NULL || fwrite(descriptor, 1, length, file) != (size_t)length || fclose(file) != 0)
+    {
+      perror(write_path);
+      return 1;
+    }
+    printf("schema          id %02x, %ld bytes\n", schema.id, length);
+    return 0;
+  }
+  if (schema_path)
+  {
+    FILE *file = fopen(schema_path, "rb");
+    if (file == NULL)
+    {
+      perror(schema_path);
+      return 1;
+    }
+    length = (long)fread(descriptor, 1, sizeof descriptor, file);
+    fclose(file);
+  }
+  else if (schema_hex)
+  {
+    length = telemetry_unhex(schema_hex, descriptor, sizeof descriptor);
+  }
+  if (length < 0 || optind >= argc)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+  if (telemetry_schema_parse(&schema, descriptor, length) != 0)
+  {
+    fprintf(stderr, "malformed schema descriptor\n");
+    return 1;
+  }
+
+  for (size_t i = 0; i < schema.count; i++)
+    printf("%s%s", i ? "," : "", schema.fields[i].name);
+  printf("\n");
+  int status = 0;
+  for (int i = optind; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-") != 0)
+    {
+      status |= telemetry_print(&schema, argv[i]);
+      continue;
+    }
+    char line[TELEMETRY_SBD_MAX * 8];
+    while (fgets(line, sizeof line, stdin))
+      status |= telemetry_print(&schema, line);
+  }
+  return status;
+}
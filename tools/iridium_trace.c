@@ -0,0 +1,228 @@
+/**
+ * @file iridium_trace.c
+ * @brief Offline decoder for the iridium driver binary trace
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * Decodes a trace dump into one line per event. The input is either a raw dump
+ * (struct trace_header followed by the entries) or a serial monitor log holding the
+ * IRTRACE hex lines written by iridium_trace_dump(), anything else in the log is
+ * ignored.
+ *
+ * Usage:
+ * @code
+ * idf.py monitor | tee monitor.log
+ * ./iridium_trace monitor.log
+ * @endcode
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "../trace.h"
+
+#define LINE_MAX_LENGTH 512
+
+/**
+ * @brief Reads a little-endian value, the dump is written by an ESP32
+ */
+static uint32_t le32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t le16(const uint8_t *p)
+{
+  return (uint16_t)(p[0] | p[1] << 8);
+}
+
+/**
+ * @brief Appends bytes to a growing buffer
+ *
+ * @return 0 on success, -1 if allocation failed
+ */
+static int append(uint8_t **buffer, size_t *size, size_t *capacity, const uint8_t *data, size_t length)
+{
+  if (*size + length > *capacity)
+  {
+    size_t grown = *capacity ? *capacity * 2 : 4096;
+    while (grown < *size + length)
+      grown *= 2;
+    uint8_t *next = realloc(*buffer, grown);
+    if (next == NULL)
+      return -1;
+    *buffer = next;
+    *capacity = grown;
+  }
+  memcpy(*buffer + *size, data, length);
+  *size += length;
+  return 0;
+}
+
+/**
+ * @brief Decodes the hex digits following an IRTRACE: marker
+ *
+ * @return The number of decoded bytes
+ */
+static size_t decode_hex(const char *hex, uint8_t *out, size_t max)
+{
+  size_t n = 0;
+  while (n < max && isxdigit((unsigned char)hex[0]) && isxdigit((unsigned char)hex[1]))
+  {
+    char pair[3] = { hex[0], hex[1], '\0' };
+    out[n++] = (uint8_t)strtoul(pair, NULL, 16);
+    hex += 2;
+  }
+  return n;
+}
+
+/**
+ * @brief Loads a raw dump or the IRTRACE lines of a log
+ *
+ * @return The dump bytes (caller frees), NULL on error
+ */
+static uint8_t *load(FILE *file, size_t *size)
+{
+  uint8_t *buffer = NULL;
+  size_t capacity = 0;
+  *size = 0;
+
+  char magic[4];
+  size_t got = fread(magic, 1, sizeof magic, file);
+  if (got == sizeof magic && memcmp(magic, TRACE_MAGIC, sizeof magic) == 0)
+  {
+    uint8_t chunk[4096];
+    if (append(&buffer, size, &capacity, (const uint8_t *)magic, got) != 0)
+      return NULL;
+    while ((got = fread(chunk, 1, sizeof chunk, file)) > 0)
+      if (append(&buffer, size, &capacity, chunk, got) != 0)
+        return NULL;
+    return buffer;
+  }
+
+  rewind(file);
+  char line[LINE_MAX_LENGTH];
+  uint8_t bytes[LINE_MAX_LENGTH / 2];
+  while (fgets(line, sizeof line, file) != NULL)
+  {
+    const char *marker = strstr(line, "IRTRACE:");
+    if (marker == NULL)
+      continue;
+    size_t n = decode_hex(marker + strlen("IRTRACE:"), bytes, sizeof bytes);
+    if (append(&buffer, size, &capacity, bytes, n) != 0)
+      return NULL;
+  }
+  return buffer;
+}
+
+/**
+ * @brief Prints the payload with non-printable bytes escaped
+ */
+static void print_data(const uint8_t *data, uint16_t length)
+{
+  size_t shown = length < TRACE_DATA_MAX ? length : TRACE_DATA_MAX;
+  putchar('"');
+  for (size_t i = 0; i < shown; i++)
+  {
+    if (data[i] == '\r')
+      fputs("\\r", stdout);
+    else if (data[i] == '\n')
+      fputs("\\n", stdout);
+    else if (isprint(data[i]) && data[i] != '"')
+      putchar(data[i]);
+    else
+      printf("\\x%02x", data[i]);
+  }
+  putchar('"');
+  if (length > shown)
+    printf("+%u", (unsigned)(length - shown));
+}
+
+/**
+ * @brief Prints every entry of a dump
+ *
+ * @return 0 on success, 1 if the dump is malformed
+ */
+static int decode(const uint8_t *dump, size_t size)
+{
+  if (size < sizeof(struct trace_header) || memcmp(dump, TRACE_MAGIC, 4) != 0)
+  {
+    fprintf(stderr, "no trace header\n");
+    return 1;
+  }
+  uint16_t version = le16(dump + 4);
+  uint16_t entry_size = le16(dump + 6);
+  uint32_t count = le32(dump + 8);
+  uint32_t dropped = le32(dump + 12);
+  if (version != TRACE_VERSION || entry_size != sizeof(struct trace_entry))
+  {
+    fprintf(stderr, "unsupported trace version %u entry size %u\n", version, entry_size);
+    return 1;
+  }
+
+  size_t available = (size - sizeof(struct trace_header)) / entry_size;
+  if (available < count)
+  {
+    fprintf(stderr, "truncated dump, %zu of %u entries\n", available, count);
+    count = (uint32_t)available;
+  }
+  printf("# %u events, %u dropped\n", count, dropped);
+
+  const uint8_t *entry = dump + sizeof(struct trace_header);
+  uint32_t previous_us = 0;
+  uint32_t expected_seq = 0;
+  for (uint32_t i = 0; i < count; i++, entry += entry_size)
+  {
+    uint32_t seq = le32(entry + 0);
+    uint32_t time_us = le32(entry + 4);
+    uint16_t event = le16(entry + 8);
+    uint16_t length = le16(entry + 10);
+    int32_t nonce = (int32_t)le32(entry + 12);
+    int32_t arg = (int32_t)le32(entry + 16);
+
+    if (i > 0 && seq != expected_seq)
+      printf("# gap of %u events\n", seq - expected_seq);
+    expected_seq = seq + 1;
+
+    /* unsigned difference survives the 32-bit wrap */
+    uint32_t delta_us = (i > 0) ? time_us - previous_us : 0;
+    previous_us = time_us;
+
+    printf("%8u %10u.%06u +%-9u %-10s nonce=%-5d arg=%-6d ", seq, time_us / 1000000, time_us % 1000000, 
+           delta_us, trace_event_name(event), nonce, arg);
+    print_data(entry + 20, length);
+    putchar('\n');
+  }
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  FILE *file = stdin;
+  if (argc > 2 || (argc == 2 && strcmp(argv[1], "-h") == 0))
+  {
+    fprintf(stderr, "usage: %s [trace.bin | monitor.log]\n", argv[0]);
+    return 2;
+  }
+  if (argc == 2 && (file = fopen(argv[1], "rb")) == NULL)
+  {
+    perror(argv[1]);
+    return 2;
+  }
+
+  size_t size;
+  uint8_t *dump = load(file, &size);
+  if (file != stdin)
+    fclose(file);
+  if (dump == NULL)
+  {
+    fprintf(stderr, "no trace found\n");
+    return 1;
+  }
+
+  int status = decode(dump, size);
+  free(dump);
+  return status;
+}
@@ -0,0 +1,133 @@
+/**
+ * @file trace.c
+ * @brief Implementation of the lock-free binary trace ring
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This file contains the implementation of the trace ring declared in trace.h.
+ * A writer claims a sequence number, clears the slot sequence, fills the slot and
+ * publishes the sequence last. A reader only accepts a slot whose sequence matches
+ * before and after the copy.
+ */
+
+#include "trace.h"
+
+_Static_assert(sizeof(struct trace_entry) == 32, "trace_entry layout is shared with the decoder");
+_Static_assert(sizeof(struct trace_header) == 16, "trace_header layout is shared with the decoder");
+
+static const char *trace_event_names[TRACE_EV_COUNT] = {
+  "NONE", "RX_CHUNK", "RX_LINE", "URC", "ORPHAN", "QUEUE", "QUEUE_FULL",
+  "DISPATCH", "TX", "TX_BINARY", "COMPLETE", "TIMEOUT", "OVERFLOW",
+  "POWER"
+};
+
+/**
+ * @brief Initializes an empty trace ring over caller provided storage
+ *
+ * @param trace Pointer to the ring
+ * @param storage Entry storage
+ * @param capacity Number of entries in storage, must be a power of two
+ * @return 0 on success, -1 if the capacity is not a power of two
+ */
+int trace_init(struct trace_t *trace, struct trace_entry *storage, uint32_t capacity)
+{
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+    return -1;
+  memset(storage, 0, capacity * sizeof *storage);
+  trace->entries = storage;
+  trace->capacity = capacity;
+  /* sequence 0 marks a slot being written */
+  __atomic_store_n(&trace->head, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/**
+ * @brief Records an event, overwriting the oldest one when the ring is full
+ *
+ * @param trace Pointer to the ring
+ * @param time_us The timestamp in us
+ * @param event The enum trace_event id
+ * @param nonce The command nonce, 0 when none
+ * @param arg The event specific argument
+ * @param data The payload or NULL
+ * @param length The payload length
+ */
+void trace_record(struct trace_t *trace, uint32_t time_us, uint16_t event, int32_t nonce, int32_t arg, 
+                  const void *data, size_t length)
+{
+  if (trace->entries == NULL)
+    return;
+
+  uint32_t seq = __atomic_fetch_add(&trace->head, 1, __ATOMIC_RELAXED);
+  if (seq == 0)
+    seq = __atomic_fetch_add(&trace->head, 1, __ATOMIC_RELAXED);
+  struct trace_entry *entry = &trace->entries[seq & (trace->capacity - 1)];
+
+  __atomic_store_n(&entry->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  entry->time_us = time_us;
+  entry->event = event;
+  entry->length = length > UINT16_MAX ? UINT16_MAX : (uint16_t)length;
+  entry->nonce = nonce;
+  entry->arg = arg;
+  size_t copy = (data == NULL) ? 0 : (length < TRACE_DATA_MAX ? length : TRACE_DATA_MAX);
+  memcpy(entry->data, data == NULL ? "" : data, copy);
+  memset(entry->data + copy, 0, TRACE_DATA_MAX - copy);
+  __atomic_store_n(&entry->seq, seq, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Copies the recorded events, oldest first
+ *
+ * @param trace Pointer to the ring
+ * @param out Storage for the copied entries
+ * @param max Maximum number of entries to copy
+ * @param dropped Pointer to store the number of events lost to overwrites, can be NULL
+ * @return The number of copied entries
+ *
+ * @note Entries written concurrently with the copy are skipped
+ */
+size_t trace_snapshot(struct trace_t *trace, struct trace_entry *out, size_t max, uint32_t *dropped)
+{
+  if (trace->entries == NULL)
+    return 0;
+
+  uint32_t head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+  uint32_t first = 1;
+  if (head - 1 > trace->capacity)
+    first = head - trace->capacity;
+  if (head - first > max)
+    first = head - (uint32_t)max;
+
+  size_t count = 0;
+  for (uint32_t seq = first; seq != head; seq++)
+  {
+    struct trace_entry *entry = &trace->entries[seq & (trace->capacity - 1)];
+    if (__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) != seq)
+      continue;
+    out[count] = *entry;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    /* overwritten while copying */
+    if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) != seq)
+      continue;
+    out[count].seq = seq;
+    count++;
+  }
+
+  if (dropped)
+    *dropped = (head - 1 > trace->capacity) ? head - 1 - trace->capacity : 0;
+  return count;
+}
+
+/**
+ * @brief Name of a trace event id
+ *
+ * @param event The enum trace_event id
+ * @return The event name, "?" for an unknown id
+ */
+const char *trace_event_name(uint16_t event)
+{
+  if (event >= TRACE_EV_COUNT)
+    return "?";
+  return trace_event_names[event];
+}
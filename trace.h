@@ -0,0 +1,154 @@
+/**
+ * @file trace.h
+ * @brief A lock-free binary trace ring for the driver hot paths
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This header file provides a fixed-size trace ring of binary events. Recording an
+ * event claims a slot with a single atomic increment and copies a few words plus the
+ * first TRACE_DATA_MAX bytes of the payload, so it never formats, blocks or allocates
+ * and can be called from any task. When the ring is full the oldest events are
+ * overwritten, the sequence numbers tell a reader what was lost.
+ *
+ * The entry and dump layouts are shared with the offline decoder (tools/iridium_trace.c),
+ * both are little-endian with no padding.
+ *
+ * Usage example:
+ * @code
+ * static struct trace_entry storage[64];
+ * struct trace_t trace;
+ * trace_init(&trace, storage, 64);
+ * trace_record(&trace, now_us, TRACE_EV_RX_LINE, nonce, 0, line, strlen(line));
+ * @endcode
+ */
+
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+/**
+ * @brief Payload bytes kept per entry, longer payloads are truncated
+ */
+#define TRACE_DATA_MAX 12
+
+/**
+ * @brief Dump header magic and layout version
+ */
+#define TRACE_MAGIC "IRTR"
+#define TRACE_VERSION 1
+
+/**
+ * @brief Trace event ids, append only, the decoder depends on the values
+ */
+enum trace_event
+{
+  TRACE_EV_NONE = 0,             /**< Unused */
+  TRACE_EV_RX_CHUNK = 1,         /**< UART read, arg = bytes */
+  TRACE_EV_RX_LINE = 2,          /**< Assembled response line */
+  TRACE_EV_URC = 3,              /**< Unsolicited result code, arg = iridium_urc_t */
+  TRACE_EV_ORPHAN = 4,           /**< Line with no outstanding command, arg = orphan count */
+  TRACE_EV_QUEUE = 5,            /**< Command queued, arg = priority */
+  TRACE_EV_QUEUE_FULL = 6,       /**< Command rejected, arg = priority */
+  TRACE_EV_DISPATCH = 7,         /**< Command popped, arg = priority class */
+  TRACE_EV_TX = 8,               /**< Command written, arg = iridium_command_t */
+  TRACE_EV_TX_BINARY = 9,        /**< +SBDWB payload written, arg = bytes */
+  TRACE_EV_COMPLETE = 10,        /**< Command completed, arg = iridium_error_t */
+  TRACE_EV_TIMEOUT = 11,         /**< Command timed out */
+  TRACE_EV_OVERFLOW = 12,        /**< UART FIFO/buffer overflow */
+  TRACE_EV_POWER = 13,           /**< Power state change, arg is the new state */
+  TRACE_EV_COUNT                 /**< Number of event ids */
+};
+
+/**
+ * @brief A single trace event, 32 bytes
+ */
+struct trace_entry
+{
+  uint32_t seq;                  /**< Sequence number, 0 while the slot is being written */
+  uint32_t time_us;              /**< Timestamp, wraps after ~71 minutes */
+  uint16_t event;                /**< enum trace_event */
+  uint16_t length;               /**< Full payload length before truncation */
+  int32_t nonce;                 /**< Command nonce, 0 when none */
+  int32_t arg;                   /**< Event specific argument */
+  char data[TRACE_DATA_MAX];     /**< Start of the payload */
+};
+
+/**
+ * @brief Header of a trace dump, followed by count entries
+ */
+struct trace_header
+{
+  char magic[4];                 /**< TRACE_MAGIC */
+  uint16_t version;              /**< TRACE_VERSION */
+  uint16_t entry_size;           /**< sizeof(struct trace_entry) */
+  uint32_t count;                /**< Entries in the dump */
+  uint32_t dropped;              /**< Entries overwritten before the dump */
+};
+
+/**
+ * @brief Trace ring structure
+ */
+struct trace_t
+{
+  struct trace_entry *entries;   /**< Caller provided storage */
+  uint32_t capacity;             /**< Number of entries, a power of two */
+  uint32_t head;                 /**< Next sequence number, updated atomically */
+};
+
+/**
+ * @brief Initializes an empty trace ring over caller provided storage
+ *
+ * @param trace Pointer to the ring
+ * @param storage Entry storage
+ * @param capacity Number of entries in storage, must be a power of two
+ * @return 0 on success, -1 if the capacity is not a power of two
+ */
+int trace_init(struct trace_t *trace, struct trace_entry *storage, uint32_t capacity);
+
+/**
+ * @brief Records an event, overwriting the oldest one when the ring is full
+ *
+ * @param trace Pointer to the ring
+ * @param time_us The timestamp in us
+ * @param event The enum trace_event id
+ * @param nonce The command nonce, 0 when none
+ * @param arg The event specific argument
+ * @param data The payload or NULL
+ * @param length The payload length
+ */
+void trace_record(struct trace_t *trace, uint32_t time_us, uint16_t event, int32_t nonce, int32_t arg, 
+                  const void *data, size_t length);
+
+/**
+ * @brief Copies the recorded events, oldest first
+ *
+ * @param trace Pointer to the ring
+ * @param out Storage for the copied entries
+ * @param max Maximum number of entries to copy
+ * @param dropped Pointer to store the number of events lost to overwrites, can be NULL
+ * @return The number of copied entries
+ *
+ * @note Entries written concurrently with the copy are skipped
+ */
+size_t trace_snapshot(struct trace_t *trace, struct trace_entry *out, size_t max, uint32_t *dropped);
+
+/**
+ * @brief Name of a trace event id
+ *
+ * @param event The enum trace_event id
+ * @return The event name, "?" for an unknown id
+ */
+const char *trace_event_name(uint16_t event);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_H_INCLUDED */
@@ -0,0 +1,141 @@
+/**
+ * @file vclock.c
+ * @brief Implementation of the simulated clock
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This file contains the implementation of the simulated clock declared in vclock.h.
+ * Sleeps wait on a condition variable in wall-time slices and re-check virtual time,
+ * so both a speedup and vclock_sim_advance() end them on time.
+ */
+
+#include <time.h>
+#include <errno.h>
+
+#include "vclock.h"
+
+/* longest wall-time slice of a sleep, bounds the reaction to vclock_sim_advance() */
+#define VCLOCK_SLICE_US 1000
+
+static uint64_t vclock_real_us(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+}
+
+/**
+ * @brief Absolute CLOCK_REALTIME deadline us of wall time from now, for pthread waits
+ */
+static struct timespec vclock_deadline(uint64_t us)
+{
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  uint64_t ns = (uint64_t)deadline.tv_nsec + us * 1000u;
+  deadline.tv_sec += ns / 1000000000u;
+  deadline.tv_nsec = ns % 1000000000u;
+  return deadline;
+}
+
+/**
+ * @brief Virtual time, the caller holds the mutex
+ */
+static uint64_t vclock_sim_now_locked(const struct vclock_sim_t *sim)
+{
+  if (sim->speedup == 0)
+    return sim->base_us;
+  return sim->base_us + (vclock_real_us() - sim->real_base_us) * sim->speedup;
+}
+
+/**
+ * @brief Wall time a virtual duration takes, at least 1 us and at most one slice
+ */
+static uint64_t vclock_sim_slice(const struct vclock_sim_t *sim, uint64_t us)
+{
+  uint64_t real = sim->speedup ? us / sim->speedup : VCLOCK_SLICE_US;
+  if (real == 0)
+    real = 1;
+  return real > VCLOCK_SLICE_US ? VCLOCK_SLICE_US : real;
+}
+
+static uint64_t vclock_sim_now(const struct vclock_t *clock)
+{
+  struct vclock_sim_t *sim = (struct vclock_sim_t *)clock;
+  pthread_mutex_lock(&sim->mutex);
+  uint64_t now = vclock_sim_now_locked(sim);
+  pthread_mutex_unlock(&sim->mutex);
+  return now;
+}
+
+static void vclock_sim_sleep(const struct vclock_t *clock, uint64_t us)
+{
+  struct vclock_sim_t *sim = (struct vclock_sim_t *)clock;
+  pthread_mutex_lock(&sim->mutex);
+  uint64_t wake = vclock_sim_now_locked(sim) + us;
+  uint64_t now;
+  while ((now = vclock_sim_now_locked(sim)) < wake)
+  {
+    struct timespec deadline = vclock_deadline(vclock_sim_slice(sim, wake - now));
+    pthread_cond_timedwait(&sim->advanced, &sim->mutex, &deadline);
+  }
+  sim->slept_us += us;
+  pthread_mutex_unlock(&sim->mutex);
+}
+
+static void vclock_sim_wait(const struct vclock_t *clock, pthread_cond_t *cond, pthread_mutex_t *mutex, uint64_t us)
+{
+  struct vclock_sim_t *sim = (struct vclock_sim_t *)clock;
+  pthread_mutex_lock(&sim->mutex);
+  uint64_t real = vclock_sim_slice(sim, us);
+  pthread_mutex_unlock(&sim->mutex);
+
+  /* one slice, the caller re-checks its condition and virtual time */
+  struct timespec deadline = vclock_deadline(real);
+  pthread_cond_timedwait(cond, mutex, &deadline);
+}
+
+/**
+ * @brief Initializes a simulated clock
+ *
+ * @param sim Pointer to the clock
+ * @param start_us The initial virtual time
+ * @param speedup Virtual us per wall us, 0 for a manual clock
+ */
+void vclock_sim_init(struct vclock_sim_t *sim, uint64_t start_us, uint32_t speedup)
+{
+  sim->clock.now_us = vclock_sim_now;
+  sim->clock.sleep_us = vclock_sim_sleep;
+  sim->clock.wait_us = vclock_sim_wait;
+  sim->base_us = start_us;
+  sim->real_base_us = vclock_real_us();
+  sim->speedup = speedup;
+  sim->slept_us = 0;
+  pthread_mutex_init(&sim->mutex, NULL);
+  pthread_cond_init(&sim->advanced, NULL);
+}
+
+/**
+ * @brief Moves virtual time forward and wakes the sleepers that are due
+ *
+ * @param sim Pointer to the clock
+ * @param us The amount of virtual time
+ */
+void vclock_sim_advance(struct vclock_sim_t *sim, uint64_t us)
+{
+  pthread_mutex_lock(&sim->mutex);
+  sim->base_us = vclock_sim_now_locked(sim) + us;
+  sim->real_base_us = vclock_real_us();
+  pthread_cond_broadcast(&sim->advanced);
+  pthread_mutex_unlock(&sim->mutex);
+}
+
+/**
+ * @brief Releases the clock, nobody may be sleeping on it
+ *
+ * @param sim Pointer to the clock
+ */
+void vclock_sim_destroy(struct vclock_sim_t *sim)
+{
+  pthread_mutex_destroy(&sim->mutex);
+  pthread_cond_destroy(&sim->advanced);
+}
@@ -0,0 +1,89 @@
+/**
+ * @file vclock.h
+ * @brief A clock interface for time, sleeps and timed waits, with a simulated clock
+ * @author John O'Sullivan <john@osullivan.dev>
+ * @date 2024
+ *
+ * This header file provides the clock the driver takes all of its time from. The
+ * system clock lives with the driver, this file provides the simulated clock used by
+ * host builds and scenario tests:
+ *
+ * - scaled, virtual time runs speedup times faster than wall time, every sleep and
+ *   timed wait is shortened by the same factor, so a 300 s retry back-off takes
+ *   300 ms at a speedup of 1000 while the driver tasks keep running concurrently.
+ * - manual (speedup 0), virtual time only moves with vclock_sim_advance(), sleepers
+ *   block until time has been advanced past their wake-up, so a single test thread
+ *   steps the driver deterministically.
+ *
+ * Usage example:
+ * @code
+ * struct vclock_sim_t sim;
+ * vclock_sim_init(&sim, 0, 1000);
+ * satcom->clock = &sim.clock;
+ * @endcode
+ */
+
+#ifndef VCLOCK_H_INCLUDED
+#define VCLOCK_H_INCLUDED
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * @brief Clock operations, all times are in us
+ */
+struct vclock_t
+{
+  uint64_t (*now_us)(const struct vclock_t *clock);        /**< Monotonic time */
+  void (*sleep_us)(const struct vclock_t *clock, uint64_t us);  /**< Block the caller */
+  void (*wait_us)(const struct vclock_t *clock, pthread_cond_t *cond, pthread_mutex_t *mutex, 
+                  uint64_t us);                            /**< Condition wait, at most us, mutex held */
+};
+
+/**
+ * @brief Simulated clock structure, pass &sim->clock to the user
+ */
+struct vclock_sim_t
+{
+  struct vclock_t clock;         /**< Operations, must stay the first member */
+  uint64_t base_us;              /**< Virtual time at real_base_us */
+  uint64_t real_base_us;         /**< Wall time of the last rebase */
+  uint32_t speedup;              /**< Virtual us per wall us, 0 for manual */
+  uint64_t slept_us;             /**< Virtual time spent in sleeps */
+  pthread_mutex_t mutex;         /**< Protects the fields above */
+  pthread_cond_t advanced;       /**< Signalled on every vclock_sim_advance() */
+};
+
+/**
+ * @brief Initializes a simulated clock
+ *
+ * @param sim Pointer to the clock
+ * @param start_us The initial virtual time
+ * @param speedup Virtual us per wall us, 0 for a manual clock
+ */
+void vclock_sim_init(struct vclock_sim_t *sim, uint64_t start_us, uint32_t speedup);
+
+/**
+ * @brief Moves virtual time forward and wakes the sleepers that are due
+ *
+ * @param sim Pointer to the clock
+ * @param us The amount of virtual time
+ */
+void vclock_sim_advance(struct vclock_sim_t *sim, uint64_t us);
+
+/**
+ * @brief Releases the clock, nobody may be sleeping on it
+ *
+ * @param sim Pointer to the clock
+ */
+void vclock_sim_destroy(struct vclock_sim_t *sim);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VCLOCK_H_INCLUDED */